@@ -0,0 +1,113 @@
+#pragma once
+
+#include "snfile/snfile.h"
+
+/**
+ * @struct SnBlockCache
+ * @brief Opaque cache of file blocks.
+ */
+typedef struct SnBlockCache SnBlockCache;
+
+/**
+ * @struct SnBlockCacheConfig
+ * @brief Block cache configuration, zero fields take defaults.
+ */
+typedef struct SnBlockCacheConfig {
+    uint64_t memory_budget; /**< Most bytes of file data held. Default 64 MiB */
+    uint32_t block_size;    /**< Rounded up to a power of 2. Default 16 KiB */
+    uint32_t readahead;     /**< Blocks read at once on sequential access, 1 disables. Default 32 */
+    uint32_t shard_count;   /**< Number of independently locked shards. Default from CPU count */
+} SnBlockCacheConfig;
+
+/**
+ * @struct SnBlockCacheStats
+ * @brief Block cache statistics.
+ */
+typedef struct SnBlockCacheStats {
+    uint64_t hits;      /**< Blocks read from memory */
+    uint64_t misses;    /**< Blocks read from files */
+    uint64_t readahead; /**< Blocks read before being asked for */
+    uint64_t evictions;
+} SnBlockCacheStats;
+
+/**
+ * @struct SnBlockFile
+ * @brief A file read through block caches, set up with sn_block_file_init.
+ */
+typedef struct SnBlockFile {
+    SnFile *file;
+    uint64_t device;              /**< Together with inode the key of the blocks */
+    uint64_t inode;
+    volatile uint64_t last_block; /**< Last block read through this file, for readahead */
+} SnBlockFile;
+
+/**
+ * @brief Identify a file for reading through block caches.
+ *
+ * Every handle to the same file shares the cached blocks. Readahead follows
+ * the reads made through each block file, threads reading different parts
+ * of a file should use a block file each.
+ *
+ * @param file The file opened for reading, must outlive block_file.
+ * @param block_file The block file to initialize.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+SN_FILE_API bool sn_block_file_init(SnFile *file, SnBlockFile *block_file);
+
+/**
+ * @brief Create a thread safe cache of fixed size file blocks.
+ *
+ * Blocks are evicted in CLOCK order once the budget is used. A read starting
+ * in or right after the last block read through the same block file reads
+ * up to readahead blocks, at most 8 MiB, at once on a miss.
+ *
+ * Writes, truncation, deletion, moves and copies done through the library
+ * drop the blocks they make stale from every block cache, at the cost of a
+ * stat per write while a block cache exists. Changes made any other way need
+ * sn_block_cache_invalidate.
+ *
+ * @param config The configuration, NULL for defaults.
+ * @param cache Pointer to write the cache to.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+SN_FILE_API bool sn_block_cache_create(const SnBlockCacheConfig *config, SnBlockCache **cache);
+
+/**
+ * @brief Destroy the cache.
+ *
+ * @param cache The cache.
+ */
+SN_FILE_API void sn_block_cache_destroy(SnBlockCache *cache);
+
+/**
+ * @brief Read like sn_file_read_at, from memory for cached blocks.
+ *
+ * @param cache The cache.
+ * @param file The file.
+ * @param offset Offset to read at.
+ * @param buffer The buffer to read into.
+ * @param size Number of bytes to read.
+ *
+ * @return Returns bytes read, less than size only at the end of the file, -1
+ * if nothing could be read.
+ */
+SN_FILE_API int64_t sn_block_cache_read(SnBlockCache *cache, SnBlockFile *file, uint64_t offset,
+                                        void *buffer, uint64_t size);
+
+/**
+ * @brief Drop every cached block of the file.
+ *
+ * @param cache The cache.
+ * @param file The file.
+ */
+SN_FILE_API void sn_block_cache_invalidate(SnBlockCache *cache, const SnBlockFile *file);
+
+/**
+ * @brief Get the cache statistics.
+ *
+ * @param cache The cache.
+ * @param stats The stats to write to.
+ */
+SN_FILE_API void sn_block_cache_stats(SnBlockCache *cache, SnBlockCacheStats *stats);
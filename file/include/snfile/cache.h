@@ -0,0 +1,99 @@
+#pragma once
+
+#include "snfile/snfile.h"
+
+/**
+ * @struct SnFileCache
+ * @brief Opaque cache of open file handles.
+ */
+typedef struct SnFileCache SnFileCache;
+
+/**
+ * @struct SnFileCacheConfig
+ * @brief File cache configuration, zero fields take defaults.
+ */
+typedef struct SnFileCacheConfig {
+    uint32_t max_open;    /**< Maximum open handles, split evenly among shards. Default 1024 */
+    uint32_t shard_count; /**< Number of independently locked shards. Default from CPU count */
+} SnFileCacheConfig;
+
+/**
+ * @struct SnFileCacheStats
+ * @brief File cache statistics.
+ */
+typedef struct SnFileCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} SnFileCacheStats;
+
+/**
+ * @brief Create a thread safe LRU cache of open file handles.
+ *
+ * Handles are keyed by path and open flags. Handles which are not checked out are
+ * closed least recently used first when the limit is reached.
+ *
+ * Handles to a path are invalidated when the path is deleted with sn_file_delete
+ * or moved (as source or destination) with sn_file_move. Paths are compared as
+ * strings, so use the same spelling everywhere.
+ *
+ * @param config The configuration, NULL for defaults.
+ * @param cache Pointer to write the cache to.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+SN_FILE_API bool sn_file_cache_create(const SnFileCacheConfig *config, SnFileCache **cache);
+
+/**
+ * @brief Close every handle and destroy the cache.
+ *
+ * @note No handle can be checked out.
+ *
+ * @param cache The cache.
+ */
+SN_FILE_API void sn_file_cache_destroy(SnFileCache *cache);
+
+/**
+ * @brief Check out a handle, opening the file if it is not cached.
+ *
+ * The same handle can be checked out by several threads at once, use positional
+ * I/O or external synchronization when sharing it.
+ *
+ * @note The limit applies per shard, each holding max_open / shard_count
+ * handles. A miss fails once every handle of the shard of path is checked
+ * out, even with fewer than max_open handles open in total.
+ *
+ * @param cache The cache.
+ * @param path The path to file.
+ * @param flags Flags for opening.
+ *
+ * @return Returns the handle, NULL if file could not be opened or every handle
+ * of the shard of path is checked out.
+ */
+SN_FILE_API SnFile *sn_file_cache_acquire(SnFileCache *cache, const char *path, int flags);
+
+/**
+ * @brief Return a handle checked out with sn_file_cache_acquire.
+ *
+ * @param cache The cache.
+ * @param file The handle.
+ */
+SN_FILE_API void sn_file_cache_release(SnFileCache *cache, SnFile *file);
+
+/**
+ * @brief Drop every cached handle to path.
+ *
+ * Handles which are checked out are closed when returned.
+ *
+ * @param cache The cache.
+ * @param path The path.
+ */
+SN_FILE_API void sn_file_cache_invalidate(SnFileCache *cache, const char *path);
+
+/**
+ * @brief Get the cache statistics.
+ *
+ * @param cache The cache.
+ * @param stats The stats to write to.
+ */
+SN_FILE_API void sn_file_cache_stats(SnFileCache *cache, SnFileCacheStats *stats);
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "snfile/snfile.h"
+
+/**
+ * @struct SnCompressedWriter
+ * @brief Opaque writer of a block compressed stream.
+ */
+typedef struct SnCompressedWriter SnCompressedWriter;
+
+/**
+ * @struct SnCompressedReader
+ * @brief Opaque random access reader of a block compressed stream.
+ */
+typedef struct SnCompressedReader SnCompressedReader;
+
+/**
+ * @struct SnCompressedConfig
+ * @brief Compressed stream configuration, zero fields take defaults.
+ */
+typedef struct SnCompressedConfig {
+    uint32_t block_size;   /**< Uncompressed bytes per block, 4 KiB to 64 MiB. Default 128 KiB */
+    uint32_t thread_count; /**< Threads compressing including the caller. Default CPU count */
+} SnCompressedConfig;
+
+/**
+ * @brief Create a writer of a block compressed stream.
+ *
+ * Data is cut into fixed size blocks which are compressed independently with the
+ * bundled LZ codec, blocks which do not shrink are stored as is. A block index
+ * at the end of the stream lets readers find any block directly.
+ *
+ * @note The writer writes from the current position of file, which must stay
+ * open until the writer is destroyed.
+ *
+ * @param file The file to write to.
+ * @param config The configuration, NULL for defaults.
+ * @param writer Pointer to write the writer to.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+SN_FILE_API bool sn_compressed_writer_create(SnFile *file, const SnCompressedConfig *config,
+                                             SnCompressedWriter **writer);
+
+/**
+ * @brief Destroy the writer.
+ *
+ * @note The stream is incomplete unless sn_compressed_writer_finish succeeded.
+ *
+ * @param writer The writer.
+ */
+SN_FILE_API void sn_compressed_writer_destroy(SnCompressedWriter *writer);
+
+/**
+ * @brief Append data to the stream.
+ *
+ * @param writer The writer.
+ * @param data The data.
+ * @param size Size of data.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+SN_FILE_API bool sn_compressed_writer_write(SnCompressedWriter *writer, const void *data,
+                                            uint64_t size);
+
+/**
+ * @brief Write the remaining data and the block index.
+ *
+ * @param writer The writer.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+SN_FILE_API bool sn_compressed_writer_finish(SnCompressedWriter *writer);
+
+/**
+ * @brief Open a block compressed stream for reading.
+ *
+ * The stream is expected to span from the start to the end of file.
+ *
+ * @note The reader is not thread safe. The file must stay open until the reader
+ * is closed.
+ *
+ * @param file The file to read from.
+ * @param thread_count Threads decompressing including the caller, 0 for CPU count.
+ * @param reader Pointer to write the reader to.
+ *
+ * @return Returns true on success, false if the stream is invalid or on failure.
+ */
+SN_FILE_API bool sn_compressed_reader_open(SnFile *file, uint32_t thread_count,
+                                           SnCompressedReader **reader);
+
+/**
+ * @brief Close the reader.
+ *
+ * @param reader The reader.
+ */
+SN_FILE_API void sn_compressed_reader_close(SnCompressedReader *reader);
+
+/**
+ * @brief Get the uncompressed size of the stream.
+ *
+ * @param reader The reader.
+ *
+ * @return The uncompressed size.
+ */
+SN_FILE_API uint64_t sn_compressed_reader_size(const SnCompressedReader *reader);
+
+/**
+ * @brief Read uncompressed data at offset.
+ *
+ * Only the blocks overlapping the range are read and decompressed.
+ *
+ * @param reader The reader.
+ * @param offset Uncompressed offset.
+ * @param data The buffer to read into.
+ * @param size Number of bytes to read.
+ *
+ * @return Returns the number of bytes read, less than size only at the end of
+ * the stream, -1 on failure or corrupt data.
+ */
+SN_FILE_API int64_t sn_compressed_reader_read_at(SnCompressedReader *reader, uint64_t offset,
+                                                 void *data, uint64_t size);
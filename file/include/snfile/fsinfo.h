@@ -0,0 +1,49 @@
+#pragma once
+
+#include "snfile/snfile.h"
+
+/**
+ * @brief File system features.
+ */
+typedef enum SnFsFeature {
+    SN_FS_FEATURE_REFLINK = SN_BIT_FLAG(0),    /**< Copy on write clones of whole files */
+    SN_FS_FEATURE_COPY_RANGE = SN_BIT_FLAG(1), /**< Copies done by the kernel */
+    SN_FS_FEATURE_DIRECT_IO = SN_BIT_FLAG(2),  /**< Reads and writes bypassing the page cache */
+    SN_FS_FEATURE_TMPFILE = SN_BIT_FLAG(3),    /**< Files created without a name */
+    SN_FS_FEATURE_SPARSE = SN_BIT_FLAG(4),     /**< Holes in files */
+} SnFsFeature;
+
+/**
+ * @struct SnFsInfo
+ * @brief What a file system supports.
+ */
+typedef struct SnFsInfo {
+    uint64_t device;           /**< Same as device in SnFileInfo */
+    uint64_t type;             /**< Magic number of statfs on Linux, 0 elsewhere */
+    char type_name[16];        /**< Like "ext4", "apfs" or "NTFS", empty if unknown */
+    uint32_t block_size;       /**< Preferred I/O size */
+    uint32_t dio_mem_align;    /**< Buffer alignment for direct I/O, 0 if unknown */
+    uint32_t dio_offset_align; /**< Offset and size alignment for direct I/O, 0 if unknown */
+    uint32_t features;         /**< SnFsFeature bits */
+} SnFsInfo;
+
+/**
+ * @brief Inspect the file system path is on.
+ *
+ * Results are cached per device, only the first call for a device queries the
+ * file system. The library consults the same cache to pick the fastest way of
+ * copying and creating temporary files, and clears a feature for the device
+ * when an operation finds it missing. Features of file systems not known to
+ * the library are assumed until then.
+ *
+ * @param path An existing path on the file system.
+ * @param info The info to write to.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+SN_FILE_API bool sn_fs_probe(const char *path, SnFsInfo *info);
+
+/**
+ * @brief Forget the cached results, for example after remounting.
+ */
+SN_FILE_API void sn_fs_probe_reset(void);
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "snfile/snfile.h"
+
+/**
+ * @struct SnGlob
+ * @brief Opaque compiled glob pattern.
+ */
+typedef struct SnGlob SnGlob;
+
+/**
+ * @brief Callback invoked for every path matched by sn_dir_glob.
+ *
+ * @note Path and entry are only valid during the call.
+ *
+ * @param path The matched path (root joined with the relative path).
+ * @param entry The directory entry of the match.
+ * @param user_data The user data passed to sn_dir_glob.
+ *
+ * @return Return false to stop the walk, true to continue.
+ */
+typedef bool (*SnGlobCallback)(const char *path, const SnDirEntry *entry, void *user_data);
+
+/**
+ * @brief Compile a glob pattern.
+ *
+ * Supported syntax:
+ * - `*` matches any run of characters within a path segment.
+ * - `?` matches a single character.
+ * - `[abc]`, `[a-z]`, `[!a-z]` / `[^a-z]` match character classes.
+ * - `**` as a whole segment matches zero or more directories.
+ * - `{a,b}` expands to alternatives, can be nested.
+ *
+ * Both `/` and `\` are treated as separators. Wildcards do not match names
+ * starting with `.` unless the pattern segment itself starts with `.`.
+ *
+ * @param pattern The pattern, relative to the walk root.
+ * @param glob Pointer to write the compiled glob to.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+SN_FILE_API bool sn_glob_compile(const char *pattern, SnGlob **glob);
+
+/**
+ * @brief Free the compiled glob.
+ *
+ * @param glob The glob to free.
+ */
+SN_FILE_API void sn_glob_free(SnGlob *glob);
+
+/**
+ * @brief Match a relative path against the compiled glob.
+ *
+ * @param glob The compiled glob.
+ * @param path The relative path to match.
+ *
+ * @return Returns true if path matches, false otherwise.
+ */
+SN_FILE_API bool sn_glob_match(const SnGlob *glob, const char *path);
+
+/**
+ * @brief Walk a directory tree and report paths matching the glob.
+ *
+ * Directories which can not lead to a match are never opened, and segments
+ * which are plain literals are checked directly instead of listing the parent.
+ * Matches are streamed through the callback as they are found.
+ *
+ * @note Symbolic links to directories are not followed unless reached by a literal segment.
+ *
+ * @param root The directory to start from, NULL or empty for the current directory.
+ * @param glob The compiled glob.
+ * @param callback The callback to call on match.
+ * @param user_data The user data passed to callback.
+ *
+ * @return Returns true on success, false if root could not be walked.
+ */
+SN_FILE_API bool sn_dir_glob(const char *root, const SnGlob *glob, SnGlobCallback callback,
+                             void *user_data);
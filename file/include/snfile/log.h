@@ -0,0 +1,139 @@
+#pragma once
+
+#include "snfile/snfile.h"
+
+/**
+ * @struct SnLog
+ * @brief Opaque segmented append only log.
+ */
+typedef struct SnLog SnLog;
+
+/**
+ * @struct SnLogReader
+ * @brief Opaque reader of a log.
+ */
+typedef struct SnLogReader SnLogReader;
+
+/**
+ * @struct SnLogConfig
+ * @brief Log configuration, zero fields take defaults.
+ */
+typedef struct SnLogConfig {
+    uint64_t segment_size; /**< Bytes per segment file of a new log. Default 64 MiB */
+} SnLogConfig;
+
+/**
+ * @struct SnLogRecord
+ * @brief A record returned by a reader.
+ */
+typedef struct SnLogRecord {
+    uint64_t position; /**< Position of the record in the log */
+    uint64_t next;     /**< Position right after the record */
+    const void *data;  /**< Valid until the next call on the reader */
+    uint32_t size;
+} SnLogRecord;
+
+/**
+ * @brief Open the log in a directory, creating it if needed.
+ *
+ * The log is a sequence of segment files of a fixed size, allocated when
+ * created. Records are framed with their size and a CRC-32C. Only the last
+ * segment is scanned on open, a torn record at its end from a crash is
+ * erased along with everything after it.
+ *
+ * @note The segment size of an existing log is kept, config only applies to
+ * new logs. A log must only be opened for appending once at a time.
+ *
+ * @param dir Path to the directory.
+ * @param config The configuration, NULL for defaults.
+ * @param log Pointer to write the log to.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+SN_FILE_API bool sn_log_open(const char *dir, const SnLogConfig *config, SnLog **log);
+
+/**
+ * @brief Close the log. Records not synced may be lost on a crash.
+ *
+ * @param log The log.
+ */
+SN_FILE_API void sn_log_close(SnLog *log);
+
+/**
+ * @brief Append records, thread safe.
+ *
+ * Records of one call are written together with as few writes as possible and
+ * are contiguous unless a segment fills up.
+ *
+ * @param log The log.
+ * @param records The records.
+ * @param count Number of records.
+ * @param position Pointer to write the position of the first record to, can be NULL.
+ *
+ * @return Returns false if a record does not fit in a segment or a write
+ * failed, true otherwise. After a failed write every later append fails too.
+ */
+SN_FILE_API bool sn_log_append(SnLog *log, const SnFileIoVec *records, uint32_t count,
+                               uint64_t *position);
+
+/**
+ * @brief Make every record appended before this call durable, thread safe.
+ *
+ * @param log The log.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+SN_FILE_API bool sn_log_sync(SnLog *log);
+
+/**
+ * @brief Get the position the next record will be appended at.
+ *
+ * @param log The log.
+ *
+ * @return The position.
+ */
+SN_FILE_API uint64_t sn_log_end(SnLog *log);
+
+/**
+ * @brief Delete the segments holding only records before position.
+ *
+ * @param log The log.
+ * @param position Position of the first record still needed.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+SN_FILE_API bool sn_log_release(SnLog *log, uint64_t position);
+
+/**
+ * @brief Open a reader on the log in a directory.
+ *
+ * Readers work while the log is appended to, from the same process or
+ * another one. They only return complete records.
+ *
+ * @param dir Path to the directory.
+ * @param position Position of a record to start at, 0 for the oldest record.
+ * @param reader Pointer to write the reader to.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+SN_FILE_API bool sn_log_reader_open(const char *dir, uint64_t position, SnLogReader **reader);
+
+/**
+ * @brief Close the reader.
+ *
+ * @param reader The reader.
+ */
+SN_FILE_API void sn_log_reader_close(SnLogReader *reader);
+
+/**
+ * @brief Read the next record.
+ *
+ * Returning false at the end is not final, call again to follow records
+ * appended since.
+ *
+ * @param reader The reader.
+ * @param record The record to write to.
+ *
+ * @return Returns true if a record was read, false at the end of the log.
+ */
+SN_FILE_API bool sn_log_reader_next(SnLogReader *reader, SnLogRecord *record);
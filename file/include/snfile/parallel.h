@@ -0,0 +1,78 @@
+#pragma once
+
+#include "snfile/snfile.h"
+
+/**
+ * @brief Parallel processing flags.
+ */
+typedef enum SnFileParallelFlag {
+    SN_FILE_PARALLEL_FLAG_DELIMITED = SN_BIT_FLAG(0), /**< Ranges end after a delimiter byte */
+    SN_FILE_PARALLEL_FLAG_MAP = SN_BIT_FLAG(1),       /**< Map the file instead of reading ranges */
+} SnFileParallelFlag;
+
+/**
+ * @struct SnFileRange
+ * @brief A range of the file handed to the map callback.
+ */
+typedef struct SnFileRange {
+    uint64_t index;  /**< Position of the range in the file, reduce order */
+    uint64_t offset; /**< Offset of the range in the file */
+    uint64_t length; /**< Length of the range */
+    const char *data;
+} SnFileRange;
+
+/**
+ * @brief Process one range, called concurrently from worker threads.
+ *
+ * @param range The range, data is valid until the range is reduced.
+ * @param partial Pointer to write the partial result to, passed to reduce.
+ * @param user_data The user data.
+ *
+ * @return Returns false to stop processing, true otherwise.
+ */
+typedef bool (*SnFileMapCallback)(const SnFileRange *range, void **partial, void *user_data);
+
+/**
+ * @brief Combine a partial result, called on the calling thread in range order.
+ *
+ * @param range The range.
+ * @param partial The partial result written by map.
+ * @param user_data The user data.
+ *
+ * @return Returns false to stop processing, true otherwise.
+ */
+typedef bool (*SnFileReduceCallback)(const SnFileRange *range, void *partial, void *user_data);
+
+/**
+ * @struct SnFileParallelConfig
+ * @brief Parallel processing configuration, zero fields take defaults.
+ */
+typedef struct SnFileParallelConfig {
+    uint64_t range_size;         /**< Nominal bytes per range. Default 4 MiB */
+    uint32_t thread_count;       /**< Threads mapping including the caller. Default CPU count */
+    int flags;                   /**< SnFileParallelFlag bits */
+    char delimiter;              /**< Record delimiter with SN_FILE_PARALLEL_FLAG_DELIMITED */
+    SnFileMapCallback map;       /**< Required */
+    SnFileReduceCallback reduce; /**< Can be NULL */
+    void *user_data;             /**< Passed to the callbacks */
+} SnFileParallelConfig;
+
+/**
+ * @brief Split a file into ranges, map them on a worker pool and reduce in order.
+ *
+ * Delimited ranges move their boundaries forward to just past the next
+ * delimiter, so every record is in exactly one range. A record longer than
+ * range_size can leave ranges empty, empty ranges are skipped.
+ *
+ * Without SN_FILE_PARALLEL_FLAG_MAP ranges are read with positional reads
+ * into reused buffers, with it the whole file is mapped once.
+ *
+ * @param file The file opened for reading.
+ * @param config The configuration.
+ *
+ * @note When processing stops, partial results of ranges mapped but not yet
+ * reduced are dropped.
+ *
+ * @return Returns true on success, false on failure or if a callback stopped.
+ */
+SN_FILE_API bool sn_file_parallel_for(SnFile *file, const SnFileParallelConfig *config);
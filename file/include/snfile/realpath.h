@@ -0,0 +1,72 @@
+#pragma once
+
+#include "snfile/snfile.h"
+
+/**
+ * @struct SnPathCache
+ * @brief Opaque thread safe cache of resolved path prefixes.
+ */
+typedef struct SnPathCache SnPathCache;
+
+/**
+ * @brief Create a path cache.
+ *
+ * @param cache Pointer to write the cache to.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+SN_FILE_API bool sn_path_cache_create(SnPathCache **cache);
+
+/**
+ * @brief Destroy the path cache.
+ *
+ * @param cache The cache.
+ */
+SN_FILE_API void sn_path_cache_destroy(SnPathCache *cache);
+
+/**
+ * @brief Drop everything and move to the next generation.
+ *
+ * @param cache The cache.
+ */
+SN_FILE_API void sn_path_cache_invalidate(SnPathCache *cache);
+
+/**
+ * @brief Tie the cache to an external generation counter.
+ *
+ * If generation differs from the current one everything is dropped. Results of
+ * resolutions started in an older generation are not cached.
+ *
+ * @param cache The cache.
+ * @param generation The generation, for example bumped by a file system watcher.
+ */
+SN_FILE_API void sn_path_cache_set_generation(SnPathCache *cache, uint64_t generation);
+
+/**
+ * @brief Get the current generation.
+ *
+ * @param cache The cache.
+ *
+ * @return The generation.
+ */
+SN_FILE_API uint64_t sn_path_cache_generation(const SnPathCache *cache);
+
+/**
+ * @brief Resolve path to an absolute path without symbolic links, `.` or `..`.
+ *
+ * Every resolved directory and link to a directory is remembered in cache,
+ * so a path in a known directory costs one lookup of the directory and a stat
+ * of the last component. Files are not remembered, the cache grows with the
+ * number of directories. The cache does not notice changes to the file
+ * system, invalidate it when links or directories move.
+ *
+ * @param cache The cache, NULL to resolve without caching.
+ * @param path The path, relative paths start from the working directory.
+ * @param dst The buffer to write to.
+ * @param dst_size Size of dst.
+ *
+ * @return Returns true on success, false if a component does not exist, there
+ * are too many links or dst is too small.
+ */
+SN_FILE_API bool sn_path_realpath(SnPathCache *cache, const char *path, char *dst,
+                                  size_t dst_size);
@@ -0,0 +1,152 @@
+#pragma once
+
+#include "snfile/snfile.h"
+
+/**
+ * @struct SnSnapshot
+ * @brief Opaque directory tree snapshot.
+ */
+typedef struct SnSnapshot SnSnapshot;
+
+/**
+ * @brief Snapshot entry types.
+ */
+typedef enum SnSnapshotEntryType {
+    SN_SNAPSHOT_ENTRY_TYPE_FILE,
+    SN_SNAPSHOT_ENTRY_TYPE_DIRECTORY,
+    SN_SNAPSHOT_ENTRY_TYPE_SYMLINK,
+    SN_SNAPSHOT_ENTRY_TYPE_OTHER
+} SnSnapshotEntryType;
+
+/**
+ * @brief Snapshot capture flags.
+ */
+typedef enum SnSnapshotCaptureFlag {
+    /**
+     * Entries of a directory whose inode and mtime did not change since the base
+     * snapshot are copied from the base without stat. Only additions, removals and
+     * renames are detected inside such directories, not content changes.
+     */
+    SN_SNAPSHOT_CAPTURE_FLAG_TRUST_DIR_MTIME = SN_BIT_FLAG(0),
+} SnSnapshotCaptureFlag;
+
+/**
+ * @brief Kind of change reported by sn_snapshot_diff.
+ */
+typedef enum SnSnapshotChange {
+    SN_SNAPSHOT_CHANGE_ADDED,
+    SN_SNAPSHOT_CHANGE_REMOVED,
+    SN_SNAPSHOT_CHANGE_MODIFIED
+} SnSnapshotChange;
+
+/**
+ * @struct SnSnapshotEntry
+ * @brief A snapshot entry.
+ */
+typedef struct SnSnapshotEntry {
+    const char *path; /**< Path relative to the snapshot root */
+    uint64_t inode;
+    uint64_t size;
+    uint64_t mtime_ns;
+    SnSnapshotEntryType type;
+} SnSnapshotEntry;
+
+/**
+ * @brief Callback invoked for every change found by sn_snapshot_diff.
+ *
+ * For removed entries the entry is from the old snapshot, otherwise from the new one.
+ *
+ * @param change The kind of change.
+ * @param entry The changed entry.
+ * @param user_data The user data passed to sn_snapshot_diff.
+ *
+ * @return Return false to stop diffing, true to continue.
+ */
+typedef bool (*SnSnapshotDiffCallback)(SnSnapshotChange change, const SnSnapshotEntry *entry,
+                                       void *user_data);
+
+/**
+ * @brief Capture a snapshot of the tree at root.
+ *
+ * When base is given, directories whose inode and mtime are unchanged are not
+ * listed again, their entries are taken from base.
+ *
+ * @note Symbolic links are recorded but not followed.
+ *
+ * @param root The root directory.
+ * @param base Previous snapshot of the same root, can be NULL.
+ * @param flags The capture flags.
+ * @param snapshot Pointer to write the snapshot to.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+SN_FILE_API bool sn_snapshot_capture(const char *root, const SnSnapshot *base, int flags,
+                                     SnSnapshot **snapshot);
+
+/**
+ * @brief Free the snapshot.
+ *
+ * @param snapshot The snapshot to free.
+ */
+SN_FILE_API void sn_snapshot_free(SnSnapshot *snapshot);
+
+/**
+ * @brief Save the snapshot to an index file.
+ *
+ * The file is written next to path and renamed into place.
+ *
+ * @param snapshot The snapshot.
+ * @param path The index file path.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+SN_FILE_API bool sn_snapshot_save(const SnSnapshot *snapshot, const char *path);
+
+/**
+ * @brief Load a snapshot from an index file.
+ *
+ * The index is memory mapped, not parsed.
+ *
+ * @param path The index file path.
+ * @param snapshot Pointer to write the snapshot to.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+SN_FILE_API bool sn_snapshot_load(const char *path, SnSnapshot **snapshot);
+
+/**
+ * @brief Get the number of entries in the snapshot.
+ *
+ * @param snapshot The snapshot.
+ *
+ * @return Number of entries.
+ */
+SN_FILE_API uint64_t sn_snapshot_count(const SnSnapshot *snapshot);
+
+/**
+ * @brief Get the entry at index.
+ *
+ * Entries are ordered depth first, siblings sorted by name.
+ *
+ * @note Path in entry is valid as long as the snapshot is alive.
+ *
+ * @param snapshot The snapshot.
+ * @param index The entry index.
+ * @param entry The entry to write to.
+ *
+ * @return Returns false if index is out of range.
+ */
+SN_FILE_API bool sn_snapshot_get(const SnSnapshot *snapshot, uint64_t index, SnSnapshotEntry *entry);
+
+/**
+ * @brief Report differences between two snapshots.
+ *
+ * @param from The older snapshot.
+ * @param to The newer snapshot.
+ * @param callback The callback to call on every change.
+ * @param user_data The user data passed to callback.
+ *
+ * @return Returns false if callback stopped the diff, true otherwise.
+ */
+SN_FILE_API bool sn_snapshot_diff(const SnSnapshot *from, const SnSnapshot *to,
+                                  SnSnapshotDiffCallback callback, void *user_data);
@@ -53,6 +53,14 @@ typedef enum SnFileSeekOrigin {
     SN_FILE_SEEK_ORIGIN_END
 } SnFileSeekOrigin;
 
+/**
+ * @brief Byte range lock types.
+ */
+typedef enum SnFileLockType {
+    SN_FILE_LOCK_SHARED,
+    SN_FILE_LOCK_EXCLUSIVE
+} SnFileLockType;
+
 /**
  * @struct SnFileInfo
  * @brief File info.
@@ -63,33 +71,179 @@ typedef struct SnFileInfo {
     uint64_t modified_time;
     uint64_t accessed_time;
 
+    uint64_t modified_time_ns; /**< Nanoseconds since Unix epoch */
+    uint64_t device;           /**< Device (volume serial number on Windows) */
+    uint64_t inode;            /**< Inode (file index on Windows) */
+    uint64_t allocated_size;   /**< Bytes of storage allocated, less than size for sparse files */
+    uint32_t link_count;       /**< Number of hard links */
+
     bool is_file;
     bool is_directory;
     bool is_symlink;
 } SnFileInfo;
 
+/**
+ * @struct SnFileExtent
+ * @brief A range of a file.
+ */
+typedef struct SnFileExtent {
+    uint64_t offset;
+    uint64_t length;
+} SnFileExtent;
+
+/**
+ * @struct SnFileIoVec
+ * @brief A buffer for vectored I/O.
+ */
+typedef struct SnFileIoVec {
+    const void *data;
+    uint64_t size;
+} SnFileIoVec;
+
 /**
  * @struct SnDirEntry
  * @brief The directory entry.
  */
 typedef struct SnDirEntry {
     const char *name;
+    uint64_t inode; /**< Inode, 0 where the listing does not carry it (Windows) */
     bool is_file;
     bool is_directory;
     bool is_symlink;
 } SnDirEntry;
 
+/**
+ * @brief Order of entries returned by sn_dir_read_all.
+ */
+typedef enum SnDirSort {
+    SN_DIR_SORT_NONE,  /**< Order of the directory listing */
+    SN_DIR_SORT_NAME,  /**< Byte wise by name */
+    SN_DIR_SORT_INODE, /**< By inode, roughly the order of the metadata on disk */
+} SnDirSort;
+
+/**
+ * @brief Bulk directory read flags.
+ */
+typedef enum SnDirReadAllFlag {
+    SN_DIR_READ_ALL_FLAG_STAT = SN_BIT_FLAG(0), /**< Fill info of every entry, in inode order */
+} SnDirReadAllFlag;
+
+/**
+ * @struct SnDirListEntry
+ * @brief An entry returned by sn_dir_read_all.
+ */
+typedef struct SnDirListEntry {
+    SnDirEntry entry;
+    SnFileInfo info; /**< Info of the entry itself, links are not followed */
+    bool has_info;   /**< False without SN_DIR_READ_ALL_FLAG_STAT or if the stat failed */
+} SnDirListEntry;
+
+/**
+ * @struct SnDirArena
+ * @brief Caller provided memory sn_dir_read_all places its listing in.
+ */
+typedef struct SnDirArena {
+    void *data;
+    size_t size;     /**< Size of data */
+    size_t used;     /**< Bytes in use, the next listing is placed after them */
+    size_t required; /**< Bytes the last listing needed when it did not fit */
+} SnDirArena;
+
+/**
+ * @struct SnDirListing
+ * @brief Entries of a directory read by sn_dir_read_all.
+ */
+typedef struct SnDirListing {
+    SnDirListEntry *entries;
+    uint64_t count;
+} SnDirListing;
+
+/**
+ * @struct SnFileAllocator
+ * @brief Allocator hooks used for every allocation made by the library.
+ *
+ * Sizes passed to realloc and free are the sizes the memory was allocated with.
+ */
+typedef struct SnFileAllocator {
+    void *(*alloc)(size_t size, void *user_data);
+    void *(*realloc)(void *ptr, size_t old_size, size_t new_size, void *user_data);
+    void (*free)(void *ptr, size_t size, void *user_data);
+    void *user_data;
+} SnFileAllocator;
+
+/**
+ * @brief Read all flags.
+ */
+typedef enum SnFileReadAllFlag {
+    SN_FILE_READ_ALL_FLAG_NULL_TERMINATE = SN_BIT_FLAG(0), /**< Append a 0 byte, never mapped */
+    SN_FILE_READ_ALL_FLAG_NO_MAP = SN_BIT_FLAG(1),         /**< Always read into allocated memory */
+} SnFileReadAllFlag;
+
+/**
+ * @brief Files of at least this size are memory mapped by sn_file_read_all.
+ */
+#define SN_FILE_READ_ALL_MAP_THRESHOLD (1ull << 20)
+
+/**
+ * @struct SnFileBuffer
+ * @brief Contents of a file read by sn_file_read_all.
+ */
+typedef struct SnFileBuffer {
+    void *data;
+    uint64_t size;     /**< Size of the contents, excluding the 0 terminator */
+    uint64_t capacity; /**< Size of the allocation or mapping */
+    bool mapped;
+} SnFileBuffer;
+
+/**
+ * @brief Set the allocator hooks.
+ *
+ * @note Must be called before any other library call, memory allocated with the
+ * previous hooks is still released with the new ones.
+ *
+ * @param allocator The allocator hooks, NULL to restore the default malloc based hooks.
+ */
+SN_FILE_API void sn_file_set_allocator(const SnFileAllocator *allocator);
+
 /**
  * @brief Open a file.
  *
  * @param path The path to file.
  * @param flags Flags for opening.
- * @param allocator Allocator hooks.
+ * @param file The file handle to initialize.
  *
  * @return Returns true on success, false otherwise.
  */
 SN_FILE_API bool sn_file_open(const char *path, int flags, SnFile *file);
 
+/**
+ * @brief Open an anonymous scratch file for reading and writing.
+ *
+ * The file has no name and is removed when closed. On Linux it is created with
+ * O_TMPFILE and never touches the directory, elsewhere (or if the filesystem
+ * lacks O_TMPFILE) a uniquely named file is created and unlinked right away. On
+ * Windows the named file is deleted on close.
+ *
+ * @param dir Directory on the filesystem to create the file on.
+ * @param file The file handle to initialize.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+SN_FILE_API bool sn_file_open_temp(const char *dir, SnFile *file);
+
+/**
+ * @brief Give a file opened with sn_file_open_temp a name.
+ *
+ * On Linux an O_TMPFILE file is linked in place with linkat, otherwise the
+ * contents are copied to path. The handle stays a scratch file either way.
+ *
+ * @param file The scratch file.
+ * @param path The path to publish at, must not exist.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+SN_FILE_API bool sn_file_publish_temp(SnFile *file, const char *path);
+
 /**
  * @brief Closes the opened file.
  *
@@ -127,6 +281,51 @@ SN_FILE_API int64_t sn_file_read(SnFile *file, void *buffer, uint64_t size);
  */
 SN_FILE_API int64_t sn_file_write(SnFile *file, const void *buffer, uint64_t size);
 
+/**
+ * @brief Read from file at offset without using the file position.
+ *
+ * Safe to call from several threads on the same handle. On Windows the file
+ * position is moved.
+ *
+ * @param file The file to read.
+ * @param offset Offset to read from.
+ * @param buffer The buffer to read into.
+ * @param size Number of bytes to read.
+ *
+ * @return Returns number of bytes read, less than size only at end of file, -1
+ * on failure.
+ */
+SN_FILE_API int64_t sn_file_read_at(SnFile *file, uint64_t offset, void *buffer, uint64_t size);
+
+/**
+ * @brief Write to file at offset without using the file position.
+ *
+ * Safe to call from several threads on the same handle. On Windows the file
+ * position is moved.
+ *
+ * @param file The file to write.
+ * @param offset Offset to write at.
+ * @param buffer The data to write.
+ * @param size Number of bytes to write.
+ *
+ * @return Returns number of bytes written, -1 on failure.
+ */
+SN_FILE_API int64_t sn_file_write_at(SnFile *file, uint64_t offset, const void *buffer,
+                                     uint64_t size);
+
+/**
+ * @brief Write buffers to file in order with as few calls as possible.
+ *
+ * On error returns negetive number.
+ *
+ * @param file The file to write to.
+ * @param iov The buffers to write.
+ * @param count Number of buffers.
+ *
+ * @return Returns number of bytes actually written.
+ */
+SN_FILE_API int64_t sn_file_writev(SnFile *file, const SnFileIoVec *iov, uint32_t count);
+
 /**
  * @brief Seek file.
  *
@@ -163,11 +362,136 @@ SN_FILE_API bool sn_file_flush(SnFile *file);
  */
 SN_FILE_API uint64_t sn_file_size(SnFile *file);
 
+/**
+ * @brief Find the next data extent at or after offset.
+ *
+ * Iterate over the allocated data of a sparse file with:
+ * `for (uint64_t off = 0; sn_file_next_extent(file, off, &e); off = e.offset + e.length)`.
+ * On filesystems without hole reporting the whole file is one extent.
+ *
+ * @note The file offset is preserved.
+ *
+ * @param file The file.
+ * @param offset Offset to start searching from.
+ * @param extent The extent to write to.
+ *
+ * @return Returns false when there is no data at or after offset.
+ */
+SN_FILE_API bool sn_file_next_extent(SnFile *file, uint64_t offset, SnFileExtent *extent);
+
+/**
+ * @brief Deallocate a range of the file, leaving a hole which reads as zeros.
+ *
+ * The file size is not changed.
+ *
+ * @param file The file opened for writing.
+ * @param offset Start of the range.
+ * @param length Length of the range.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+SN_FILE_API bool sn_file_punch_hole(SnFile *file, uint64_t offset, uint64_t length);
+
+/**
+ * @brief Allocate storage for the first size bytes of the file.
+ *
+ * The file grows to size if it is smaller, the new range reads as zeros.
+ * Later writes into the range do not have to allocate, which keeps data
+ * syncs from also writing metadata. Where allocation is not supported only
+ * the size is set.
+ *
+ * @param file The file opened for writing.
+ * @param size The size to allocate.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+SN_FILE_API bool sn_file_allocate(SnFile *file, uint64_t size);
+
+/**
+ * @brief Lock a byte range of the file, waiting while it conflicts.
+ *
+ * Locks are owned by the open file handle (OFD locks on Linux, LockFileEx on
+ * Windows), so handles in the same process conflict as well. Other POSIX systems
+ * fall back to process owned record locks.
+ *
+ * @note Locks are advisory on POSIX and mandatory on Windows.
+ *
+ * @param file The file.
+ * @param offset Start of the range.
+ * @param length Length of the range, 0 for everything from offset onwards.
+ * @param type The lock type.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+SN_FILE_API bool sn_file_lock(SnFile *file, uint64_t offset, uint64_t length, SnFileLockType type);
+
+/**
+ * @brief Lock a byte range of the file without waiting.
+ *
+ * @param file The file.
+ * @param offset Start of the range.
+ * @param length Length of the range, 0 for everything from offset onwards.
+ * @param type The lock type.
+ *
+ * @return Returns true on success, false if range is locked or on error.
+ */
+SN_FILE_API bool sn_file_try_lock(SnFile *file, uint64_t offset, uint64_t length,
+                                  SnFileLockType type);
+
+/**
+ * @brief Lock a byte range of the file, waiting at most timeout_ms.
+ *
+ * @param file The file.
+ * @param offset Start of the range.
+ * @param length Length of the range, 0 for everything from offset onwards.
+ * @param type The lock type.
+ * @param timeout_ms Maximum milliseconds to wait.
+ *
+ * @return Returns true on success, false on timeout or error.
+ */
+SN_FILE_API bool sn_file_lock_timeout(SnFile *file, uint64_t offset, uint64_t length,
+                                      SnFileLockType type, uint32_t timeout_ms);
+
+/**
+ * @brief Unlock a byte range of the file.
+ *
+ * @note On Windows the range must be exactly a previously locked range.
+ *
+ * @param file The file.
+ * @param offset Start of the range.
+ * @param length Length of the range, 0 for everything from offset onwards.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+SN_FILE_API bool sn_file_unlock(SnFile *file, uint64_t offset, uint64_t length);
+
+/**
+ * @brief Read a whole file.
+ *
+ * The buffer is sized once from the file size and filled with as few reads as
+ * possible. Files of at least SN_FILE_READ_ALL_MAP_THRESHOLD bytes are memory
+ * mapped instead, unless disabled by flags.
+ *
+ * @param path The path to file.
+ * @param flags The read all flags.
+ * @param buffer The buffer to write to, release with sn_file_buffer_free.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+SN_FILE_API bool sn_file_read_all(const char *path, int flags, SnFileBuffer *buffer);
+
+/**
+ * @brief Release a buffer returned by sn_file_read_all.
+ *
+ * @param buffer The buffer to release.
+ */
+SN_FILE_API void sn_file_buffer_free(SnFileBuffer *buffer);
+
 /**
  * @brief Open a directory.
  *
  * @param path Path to directory.
- * @param allocator The allocator.
+ * @param dir The directory handle to initialize.
  *
  * @return Returns true on success, false otherwise.
  */
@@ -185,6 +509,30 @@ SN_FILE_API bool sn_dir_open(const char *path, SnDir *dir);
  */
 SN_FILE_API bool sn_dir_read(SnDir *dir, SnDirEntry *entry);
 
+/**
+ * @brief Read all remaining entries of the directory at once.
+ *
+ * Entries and their names are placed in arena, `.` and `..` are left out. With
+ * SN_DIR_READ_ALL_FLAG_STAT entries are stat-ed relative to the directory in
+ * inode order whatever the sort, which avoids random seeks in the inode table
+ * when the metadata is not cached. On Windows the info comes from the listing
+ * itself and has no device, inode, allocated size or link count.
+ *
+ * @param dir The directory to read.
+ * @param sort Order of the entries.
+ * @param flags SnDirReadAllFlag bits.
+ * @param arena The memory to place the listing in.
+ * @param listing The listing to write to, valid as long as the arena memory.
+ *
+ * @note If arena is too small the directory is still read to the end, required
+ * is set to the bytes needed past used and false is returned. Reopen the
+ * directory to retry.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+SN_FILE_API bool sn_dir_read_all(SnDir *dir, SnDirSort sort, int flags, SnDirArena *arena,
+                                 SnDirListing *listing);
+
 /**
  * @brief Close the opened directory.
  *
@@ -298,6 +646,8 @@ SN_FILE_API bool sn_dir_delete(const char *path);
 /**
  * @brief Copy file.
  *
+ * Holes of sparse files are skipped and recreated in the destination.
+ *
  * @param src Path to copy from.
  * @param dst Path to copy to.
  * @param overwrite Overwrite if exists
@@ -327,3 +677,13 @@ SN_FILE_API bool sn_file_move(const char *src, const char *dst, bool overwrite);
  */
 SN_FILE_API bool sn_file_stat(const char *path, SnFileInfo *info);
 
+/**
+ * @brief Get file info without following symbolic links.
+ *
+ * @param path The file path.
+ * @param info The info to write to.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+SN_FILE_API bool sn_file_lstat(const char *path, SnFileInfo *info);
+
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "snfile/snfile.h"
+
+/**
+ * @brief Traced operations.
+ */
+typedef enum SnTraceOp {
+    SN_TRACE_OP_OPEN,
+    SN_TRACE_OP_CLOSE,
+    SN_TRACE_OP_READ,
+    SN_TRACE_OP_WRITE,
+    SN_TRACE_OP_READ_AT,
+    SN_TRACE_OP_WRITE_AT,
+    SN_TRACE_OP_WRITEV,
+    SN_TRACE_OP_SEEK,
+    SN_TRACE_OP_FLUSH,
+    SN_TRACE_OP_STAT,
+    SN_TRACE_OP_LSTAT,
+    SN_TRACE_OP_DELETE,
+    SN_TRACE_OP_MOVE,
+    SN_TRACE_OP_COPY,
+    SN_TRACE_OP_DIR_OPEN,
+    SN_TRACE_OP_DIR_READ,
+    SN_TRACE_OP_DIR_CLOSE,
+    SN_TRACE_OP_DIR_CREATE,
+    SN_TRACE_OP_DIR_DELETE,
+    SN_TRACE_OP_TELL,
+    SN_TRACE_OP_SIZE,
+    SN_TRACE_OP_SYNC_DATA,
+    SN_TRACE_OP_DIR_SYNC,
+    SN_TRACE_OP_ALLOCATE,
+    SN_TRACE_OP_PUNCH_HOLE,
+    SN_TRACE_OP_NEXT_EXTENT,
+    SN_TRACE_OP_LOCK,
+    SN_TRACE_OP_TRY_LOCK,
+    SN_TRACE_OP_UNLOCK,
+    SN_TRACE_OP_OPEN_TEMP,
+    SN_TRACE_OP_PUBLISH_TEMP,
+    SN_TRACE_OP_REALPATH,
+
+    SN_TRACE_OP_COUNT,
+} SnTraceOp;
+
+// Long paths keep their end, the part telling files apart
+#define SN_TRACE_PATH_SIZE 64
+
+/**
+ * @struct SnTraceEvent
+ * @brief A traced operation.
+ */
+typedef struct SnTraceEvent {
+    uint64_t start_ns;    /**< Monotonic clock, same origin for every thread */
+    uint64_t duration_ns; /**< Time spent in the operation */
+    uint64_t thread_id;
+    int64_t handle;       /**< File descriptor or HANDLE, -1 for operations on paths */
+    uint64_t bytes;       /**< Bytes asked for, or length locked, allocated or punched */
+    int64_t result;       /**< Return value, 1 or 0 for operations returning bool */
+    SnTraceOp op;
+    char path[SN_TRACE_PATH_SIZE]; /**< Path or source path, empty for operations on handles */
+} SnTraceEvent;
+
+/**
+ * @brief Called for each collected event.
+ */
+typedef void (*SnTraceCallback)(const SnTraceEvent *event, void *user_data);
+
+/**
+ * @brief Start recording the operations of every thread.
+ *
+ * Each thread records into its own ring buffer without locks, overwriting its
+ * oldest events when full. Past 64 threads, threads share rings. Stopped,
+ * tracing costs a load and a branch per operation.
+ *
+ * Independent of this, builds configured with SN_FILE_USDT have the static
+ * probes snfile:op_begin(op) and snfile:op_end(op, handle, path, bytes, result)
+ * for perf or bpftrace, costing a nop each until attached.
+ *
+ * @param events_per_thread Capacity of rings created from now on, rounded up
+ * to a power of 2, 0 for 4096.
+ *
+ * @return Returns false if events_per_thread is over 2^24, true otherwise.
+ */
+SN_FILE_API bool sn_trace_start(uint32_t events_per_thread);
+
+/**
+ * @brief Stop recording, the recorded events are kept.
+ */
+SN_FILE_API void sn_trace_stop(void);
+
+/**
+ * @brief Free the recorded events.
+ *
+ * Rings are freed and created again on the next recorded operation, with the
+ * capacity given to the last sn_trace_start.
+ *
+ * @note Stopping tracing first is not enough: no other library call may be in
+ * progress on any thread, as an operation started before sn_trace_stop still
+ * records when it ends, and sn_trace_collect reads the rings without locking.
+ */
+SN_FILE_API void sn_trace_reset(void);
+
+/**
+ * @brief Call callback for every recorded event, in order for each thread.
+ *
+ * @note Events being overwritten while collecting are skipped.
+ *
+ * @param callback The callback.
+ * @param user_data Passed to callback.
+ *
+ * @return Number of events.
+ */
+SN_FILE_API uint64_t sn_trace_collect(SnTraceCallback callback, void *user_data);
+
+/**
+ * @brief Write the recorded events as Chrome trace event JSON.
+ *
+ * The file loads in chrome://tracing and Perfetto, one complete event per
+ * operation with the handle, path, bytes and result as arguments.
+ *
+ * @param path Path to the file to write.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+SN_FILE_API bool sn_trace_export_chrome(const char *path);
+
+/**
+ * @brief Get the name of an operation.
+ *
+ * @param op The operation.
+ *
+ * @return Name of the function performing it, like "sn_file_read".
+ */
+SN_FILE_API const char *sn_trace_op_name(SnTraceOp op);
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "snfile/snfile.h"
+
+/**
+ * @struct SnDirUsage
+ * @brief Disk usage of a tree.
+ */
+typedef struct SnDirUsage {
+    uint64_t apparent_size;  /**< Sum of file sizes */
+    uint64_t allocated_size; /**< Sum of allocated storage */
+    uint64_t file_count;     /**< Non directory entries, hard links counted once */
+    uint64_t dir_count;      /**< Directories including the root */
+    uint64_t error_count;    /**< Entries which could not be read and are not counted */
+} SnDirUsage;
+
+/**
+ * @brief Directory usage flags.
+ */
+typedef enum SnDirUsageFlag {
+    SN_DIR_USAGE_FLAG_ONE_FILESYSTEM = SN_BIT_FLAG(0), /**< Do not descend into other devices */
+} SnDirUsageFlag;
+
+/**
+ * @brief Called with the totals of a directory once its whole subtree is done.
+ *
+ * Calls are serialized, a directory is reported after all of its descendants.
+ *
+ * @param path Path of the directory (root joined with the relative path).
+ * @param depth Depth of the directory, 0 for root.
+ * @param usage Totals of the subtree.
+ * @param user_data The user data.
+ */
+typedef void (*SnDirUsageCallback)(const char *path, uint32_t depth, const SnDirUsage *usage,
+                                   void *user_data);
+
+/**
+ * @struct SnDirUsageConfig
+ * @brief Directory usage configuration, zero fields take defaults.
+ */
+typedef struct SnDirUsageConfig {
+    int flags;                   /**< SnDirUsageFlag bits */
+    uint32_t thread_count;       /**< Threads walking including the caller. Default CPU count */
+    uint32_t report_depth;       /**< Deepest directories reported to callback */
+    SnDirUsageCallback callback; /**< Per directory totals, can be NULL */
+    void *user_data;             /**< Passed to callback */
+} SnDirUsageConfig;
+
+/**
+ * @brief Compute disk usage of a tree in parallel.
+ *
+ * Symbolic links are not followed. Files with several hard links are counted
+ * once per (device, inode).
+ *
+ * @param root The directory to start from.
+ * @param config The configuration, NULL for defaults.
+ * @param usage The totals to write to.
+ *
+ * @return Returns true on success, false if root could not be read or on failure.
+ */
+SN_FILE_API bool sn_dir_usage(const char *root, const SnDirUsageConfig *config, SnDirUsage *usage);
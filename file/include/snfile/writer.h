@@ -0,0 +1,93 @@
+#pragma once
+
+#include "snfile/snfile.h"
+
+/**
+ * @struct SnFileWriter
+ * @brief Opaque background write-behind writer.
+ */
+typedef struct SnFileWriter SnFileWriter;
+
+/**
+ * @brief What append does when the buffer is full.
+ */
+typedef enum SnFileWriterPolicy {
+    SN_FILE_WRITER_POLICY_BLOCK, /**< Wait for the background thread to make space */
+    SN_FILE_WRITER_POLICY_DROP   /**< Drop the data and count it */
+} SnFileWriterPolicy;
+
+/**
+ * @struct SnFileWriterConfig
+ * @brief Writer configuration, zero fields take defaults.
+ */
+typedef struct SnFileWriterConfig {
+    uint64_t buffer_size;       /**< Bytes buffered, rounded up to a power of two. Default 1 MiB */
+    uint32_t flush_interval_ms; /**< Max time data waits in the buffer. Default 10 */
+    SnFileWriterPolicy policy;  /**< Full buffer policy. Default block */
+} SnFileWriterConfig;
+
+/**
+ * @brief Create a writer appending to file from a background thread.
+ *
+ * Appends are copied into a lock free buffer shared by all threads, the
+ * background thread coalesces them into vectored writes.
+ *
+ * @note The file should be opened with SN_FILE_OPEN_FLAG_APPEND and must stay
+ * open until the writer is destroyed.
+ *
+ * @param file The file to write to.
+ * @param config The configuration, NULL for defaults.
+ * @param writer Pointer to write the writer to.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+SN_FILE_API bool sn_file_writer_create(SnFile *file, const SnFileWriterConfig *config,
+                                       SnFileWriter **writer);
+
+/**
+ * @brief Flush everything and stop the writer.
+ *
+ * @param writer The writer.
+ */
+SN_FILE_API void sn_file_writer_destroy(SnFileWriter *writer);
+
+/**
+ * @brief Append data, thread safe.
+ *
+ * Data of one call is written contiguously. Data larger than half of the
+ * buffer is written directly after flushing the buffer.
+ *
+ * @param writer The writer.
+ * @param data The data to append.
+ * @param size Size of data.
+ *
+ * @return Returns false if data was dropped or the writer failed, true otherwise.
+ */
+SN_FILE_API bool sn_file_writer_append(SnFileWriter *writer, const void *data, uint64_t size);
+
+/**
+ * @brief Wait until everything appended before this call is written to the file.
+ *
+ * @param writer The writer.
+ *
+ * @return Returns false if a write failed, true otherwise.
+ */
+SN_FILE_API bool sn_file_writer_flush(SnFileWriter *writer);
+
+/**
+ * @brief Flush and make everything appended before this call durable.
+ *
+ * @param writer The writer.
+ *
+ * @return Returns false if a write or sync failed, true otherwise.
+ */
+SN_FILE_API bool sn_file_writer_sync(SnFileWriter *writer);
+
+/**
+ * @brief Get the number of bytes dropped by SN_FILE_WRITER_POLICY_DROP.
+ *
+ * @param writer The writer.
+ *
+ * @return Number of dropped bytes.
+ */
+SN_FILE_API uint64_t sn_file_writer_dropped(SnFileWriter *writer);
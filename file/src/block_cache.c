@@ -0,0 +1,514 @@
+#include "snfile/blockcache.h"
+
+#include "src/internal.h"
+#include "src/thread.h"
+
+#include <string.h>
+
+#define BLOCK_CACHE_DEFAULT_BUDGET (64ull << 20)
+#define BLOCK_CACHE_DEFAULT_BLOCK_SIZE (16u << 10)
+#define BLOCK_CACHE_DEFAULT_READAHEAD 32
+#define BLOCK_CACHE_MAX_BLOCK_SIZE (1u << 30)
+#define BLOCK_CACHE_MAX_READAHEAD 1024
+#define BLOCK_CACHE_MAX_READAHEAD_BYTES (8u << 20)
+#define BLOCK_CACHE_MAX_SHARDS 64
+
+#define NO_FRAME UINT32_MAX
+#define NO_BLOCK UINT64_MAX
+
+/*
+ * Every shard owns a fixed set of frames, found through a chained hash table
+ * of frame indices. Frames are reused in CLOCK order, the hand clears
+ * referenced bits and takes the first frame without one. Their memory is
+ * allocated on first use, so the budget is a limit and not a reservation.
+ *
+ * Files are read without holding a lock. Each invalidation advances the
+ * epoch first, blocks read while it changed may predate the write and are
+ * not inserted.
+ */
+typedef struct BlockFrame {
+    uint64_t hash;
+    uint64_t device;
+    uint64_t inode;
+    uint64_t block;
+    char *data;
+    uint32_t length; // Short only for the last block of a file
+    uint32_t next;   // Hash chain
+    bool used;
+    bool referenced;
+} BlockFrame;
+
+typedef struct BlockShard {
+    SnMutex mutex;
+
+    BlockFrame *frames;
+    uint32_t frame_count;
+    uint32_t hand;
+
+    uint32_t *buckets;
+    uint32_t bucket_mask;
+} BlockShard;
+
+struct SnBlockCache {
+    BlockShard *shards;
+    uint32_t shard_count;
+    uint32_t block_size;
+    uint32_t block_shift;
+    uint32_t readahead;
+
+    volatile uint64_t epoch;
+
+    volatile uint64_t hits;
+    volatile uint64_t misses;
+    volatile uint64_t readahead_blocks;
+    volatile uint64_t evictions;
+
+    SnBlockCache *next_registered;
+    uint32_t notifying; // Writers dropping blocks, keeps the cache registered
+};
+
+/*
+ * Caches notified of writes through the library. The lock guards the list and
+ * notifying only, writers hold it just to step to the next cache so unrelated
+ * writes do not wait behind each other dropping blocks.
+ */
+static volatile uint32_t registry_lock;
+static volatile uint32_t registry_count;
+static SnBlockCache *registry;
+
+static uint64_t hash_block(uint64_t device, uint64_t inode, uint64_t block) {
+    // splitmix64 finalizer
+    uint64_t hash = (device * 0x9e3779b97f4a7c15ull) ^ (inode * 0xc2b2ae3d27d4eb4full) ^ block;
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9ull;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebull;
+    hash ^= hash >> 31;
+    return hash;
+}
+
+static BlockShard *shard_of(SnBlockCache *cache, uint64_t hash) {
+    return &cache->shards[(hash >> 32) % cache->shard_count];
+}
+
+static BlockFrame *find(BlockShard *shard, uint64_t hash, uint64_t device, uint64_t inode,
+                        uint64_t block) {
+    for (uint32_t i = shard->buckets[hash & shard->bucket_mask]; i != NO_FRAME;
+         i = shard->frames[i].next) {
+        BlockFrame *frame = &shard->frames[i];
+        if (frame->hash == hash && frame->block == block && frame->inode == inode
+            && frame->device == device)
+            return frame;
+    }
+    return NULL;
+}
+
+static void unlink_frame(BlockShard *shard, uint32_t index) {
+    BlockFrame *frame = &shard->frames[index];
+    uint32_t *link = &shard->buckets[frame->hash & shard->bucket_mask];
+    while (*link != index) link = &shard->frames[*link].next;
+    *link = frame->next;
+
+    frame->next = NO_FRAME;
+    frame->used = false;
+}
+
+/**
+ * @brief Advance the hand to a frame to reuse, unlinking it if it holds a block.
+ */
+static uint32_t take_frame(BlockShard *shard, bool *evicted) {
+    for (;;) {
+        uint32_t index = shard->hand;
+        shard->hand = index + 1 < shard->frame_count ? index + 1 : 0;
+
+        BlockFrame *frame = &shard->frames[index];
+        if (!frame->used) return index;
+        if (frame->referenced) {
+            frame->referenced = false;
+            continue;
+        }
+
+        unlink_frame(shard, index);
+        *evicted = true;
+        return index;
+    }
+}
+
+static void insert(SnBlockCache *cache, const SnBlockFile *file, uint64_t block, const char *data,
+                   uint32_t length, bool referenced, uint64_t epoch) {
+    uint64_t hash = hash_block(file->device, file->inode, block);
+    BlockShard *shard = shard_of(cache, hash);
+    bool evicted = false;
+
+    sn_mutex_lock(&shard->mutex);
+
+    if (sn_atomic_load_u64(&cache->epoch) != epoch
+        || find(shard, hash, file->device, file->inode, block)) {
+        sn_mutex_unlock(&shard->mutex);
+        return;
+    }
+
+    uint32_t index = take_frame(shard, &evicted);
+    BlockFrame *frame = &shard->frames[index];
+    if (!frame->data) frame->data = sn_file_alloc(cache->block_size);
+
+    if (frame->data) {
+        memcpy(frame->data, data, length);
+        frame->hash = hash;
+        frame->device = file->device;
+        frame->inode = file->inode;
+        frame->block = block;
+        frame->length = length;
+        frame->used = true;
+        frame->referenced = referenced;
+
+        uint32_t *bucket = &shard->buckets[hash & shard->bucket_mask];
+        frame->next = *bucket;
+        *bucket = index;
+    }
+
+    sn_mutex_unlock(&shard->mutex);
+
+    if (evicted) sn_atomic_fetch_add_u64(&cache->evictions, 1);
+}
+
+/**
+ * @brief Drop the blocks first to last of a file.
+ */
+static void drop_blocks(SnBlockCache *cache, uint64_t device, uint64_t inode, uint64_t first,
+                        uint64_t last) {
+    // Loads racing with this keep what they read to themselves
+    sn_atomic_fetch_add_u64(&cache->epoch, 1);
+
+    uint64_t frame_count = (uint64_t)cache->shard_count * cache->shards[0].frame_count;
+    if (last - first < frame_count) {
+        for (uint64_t block = first; block <= last; ++block) {
+            uint64_t hash = hash_block(device, inode, block);
+            BlockShard *shard = shard_of(cache, hash);
+
+            sn_mutex_lock(&shard->mutex);
+            BlockFrame *frame = find(shard, hash, device, inode, block);
+            if (frame) unlink_frame(shard, (uint32_t)(frame - shard->frames));
+            sn_mutex_unlock(&shard->mutex);
+        }
+        return;
+    }
+
+    // Fewer frames than blocks, look at each frame instead
+    for (uint32_t s = 0; s < cache->shard_count; ++s) {
+        BlockShard *shard = &cache->shards[s];
+
+        sn_mutex_lock(&shard->mutex);
+        for (uint32_t i = 0; i < shard->frame_count; ++i) {
+            BlockFrame *frame = &shard->frames[i];
+            if (frame->used && frame->inode == inode && frame->device == device
+                && frame->block >= first && frame->block <= last)
+                unlink_frame(shard, i);
+        }
+        sn_mutex_unlock(&shard->mutex);
+    }
+}
+
+static void notify_range(uint64_t device, uint64_t inode, uint64_t offset, uint64_t size) {
+    sn_spin_lock(&registry_lock);
+    SnBlockCache *cache = registry;
+    if (cache) cache->notifying++;
+    sn_spin_unlock(&registry_lock);
+
+    while (cache) {
+        uint64_t first = offset >> cache->block_shift;
+        uint64_t last = size == UINT64_MAX || offset + size < offset
+                          ? UINT64_MAX
+                          : (offset + size - 1) >> cache->block_shift;
+        drop_blocks(cache, device, inode, first, last);
+
+        sn_spin_lock(&registry_lock);
+        SnBlockCache *next = cache->next_registered;
+        if (next) next->notifying++;
+        cache->notifying--;
+        sn_spin_unlock(&registry_lock);
+
+        cache = next;
+    }
+}
+
+void sn_block_cache_notify(SnFile *file, int64_t offset, uint64_t size) {
+    if (!size || !sn_atomic_load_u32(&registry_count)) return;
+
+    uint64_t device, inode;
+    if (!sn_file_identity(file, &device, &inode)) return;
+
+    // Without a position drop the whole file
+    uint64_t start = 0, length = UINT64_MAX;
+    uint64_t end = offset >= 0 ? (uint64_t)offset + size : sn_file_tell(file);
+    if (end != UINT64_MAX && end >= size) {
+        start = end - size;
+        length = size;
+    }
+
+    notify_range(device, inode, start, length);
+}
+
+void sn_block_cache_notify_path(const char *path) {
+    if (!sn_atomic_load_u32(&registry_count)) return;
+
+    SnFileInfo info;
+    if (!sn_file_stat(path, &info)) return;
+
+    notify_range(info.device, info.inode, 0, UINT64_MAX);
+}
+
+static void registry_add(SnBlockCache *cache) {
+    sn_spin_lock(&registry_lock);
+    cache->next_registered = registry;
+    registry = cache;
+    sn_atomic_fetch_add_u32(&registry_count, 1);
+    sn_spin_unlock(&registry_lock);
+}
+
+static void registry_remove(SnBlockCache *cache) {
+    sn_spin_lock(&registry_lock);
+    while (cache->notifying) {
+        sn_spin_unlock(&registry_lock);
+        sn_thread_yield();
+        sn_spin_lock(&registry_lock);
+    }
+
+    SnBlockCache **link = &registry;
+    while (*link != cache) link = &(*link)->next_registered;
+    *link = cache->next_registered;
+    sn_atomic_fetch_add_u32(&registry_count, (uint32_t)-1);
+    sn_spin_unlock(&registry_lock);
+}
+
+static void shard_free(SnBlockCache *cache, BlockShard *shard) {
+    for (uint32_t i = 0; i < shard->frame_count; ++i)
+        sn_file_free(shard->frames[i].data, cache->block_size);
+
+    sn_file_free(shard->frames, sizeof(BlockFrame) * shard->frame_count);
+    sn_file_free(shard->buckets, sizeof(uint32_t) * (shard->bucket_mask + 1));
+    sn_mutex_destroy(&shard->mutex);
+}
+
+static bool shard_init(BlockShard *shard, uint32_t frame_count) {
+    // Around two buckets per frame
+    uint32_t bucket_count = 4;
+    while (bucket_count < frame_count * 2) bucket_count <<= 1;
+
+    *shard = (BlockShard){.frame_count = frame_count, .bucket_mask = bucket_count - 1};
+
+    shard->frames = sn_file_alloc(sizeof(BlockFrame) * frame_count);
+    shard->buckets = sn_file_alloc(sizeof(uint32_t) * bucket_count);
+    if (!shard->frames || !shard->buckets || !sn_mutex_init(&shard->mutex)) {
+        sn_file_free(shard->frames, sizeof(BlockFrame) * frame_count);
+        sn_file_free(shard->buckets, sizeof(uint32_t) * bucket_count);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < frame_count; ++i) shard->frames[i] = (BlockFrame){.next = NO_FRAME};
+    for (uint32_t i = 0; i < bucket_count; ++i) shard->buckets[i] = NO_FRAME;
+
+    return true;
+}
+
+bool sn_block_cache_create(const SnBlockCacheConfig *config, SnBlockCache **cache) {
+    SnBlockCacheConfig defaults = {0};
+    if (!config) config = &defaults;
+
+    uint64_t budget = config->memory_budget ? config->memory_budget : BLOCK_CACHE_DEFAULT_BUDGET;
+
+    uint32_t requested_size = config->block_size ? config->block_size
+                                                 : BLOCK_CACHE_DEFAULT_BLOCK_SIZE;
+    if (requested_size > BLOCK_CACHE_MAX_BLOCK_SIZE) return false;
+    uint32_t block_shift = 0;
+    while ((1u << block_shift) < requested_size) ++block_shift;
+
+    uint32_t readahead = config->readahead ? config->readahead : BLOCK_CACHE_DEFAULT_READAHEAD;
+    if (readahead > BLOCK_CACHE_MAX_READAHEAD) readahead = BLOCK_CACHE_MAX_READAHEAD;
+    uint32_t readahead_limit = BLOCK_CACHE_MAX_READAHEAD_BYTES >> block_shift;
+    if (readahead > readahead_limit) readahead = readahead_limit ? readahead_limit : 1;
+
+    // At least one frame, and frame indices must fit next to NO_FRAME
+    uint64_t frame_total = budget >> block_shift;
+    if (!frame_total) frame_total = 1;
+    if (frame_total > UINT32_MAX / 4) frame_total = UINT32_MAX / 4;
+
+    uint32_t requested = config->shard_count ? config->shard_count : sn_thread_cpu_count();
+    uint32_t shard_count = 1;
+    while (shard_count < requested && shard_count < BLOCK_CACHE_MAX_SHARDS) shard_count <<= 1;
+    // Every shard gets at least one frame
+    while (shard_count > frame_total) shard_count >>= 1;
+
+    SnBlockCache *c = sn_file_alloc(sizeof(SnBlockCache));
+    if (!c) return false;
+    *c = (SnBlockCache){.shard_count = shard_count,
+                        .block_size = 1u << block_shift,
+                        .block_shift = block_shift,
+                        .readahead = readahead};
+
+    c->shards = sn_file_alloc(sizeof(BlockShard) * shard_count);
+    if (!c->shards) {
+        sn_file_free(c, sizeof(SnBlockCache));
+        return false;
+    }
+
+    uint32_t initialized = 0;
+    while (initialized < shard_count
+           && shard_init(&c->shards[initialized], (uint32_t)(frame_total / shard_count)))
+        ++initialized;
+
+    if (initialized != shard_count) {
+        for (uint32_t i = 0; i < initialized; ++i) shard_free(c, &c->shards[i]);
+        sn_file_free(c->shards, sizeof(BlockShard) * shard_count);
+        sn_file_free(c, sizeof(SnBlockCache));
+        return false;
+    }
+
+    registry_add(c);
+
+    *cache = c;
+    return true;
+}
+
+void sn_block_cache_destroy(SnBlockCache *cache) {
+    registry_remove(cache);
+
+    for (uint32_t i = 0; i < cache->shard_count; ++i) shard_free(cache, &cache->shards[i]);
+
+    sn_file_free(cache->shards, sizeof(BlockShard) * cache->shard_count);
+    sn_file_free(cache, sizeof(SnBlockCache));
+}
+
+bool sn_block_file_init(SnFile *file, SnBlockFile *block_file) {
+    block_file->file = file;
+    block_file->last_block = NO_BLOCK;
+    return sn_file_identity(file, &block_file->device, &block_file->inode);
+}
+
+/**
+ * @brief Copy a cached block, reporting whether it is the last of the file.
+ *
+ * @return Returns false if the block is not cached.
+ */
+static bool read_cached(SnBlockCache *cache, const SnBlockFile *file, uint64_t block,
+                        uint32_t within, char *dst, uint64_t size, uint64_t *copied, bool *end) {
+    uint64_t hash = hash_block(file->device, file->inode, block);
+    BlockShard *shard = shard_of(cache, hash);
+
+    sn_mutex_lock(&shard->mutex);
+
+    BlockFrame *frame = find(shard, hash, file->device, file->inode, block);
+    if (frame && frame->length < cache->block_size && within + size > frame->length) {
+        // The file may have grown past its last block since, read it again
+        unlink_frame(shard, (uint32_t)(frame - shard->frames));
+        frame = NULL;
+    }
+    if (!frame) {
+        sn_mutex_unlock(&shard->mutex);
+        return false;
+    }
+
+    frame->referenced = true;
+    uint64_t available = within < frame->length ? frame->length - within : 0;
+    *copied = available < size ? available : size;
+    memcpy(dst, frame->data + within, *copied);
+    *end = frame->length < cache->block_size;
+
+    sn_mutex_unlock(&shard->mutex);
+    return true;
+}
+
+/**
+ * @brief Read blocks from the file starting at block, caching them.
+ *
+ * @param sequential Whether to read readahead blocks even if fewer are wanted.
+ *
+ * @return Returns bytes copied to dst, -1 on failure.
+ */
+static int64_t read_blocks(SnBlockCache *cache, const SnBlockFile *file, uint64_t block,
+                           uint32_t within, char *dst, uint64_t size, bool sequential, bool *end) {
+    uint64_t wanted = (within + size + cache->block_size - 1) >> cache->block_shift;
+    uint64_t count = wanted < cache->readahead && !sequential ? wanted : cache->readahead;
+
+    uint64_t bytes = count << cache->block_shift;
+    char *data = sn_file_alloc(bytes);
+    if (!data) return -1;
+
+    uint64_t epoch = sn_atomic_load_u64(&cache->epoch);
+    int64_t got = sn_file_read_at(file->file, block << cache->block_shift, data, bytes);
+    if (got < 0) {
+        sn_file_free(data, bytes);
+        return -1;
+    }
+
+    // Blocks past the end are not cached, a short one marks it
+    uint64_t loaded = ((uint64_t)got + cache->block_size - 1) >> cache->block_shift;
+    for (uint64_t i = 0; i < loaded; ++i) {
+        uint64_t offset = i << cache->block_shift;
+        uint64_t left = (uint64_t)got - offset;
+        uint32_t length = left < cache->block_size ? (uint32_t)left : cache->block_size;
+        insert(cache, file, block + i, data + offset, length, i < wanted, epoch);
+    }
+
+    uint64_t asked = loaded < wanted ? loaded : wanted;
+    sn_atomic_fetch_add_u64(&cache->misses, asked ? asked : 1);
+    if (loaded > asked) sn_atomic_fetch_add_u64(&cache->readahead_blocks, loaded - asked);
+
+    uint64_t available = (uint64_t)got > within ? (uint64_t)got - within : 0;
+    uint64_t copied = available < size ? available : size;
+    memcpy(dst, data + within, copied);
+    *end = (uint64_t)got < bytes;
+
+    sn_file_free(data, bytes);
+    return (int64_t)copied;
+}
+
+int64_t sn_block_cache_read(SnBlockCache *cache, SnBlockFile *file, uint64_t offset, void *buffer,
+                            uint64_t size) {
+    char *dst = buffer;
+    uint64_t done = 0;
+    bool end = false;
+
+    // Continuing the previous read, a neighbour merely being cached says nothing
+    uint64_t first = offset >> cache->block_shift;
+    uint64_t last = sn_atomic_load_u64(&file->last_block);
+    bool sequential = cache->readahead > 1 && last != NO_BLOCK
+                   && (first == last || first == last + 1);
+
+    while (done < size && !end) {
+        uint64_t position = offset + done;
+        uint64_t block = position >> cache->block_shift;
+        uint32_t within = (uint32_t)(position & (cache->block_size - 1));
+
+        uint64_t copied;
+        if (read_cached(cache, file, block, within, dst + done, size - done, &copied, &end)) {
+            sn_atomic_fetch_add_u64(&cache->hits, 1);
+            done += copied;
+            continue;
+        }
+
+        int64_t got = read_blocks(cache, file, block, within, dst + done, size - done, sequential,
+                                  &end);
+        if (got < 0) {
+            if (!done) return -1;
+            break;
+        }
+        done += got;
+    }
+
+    if (done) sn_atomic_store_u64(&file->last_block, (offset + done - 1) >> cache->block_shift);
+    return (int64_t)done;
+}
+
+void sn_block_cache_invalidate(SnBlockCache *cache, const SnBlockFile *file) {
+    drop_blocks(cache, file->device, file->inode, 0, UINT64_MAX);
+}
+
+void sn_block_cache_stats(SnBlockCache *cache, SnBlockCacheStats *stats) {
+    *stats = (SnBlockCacheStats){
+        .hits = sn_atomic_load_u64(&cache->hits),
+        .misses = sn_atomic_load_u64(&cache->misses),
+        .readahead = sn_atomic_load_u64(&cache->readahead_blocks),
+        .evictions = sn_atomic_load_u64(&cache->evictions),
+    };
+}
@@ -0,0 +1,410 @@
+#include "snfile/cache.h"
+
+#include "src/internal.h"
+#include "src/thread.h"
+
+#include <string.h>
+
+#define CACHE_DEFAULT_MAX_OPEN 1024
+#define CACHE_MAX_SHARDS 64
+
+/*
+ * Entries live in a per shard hash table keyed by path, every open flags
+ * variant of a path is in the same bucket so invalidation touches one shard.
+ * Entries nobody has checked out are also linked in the shard's LRU list, the
+ * tail is evicted first. An entry invalidated while checked out is unlinked
+ * from the table and closed by its last release.
+ *
+ * Files are opened without the shard lock, the shard generation bumped by
+ * every invalidation tells whether the path may have changed meanwhile.
+ */
+typedef struct CacheEntry {
+    SnFile file; // First so a returned handle maps back to its entry
+
+    struct CacheEntry *next;
+    struct CacheEntry *lru_prev;
+    struct CacheEntry *lru_next;
+
+    uint64_t hash;
+    char *path;
+    size_t path_size;
+    int flags;
+
+    uint32_t refs;
+    bool stale;
+} CacheEntry;
+
+typedef struct CacheShard {
+    SnMutex mutex;
+
+    CacheEntry **buckets;
+    uint32_t bucket_mask;
+
+    CacheEntry *lru_head;
+    CacheEntry *lru_tail;
+
+    uint32_t open;
+    uint32_t capacity;
+
+    uint64_t generation; // Invalidations so far
+} CacheShard;
+
+struct SnFileCache {
+    CacheShard *shards;
+    uint32_t shard_count;
+
+    volatile uint64_t hits;
+    volatile uint64_t misses;
+    volatile uint64_t evictions;
+
+    SnFileCache *next_registered;
+};
+
+// Caches notified by sn_file_delete and sn_file_move
+static volatile uint32_t registry_lock;
+static volatile uint32_t registry_count;
+static SnFileCache *registry;
+
+static uint64_t hash_path(const char *path, size_t length) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (unsigned char)path[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static CacheShard *shard_of(SnFileCache *cache, uint64_t hash) {
+    return &cache->shards[(hash >> 32) % cache->shard_count];
+}
+
+static CacheEntry **bucket_of(CacheShard *shard, uint64_t hash) {
+    return &shard->buckets[hash & shard->bucket_mask];
+}
+
+static void lru_remove(CacheShard *shard, CacheEntry *entry) {
+    if (entry->lru_prev) entry->lru_prev->lru_next = entry->lru_next;
+    else shard->lru_head = entry->lru_next;
+
+    if (entry->lru_next) entry->lru_next->lru_prev = entry->lru_prev;
+    else shard->lru_tail = entry->lru_prev;
+
+    entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void lru_push(CacheShard *shard, CacheEntry *entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = shard->lru_head;
+    if (shard->lru_head) shard->lru_head->lru_prev = entry;
+    else shard->lru_tail = entry;
+    shard->lru_head = entry;
+}
+
+static void table_remove(CacheShard *shard, CacheEntry *entry) {
+    CacheEntry **link = bucket_of(shard, entry->hash);
+    while (*link != entry) link = &(*link)->next;
+    *link = entry->next;
+    entry->next = NULL;
+}
+
+static void entry_free(CacheEntry *entry) {
+    sn_file_close(&entry->file);
+    sn_file_free(entry->path, entry->path_size);
+    sn_file_free(entry, sizeof(CacheEntry));
+}
+
+/**
+ * @brief Close the given list of entries linked by next, outside of the shard lock.
+ */
+static void free_list(CacheEntry *list) {
+    while (list) {
+        CacheEntry *next = list->next;
+        entry_free(list);
+        list = next;
+    }
+}
+
+static CacheEntry *find(CacheShard *shard, uint64_t hash, const char *path, size_t length,
+                        int flags) {
+    for (CacheEntry *e = *bucket_of(shard, hash); e; e = e->next) {
+        if (e->hash == hash && e->flags == flags && e->path_size == length + 1
+            && memcmp(e->path, path, length) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+static void registry_add(SnFileCache *cache) {
+    sn_spin_lock(&registry_lock);
+    cache->next_registered = registry;
+    registry = cache;
+    sn_atomic_fetch_add_u32(&registry_count, 1);
+    sn_spin_unlock(&registry_lock);
+}
+
+static void registry_remove(SnFileCache *cache) {
+    sn_spin_lock(&registry_lock);
+    SnFileCache **link = &registry;
+    while (*link != cache) link = &(*link)->next_registered;
+    *link = cache->next_registered;
+    sn_atomic_fetch_add_u32(&registry_count, (uint32_t)-1);
+    sn_spin_unlock(&registry_lock);
+}
+
+/**
+ * @brief Unlink the entries of path, adding the ones to close to closed.
+ *
+ * @return The new head of closed.
+ */
+static CacheEntry *unlink_path(SnFileCache *cache, const char *path, CacheEntry *closed) {
+    size_t length = strlen(path);
+    uint64_t hash = hash_path(path, length);
+    CacheShard *shard = shard_of(cache, hash);
+
+    sn_mutex_lock(&shard->mutex);
+
+    // Files being opened right now are not cached
+    shard->generation++;
+
+    CacheEntry **link = bucket_of(shard, hash);
+    while (*link) {
+        CacheEntry *e = *link;
+        if (e->hash != hash || e->path_size != length + 1 || memcmp(e->path, path, length) != 0) {
+            link = &e->next;
+            continue;
+        }
+
+        *link = e->next;
+        e->next = NULL;
+
+        if (e->refs) {
+            // Closed by the last release, still counts towards the limit until then
+            e->stale = true;
+        } else {
+            lru_remove(shard, e);
+            e->next = closed;
+            closed = e;
+            shard->open--;
+        }
+    }
+
+    sn_mutex_unlock(&shard->mutex);
+
+    return closed;
+}
+
+void sn_file_cache_notify(const char *path) {
+    if (!sn_atomic_load_u32(&registry_count)) return;
+
+    CacheEntry *closed = NULL;
+
+    sn_spin_lock(&registry_lock);
+    for (SnFileCache *cache = registry; cache; cache = cache->next_registered)
+        closed = unlink_path(cache, path, closed);
+    sn_spin_unlock(&registry_lock);
+
+    free_list(closed);
+}
+
+bool sn_file_cache_create(const SnFileCacheConfig *config, SnFileCache **cache) {
+    SnFileCacheConfig defaults = {0};
+    if (!config) config = &defaults;
+
+    uint32_t max_open = config->max_open ? config->max_open : CACHE_DEFAULT_MAX_OPEN;
+
+    uint32_t requested = config->shard_count ? config->shard_count : sn_thread_cpu_count();
+    uint32_t shard_count = 1;
+    while (shard_count < requested && shard_count < CACHE_MAX_SHARDS) shard_count <<= 1;
+    // Every shard gets at least one handle
+    while (shard_count > max_open) shard_count >>= 1;
+
+    uint32_t capacity = max_open / shard_count;
+
+    // Around two buckets per handle
+    uint32_t bucket_count = 4;
+    while (bucket_count < capacity * 2) bucket_count <<= 1;
+
+    SnFileCache *c = sn_file_alloc(sizeof(SnFileCache));
+    if (!c) return false;
+    *c = (SnFileCache){.shard_count = shard_count};
+
+    c->shards = sn_file_alloc(sizeof(CacheShard) * shard_count);
+    if (!c->shards) goto fail;
+
+    uint32_t initialized = 0;
+    for (; initialized < shard_count; ++initialized) {
+        CacheShard *shard = &c->shards[initialized];
+        *shard = (CacheShard){.bucket_mask = bucket_count - 1, .capacity = capacity};
+
+        shard->buckets = sn_file_alloc(sizeof(CacheEntry *) * bucket_count);
+        if (!shard->buckets) break;
+        memset(shard->buckets, 0, sizeof(CacheEntry *) * bucket_count);
+
+        if (!sn_mutex_init(&shard->mutex)) {
+            sn_file_free(shard->buckets, sizeof(CacheEntry *) * bucket_count);
+            break;
+        }
+    }
+
+    if (initialized != shard_count) {
+        for (uint32_t i = 0; i < initialized; ++i) {
+            sn_mutex_destroy(&c->shards[i].mutex);
+            sn_file_free(c->shards[i].buckets, sizeof(CacheEntry *) * bucket_count);
+        }
+        sn_file_free(c->shards, sizeof(CacheShard) * shard_count);
+        goto fail;
+    }
+
+    registry_add(c);
+
+    *cache = c;
+    return true;
+
+fail:
+    sn_file_free(c, sizeof(SnFileCache));
+    return false;
+}
+
+void sn_file_cache_destroy(SnFileCache *cache) {
+    registry_remove(cache);
+
+    for (uint32_t i = 0; i < cache->shard_count; ++i) {
+        CacheShard *shard = &cache->shards[i];
+        uint32_t bucket_count = shard->bucket_mask + 1;
+
+        for (uint32_t b = 0; b < bucket_count; ++b) {
+            SN_ASSERT(!shard->buckets[b] || shard->buckets[b]->refs == 0);
+            free_list(shard->buckets[b]);
+        }
+
+        sn_mutex_destroy(&shard->mutex);
+        sn_file_free(shard->buckets, sizeof(CacheEntry *) * bucket_count);
+    }
+
+    sn_file_free(cache->shards, sizeof(CacheShard) * cache->shard_count);
+    sn_file_free(cache, sizeof(SnFileCache));
+}
+
+SnFile *sn_file_cache_acquire(SnFileCache *cache, const char *path, int flags) {
+    size_t length = strlen(path);
+    uint64_t hash = hash_path(path, length);
+    CacheShard *shard = shard_of(cache, hash);
+
+    sn_mutex_lock(&shard->mutex);
+    CacheEntry *entry = find(shard, hash, path, length, flags);
+    if (entry) {
+        if (entry->refs++ == 0) lru_remove(shard, entry);
+        sn_mutex_unlock(&shard->mutex);
+        sn_atomic_fetch_add_u64(&cache->hits, 1);
+        return &entry->file;
+    }
+    uint64_t generation = shard->generation;
+    sn_mutex_unlock(&shard->mutex);
+
+    sn_atomic_fetch_add_u64(&cache->misses, 1);
+
+    // Open without holding the lock so other paths in the shard are not blocked
+    CacheEntry *created = sn_file_alloc(sizeof(CacheEntry));
+    if (!created) return NULL;
+    *created = (CacheEntry){.hash = hash, .path_size = length + 1, .flags = flags, .refs = 1};
+
+    created->path = sn_file_alloc(length + 1);
+    if (!created->path) {
+        sn_file_free(created, sizeof(CacheEntry));
+        return NULL;
+    }
+    memcpy(created->path, path, length + 1);
+
+retry:
+    if (!sn_file_open(path, flags, &created->file)) {
+        sn_file_free(created->path, created->path_size);
+        sn_file_free(created, sizeof(CacheEntry));
+        return NULL;
+    }
+
+    CacheEntry *evicted = NULL;
+    uint64_t evictions = 0;
+
+    sn_mutex_lock(&shard->mutex);
+
+    if (shard->generation != generation) {
+        // The path may have been deleted or replaced while opening, the handle could be stale
+        generation = shard->generation;
+        sn_mutex_unlock(&shard->mutex);
+        sn_file_close(&created->file);
+        goto retry;
+    }
+
+    // Another thread may have opened the same file meanwhile
+    entry = find(shard, hash, path, length, flags);
+    if (entry) {
+        if (entry->refs++ == 0) lru_remove(shard, entry);
+        sn_mutex_unlock(&shard->mutex);
+        entry_free(created);
+        return &entry->file;
+    }
+
+    while (shard->open >= shard->capacity && shard->lru_tail) {
+        CacheEntry *victim = shard->lru_tail;
+        lru_remove(shard, victim);
+        table_remove(shard, victim);
+        victim->next = evicted;
+        evicted = victim;
+        shard->open--;
+        evictions++;
+    }
+
+    if (shard->open >= shard->capacity) {
+        // Every handle of the shard is checked out
+        sn_mutex_unlock(&shard->mutex);
+        entry_free(created);
+        return NULL;
+    }
+
+    CacheEntry **bucket = bucket_of(shard, hash);
+    created->next = *bucket;
+    *bucket = created;
+    shard->open++;
+
+    sn_mutex_unlock(&shard->mutex);
+
+    if (evictions) sn_atomic_fetch_add_u64(&cache->evictions, evictions);
+    free_list(evicted);
+
+    return &created->file;
+}
+
+void sn_file_cache_release(SnFileCache *cache, SnFile *file) {
+    CacheEntry *entry = (CacheEntry *)file;
+    CacheShard *shard = shard_of(cache, entry->hash);
+
+    sn_mutex_lock(&shard->mutex);
+    SN_ASSERT(entry->refs > 0);
+    if (--entry->refs) {
+        sn_mutex_unlock(&shard->mutex);
+        return;
+    }
+
+    if (entry->stale) {
+        shard->open--;
+        sn_mutex_unlock(&shard->mutex);
+        entry_free(entry);
+        return;
+    }
+
+    lru_push(shard, entry);
+    sn_mutex_unlock(&shard->mutex);
+}
+
+void sn_file_cache_invalidate(SnFileCache *cache, const char *path) {
+    free_list(unlink_path(cache, path, NULL));
+}
+
+void sn_file_cache_stats(SnFileCache *cache, SnFileCacheStats *stats) {
+    *stats = (SnFileCacheStats){
+        .hits = sn_atomic_load_u64(&cache->hits),
+        .misses = sn_atomic_load_u64(&cache->misses),
+        .evictions = sn_atomic_load_u64(&cache->evictions),
+    };
+}
@@ -0,0 +1,447 @@
+#include "snfile/compressed.h"
+
+#include "src/internal.h"
+#include "src/lz.h"
+#include "src/pool.h"
+
+#include <string.h>
+
+#define COMPRESSED_MAGIC "SNLZS001"
+#define COMPRESSED_TRAILER_MAGIC "SNLZSEND"
+#define COMPRESSED_VERSION 1
+
+#define COMPRESSED_DEFAULT_BLOCK_SIZE (128u << 10)
+#define COMPRESSED_MIN_BLOCK_SIZE (4u << 10)
+#define COMPRESSED_MAX_BLOCK_SIZE (64u << 20)
+
+// Blocks in flight per thread
+#define COMPRESSED_BLOCKS_PER_THREAD 2
+
+#define BLOCK_FLAG_RAW SN_BIT_FLAG(0)
+
+/*
+ * Stream layout, offsets relative to the start of the stream:
+ *
+ *   header | block 0 | block 1 | ... | index entry per block | trailer
+ *
+ * Blocks are stored back to back in order, so any run of blocks is one
+ * contiguous read. The trailer is at the end of the file and locates the index.
+ */
+typedef struct CompressedHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t block_size;
+} CompressedHeader;
+
+typedef struct CompressedIndexEntry {
+    uint64_t offset;
+    uint32_t stored_size;
+    uint32_t flags;
+} CompressedIndexEntry;
+
+typedef struct CompressedTrailer {
+    uint64_t index_offset;
+    uint64_t block_count;
+    uint64_t size; /**< Uncompressed size */
+    char magic[8];
+} CompressedTrailer;
+
+struct SnCompressedWriter {
+    SnFile *file;
+    SnPool *pool;
+
+    uint32_t block_size;
+    uint32_t batch; // Blocks compressed together
+
+    char *input;
+    uint64_t input_fill;
+    char *output;
+    uint32_t *stored; // Compressed size per block of the batch, 0 when raw
+    SnFileIoVec *iov;
+
+    CompressedIndexEntry *index;
+    uint64_t block_count;
+    uint64_t index_capacity;
+
+    uint64_t position; // Relative to the start of the stream
+    uint64_t size;
+    bool failed;
+    bool finished;
+};
+
+typedef struct DecodeJob {
+    const char *src;
+    uint32_t stored_size;
+    uint32_t size;
+    bool raw;
+    char *dst; // NULL when the block is taken from the cache
+    bool ok;
+} DecodeJob;
+
+struct SnCompressedReader {
+    SnFile *file;
+    SnPool *pool;
+
+    uint64_t base; // Start of the stream in file
+    uint32_t block_size;
+    uint32_t batch;
+    uint64_t block_count;
+    uint64_t size;
+    CompressedIndexEntry *index;
+
+    char *staging; // Compressed bytes of a batch
+    DecodeJob *jobs;
+
+    // Partially read blocks are decoded here, the last one is kept for the next read
+    char *cache;
+    char *scratch[2];
+    uint64_t cache_block;
+};
+
+static uint32_t clamp_block_size(uint32_t block_size) {
+    if (!block_size) return COMPRESSED_DEFAULT_BLOCK_SIZE;
+    if (block_size < COMPRESSED_MIN_BLOCK_SIZE) return COMPRESSED_MIN_BLOCK_SIZE;
+    if (block_size > COMPRESSED_MAX_BLOCK_SIZE) return COMPRESSED_MAX_BLOCK_SIZE;
+    return block_size;
+}
+
+static void compress_block(void *user_data, uint32_t index) {
+    SnCompressedWriter *w = user_data;
+
+    uint64_t begin = (uint64_t)index * w->block_size;
+    uint64_t length = w->input_fill - begin;
+    if (length > w->block_size) length = w->block_size;
+
+    // Only keep the compressed form if it is smaller
+    w->stored[index] = (uint32_t)sn_lz_compress(w->input + begin, length,
+                                                w->output + begin, length - 1);
+}
+
+static bool flush_batch(SnCompressedWriter *w) {
+    if (!w->input_fill) return true;
+
+    uint32_t count = (uint32_t)((w->input_fill + w->block_size - 1) / w->block_size);
+
+    if (w->block_count + count > w->index_capacity) {
+        uint64_t capacity = w->index_capacity ? w->index_capacity * 2 : 64;
+        while (capacity < w->block_count + count) capacity *= 2;
+        CompressedIndexEntry *index = sn_file_realloc(
+            w->index, w->index_capacity * sizeof(CompressedIndexEntry),
+            capacity * sizeof(CompressedIndexEntry));
+        if (!index) return false;
+        w->index = index;
+        w->index_capacity = capacity;
+    }
+
+    sn_pool_run(w->pool, count, compress_block, w);
+
+    SnFileIoVec *iov = w->iov;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint64_t begin = (uint64_t)i * w->block_size;
+        uint64_t length = w->input_fill - begin;
+        if (length > w->block_size) length = w->block_size;
+
+        bool raw = w->stored[i] == 0;
+        uint32_t stored_size = raw ? (uint32_t)length : w->stored[i];
+
+        iov[i] = (SnFileIoVec){.data = (raw ? w->input : w->output) + begin, .size = stored_size};
+        w->index[w->block_count++] = (CompressedIndexEntry){
+            .offset = w->position, .stored_size = stored_size, .flags = raw ? BLOCK_FLAG_RAW : 0};
+        w->position += stored_size;
+    }
+
+    w->input_fill = 0;
+    return sn_file_write_all(w->file, iov, count);
+}
+
+bool sn_compressed_writer_create(SnFile *file, const SnCompressedConfig *config,
+                                 SnCompressedWriter **writer) {
+    SnCompressedConfig defaults = {0};
+    if (!config) config = &defaults;
+
+    SnCompressedWriter *w = sn_file_alloc(sizeof(SnCompressedWriter));
+    if (!w) return false;
+    *w = (SnCompressedWriter){.file = file, .block_size = clamp_block_size(config->block_size)};
+
+    if (!sn_pool_create(config->thread_count, &w->pool)) goto fail;
+    w->batch = sn_pool_thread_count(w->pool) * COMPRESSED_BLOCKS_PER_THREAD;
+
+    uint64_t batch_size = (uint64_t)w->batch * w->block_size;
+    w->input = sn_file_alloc(batch_size);
+    w->output = sn_file_alloc(batch_size);
+    w->stored = sn_file_alloc(w->batch * sizeof(uint32_t));
+    w->iov = sn_file_alloc(w->batch * sizeof(SnFileIoVec));
+    if (!w->input || !w->output || !w->stored || !w->iov) goto fail;
+
+    CompressedHeader header = {.version = COMPRESSED_VERSION, .block_size = w->block_size};
+    memcpy(header.magic, COMPRESSED_MAGIC, sizeof(header.magic));
+    SnFileIoVec iov = {.data = &header, .size = sizeof(header)};
+    if (!sn_file_write_all(file, &iov, 1)) goto fail;
+    w->position = sizeof(header);
+
+    *writer = w;
+    return true;
+
+fail:
+    sn_compressed_writer_destroy(w);
+    return false;
+}
+
+void sn_compressed_writer_destroy(SnCompressedWriter *writer) {
+    uint64_t batch_size = (uint64_t)writer->batch * writer->block_size;
+
+    sn_pool_destroy(writer->pool);
+    sn_file_free(writer->input, batch_size);
+    sn_file_free(writer->output, batch_size);
+    sn_file_free(writer->stored, writer->batch * sizeof(uint32_t));
+    sn_file_free(writer->iov, writer->batch * sizeof(SnFileIoVec));
+    sn_file_free(writer->index, writer->index_capacity * sizeof(CompressedIndexEntry));
+    sn_file_free(writer, sizeof(SnCompressedWriter));
+}
+
+bool sn_compressed_writer_write(SnCompressedWriter *writer, const void *data, uint64_t size) {
+    SnCompressedWriter *w = writer;
+    if (w->failed || w->finished) return false;
+
+    uint64_t batch_size = (uint64_t)w->batch * w->block_size;
+    const char *p = data;
+
+    while (size) {
+        uint64_t n = batch_size - w->input_fill;
+        if (n > size) n = size;
+
+        memcpy(w->input + w->input_fill, p, n);
+        w->input_fill += n;
+        w->size += n;
+        p += n;
+        size -= n;
+
+        if (w->input_fill == batch_size && !flush_batch(w)) {
+            w->failed = true;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool sn_compressed_writer_finish(SnCompressedWriter *writer) {
+    SnCompressedWriter *w = writer;
+    if (w->failed || w->finished) return false;
+    w->finished = true;
+
+    if (!flush_batch(w)) {
+        w->failed = true;
+        return false;
+    }
+
+    CompressedTrailer trailer = {
+        .index_offset = w->position, .block_count = w->block_count, .size = w->size};
+    memcpy(trailer.magic, COMPRESSED_TRAILER_MAGIC, sizeof(trailer.magic));
+
+    SnFileIoVec iov[2] = {
+        {.data = w->index, .size = w->block_count * sizeof(CompressedIndexEntry)},
+        {.data = &trailer, .size = sizeof(trailer)},
+    };
+    if (!sn_file_write_all(w->file, iov, 2)) {
+        w->failed = true;
+        return false;
+    }
+
+    return true;
+}
+
+static uint32_t block_length(const SnCompressedReader *r, uint64_t block) {
+    uint64_t length = r->size - block * r->block_size;
+    return length > r->block_size ? r->block_size : (uint32_t)length;
+}
+
+static bool read_at(SnCompressedReader *r, uint64_t offset, void *data, uint64_t size) {
+    return sn_file_seek(r->file, (int64_t)(r->base + offset), SN_FILE_SEEK_ORIGIN_BEGIN)
+        && sn_file_read_exact(r->file, data, size);
+}
+
+/**
+ * @brief Check that blocks are back to back and sizes are consistent.
+ */
+static bool validate_index(const SnCompressedReader *r, uint64_t index_offset) {
+    uint64_t expected = sizeof(CompressedHeader);
+    for (uint64_t i = 0; i < r->block_count; ++i) {
+        const CompressedIndexEntry *e = &r->index[i];
+        uint32_t length = block_length(r, i);
+
+        if (e->offset != expected || !e->stored_size || e->stored_size > length) return false;
+        if ((e->flags & BLOCK_FLAG_RAW) && e->stored_size != length) return false;
+
+        expected += e->stored_size;
+    }
+    return expected == index_offset;
+}
+
+bool sn_compressed_reader_open(SnFile *file, uint32_t thread_count, SnCompressedReader **reader) {
+    uint64_t file_size = sn_file_size(file);
+    if (file_size < sizeof(CompressedHeader) + sizeof(CompressedTrailer)) return false;
+
+    SnCompressedReader *r = sn_file_alloc(sizeof(SnCompressedReader));
+    if (!r) return false;
+    *r = (SnCompressedReader){.file = file, .cache_block = UINT64_MAX};
+
+    CompressedTrailer trailer;
+    if (!read_at(r, file_size - sizeof(trailer), &trailer, sizeof(trailer))
+        || memcmp(trailer.magic, COMPRESSED_TRAILER_MAGIC, sizeof(trailer.magic)) != 0
+        || trailer.block_count > file_size / sizeof(CompressedIndexEntry))
+        goto fail;
+
+    uint64_t index_size = trailer.block_count * sizeof(CompressedIndexEntry);
+    if (index_size > file_size - sizeof(trailer)
+        || trailer.index_offset > file_size - sizeof(trailer) - index_size)
+        goto fail;
+    r->base = file_size - sizeof(trailer) - index_size - trailer.index_offset;
+
+    CompressedHeader header;
+    if (!read_at(r, 0, &header, sizeof(header))
+        || memcmp(header.magic, COMPRESSED_MAGIC, sizeof(header.magic)) != 0
+        || header.version != COMPRESSED_VERSION
+        || clamp_block_size(header.block_size) != header.block_size)
+        goto fail;
+
+    r->block_size = header.block_size;
+    r->block_count = trailer.block_count;
+    r->size = trailer.size;
+    if ((r->size + r->block_size - 1) / r->block_size != r->block_count) goto fail;
+
+    r->index = sn_file_alloc(index_size ? index_size : 1);
+    if (!r->index || !read_at(r, trailer.index_offset, r->index, index_size)
+        || !validate_index(r, trailer.index_offset))
+        goto fail;
+
+    if (!sn_pool_create(thread_count, &r->pool)) goto fail;
+    r->batch = sn_pool_thread_count(r->pool) * COMPRESSED_BLOCKS_PER_THREAD;
+
+    r->staging = sn_file_alloc((uint64_t)r->batch * r->block_size);
+    r->jobs = sn_file_alloc(r->batch * sizeof(DecodeJob));
+    r->cache = sn_file_alloc(r->block_size);
+    r->scratch[0] = sn_file_alloc(r->block_size);
+    r->scratch[1] = sn_file_alloc(r->block_size);
+    if (!r->staging || !r->jobs || !r->cache || !r->scratch[0] || !r->scratch[1]) goto fail;
+
+    *reader = r;
+    return true;
+
+fail:
+    sn_compressed_reader_close(r);
+    return false;
+}
+
+void sn_compressed_reader_close(SnCompressedReader *reader) {
+    SnCompressedReader *r = reader;
+    uint64_t index_size = r->block_count * sizeof(CompressedIndexEntry);
+
+    sn_pool_destroy(r->pool);
+    sn_file_free(r->index, index_size ? index_size : 1);
+    sn_file_free(r->staging, (uint64_t)r->batch * r->block_size);
+    sn_file_free(r->jobs, r->batch * sizeof(DecodeJob));
+    sn_file_free(r->cache, r->block_size);
+    sn_file_free(r->scratch[0], r->block_size);
+    sn_file_free(r->scratch[1], r->block_size);
+    sn_file_free(r, sizeof(SnCompressedReader));
+}
+
+uint64_t sn_compressed_reader_size(const SnCompressedReader *reader) {
+    return reader->size;
+}
+
+static void decode_block(void *user_data, uint32_t index) {
+    DecodeJob *job = &((DecodeJob *)user_data)[index];
+    if (!job->dst) {
+        job->ok = true;
+        return;
+    }
+
+    if (job->raw) {
+        memcpy(job->dst, job->src, job->size);
+        job->ok = true;
+    } else {
+        job->ok = sn_lz_decompress(job->src, job->stored_size, job->dst, job->size);
+    }
+}
+
+/**
+ * @brief Copy the part of block b inside [offset, end) from its decoded bytes.
+ */
+static void copy_part(SnCompressedReader *r, uint64_t b, uint32_t length, const char *decoded,
+                      uint64_t offset, uint64_t end, void *data) {
+    uint64_t block_begin = b * r->block_size;
+    uint64_t from = offset > block_begin ? offset : block_begin;
+    uint64_t to = end < block_begin + length ? end : block_begin + length;
+    memcpy((char *)data + (from - offset), decoded + (from - block_begin), to - from);
+}
+
+int64_t sn_compressed_reader_read_at(SnCompressedReader *reader, uint64_t offset, void *data,
+                                     uint64_t size) {
+    SnCompressedReader *r = reader;
+    if (offset >= r->size || !size) return 0;
+    if (size > r->size - offset) size = r->size - offset;
+
+    uint64_t end = offset + size;
+    uint64_t first = offset / r->block_size;
+    uint64_t last = (end - 1) / r->block_size;
+
+    for (uint64_t block = first; block <= last;) {
+        uint32_t count = (uint32_t)(last - block + 1 < r->batch ? last - block + 1 : r->batch);
+
+        const CompressedIndexEntry *begin_entry = &r->index[block];
+        const CompressedIndexEntry *end_entry = &r->index[block + count - 1];
+        uint64_t span = end_entry->offset + end_entry->stored_size - begin_entry->offset;
+        if (!read_at(r, begin_entry->offset, r->staging, span)) return -1;
+
+        // Blocks read whole go straight to data, partial ones through scratch
+        uint32_t partial = 0;
+        for (uint32_t i = 0; i < count; ++i) {
+            uint64_t b = block + i;
+            const CompressedIndexEntry *e = &r->index[b];
+            uint64_t block_begin = b * r->block_size;
+            uint32_t length = block_length(r, b);
+
+            DecodeJob *job = &r->jobs[i];
+            *job = (DecodeJob){.src = r->staging + (e->offset - begin_entry->offset),
+                               .stored_size = e->stored_size,
+                               .size = length,
+                               .raw = e->flags & BLOCK_FLAG_RAW};
+
+            if (block_begin >= offset && block_begin + length <= end)
+                job->dst = (char *)data + (block_begin - offset);
+            else if (b != r->cache_block)
+                job->dst = r->scratch[partial++];
+        }
+
+        sn_pool_run(r->pool, count, decode_block, r->jobs);
+
+        // The cached block first, keeping a decoded block below replaces it
+        for (uint32_t i = 0; i < count; ++i) {
+            DecodeJob *job = &r->jobs[i];
+            if (!job->ok) return -1;
+            if (!job->dst) copy_part(r, block + i, job->size, r->cache, offset, end, data);
+        }
+
+        partial = 0;
+        for (uint32_t i = 0; i < count; ++i) {
+            DecodeJob *job = &r->jobs[i];
+            uint64_t b = block + i;
+            uint64_t block_begin = b * r->block_size;
+            if (!job->dst || (block_begin >= offset && block_begin + job->size <= end)) continue;
+
+            // Keep the decoded block for the next read
+            char *decoded = r->scratch[partial];
+            r->scratch[partial++] = r->cache;
+            r->cache = decoded;
+            r->cache_block = b;
+
+            copy_part(r, b, job->size, decoded, offset, end, data);
+        }
+
+        block += count;
+    }
+
+    return (int64_t)size;
+}
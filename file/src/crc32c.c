@@ -0,0 +1,46 @@
+#include "src/crc32c.h"
+
+#include "src/thread.h"
+
+// Reflected Castagnoli polynomial
+#define CRC32C_POLY 0x82F63B78u
+
+// Slicing by 8, table[k][b] is the CRC of b followed by k zero bytes
+static uint32_t table[8][256];
+static volatile uint32_t table_lock;
+static volatile uint32_t table_ready;
+
+static void build_table(void) {
+    if (sn_atomic_load_u32(&table_ready)) return;
+
+    sn_spin_lock(&table_lock);
+    if (!table_ready) {
+        for (uint32_t b = 0; b < 256; ++b) {
+            uint32_t crc = b;
+            for (int i = 0; i < 8; ++i) crc = (crc >> 1) ^ (CRC32C_POLY & (0u - (crc & 1)));
+            table[0][b] = crc;
+        }
+        for (uint32_t b = 0; b < 256; ++b)
+            for (int k = 1; k < 8; ++k)
+                table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xFF];
+        sn_atomic_store_u32(&table_ready, 1);
+    }
+    sn_spin_unlock(&table_lock);
+}
+
+uint32_t sn_crc32c(uint32_t crc, const void *data, size_t size) {
+    build_table();
+
+    const unsigned char *p = data;
+    crc = ~crc;
+
+    for (; size >= 8; p += 8, size -= 8) {
+        crc ^= (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+        crc = table[7][crc & 0xFF] ^ table[6][(crc >> 8) & 0xFF] ^ table[5][(crc >> 16) & 0xFF]
+            ^ table[4][crc >> 24] ^ table[3][p[4]] ^ table[2][p[5]] ^ table[1][p[6]]
+            ^ table[0][p[7]];
+    }
+    while (size--) crc = table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+}
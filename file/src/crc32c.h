@@ -0,0 +1,18 @@
+#pragma once
+
+#include "snfile/snfile.h"
+
+#include <stddef.h>
+
+/**
+ * @brief Update a CRC-32C (Castagnoli) checksum.
+ *
+ * Start with 0, pass the previous result to continue over more data.
+ *
+ * @param crc The checksum so far.
+ * @param data The data.
+ * @param size Size of data.
+ *
+ * @return The updated checksum.
+ */
+uint32_t sn_crc32c(uint32_t crc, const void *data, size_t size);
@@ -0,0 +1,123 @@
+#include "snfile/snfile.h"
+
+#include "src/internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static bool is_dot(const char *name) {
+    return name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2]));
+}
+
+static int compare_u64(uint64_t a, uint64_t b) {
+    return (a > b) - (a < b);
+}
+
+static int compare_name(const void *a, const void *b) {
+    return strcmp(((const SnDirListEntry *)a)->entry.name, ((const SnDirListEntry *)b)->entry.name);
+}
+
+static int compare_inode(const void *a, const void *b) {
+    return compare_u64(((const SnDirListEntry *)a)->entry.inode,
+                       ((const SnDirListEntry *)b)->entry.inode);
+}
+
+// Pairs of (inode, index)
+static int compare_pair(const void *a, const void *b) {
+    return compare_u64(*(const uint64_t *)a, *(const uint64_t *)b);
+}
+
+/**
+ * @brief Stat the entries the listing did not carry info for, in inode order.
+ */
+static void stat_entries(SnDir *dir, SnDirListEntry *entries, uint64_t count, bool sorted) {
+    uint64_t pending = 0;
+    for (uint64_t i = 0; i < count; ++i) pending += !entries[i].has_info;
+    if (!pending) return;
+
+    uint64_t *pairs = NULL;
+    if (!sorted) {
+        pairs = sn_file_alloc(count * 2 * sizeof(uint64_t));
+        if (pairs) {
+            for (uint64_t i = 0; i < count; ++i) {
+                pairs[2 * i] = entries[i].entry.inode;
+                pairs[2 * i + 1] = i;
+            }
+            qsort(pairs, count, 2 * sizeof(uint64_t), compare_pair);
+        }
+    }
+
+    // Without the pairs it is done in listing order, slower but the same result
+    for (uint64_t i = 0; i < count; ++i) {
+        SnDirListEntry *e = &entries[pairs ? pairs[2 * i + 1] : i];
+        if (!e->has_info) e->has_info = sn_dir_stat_at(dir, e->entry.name, &e->info);
+    }
+
+    sn_file_free(pairs, count * 2 * sizeof(uint64_t));
+}
+
+bool sn_dir_read_all(SnDir *dir, SnDirSort sort, int flags, SnDirArena *arena,
+                     SnDirListing *listing) {
+    bool stat = flags & SN_DIR_READ_ALL_FLAG_STAT;
+
+    // Entries grow up from the aligned start, names down from the end
+    uintptr_t start = (uintptr_t)arena->data + arena->used;
+    uintptr_t aligned = (start + alignof(SnDirListEntry) - 1)
+                      & ~(uintptr_t)(alignof(SnDirListEntry) - 1);
+    size_t available = arena->used < arena->size ? arena->size - arena->used : 0;
+    size_t front = aligned - start;
+    size_t back = 0;
+
+    SnDirListEntry *entries = (SnDirListEntry *)aligned;
+    uint64_t count = 0;
+    bool full = front > available;
+
+    SnDirEntry entry;
+    while (sn_dir_read(dir, &entry)) {
+        if (is_dot(entry.name)) continue;
+
+        size_t name_size = strlen(entry.name) + 1;
+        if (full || front + sizeof(SnDirListEntry) + back + name_size > available) {
+            // Keep reading to tell how much it takes
+            full = true;
+            front += sizeof(SnDirListEntry);
+            back += name_size;
+            continue;
+        }
+
+        front += sizeof(SnDirListEntry);
+        back += name_size;
+        char *name = (char *)arena->data + arena->size - back;
+        memcpy(name, entry.name, name_size);
+
+        SnDirListEntry *e = &entries[count++];
+        *e = (SnDirListEntry){.entry = entry};
+        e->entry.name = name;
+        if (stat) e->has_info = sn_dir_entry_info(dir, &e->info);
+    }
+
+    if (full) {
+        arena->required = front + back;
+        return false;
+    }
+
+    *listing = (SnDirListing){.entries = count ? entries : NULL, .count = count};
+    arena->required = 0;
+    if (!count) return true;
+
+    // Close the gap so the rest of the arena stays usable
+    char *names = (char *)arena->data + arena->size - back;
+    char *moved = (char *)(entries + count);
+    memmove(moved, names, back);
+    for (uint64_t i = 0; i < count; ++i)
+        entries[i].entry.name = moved + (entries[i].entry.name - names);
+
+    if (sort == SN_DIR_SORT_NAME) qsort(entries, count, sizeof(SnDirListEntry), compare_name);
+    else if (sort == SN_DIR_SORT_INODE)
+        qsort(entries, count, sizeof(SnDirListEntry), compare_inode);
+
+    if (stat) stat_entries(dir, entries, count, sort == SN_DIR_SORT_INODE);
+
+    arena->used = (size_t)(moved + back - (char *)arena->data);
+    return true;
+}
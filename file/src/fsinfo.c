@@ -0,0 +1,70 @@
+#include "snfile/fsinfo.h"
+
+#include "src/internal.h"
+#include "src/thread.h"
+
+#define FS_PROBE_MIN_CAPACITY 8
+
+// One entry per device seen, there are only ever a few
+static volatile uint32_t probe_lock;
+static SnFsInfo *probes;
+static uint32_t probe_count;
+static uint32_t probe_capacity;
+
+static SnFsInfo *find(uint64_t device) {
+    for (uint32_t i = 0; i < probe_count; ++i)
+        if (probes[i].device == device) return &probes[i];
+    return NULL;
+}
+
+static void remember(const SnFsInfo *info) {
+    if (probe_count == probe_capacity) {
+        uint32_t capacity = probe_capacity ? probe_capacity * 2 : FS_PROBE_MIN_CAPACITY;
+        SnFsInfo *grown = sn_file_realloc(probes, probe_capacity * sizeof(SnFsInfo),
+                                          capacity * sizeof(SnFsInfo));
+        // Not cached, probed again next time
+        if (!grown) return;
+        probes = grown;
+        probe_capacity = capacity;
+    }
+    probes[probe_count++] = *info;
+}
+
+bool sn_fs_probe(const char *path, SnFsInfo *info) {
+    SnFileInfo file_info;
+    if (!sn_file_stat(path, &file_info)) return false;
+
+    sn_spin_lock(&probe_lock);
+    SnFsInfo *cached = find(file_info.device);
+    if (cached) *info = *cached;
+    sn_spin_unlock(&probe_lock);
+    if (cached) return true;
+
+    if (!sn_fs_query(path, info)) return false;
+    info->device = file_info.device;
+
+    sn_spin_lock(&probe_lock);
+    // Another thread may have been first, keep what it has learned since
+    cached = find(file_info.device);
+    if (cached) *info = *cached;
+    else remember(info);
+    sn_spin_unlock(&probe_lock);
+
+    return true;
+}
+
+void sn_fs_probe_reset(void) {
+    sn_spin_lock(&probe_lock);
+    sn_file_free(probes, probe_capacity * sizeof(SnFsInfo));
+    probes = NULL;
+    probe_count = 0;
+    probe_capacity = 0;
+    sn_spin_unlock(&probe_lock);
+}
+
+void sn_fs_demote(uint64_t device, uint32_t features) {
+    sn_spin_lock(&probe_lock);
+    SnFsInfo *cached = find(device);
+    if (cached) cached->features &= ~features;
+    sn_spin_unlock(&probe_lock);
+}
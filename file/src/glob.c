@@ -0,0 +1,571 @@
+#include "snfile/glob.h"
+
+#include "src/internal.h"
+
+#include <string.h>
+
+// Upper limit on the number of alternatives produced by brace expansion
+#define GLOB_MAX_ALTERNATIVES 1024
+
+typedef enum GlobSegmentType {
+    GLOB_SEGMENT_LITERAL,
+    GLOB_SEGMENT_WILDCARD,
+    GLOB_SEGMENT_RECURSIVE,
+    GLOB_SEGMENT_END
+} GlobSegmentType;
+
+typedef struct GlobSegment {
+    GlobSegmentType type;
+    char *text;
+} GlobSegment;
+
+struct SnGlob {
+    // Segments of all alternatives, each alternative terminated by GLOB_SEGMENT_END
+    GlobSegment *segments;
+    uint32_t segment_count;
+    uint32_t segment_capacity;
+
+    // Index of the first segment of every alternative
+    uint32_t *starts;
+    uint32_t start_count;
+    uint32_t start_capacity;
+};
+
+typedef struct GlobList {
+    char **items;
+    size_t count;
+    size_t capacity;
+} GlobList;
+
+static bool is_separator(char c) {
+    return c == '/' || c == '\\';
+}
+
+static char *string_dup(const char *s, size_t len) {
+    char *dup = sn_file_alloc(len + 1);
+    if (!dup) return NULL;
+    memcpy(dup, s, len);
+    dup[len] = 0;
+    return dup;
+}
+
+static void string_free(char *s) {
+    if (s) sn_file_free(s, strlen(s) + 1);
+}
+
+static bool list_push(GlobList *list, char *item) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 8;
+        char **items = sn_file_realloc(list->items, list->capacity * sizeof(char *),
+                                       capacity * sizeof(char *));
+        if (!items) return false;
+        list->items = items;
+        list->capacity = capacity;
+    }
+
+    list->items[list->count++] = item;
+    return true;
+}
+
+static void list_free(GlobList *list) {
+    for (size_t i = 0; i < list->count; ++i) string_free(list->items[i]);
+    sn_file_free(list->items, list->capacity * sizeof(char *));
+}
+
+/**
+ * @brief Expand the first top level brace group of pattern, recursively.
+ */
+static bool expand_braces(const char *pattern, GlobList *out) {
+    const char *open = NULL;
+    const char *close = NULL;
+    int depth = 0;
+    bool has_comma = false;
+
+    for (const char *p = pattern; *p; ++p) {
+        if (*p == '[') {
+            // Skip character classes, braces inside them are literal
+            const char *q = p + 1;
+            if (*q == '!' || *q == '^') ++q;
+            if (*q == ']') ++q;
+            while (*q && *q != ']') ++q;
+            if (*q) p = q;
+        } else if (*p == '{') {
+            if (depth++ == 0) {
+                open = p;
+                has_comma = false;
+            }
+        } else if (*p == '}' && depth > 0) {
+            if (--depth == 0) {
+                if (has_comma) {
+                    close = p;
+                    break;
+                }
+                open = NULL;
+            }
+        } else if (*p == ',' && depth == 1) {
+            has_comma = true;
+        }
+    }
+
+    if (!close) {
+        if (out->count >= GLOB_MAX_ALTERNATIVES) return false;
+        char *dup = string_dup(pattern, strlen(pattern));
+        if (!dup || !list_push(out, dup)) {
+            string_free(dup);
+            return false;
+        }
+        return true;
+    }
+
+    size_t prefix_len = open - pattern;
+    size_t suffix_len = strlen(close + 1);
+
+    const char *option = open + 1;
+    depth = 0;
+    for (const char *p = open + 1; p <= close; ++p) {
+        if (*p == '{') ++depth;
+        else if (*p == '}' && p != close) --depth;
+
+        if ((*p == ',' && depth == 0) || p == close) {
+            size_t option_len = p - option;
+            size_t expanded_size = prefix_len + option_len + suffix_len + 1;
+            char *expanded = sn_file_alloc(expanded_size);
+            if (!expanded) return false;
+
+            memcpy(expanded, pattern, prefix_len);
+            memcpy(expanded + prefix_len, option, option_len);
+            memcpy(expanded + prefix_len + option_len, close + 1, suffix_len + 1);
+
+            bool ok = expand_braces(expanded, out);
+            sn_file_free(expanded, expanded_size);
+            if (!ok) return false;
+
+            option = p + 1;
+        }
+    }
+
+    return true;
+}
+
+static GlobSegmentType classify_segment(const char *text, size_t len) {
+    if (len == 2 && text[0] == '*' && text[1] == '*') return GLOB_SEGMENT_RECURSIVE;
+
+    for (size_t i = 0; i < len; ++i)
+        if (text[i] == '*' || text[i] == '?' || text[i] == '[') return GLOB_SEGMENT_WILDCARD;
+
+    return GLOB_SEGMENT_LITERAL;
+}
+
+static bool push_segment(SnGlob *glob, uint32_t *capacity, GlobSegmentType type, const char *text,
+                         size_t len) {
+    if (glob->segment_count == *capacity) {
+        uint32_t new_capacity = *capacity ? *capacity * 2 : 16;
+        GlobSegment *segments = sn_file_realloc(glob->segments, *capacity * sizeof(GlobSegment),
+                                                new_capacity * sizeof(GlobSegment));
+        if (!segments) return false;
+        glob->segments = segments;
+        *capacity = new_capacity;
+    }
+
+    char *dup = NULL;
+    if (text && !(dup = string_dup(text, len))) return false;
+
+    glob->segments[glob->segment_count++] = (GlobSegment){.type = type, .text = dup};
+    return true;
+}
+
+bool sn_glob_compile(const char *pattern, SnGlob **glob) {
+    GlobList alternatives = {0};
+    if (!expand_braces(pattern, &alternatives)) {
+        list_free(&alternatives);
+        return false;
+    }
+
+    SnGlob *g = sn_file_alloc(sizeof(SnGlob));
+    if (g) *g = (SnGlob){0};
+    if (!g || !(g->starts = sn_file_alloc(alternatives.count * sizeof(uint32_t)))) {
+        sn_file_free(g, sizeof(SnGlob));
+        list_free(&alternatives);
+        return false;
+    }
+
+    uint32_t capacity = 0;
+    bool ok = true;
+    g->start_capacity = (uint32_t)alternatives.count;
+
+    for (size_t i = 0; ok && i < alternatives.count; ++i) {
+        g->starts[g->start_count++] = g->segment_count;
+
+        const char *p = alternatives.items[i];
+        while (ok && *p) {
+            while (is_separator(*p)) ++p;
+            if (!*p) break;
+
+            const char *start = p;
+            while (*p && !is_separator(*p)) ++p;
+
+            GlobSegmentType type = classify_segment(start, p - start);
+
+            // Consecutive `**` segments are equivalent to one
+            if (type == GLOB_SEGMENT_RECURSIVE && g->segment_count > g->starts[i]
+                && g->segments[g->segment_count - 1].type == GLOB_SEGMENT_RECURSIVE)
+                continue;
+
+            ok = push_segment(g, &capacity, type, type == GLOB_SEGMENT_RECURSIVE ? NULL : start,
+                              p - start);
+        }
+
+        if (ok) ok = push_segment(g, &capacity, GLOB_SEGMENT_END, NULL, 0);
+    }
+
+    list_free(&alternatives);
+    g->segment_capacity = capacity;
+
+    if (!ok) {
+        sn_glob_free(g);
+        return false;
+    }
+
+    *glob = g;
+    return true;
+}
+
+void sn_glob_free(SnGlob *glob) {
+    if (!glob) return;
+
+    for (uint32_t i = 0; i < glob->segment_count; ++i) string_free(glob->segments[i].text);
+
+    sn_file_free(glob->segments, glob->segment_capacity * sizeof(GlobSegment));
+    sn_file_free(glob->starts, glob->start_capacity * sizeof(uint32_t));
+    sn_file_free(glob, sizeof(SnGlob));
+}
+
+/**
+ * @brief Match one character against the class starting at pattern.
+ *
+ * @return Returns 1 on match, 0 on mismatch and -1 if class is not terminated.
+ */
+static int match_class(const char *pattern, char c, const char **end) {
+    const char *p = pattern + 1;
+    bool negate = false;
+    bool matched = false;
+
+    if (*p == '!' || *p == '^') {
+        negate = true;
+        ++p;
+    }
+
+    // A `]` right after the opening is a literal
+    bool first = true;
+    while (*p && (first || *p != ']')) {
+        first = false;
+        if (p[1] == '-' && p[2] && p[2] != ']') {
+            if ((unsigned char)c >= (unsigned char)p[0] && (unsigned char)c <= (unsigned char)p[2])
+                matched = true;
+            p += 3;
+        } else {
+            if (*p == c) matched = true;
+            ++p;
+        }
+    }
+
+    if (!*p) return -1;
+
+    *end = p + 1;
+    return matched != negate;
+}
+
+static bool match_segment(const char *pattern, const char *name) {
+    // Hidden names need an explicit leading dot
+    if (name[0] == '.' && pattern[0] != '.') return false;
+
+    const char *p = pattern;
+    const char *n = name;
+    const char *star_p = NULL;
+    const char *star_n = NULL;
+
+    while (*n) {
+        if (*p == '*') {
+            while (*p == '*') ++p;
+            star_p = p;
+            star_n = n;
+            continue;
+        }
+
+        if (*p == '?') {
+            ++p;
+            ++n;
+            continue;
+        }
+
+        if (*p == '[') {
+            const char *end;
+            int res = match_class(p, *n, &end);
+            if (res == 1) {
+                p = end;
+                ++n;
+                continue;
+            }
+            if (res == -1 && *n == '[') {
+                ++p;
+                ++n;
+                continue;
+            }
+        } else if (*p && *p == *n) {
+            ++p;
+            ++n;
+            continue;
+        }
+
+        if (!star_p) return false;
+
+        p = star_p;
+        n = ++star_n;
+    }
+
+    while (*p == '*') ++p;
+    return !*p;
+}
+
+/**
+ * @brief A set of glob states, each state is an index of the next segment to match.
+ */
+typedef struct GlobStates {
+    uint32_t *items;
+    uint32_t count;
+    uint8_t *seen;
+    bool matched;
+} GlobStates;
+
+static size_t states_size(const SnGlob *glob) {
+    return glob->segment_count * (sizeof(uint32_t) + 1);
+}
+
+static void states_free(GlobStates *states, const SnGlob *glob) {
+    sn_file_free(states->items, states_size(glob));
+}
+
+static bool states_init(GlobStates *states, const SnGlob *glob) {
+    void *memory = sn_file_alloc(states_size(glob));
+    if (!memory) return false;
+
+    states->items = memory;
+    states->seen = (uint8_t *)(states->items + glob->segment_count);
+    states->count = 0;
+    states->matched = false;
+    memset(states->seen, 0, glob->segment_count);
+    return true;
+}
+
+static void states_reset(GlobStates *states) {
+    for (uint32_t i = 0; i < states->count; ++i) states->seen[states->items[i]] = 0;
+    states->count = 0;
+    states->matched = false;
+}
+
+static void states_add(GlobStates *states, const SnGlob *glob, uint32_t state) {
+    // `**` may match zero segments, so the following segment is reachable too
+    for (;;) {
+        // END is tracked through matched only, seen is cleared through items
+        if (glob->segments[state].type == GLOB_SEGMENT_END) {
+            states->matched = true;
+            return;
+        }
+
+        if (states->seen[state]) return;
+        states->seen[state] = 1;
+        states->items[states->count++] = state;
+        if (glob->segments[state].type != GLOB_SEGMENT_RECURSIVE) return;
+        ++state;
+    }
+}
+
+static void states_step(const GlobStates *from, GlobStates *to, const SnGlob *glob, const char *name) {
+    states_reset(to);
+
+    for (uint32_t i = 0; i < from->count; ++i) {
+        uint32_t state = from->items[i];
+        const GlobSegment *segment = &glob->segments[state];
+
+        switch (segment->type) {
+            case GLOB_SEGMENT_LITERAL:
+                if (strcmp(segment->text, name) == 0) states_add(to, glob, state + 1);
+                break;
+            case GLOB_SEGMENT_WILDCARD:
+                if (match_segment(segment->text, name)) states_add(to, glob, state + 1);
+                break;
+            case GLOB_SEGMENT_RECURSIVE:
+                if (name[0] != '.') states_add(to, glob, state);
+                break;
+            case GLOB_SEGMENT_END:
+            default:
+                break;
+        }
+    }
+}
+
+static bool states_initial(GlobStates *states, const SnGlob *glob) {
+    if (!states_init(states, glob)) return false;
+    for (uint32_t i = 0; i < glob->start_count; ++i) states_add(states, glob, glob->starts[i]);
+    return true;
+}
+
+bool sn_glob_match(const SnGlob *glob, const char *path) {
+    GlobStates a, b;
+    if (!states_initial(&a, glob)) return false;
+    if (!states_init(&b, glob)) {
+        states_free(&a, glob);
+        return false;
+    }
+
+    GlobStates *current = &a;
+    GlobStates *next = &b;
+    bool matched = current->matched;
+
+    char name[1024];
+    const char *p = path;
+    while (*p) {
+        while (is_separator(*p)) ++p;
+        if (!*p) break;
+
+        size_t len = 0;
+        while (*p && !is_separator(*p)) {
+            if (len < SN_ARRAY_LENGTH(name) - 1) name[len++] = *p;
+            ++p;
+        }
+        name[len] = 0;
+
+        states_step(current, next, glob, name);
+        matched = next->matched;
+
+        GlobStates *tmp = current;
+        current = next;
+        next = tmp;
+
+        if (!current->count) {
+            while (is_separator(*p)) ++p;
+            matched = matched && !*p;
+            break;
+        }
+    }
+
+    states_free(&a, glob);
+    states_free(&b, glob);
+    return matched;
+}
+
+typedef struct GlobWalk {
+    const SnGlob *glob;
+    SnGlobCallback callback;
+    void *user_data;
+    char path[4096];
+    bool stop;
+} GlobWalk;
+
+static bool all_literal(const GlobStates *states, const SnGlob *glob) {
+    for (uint32_t i = 0; i < states->count; ++i)
+        if (glob->segments[states->items[i]].type != GLOB_SEGMENT_LITERAL) return false;
+    return true;
+}
+
+static void walk(GlobWalk *walk_state, size_t path_len, const GlobStates *states);
+
+/**
+ * @brief Handle one child of the directory at path_len, appending name to path.
+ */
+static void visit(GlobWalk *w, size_t path_len, const GlobStates *states, GlobStates *next,
+                  SnDirEntry *entry) {
+    states_step(states, next, w->glob, entry->name);
+    if (!next->matched && !next->count) return;
+
+    size_t name_len = strlen(entry->name);
+    size_t child_len = path_len;
+    if (child_len > 0 && !is_separator(w->path[child_len - 1])) {
+        if (child_len + 1 >= sizeof(w->path)) return;
+        w->path[child_len++] = SN_PATH_SEPARATOR;
+    }
+    if (child_len + name_len >= sizeof(w->path)) return;
+
+    memcpy(w->path + child_len, entry->name, name_len + 1);
+    child_len += name_len;
+
+    // Some filesystems do not report the type in directory entries
+    if (next->count && !entry->is_file && !entry->is_directory && !entry->is_symlink)
+        entry->is_directory = sn_path_is_directory(w->path);
+
+    entry->name = w->path + child_len - name_len;
+
+    if (next->matched && !w->callback(w->path, entry, w->user_data)) w->stop = true;
+    else if (next->count && entry->is_directory) walk(w, child_len, next);
+
+    w->path[path_len] = 0;
+}
+
+static void walk(GlobWalk *w, size_t path_len, const GlobStates *states) {
+    GlobStates next;
+    if (!states_init(&next, w->glob)) return;
+
+    if (all_literal(states, w->glob)) {
+        // Only literal names can match here, check them without listing
+        for (uint32_t i = 0; i < states->count && !w->stop; ++i) {
+            const char *name = w->glob->segments[states->items[i]].text;
+
+            bool duplicate = false;
+            for (uint32_t j = 0; j < i; ++j)
+                if (strcmp(w->glob->segments[states->items[j]].text, name) == 0) duplicate = true;
+            if (duplicate) continue;
+
+            char child[4096];
+            const char *base = path_len ? w->path : "";
+            SnFileInfo info;
+            if (!sn_path_join(child, sizeof(child), base, name) || !sn_file_stat(child, &info))
+                continue;
+
+            SnDirEntry entry = {.name = name,
+                                .is_file = info.is_file,
+                                .is_directory = info.is_directory,
+                                .is_symlink = info.is_symlink};
+            visit(w, path_len, states, &next, &entry);
+        }
+    } else {
+        SnDir dir;
+        if (sn_dir_open(path_len ? w->path : ".", &dir)) {
+            SnDirEntry entry;
+            while (!w->stop && sn_dir_read(&dir, &entry)) {
+                if (strcmp(entry.name, ".") == 0 || strcmp(entry.name, "..") == 0) continue;
+                visit(w, path_len, states, &next, &entry);
+            }
+            sn_dir_close(&dir);
+        }
+    }
+
+    states_free(&next, w->glob);
+}
+
+bool sn_dir_glob(const char *root, const SnGlob *glob, SnGlobCallback callback, void *user_data) {
+    GlobWalk *w = sn_file_alloc(sizeof(GlobWalk));
+    if (!w) return false;
+
+    *w = (GlobWalk){.glob = glob, .callback = callback, .user_data = user_data};
+
+    size_t root_len = root ? strlen(root) : 0;
+    if (root_len >= sizeof(w->path) || (root_len && !sn_path_is_directory(root))) {
+        sn_file_free(w, sizeof(GlobWalk));
+        return false;
+    }
+
+    if (root_len) memcpy(w->path, root, root_len);
+    w->path[root_len] = 0;
+
+    GlobStates states;
+    if (!states_initial(&states, glob)) {
+        sn_file_free(w, sizeof(GlobWalk));
+        return false;
+    }
+
+    if (states.count) walk(w, root_len, &states);
+
+    states_free(&states, glob);
+    sn_file_free(w, sizeof(GlobWalk));
+    return true;
+}
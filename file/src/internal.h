@@ -0,0 +1,198 @@
+#pragma once
+
+#include "snfile/fsinfo.h"
+#include "snfile/realpath.h"
+#include "snfile/snfile.h"
+
+/**
+ * @brief Map the first size bytes of file read only.
+ *
+ * The mapping stays valid after the file is closed.
+ *
+ * @param file The file opened for reading.
+ * @param size Number of bytes to map, must be non zero.
+ *
+ * @return Returns pointer to mapped memory, NULL on failure.
+ */
+void *sn_file_map(SnFile *file, uint64_t size);
+
+/**
+ * @brief Unmap memory mapped with sn_file_map.
+ *
+ * @param data The mapped memory.
+ * @param size The size passed to sn_file_map.
+ */
+void sn_file_unmap(void *data, uint64_t size);
+
+/**
+ * @brief Write all buffers, retrying short writes.
+ *
+ * @param file The file.
+ * @param iov The buffers, modified to track progress.
+ * @param count Number of buffers.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+bool sn_file_write_all(SnFile *file, SnFileIoVec *iov, uint32_t count);
+
+/**
+ * @brief Make written data durable, skipping metadata not needed to read it back.
+ *
+ * @param file The file.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+bool sn_file_sync_data(SnFile *file);
+
+/**
+ * @brief Make created, deleted and renamed entries of a directory durable.
+ *
+ * @param path Path to the directory.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+bool sn_dir_sync(const char *path);
+
+/**
+ * @brief Read exactly size bytes, retrying short reads.
+ *
+ * @param file The file.
+ * @param buffer The buffer to read into.
+ * @param size Number of bytes.
+ *
+ * @return Returns false on failure or end of file, true otherwise.
+ */
+bool sn_file_read_exact(SnFile *file, void *buffer, uint64_t size);
+
+/**
+ * @brief Allocate memory with the allocator hooks.
+ *
+ * @param size Size to allocate.
+ *
+ * @return Returns pointer to memory, NULL on failure.
+ */
+void *sn_file_alloc(size_t size);
+
+/**
+ * @brief Reallocate memory with the allocator hooks.
+ *
+ * @param ptr The memory to reallocate, can be NULL.
+ * @param old_size Size ptr was allocated with.
+ * @param new_size Size to reallocate to.
+ *
+ * @return Returns pointer to memory, NULL on failure (ptr is untouched).
+ */
+void *sn_file_realloc(void *ptr, size_t old_size, size_t new_size);
+
+/**
+ * @brief Free memory with the allocator hooks.
+ *
+ * @param ptr The memory to free, can be NULL.
+ * @param size Size ptr was allocated with.
+ */
+void sn_file_free(void *ptr, size_t size);
+
+/**
+ * @brief Invalidate handles to path in every file cache.
+ *
+ * Called before the library deletes or replaces path.
+ *
+ * @param path The path.
+ */
+void sn_file_cache_notify(const char *path);
+
+/**
+ * @brief Drop blocks of file from every block cache after writing to it.
+ *
+ * @param file The file written to.
+ * @param offset Offset written at, -1 if the write ended at the file position.
+ * @param size Bytes written, UINT64_MAX for the whole file.
+ */
+void sn_block_cache_notify(SnFile *file, int64_t offset, uint64_t size);
+
+/**
+ * @brief Drop every block of the file at path from every block cache.
+ *
+ * Called before the library deletes or replaces path and after it copies to it.
+ *
+ * @param path The path.
+ */
+void sn_block_cache_notify_path(const char *path);
+
+/**
+ * @brief Get the device and inode (volume serial and file index on Windows) of a file.
+ *
+ * @param file The file.
+ * @param device Pointer to write the device to.
+ * @param inode Pointer to write the inode to.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+bool sn_file_identity(SnFile *file, uint64_t *device, uint64_t *inode);
+
+/**
+ * @brief Get info of the entry last read from dir if the listing carries it.
+ *
+ * @param dir The directory.
+ * @param info The info to write to.
+ *
+ * @return Returns true on success, false if it has to be stat-ed (POSIX).
+ */
+bool sn_dir_entry_info(SnDir *dir, SnFileInfo *info);
+
+/**
+ * @brief Stat an entry of dir by name without following links.
+ *
+ * @param dir The directory.
+ * @param name Name of the entry.
+ * @param info The info to write to.
+ *
+ * @return Returns true on success, false otherwise or if unsupported (Windows).
+ */
+bool sn_dir_stat_at(SnDir *dir, const char *name, SnFileInfo *info);
+
+/**
+ * @brief Copy the cached resolution of key to dst.
+ *
+ * @param cache The cache, can be NULL.
+ * @param key The path.
+ * @param key_len Length of key.
+ * @param dst The buffer to write to, can overlap key.
+ * @param dst_size Size of dst.
+ * @param length Pointer to write the length of the resolved path to.
+ *
+ * @return Returns true if found and it fits, false otherwise.
+ */
+bool sn_path_cache_lookup(SnPathCache *cache, const char *key, size_t key_len, char *dst,
+                          size_t dst_size, size_t *length);
+
+/**
+ * @brief Remember the resolution of key.
+ *
+ * @param cache The cache, can be NULL.
+ * @param generation Generation the resolution started in.
+ * @param key The path.
+ * @param key_len Length of key.
+ * @param value The resolved path.
+ * @param value_len Length of value.
+ */
+void sn_path_cache_insert(SnPathCache *cache, uint64_t generation, const char *key,
+                          size_t key_len, const char *value, size_t value_len);
+
+/**
+ * @brief Query the file system of path, everything but the device.
+ *
+ * @param path An existing path.
+ * @param info The info to write to.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+bool sn_fs_query(const char *path, SnFsInfo *info);
+
+/**
+ * @brief Clear features an operation found missing on the file system of device.
+ *
+ * @param device The device.
+ * @param features SnFsFeature bits.
+ */
+void sn_fs_demote(uint64_t device, uint32_t features);
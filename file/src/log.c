@@ -0,0 +1,581 @@
+#include "snfile/log.h"
+
+#include "src/crc32c.h"
+#include "src/internal.h"
+#include "src/thread.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define LOG_MAGIC "SNLOGSEG"
+#define LOG_VERSION 1
+#define LOG_DEFAULT_SEGMENT_SIZE (64ull << 20)
+#define LOG_MIN_SEGMENT_SIZE (64u << 10)
+// Frames start at multiples of this
+#define LOG_ALIGN 8
+// Read size of readers and recovery
+#define LOG_READ_CHUNK (256u << 10)
+// 16 hex digits and ".log"
+#define LOG_NAME_LENGTH 20
+
+/*
+ * Segment i covers positions [i * segment_size, (i + 1) * segment_size) and
+ * starts with a header. Frames follow back to back, a frame never crosses a
+ * segment. Segments are allocated and zero filled, so the first frame with a
+ * zero checksum or one that does not match ends the records of a segment.
+ * Checksums cover the segment index, so stale data can not pass as a record.
+ */
+typedef struct LogHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t segment_size;
+    uint64_t index;
+} LogHeader;
+
+typedef struct LogFrame {
+    uint32_t size;
+    uint32_t crc; // Never 0
+} LogFrame;
+
+// Buffered frame reader over one segment, shared by readers and recovery
+typedef struct LogCursor {
+    SnFile file;
+    bool open;
+    uint64_t index;
+    uint64_t offset;
+
+    char *window;
+    uint64_t window_capacity;
+    uint64_t window_offset;
+    uint64_t window_size;
+    bool error; // Failed to read, as opposed to finding no record
+} LogCursor;
+
+struct SnLog {
+    SnMutex mutex;
+    char *dir;
+    size_t dir_size;
+    uint64_t segment_size;
+
+    SnFile file;
+    bool open;
+    bool failed;
+    uint64_t index;  // Segment appended to
+    uint64_t offset; // Append offset in it
+    uint64_t synced; // Position everything before is durable
+
+    // Scratch for batches
+    LogFrame *frames;
+    SnFileIoVec *iov;
+    uint32_t capacity; // Records
+};
+
+struct SnLogReader {
+    char *dir;
+    size_t dir_size;
+    uint64_t segment_size;
+    LogCursor cursor;
+};
+
+static const char zeros[LOG_ALIGN];
+
+static uint64_t frame_length(uint64_t size) {
+    return (sizeof(LogFrame) + size + LOG_ALIGN - 1) & ~(uint64_t)(LOG_ALIGN - 1);
+}
+
+static uint32_t frame_crc(uint64_t index, uint32_t size, const void *data) {
+    uint32_t crc = sn_crc32c(0, &index, sizeof(index));
+    crc = sn_crc32c(crc, &size, sizeof(size));
+    crc = sn_crc32c(crc, data, size);
+    return crc ? crc : 1;
+}
+
+static char *copy_string(const char *s, size_t *size) {
+    *size = strlen(s) + 1;
+    char *copy = sn_file_alloc(*size);
+    if (copy) memcpy(copy, s, *size);
+    return copy;
+}
+
+static bool segment_path(const char *dir, uint64_t index, char *path, size_t path_size) {
+    int length = snprintf(path, path_size, "%s/%016llx.log", dir, (unsigned long long)index);
+    return length > 0 && (size_t)length < path_size;
+}
+
+static bool parse_segment_name(const char *name, uint64_t *index) {
+    if (strlen(name) != LOG_NAME_LENGTH || strcmp(name + 16, ".log") != 0) return false;
+
+    uint64_t value = 0;
+    for (int i = 0; i < 16; ++i) {
+        char c = name[i];
+        int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+        if (digit < 0) return false;
+        value = value << 4 | (uint64_t)digit;
+    }
+
+    *index = value;
+    return true;
+}
+
+/**
+ * @brief Find the oldest and newest segment.
+ *
+ * @return Returns false if there are none or the directory can not be read.
+ */
+static bool find_segments(const char *dir, uint64_t *first, uint64_t *last) {
+    SnDir d;
+    if (!sn_dir_open(dir, &d)) return false;
+
+    bool found = false;
+    SnDirEntry entry;
+    while (sn_dir_read(&d, &entry)) {
+        uint64_t index;
+        if (!parse_segment_name(entry.name, &index)) continue;
+        if (!found || index < *first) *first = index;
+        if (!found || index > *last) *last = index;
+        found = true;
+    }
+    sn_dir_close(&d);
+
+    return found;
+}
+
+static bool read_header(SnFile *file, uint64_t index, LogHeader *header) {
+    return sn_file_read_at(file, 0, header, sizeof(LogHeader)) == (int64_t)sizeof(LogHeader)
+        && memcmp(header->magic, LOG_MAGIC, sizeof(header->magic)) == 0
+        && header->version == LOG_VERSION && header->index == index
+        && header->segment_size >= LOG_MIN_SEGMENT_SIZE;
+}
+
+/**
+ * @brief Make sure [offset, offset + size) of the segment is in the window.
+ */
+static bool cursor_fill(LogCursor *cursor, uint64_t segment_size, uint64_t offset, uint64_t size) {
+    if (offset >= cursor->window_offset
+        && offset + size <= cursor->window_offset + cursor->window_size)
+        return true;
+
+    uint64_t want = size > LOG_READ_CHUNK ? size : LOG_READ_CHUNK;
+    if (want > segment_size - offset) want = segment_size - offset;
+    if (want < size) return false;
+
+    if (want > cursor->window_capacity) {
+        char *window = sn_file_realloc(cursor->window, cursor->window_capacity, want);
+        if (!window) {
+            cursor->error = true;
+            return false;
+        }
+        cursor->window = window;
+        cursor->window_capacity = want;
+    }
+
+    int64_t got = sn_file_read_at(&cursor->file, offset, cursor->window, want);
+    if (got < 0) cursor->error = true;
+    cursor->window_offset = offset;
+    cursor->window_size = got > 0 ? (uint64_t)got : 0;
+    return cursor->window_size >= size;
+}
+
+/**
+ * @brief Read the frame at the cursor without moving past it.
+ *
+ * @return Returns false if there is no complete record there.
+ */
+static bool cursor_frame(LogCursor *cursor, uint64_t segment_size, SnLogRecord *record) {
+    uint64_t offset = cursor->offset;
+    if (offset + sizeof(LogFrame) > segment_size
+        || !cursor_fill(cursor, segment_size, offset, sizeof(LogFrame)))
+        return false;
+
+    LogFrame frame;
+    memcpy(&frame, cursor->window + (offset - cursor->window_offset), sizeof(LogFrame));
+    if (!frame.crc || frame_length(frame.size) > segment_size - offset
+        || !cursor_fill(cursor, segment_size, offset, sizeof(LogFrame) + frame.size))
+        return false;
+
+    const char *data = cursor->window + (offset - cursor->window_offset) + sizeof(LogFrame);
+    if (frame_crc(cursor->index, frame.size, data) != frame.crc) return false;
+
+    *record = (SnLogRecord){.position = cursor->index * segment_size + offset,
+                            .next = cursor->index * segment_size + offset
+                                  + frame_length(frame.size),
+                            .data = data,
+                            .size = frame.size};
+    return true;
+}
+
+static void cursor_free(LogCursor *cursor) {
+    if (cursor->open) sn_file_close(&cursor->file);
+    sn_file_free(cursor->window, cursor->window_capacity);
+}
+
+/**
+ * @brief Create segment index and make it the one appended to.
+ */
+static bool create_segment(SnLog *log, uint64_t index) {
+    char path[4096];
+    if (!segment_path(log->dir, index, path, sizeof(path))) return false;
+
+    int flags = SN_FILE_OPEN_FLAG_CREATE | SN_FILE_OPEN_FLAG_READ | SN_FILE_OPEN_FLAG_WRITE
+              | SN_FILE_OPEN_FLAG_TRUNCATE | SN_FILE_OPEN_FLAG_BINARY;
+    if (!sn_file_open(path, flags, &log->file)) return false;
+
+    LogHeader header = {.version = LOG_VERSION, .segment_size = log->segment_size, .index = index};
+    memcpy(header.magic, LOG_MAGIC, sizeof(header.magic));
+
+    if (!sn_file_allocate(&log->file, log->segment_size)
+        || sn_file_write_at(&log->file, 0, &header, sizeof(header)) != (int64_t)sizeof(header)
+        || !sn_file_seek(&log->file, sizeof(header), SN_FILE_SEEK_ORIGIN_BEGIN)
+        || !sn_dir_sync(log->dir)) {
+        sn_file_close(&log->file);
+        return false;
+    }
+
+    log->open = true;
+    log->index = index;
+    log->offset = sizeof(header);
+    return true;
+}
+
+/**
+ * @brief Find the end of the records in the open segment and erase what follows.
+ */
+static bool recover(SnLog *log) {
+    LogCursor cursor = {.file = log->file, .index = log->index, .offset = sizeof(LogHeader)};
+
+    SnLogRecord record;
+    while (cursor_frame(&cursor, log->segment_size, &record))
+        cursor.offset = record.next - log->index * log->segment_size;
+
+    // Erasing after a failed read could destroy records
+    if (cursor.error) {
+        sn_file_free(cursor.window, cursor.window_capacity);
+        return false;
+    }
+
+    // A crash can leave parts of later frames behind, erase up to the first zero chunk
+    uint64_t end = cursor.offset;
+    uint64_t dirty = end;
+    for (uint64_t at = end; at < log->segment_size;) {
+        cursor.window_size = 0;
+        uint64_t size = log->segment_size - at < LOG_READ_CHUNK ? log->segment_size - at
+                                                                  : LOG_READ_CHUNK;
+        if (!cursor_fill(&cursor, log->segment_size, at, size)) {
+            if (cursor.error) {
+                sn_file_free(cursor.window, cursor.window_capacity);
+                return false;
+            }
+            break;
+        }
+
+        uint64_t last = size;
+        while (last && !cursor.window[last - 1]) --last;
+        if (!last) break;
+
+        dirty = at + last;
+        at += size;
+    }
+
+    bool ok = true;
+    if (dirty > end) {
+        memset(cursor.window, 0, cursor.window_capacity);
+        for (uint64_t at = end; ok && at < dirty;) {
+            uint64_t size = dirty - at;
+            if (size > cursor.window_capacity) size = cursor.window_capacity;
+            ok = sn_file_write_at(&log->file, at, cursor.window, size) == (int64_t)size;
+            at += size;
+        }
+        ok = ok && sn_file_sync_data(&log->file);
+    }
+    sn_file_free(cursor.window, cursor.window_capacity);
+
+    log->offset = end;
+    return ok && sn_file_seek(&log->file, (int64_t)end, SN_FILE_SEEK_ORIGIN_BEGIN);
+}
+
+/**
+ * @brief Open the newest segment, or create the first one.
+ */
+static uint64_t configured_segment_size(const SnLogConfig *config) {
+    uint64_t size = config->segment_size ? config->segment_size : LOG_DEFAULT_SEGMENT_SIZE;
+    size = size < LOG_MIN_SEGMENT_SIZE ? LOG_MIN_SEGMENT_SIZE : size;
+    return (size + LOG_ALIGN - 1) & ~(uint64_t)(LOG_ALIGN - 1);
+}
+
+static bool open_tail(SnLog *log, const SnLogConfig *config) {
+    uint64_t first, last;
+    if (!find_segments(log->dir, &first, &last)) {
+        log->segment_size = configured_segment_size(config);
+        return create_segment(log, 0);
+    }
+
+    char path[4096];
+    int flags = SN_FILE_OPEN_FLAG_READ | SN_FILE_OPEN_FLAG_WRITE | SN_FILE_OPEN_FLAG_BINARY;
+    if (!segment_path(log->dir, last, path, sizeof(path)) || !sn_file_open(path, flags, &log->file))
+        return false;
+
+    LogHeader header;
+    if (read_header(&log->file, last, &header)) {
+        log->open = true;
+        log->index = last;
+        log->segment_size = header.segment_size;
+        return recover(log);
+    }
+    sn_file_close(&log->file);
+
+    // Crashed while creating it, so it holds no records. Take the size from the one before
+    if (last == first) {
+        log->segment_size = configured_segment_size(config);
+        return create_segment(log, last);
+    }
+
+    SnFile previous;
+    if (!segment_path(log->dir, last - 1, path, sizeof(path))
+        || !sn_file_open(path, SN_FILE_OPEN_FLAG_READ | SN_FILE_OPEN_FLAG_BINARY, &previous))
+        return false;
+    bool ok = read_header(&previous, last - 1, &header);
+    sn_file_close(&previous);
+    if (!ok) return false;
+
+    log->segment_size = header.segment_size;
+    return create_segment(log, last);
+}
+
+bool sn_log_open(const char *dir, const SnLogConfig *config, SnLog **log) {
+    SnLogConfig defaults = {0};
+    if (!config) config = &defaults;
+
+    if (!sn_dir_create(dir, true)) return false;
+
+    SnLog *l = sn_file_alloc(sizeof(SnLog));
+    if (!l) return false;
+    *l = (SnLog){0};
+
+    l->dir = copy_string(dir, &l->dir_size);
+    if (!l->dir) goto fail_dir;
+    if (!sn_mutex_init(&l->mutex)) goto fail_mutex;
+    if (!open_tail(l, config)) goto fail_tail;
+
+    l->synced = l->index * l->segment_size + l->offset;
+    *log = l;
+    return true;
+
+fail_tail:
+    if (l->open) sn_file_close(&l->file);
+    sn_mutex_destroy(&l->mutex);
+fail_mutex:
+    sn_file_free(l->dir, l->dir_size);
+fail_dir:
+    sn_file_free(l, sizeof(SnLog));
+    return false;
+}
+
+void sn_log_close(SnLog *log) {
+    if (log->open) sn_file_close(&log->file);
+    sn_file_free(log->frames, log->capacity * sizeof(LogFrame));
+    sn_file_free(log->iov, log->capacity * 3 * sizeof(SnFileIoVec));
+    sn_mutex_destroy(&log->mutex);
+    sn_file_free(log->dir, log->dir_size);
+    sn_file_free(log, sizeof(SnLog));
+}
+
+static bool reserve(SnLog *log, uint32_t count) {
+    if (count <= log->capacity) return true;
+
+    LogFrame *frames = sn_file_alloc(count * sizeof(LogFrame));
+    SnFileIoVec *iov = sn_file_alloc(count * 3 * sizeof(SnFileIoVec));
+    if (!frames || !iov) {
+        sn_file_free(frames, count * sizeof(LogFrame));
+        sn_file_free(iov, count * 3 * sizeof(SnFileIoVec));
+        return false;
+    }
+
+    sn_file_free(log->frames, log->capacity * sizeof(LogFrame));
+    sn_file_free(log->iov, log->capacity * 3 * sizeof(SnFileIoVec));
+    log->frames = frames;
+    log->iov = iov;
+    log->capacity = count;
+    return true;
+}
+
+/**
+ * @brief Seal the segment appended to and continue in a new one.
+ */
+static bool roll(SnLog *log) {
+    // Sealed segments are always durable, sync only has to care about the last one
+    bool ok = sn_file_sync_data(&log->file);
+    sn_file_close(&log->file);
+    log->open = false;
+    if (!ok) return false;
+
+    log->synced = (log->index + 1) * log->segment_size;
+    return create_segment(log, log->index + 1);
+}
+
+bool sn_log_append(SnLog *log, const SnFileIoVec *records, uint32_t count, uint64_t *position) {
+    uint64_t max = log->segment_size - sizeof(LogHeader) - sizeof(LogFrame);
+    for (uint32_t i = 0; i < count; ++i)
+        if (records[i].size > max || records[i].size > UINT32_MAX) return false;
+
+    sn_mutex_lock(&log->mutex);
+
+    bool ok = !log->failed && reserve(log, count);
+    uint32_t n = 0;
+    for (uint32_t i = 0; ok && i < count; ++i) {
+        uint32_t size = (uint32_t)records[i].size;
+        uint64_t length = frame_length(size);
+
+        if (log->offset + length > log->segment_size) {
+            ok = (!n || sn_file_write_all(&log->file, log->iov, n)) && roll(log);
+            n = 0;
+            if (!ok) break;
+        }
+        if (i == 0 && position) *position = log->index * log->segment_size + log->offset;
+
+        LogFrame *frame = &log->frames[i];
+        *frame = (LogFrame){.size = size, .crc = frame_crc(log->index, size, records[i].data)};
+
+        log->iov[n++] = (SnFileIoVec){.data = frame, .size = sizeof(LogFrame)};
+        if (size) log->iov[n++] = (SnFileIoVec){.data = records[i].data, .size = size};
+        if (length > sizeof(LogFrame) + size)
+            log->iov[n++] = (SnFileIoVec){.data = zeros, .size = length - sizeof(LogFrame) - size};
+
+        log->offset += length;
+    }
+    if (ok && n) ok = sn_file_write_all(&log->file, log->iov, n);
+
+    // Nothing is known about what made it to the file
+    if (!ok) log->failed = true;
+
+    sn_mutex_unlock(&log->mutex);
+    return ok;
+}
+
+bool sn_log_sync(SnLog *log) {
+    sn_mutex_lock(&log->mutex);
+
+    uint64_t end = log->index * log->segment_size + log->offset;
+    bool ok = !log->failed;
+    if (ok && log->synced < end) {
+        ok = sn_file_sync_data(&log->file);
+        if (ok) log->synced = end;
+    }
+
+    sn_mutex_unlock(&log->mutex);
+    return ok;
+}
+
+uint64_t sn_log_end(SnLog *log) {
+    sn_mutex_lock(&log->mutex);
+    uint64_t end = log->index * log->segment_size + log->offset;
+    sn_mutex_unlock(&log->mutex);
+    return end;
+}
+
+bool sn_log_release(SnLog *log, uint64_t position) {
+    sn_mutex_lock(&log->mutex);
+    uint64_t keep = position / log->segment_size;
+    if (keep > log->index) keep = log->index;
+    sn_mutex_unlock(&log->mutex);
+
+    uint64_t first, last;
+    if (!find_segments(log->dir, &first, &last)) return false;
+
+    bool ok = true;
+    char path[4096];
+    for (uint64_t index = first; index < keep; ++index)
+        if (segment_path(log->dir, index, path, sizeof(path)) && sn_path_exists(path))
+            ok = sn_file_delete(path) && ok;
+
+    return sn_dir_sync(log->dir) && ok;
+}
+
+/**
+ * @brief Point the cursor of the reader at the start of segment index.
+ */
+static bool reader_enter(SnLogReader *reader, uint64_t index, uint64_t offset) {
+    char path[4096];
+    SnFile file;
+    if (!segment_path(reader->dir, index, path, sizeof(path))
+        || !sn_file_open(path, SN_FILE_OPEN_FLAG_READ | SN_FILE_OPEN_FLAG_BINARY, &file))
+        return false;
+
+    LogHeader header;
+    if (!read_header(&file, index, &header)
+        || (reader->segment_size && header.segment_size != reader->segment_size)) {
+        sn_file_close(&file);
+        return false;
+    }
+
+    if (reader->cursor.open) sn_file_close(&reader->cursor.file);
+    reader->segment_size = header.segment_size;
+    reader->cursor.file = file;
+    reader->cursor.open = true;
+    reader->cursor.index = index;
+    reader->cursor.offset = offset > sizeof(LogHeader) ? offset : sizeof(LogHeader);
+    reader->cursor.window_size = 0;
+    return true;
+}
+
+bool sn_log_reader_open(const char *dir, uint64_t position, SnLogReader **reader) {
+    uint64_t first, last;
+    if (!find_segments(dir, &first, &last)) return false;
+
+    SnLogReader *r = sn_file_alloc(sizeof(SnLogReader));
+    if (!r) return false;
+    *r = (SnLogReader){0};
+
+    r->dir = copy_string(dir, &r->dir_size);
+    if (!r->dir || !reader_enter(r, first, 0)) {
+        sn_log_reader_close(r);
+        return false;
+    }
+
+    // Released segments before position are skipped over
+    uint64_t index = position / r->segment_size;
+    if (index > first && !reader_enter(r, index, position % r->segment_size)) {
+        sn_log_reader_close(r);
+        return false;
+    }
+    if (index == first) r->cursor.offset = position % r->segment_size;
+    if (r->cursor.offset < sizeof(LogHeader)) r->cursor.offset = sizeof(LogHeader);
+
+    *reader = r;
+    return true;
+}
+
+void sn_log_reader_close(SnLogReader *reader) {
+    cursor_free(&reader->cursor);
+    sn_file_free(reader->dir, reader->dir_size);
+    sn_file_free(reader, sizeof(SnLogReader));
+}
+
+bool sn_log_reader_next(SnLogReader *reader, SnLogRecord *record) {
+    LogCursor *cursor = &reader->cursor;
+
+    for (;;) {
+        if (cursor_frame(cursor, reader->segment_size, record)) {
+            cursor->offset = record->next - cursor->index * reader->segment_size;
+            return true;
+        }
+
+        // Not there yet, read again next time
+        cursor->window_size = 0;
+
+        // The appender only moves on once a segment is full, so once the next
+        // one exists this one is final. Look once more for a record that
+        // landed in between
+        char path[4096];
+        if (!segment_path(reader->dir, cursor->index + 1, path, sizeof(path))
+            || !sn_path_exists(path))
+            return false;
+        if (cursor_frame(cursor, reader->segment_size, record)) {
+            cursor->offset = record->next - cursor->index * reader->segment_size;
+            return true;
+        }
+        cursor->window_size = 0;
+
+        if (!reader_enter(reader, cursor->index + 1, 0)) return false;
+    }
+}
@@ -0,0 +1,174 @@
+#include "src/lz.h"
+
+#include <string.h>
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_MAX_DISTANCE 65535
+
+// Format constraints, the last literals and the last match start
+#define LZ_LAST_LITERALS 5
+#define LZ_MF_LIMIT 12
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t hash32(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+ * @brief Write a length continuation, the part not fitting in the token.
+ */
+static uint8_t *write_length(uint8_t *op, size_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+/**
+ * @brief Write literals and an optional match.
+ *
+ * @return Returns the new output position, NULL if it does not fit.
+ */
+static uint8_t *write_sequence(uint8_t *op, const uint8_t *oend, const uint8_t *literals,
+                               size_t literal_length, size_t offset, size_t match_length) {
+    // Token, length bytes, literals and offset
+    size_t worst = 1 + literal_length / 255 + 1 + literal_length + 2 + match_length / 255 + 1;
+    if (worst > (size_t)(oend - op)) return NULL;
+
+    uint8_t *token = op++;
+    *token = (uint8_t)((literal_length < 15 ? literal_length : 15) << 4);
+    if (literal_length >= 15) op = write_length(op, literal_length - 15);
+
+    memcpy(op, literals, literal_length);
+    op += literal_length;
+
+    if (!match_length) return op;
+
+    *op++ = (uint8_t)offset;
+    *op++ = (uint8_t)(offset >> 8);
+
+    size_t code = match_length - LZ_MIN_MATCH;
+    *token |= (uint8_t)(code < 15 ? code : 15);
+    if (code >= 15) op = write_length(op, code - 15);
+
+    return op;
+}
+
+size_t sn_lz_compress(const void *src, size_t size, void *dst, size_t capacity) {
+    const uint8_t *base = src;
+    const uint8_t *ip = base;
+    const uint8_t *anchor = base;
+    const uint8_t *end = base + size;
+
+    uint8_t *op = dst;
+    const uint8_t *oend = op + capacity;
+
+    if (size > LZ_MF_LIMIT) {
+        uint32_t table[1 << LZ_HASH_BITS] = {0};
+
+        const uint8_t *mflimit = end - LZ_MF_LIMIT;
+        const uint8_t *match_limit = end - LZ_LAST_LITERALS;
+
+        while (ip < mflimit) {
+            uint32_t sequence = read32(ip);
+            uint32_t h = hash32(sequence);
+            const uint8_t *ref = base + table[h];
+            table[h] = (uint32_t)(ip - base);
+
+            if (ref >= ip || ip - ref > LZ_MAX_DISTANCE || read32(ref) != sequence) {
+                // Step faster through data which does not match
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                --ip;
+                --ref;
+            }
+
+            const uint8_t *match_end = ip + LZ_MIN_MATCH;
+            const uint8_t *r = ref + LZ_MIN_MATCH;
+            while (match_end < match_limit && *match_end == *r) {
+                ++match_end;
+                ++r;
+            }
+
+            op = write_sequence(op, oend, anchor, ip - anchor, ip - ref, match_end - ip);
+            if (!op) return 0;
+
+            ip = anchor = match_end;
+        }
+    }
+
+    op = write_sequence(op, oend, anchor, end - anchor, 0, 0);
+    if (!op) return 0;
+
+    return op - (uint8_t *)dst;
+}
+
+/**
+ * @brief Read a length continuation.
+ *
+ * @return Returns false if input ends.
+ */
+static bool read_length(const uint8_t **ip, const uint8_t *iend, size_t *length) {
+    uint8_t byte;
+    do {
+        if (*ip >= iend) return false;
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+bool sn_lz_decompress(const void *src, size_t size, void *dst, size_t dst_size) {
+    const uint8_t *ip = src;
+    const uint8_t *iend = ip + size;
+
+    uint8_t *op = dst;
+    uint8_t *oend = op + dst_size;
+
+    for (;;) {
+        if (ip >= iend) return false;
+        uint8_t token = *ip++;
+
+        size_t literal_length = token >> 4;
+        if (literal_length == 15 && !read_length(&ip, iend, &literal_length)) return false;
+        if (literal_length > (size_t)(iend - ip) || literal_length > (size_t)(oend - op))
+            return false;
+
+        memcpy(op, ip, literal_length);
+        op += literal_length;
+        ip += literal_length;
+
+        // The last sequence has literals only
+        if (ip == iend) return op == oend;
+
+        if (iend - ip < 2) return false;
+        size_t offset = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        if (!offset || offset > (size_t)(op - (uint8_t *)dst)) return false;
+
+        size_t match_length = token & 15;
+        if (match_length == 15 && !read_length(&ip, iend, &match_length)) return false;
+        match_length += LZ_MIN_MATCH;
+        if (match_length > (size_t)(oend - op)) return false;
+
+        const uint8_t *ref = op - offset;
+        if (offset >= match_length) {
+            memcpy(op, ref, match_length);
+            op += match_length;
+        } else {
+            // Overlapping copy repeats the last offset bytes
+            for (size_t i = 0; i < match_length; ++i) *op++ = *ref++;
+        }
+    }
+}
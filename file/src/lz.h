@@ -0,0 +1,36 @@
+#pragma once
+
+#include "snfile/snfile.h"
+
+#include <stddef.h>
+
+/*
+ * Byte oriented LZ77 codec using the LZ4 block format: sequences of a token,
+ * literals, a 16 bit match offset and match length. Fast rather than dense.
+ */
+
+/**
+ * @brief Compress a block.
+ *
+ * @param src The data.
+ * @param size Size of data.
+ * @param dst The buffer to write to.
+ * @param capacity Size of dst.
+ *
+ * @return Returns the compressed size, 0 if it does not fit in capacity.
+ */
+size_t sn_lz_compress(const void *src, size_t size, void *dst, size_t capacity);
+
+/**
+ * @brief Decompress a block.
+ *
+ * Malformed input is detected and never read or written out of bounds.
+ *
+ * @param src The compressed data.
+ * @param size Size of compressed data.
+ * @param dst The buffer to write to.
+ * @param dst_size Exact decompressed size.
+ *
+ * @return Returns true on success, false if input is malformed.
+ */
+bool sn_lz_decompress(const void *src, size_t size, void *dst, size_t dst_size);
@@ -0,0 +1,44 @@
+#include "snfile/snfile.h"
+
+#include "src/internal.h"
+
+#include <stdlib.h>
+
+static void *default_alloc(size_t size, void *user_data) {
+    SN_UNUSED(user_data);
+    return malloc(size);
+}
+
+static void *default_realloc(void *ptr, size_t old_size, size_t new_size, void *user_data) {
+    SN_UNUSED(old_size);
+    SN_UNUSED(user_data);
+    return realloc(ptr, new_size);
+}
+
+static void default_free(void *ptr, size_t size, void *user_data) {
+    SN_UNUSED(size);
+    SN_UNUSED(user_data);
+    free(ptr);
+}
+
+static SnFileAllocator allocator = {
+    .alloc = default_alloc, .realloc = default_realloc, .free = default_free};
+
+void sn_file_set_allocator(const SnFileAllocator *hooks) {
+    if (hooks) allocator = *hooks;
+    else allocator = (SnFileAllocator){
+        .alloc = default_alloc, .realloc = default_realloc, .free = default_free};
+}
+
+void *sn_file_alloc(size_t size) {
+    return allocator.alloc(size, allocator.user_data);
+}
+
+void *sn_file_realloc(void *ptr, size_t old_size, size_t new_size) {
+    if (!ptr) return allocator.alloc(new_size, allocator.user_data);
+    return allocator.realloc(ptr, old_size, new_size, allocator.user_data);
+}
+
+void sn_file_free(void *ptr, size_t size) {
+    if (ptr) allocator.free(ptr, size, allocator.user_data);
+}
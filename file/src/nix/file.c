@@ -1,15 +1,34 @@
 #define _GNU_SOURCE
 #include "snfile/snfile.h"
 
+#include "src/internal.h"
+#include "src/trace.h"
+
 #if defined(SN_OS_LINUX) || defined(SN_OS_MAC)
 
     #include <dirent.h>
     #include <errno.h>
     #include <fcntl.h>
     #include <stdio.h>
+    #include <stdlib.h>
+    #include <string.h>
+    #include <sys/mman.h>
     #include <sys/stat.h>
+    #include <sys/uio.h>
     #include <unistd.h>
 
+    #if defined(SN_OS_LINUX)
+        #include <sys/ioctl.h>
+        #include <sys/vfs.h>
+
+        #if !defined(FICLONE)
+            #define FICLONE _IOW(0x94, 9, int)
+        #endif
+    #else
+        #include <sys/mount.h>
+        #include <sys/param.h>
+    #endif
+
 typedef struct SnFilePosix {
     int fd;
 } SnFilePosix;
@@ -22,42 +41,137 @@ typedef struct SnDirPosix {
 
     #define DIRECTORY(dir) (((SnDirPosix *)(dir))->dir)
 
+    #if defined(SN_OS_MAC)
+        #define MTIME_NS(st) ((uint64_t)(st).st_mtimespec.tv_sec * 1000000000ull + (st).st_mtimespec.tv_nsec)
+    #else
+        #define MTIME_NS(st) ((uint64_t)(st).st_mtim.tv_sec * 1000000000ull + (st).st_mtim.tv_nsec)
+    #endif
+
 SN_STATIC_ASSERT(sizeof(SnFilePosix) <= sizeof(SnFile), "SnFile size is not large enough!");
 SN_STATIC_ASSERT(sizeof(SnDirPosix) <= sizeof(SnDir), "SnDir size is not large enough!");
 
 bool sn_file_open(const char *path, int flags, SnFile *file) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_OPEN);
     int open_flags = 0;
 
-    if (flags & SN_FILE_OPEN_FLAG_READ) open_flags |= O_RDONLY;
-    if (flags & SN_FILE_OPEN_FLAG_WRITE) open_flags |= O_WRONLY;
     if ((flags & (SN_FILE_OPEN_FLAG_READ | SN_FILE_OPEN_FLAG_WRITE)) == (SN_FILE_OPEN_FLAG_READ | SN_FILE_OPEN_FLAG_WRITE))
         open_flags |= O_RDWR;
+    else if (flags & SN_FILE_OPEN_FLAG_WRITE) open_flags |= O_WRONLY;
+    else open_flags |= O_RDONLY;
 
     if (flags & SN_FILE_OPEN_FLAG_CREATE) open_flags |= O_CREAT;
     if (flags & SN_FILE_OPEN_FLAG_TRUNCATE) open_flags |= O_TRUNC;
     if (flags & SN_FILE_OPEN_FLAG_APPEND) open_flags |= O_APPEND;
 
     FD(file) = open(path, open_flags, 0644);
+    SN_TRACE_END(SN_TRACE_OP_OPEN, FD(file), path, 0, FD(file) >= 0);
     if (FD(file) < 0) return false;
 
+    if (flags & SN_FILE_OPEN_FLAG_TRUNCATE) sn_block_cache_notify(file, 0, UINT64_MAX);
     return true;
 }
 
 void sn_file_close(SnFile *file) {
-    int res = close(FD(file));
+    SN_TRACE_BEGIN(SN_TRACE_OP_CLOSE);
+    int fd = FD(file);
+    int res = close(fd);
+    SN_TRACE_END(SN_TRACE_OP_CLOSE, fd, NULL, 0, res == 0);
     SN_ASSERT(res == 0);
     FD(file) = -1;
 }
 
 int64_t sn_file_read(SnFile *file, void *buffer, uint64_t size) {
-    return (int64_t)read(FD(file), buffer, size);
+    SN_TRACE_BEGIN(SN_TRACE_OP_READ);
+    int64_t got = (int64_t)read(FD(file), buffer, size);
+    SN_TRACE_END(SN_TRACE_OP_READ, FD(file), NULL, size, got);
+    return got;
 }
 
 int64_t sn_file_write(SnFile *file, const void *buffer, uint64_t size) {
-    return (int64_t)write(FD(file), buffer, size);
+    SN_TRACE_BEGIN(SN_TRACE_OP_WRITE);
+    int64_t put = (int64_t)write(FD(file), buffer, size);
+    SN_TRACE_END(SN_TRACE_OP_WRITE, FD(file), NULL, size, put);
+    if (put > 0) sn_block_cache_notify(file, -1, (uint64_t)put);
+    return put;
+}
+
+static int64_t read_at(int fd, uint64_t offset, char *p, uint64_t size) {
+    uint64_t total = 0;
+    while (total < size) {
+        ssize_t got = pread(fd, p + total, size - total, (off_t)(offset + total));
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) return total ? (int64_t)total : -1;
+        if (got == 0) break;
+        total += got;
+    }
+    return (int64_t)total;
+}
+
+int64_t sn_file_read_at(SnFile *file, uint64_t offset, void *buffer, uint64_t size) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_READ_AT);
+    int64_t got = read_at(FD(file), offset, buffer, size);
+    SN_TRACE_END(SN_TRACE_OP_READ_AT, FD(file), NULL, size, got);
+    return got;
+}
+
+static int64_t write_at(int fd, uint64_t offset, const char *p, uint64_t size) {
+    uint64_t total = 0;
+    while (total < size) {
+        ssize_t put = pwrite(fd, p + total, size - total, (off_t)(offset + total));
+        if (put < 0 && errno == EINTR) continue;
+        if (put <= 0) return total ? (int64_t)total : -1;
+        total += put;
+    }
+    return (int64_t)total;
+}
+
+int64_t sn_file_write_at(SnFile *file, uint64_t offset, const void *buffer, uint64_t size) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_WRITE_AT);
+    int64_t put = write_at(FD(file), offset, buffer, size);
+    SN_TRACE_END(SN_TRACE_OP_WRITE_AT, FD(file), NULL, size, put);
+    if (put > 0) sn_block_cache_notify(file, (int64_t)offset, (uint64_t)put);
+    return put;
+}
+
+static int64_t write_vectors(int fd, const SnFileIoVec *iov, uint32_t count) {
+    struct iovec vec[64];
+    int64_t total = 0;
+
+    while (count) {
+        int n = count < SN_ARRAY_LENGTH(vec) ? (int)count : (int)SN_ARRAY_LENGTH(vec);
+        size_t expected = 0;
+        for (int i = 0; i < n; ++i) {
+            vec[i] = (struct iovec){.iov_base = (void *)iov[i].data, .iov_len = iov[i].size};
+            expected += iov[i].size;
+        }
+
+        ssize_t written = writev(fd, vec, n);
+        if (written < 0) return total ? total : -1;
+
+        total += written;
+        if ((size_t)written != expected) return total;
+
+        iov += n;
+        count -= n;
+    }
+
+    return total;
+}
+
+int64_t sn_file_writev(SnFile *file, const SnFileIoVec *iov, uint32_t count) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_WRITEV);
+    int64_t put = write_vectors(FD(file), iov, count);
+
+    uint64_t size = 0;
+    for (uint32_t i = 0; i < count; ++i) size += iov[i].size;
+    SN_TRACE_END(SN_TRACE_OP_WRITEV, FD(file), NULL, size, put);
+    if (put > 0) sn_block_cache_notify(file, -1, (uint64_t)put);
+
+    return put;
 }
 
 bool sn_file_seek(SnFile *file, int64_t offset, SnFileSeekOrigin origin) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_SEEK);
     int whence = 0;
     switch (origin) {
         case SN_FILE_SEEK_ORIGIN_BEGIN:
@@ -72,35 +186,214 @@ bool sn_file_seek(SnFile *file, int64_t offset, SnFileSeekOrigin origin) {
             break;
     }
 
-    return lseek(FD(file), offset, whence) >= 0;
+    bool ok = lseek(FD(file), offset, whence) >= 0;
+    SN_TRACE_END(SN_TRACE_OP_SEEK, FD(file), NULL, 0, ok);
+    return ok;
 }
 
 uint64_t sn_file_tell(SnFile *file) {
-    return (uint64_t)lseek(FD(file), 0, SEEK_CUR);
+    SN_TRACE_BEGIN(SN_TRACE_OP_TELL);
+    off_t position = lseek(FD(file), 0, SEEK_CUR);
+    SN_TRACE_END(SN_TRACE_OP_TELL, FD(file), NULL, 0, position);
+    return (uint64_t)position;
 }
 
 bool sn_file_flush(SnFile *file) {
-    return fsync(FD(file)) == 0;
+    SN_TRACE_BEGIN(SN_TRACE_OP_FLUSH);
+    bool ok = fsync(FD(file)) == 0;
+    SN_TRACE_END(SN_TRACE_OP_FLUSH, FD(file), NULL, 0, ok);
+    return ok;
 }
 
 uint64_t sn_file_size(SnFile *file) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_SIZE);
+    struct stat st;
+    uint64_t size = fstat(FD(file), &st) == 0 ? (uint64_t)st.st_size : 0;
+    SN_TRACE_END(SN_TRACE_OP_SIZE, FD(file), NULL, 0, size);
+    return size;
+}
+
+static bool next_extent(SnFile *file, uint64_t offset, SnFileExtent *extent) {
+    struct stat st;
+    if (fstat(FD(file), &st) != 0 || offset >= (uint64_t)st.st_size) return false;
+
+    uint64_t start = offset;
+    uint64_t end = st.st_size;
+
+    #if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    off_t position = lseek(FD(file), 0, SEEK_CUR);
+
+    off_t data = lseek(FD(file), offset, SEEK_DATA);
+    if (data < 0 && errno == ENXIO) {
+        // Only a hole till the end
+        lseek(FD(file), position, SEEK_SET);
+        return false;
+    }
+
+    // Filesystems without support report EINVAL, treat the rest as data
+    if (data >= 0) {
+        start = data;
+        off_t hole = lseek(FD(file), data, SEEK_HOLE);
+        if (hole > data && (uint64_t)hole < end) end = hole;
+    }
+
+    lseek(FD(file), position, SEEK_SET);
+    #endif
+
+    if (start >= end) return false;
+
+    *extent = (SnFileExtent){.offset = start, .length = end - start};
+    return true;
+}
+
+bool sn_file_next_extent(SnFile *file, uint64_t offset, SnFileExtent *extent) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_NEXT_EXTENT);
+    bool ok = next_extent(file, offset, extent);
+    SN_TRACE_END(SN_TRACE_OP_NEXT_EXTENT, FD(file), NULL, 0, ok);
+    return ok;
+}
+
+static bool punch_hole(SnFile *file, uint64_t offset, uint64_t length) {
+    #if defined(SN_OS_LINUX) && defined(FALLOC_FL_PUNCH_HOLE)
+    return fallocate(FD(file), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length) == 0;
+    #elif defined(F_PUNCHHOLE)
+    struct fpunchhole hole = {.fp_offset = offset, .fp_length = length};
+    return fcntl(FD(file), F_PUNCHHOLE, &hole) == 0;
+    #else
+    SN_UNUSED(file);
+    SN_UNUSED(offset);
+    SN_UNUSED(length);
+    return false;
+    #endif
+}
+
+bool sn_file_punch_hole(SnFile *file, uint64_t offset, uint64_t length) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_PUNCH_HOLE);
+    bool ok = punch_hole(file, offset, length);
+    SN_TRACE_END(SN_TRACE_OP_PUNCH_HOLE, FD(file), NULL, length, ok);
+    if (ok) sn_block_cache_notify(file, (int64_t)offset, length);
+    return ok;
+}
+
+static bool grow(SnFile *file, uint64_t size) {
+    struct stat st;
+    if (fstat(FD(file), &st) != 0) return false;
+    if ((uint64_t)st.st_size >= size) return true;
+
+    #if defined(SN_OS_LINUX)
+    if (fallocate(FD(file), 0, 0, size) == 0) return true;
+    if (errno != EOPNOTSUPP) return false;
+    #elif defined(F_PREALLOCATE)
+    // Failing to allocate still leaves a usable file
+    fstore_t store = {.fst_flags = F_ALLOCATEALL,
+                      .fst_posmode = F_PEOFPOSMODE,
+                      .fst_length = size - st.st_size};
+    fcntl(FD(file), F_PREALLOCATE, &store);
+    #endif
+
+    return ftruncate(FD(file), size) == 0;
+}
+
+bool sn_file_allocate(SnFile *file, uint64_t size) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_ALLOCATE);
+    bool ok = grow(file, size);
+    SN_TRACE_END(SN_TRACE_OP_ALLOCATE, FD(file), NULL, size, ok);
+    // A last block cached short is not the last one anymore
+    if (ok) sn_block_cache_notify(file, 0, UINT64_MAX);
+    return ok;
+}
+
+bool sn_file_identity(SnFile *file, uint64_t *device, uint64_t *inode) {
     struct stat st;
-    if (fstat(FD(file), &st) != 0) return 0;
-    return st.st_size;
+    if (fstat(FD(file), &st) != 0) return false;
+    *device = st.st_dev;
+    *inode = st.st_ino;
+    return true;
+}
+
+bool sn_file_sync_data(SnFile *file) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_SYNC_DATA);
+    #if defined(SN_OS_LINUX)
+    bool ok = fdatasync(FD(file)) == 0;
+    #else
+    bool ok = fsync(FD(file)) == 0;
+    #endif
+    SN_TRACE_END(SN_TRACE_OP_SYNC_DATA, FD(file), NULL, 0, ok);
+    return ok;
+}
+
+bool sn_dir_sync(const char *path) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_DIR_SYNC);
+    int fd = open(path, O_RDONLY | O_DIRECTORY);
+    bool ok = fd >= 0 && fsync(fd) == 0;
+    if (fd >= 0) close(fd);
+    SN_TRACE_END(SN_TRACE_OP_DIR_SYNC, -1, path, 0, ok);
+    return ok;
+}
+
+static bool lock_range(SnFile *file, uint64_t offset, uint64_t length, short type, bool wait) {
+    // off_t is signed, ranges reaching past INT64_MAX extend to the end like on Windows
+    if (offset > INT64_MAX) offset = INT64_MAX;
+    if (length > INT64_MAX - offset) length = 0;
+
+    // OFD locks need l_pid to be 0
+    struct flock lock = {.l_type = type,
+                         .l_whence = SEEK_SET,
+                         .l_start = (off_t)offset,
+                         .l_len = (off_t)length};
+
+    #if defined(F_OFD_SETLK)
+    int cmd = wait ? F_OFD_SETLKW : F_OFD_SETLK;
+    #else
+    int cmd = wait ? F_SETLKW : F_SETLK;
+    #endif
+
+    int res;
+    while ((res = fcntl(FD(file), cmd, &lock)) != 0 && errno == EINTR);
+    return res == 0;
+}
+
+bool sn_file_lock(SnFile *file, uint64_t offset, uint64_t length, SnFileLockType type) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_LOCK);
+    bool ok =
+        lock_range(file, offset, length, type == SN_FILE_LOCK_EXCLUSIVE ? F_WRLCK : F_RDLCK, true);
+    SN_TRACE_END(SN_TRACE_OP_LOCK, FD(file), NULL, length, ok);
+    return ok;
+}
+
+bool sn_file_try_lock(SnFile *file, uint64_t offset, uint64_t length, SnFileLockType type) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_TRY_LOCK);
+    bool ok =
+        lock_range(file, offset, length, type == SN_FILE_LOCK_EXCLUSIVE ? F_WRLCK : F_RDLCK, false);
+    SN_TRACE_END(SN_TRACE_OP_TRY_LOCK, FD(file), NULL, length, ok);
+    return ok;
+}
+
+bool sn_file_unlock(SnFile *file, uint64_t offset, uint64_t length) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_UNLOCK);
+    bool ok = lock_range(file, offset, length, F_UNLCK, false);
+    SN_TRACE_END(SN_TRACE_OP_UNLOCK, FD(file), NULL, length, ok);
+    return ok;
 }
 
 bool sn_dir_open(const char *path, SnDir *dir) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_DIR_OPEN);
     DIRECTORY(dir) = opendir(path);
-    if (!DIRECTORY(dir)) return false;
-    return true;
+    int fd = DIRECTORY(dir) ? dirfd(DIRECTORY(dir)) : -1;
+    SN_TRACE_END(SN_TRACE_OP_DIR_OPEN, fd, path, 0, fd >= 0);
+    return DIRECTORY(dir) != NULL;
 }
 
 bool sn_dir_read(SnDir *dir, SnDirEntry *entry) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_DIR_READ);
     struct dirent *dirent = readdir(DIRECTORY(dir));
+    SN_TRACE_END(SN_TRACE_OP_DIR_READ, dirfd(DIRECTORY(dir)), dirent ? dirent->d_name : NULL, 0,
+                 dirent != NULL);
 
     if (!dirent) return false;
 
     *entry = (SnDirEntry){.name = dirent->d_name,
+                          .inode = dirent->d_ino,
                           .is_file = dirent->d_type == DT_REG,
                           .is_directory = dirent->d_type == DT_DIR,
                           .is_symlink = dirent->d_type == DT_LNK};
@@ -109,7 +402,10 @@ bool sn_dir_read(SnDir *dir, SnDirEntry *entry) {
 }
 
 void sn_dir_close(SnDir *dir) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_DIR_CLOSE);
+    int fd = dirfd(DIRECTORY(dir));
     int res = closedir(DIRECTORY(dir));
+    SN_TRACE_END(SN_TRACE_OP_DIR_CLOSE, fd, NULL, 0, res == 0);
     SN_ASSERT(res == 0);
 }
 
@@ -130,10 +426,17 @@ bool sn_path_is_directory(const char *path) {
 }
 
 bool sn_file_delete(const char *path) {
-    return unlink(path) == 0;
+    SN_TRACE_BEGIN(SN_TRACE_OP_DELETE);
+    sn_file_cache_notify(path);
+    sn_block_cache_notify_path(path);
+    bool ok = unlink(path) == 0;
+    // Again for handles opened by misses that raced with the unlink
+    if (ok) sn_file_cache_notify(path);
+    SN_TRACE_END(SN_TRACE_OP_DELETE, -1, path, 0, ok);
+    return ok;
 }
 
-bool sn_dir_create(const char *path, bool recursive) {
+static bool create_directories(const char *path, bool recursive) {
     if (!recursive) return mkdir(path, 0755) == 0 || errno == EEXIST;
 
     // Hopefully large enough buffer
@@ -151,51 +454,507 @@ bool sn_dir_create(const char *path, bool recursive) {
     return mkdir(buffer, 0755) == 0 || errno == EEXIST;
 }
 
+bool sn_dir_create(const char *path, bool recursive) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_DIR_CREATE);
+    bool ok = create_directories(path, recursive);
+    SN_TRACE_END(SN_TRACE_OP_DIR_CREATE, -1, path, 0, ok);
+    return ok;
+}
+
 bool sn_dir_delete(const char *path) {
-    return rmdir(path) == 0;
+    SN_TRACE_BEGIN(SN_TRACE_OP_DIR_DELETE);
+    bool ok = rmdir(path) == 0;
+    SN_TRACE_END(SN_TRACE_OP_DIR_DELETE, -1, path, 0, ok);
+    return ok;
 }
 
-bool sn_file_copy(const char *src, const char *dst, bool overwrite) {
+static bool copy_range(int src, int dst, uint64_t offset, uint64_t length, char *buffer,
+                       size_t buffer_size) {
+    while (length) {
+        size_t chunk = length < buffer_size ? length : buffer_size;
+        ssize_t got = pread(src, buffer, chunk, offset);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return got == 0;
+
+        for (ssize_t done = 0; done < got;) {
+            ssize_t put = pwrite(dst, buffer + done, got - done, offset + done);
+            if (put < 0 && errno == EINTR) continue;
+            if (put <= 0) return false;
+            done += put;
+        }
+
+        offset += got;
+        length -= got;
+    }
+
+    return true;
+}
+
+    #if defined(SN_OS_LINUX)
+/**
+ * @brief Copy with copy_file_range, stopping early if the file system can not.
+ *
+ * @return Returns the bytes copied, -1 on failure.
+ */
+static int64_t kernel_copy(int src, int dst, uint64_t offset, uint64_t length, bool *unsupported) {
+    uint64_t done = 0;
+    while (done < length) {
+        loff_t in = offset + done, out = offset + done;
+        ssize_t copied = copy_file_range(src, &in, dst, &out, length - done, 0);
+        if (copied < 0 && errno == EINTR) continue;
+        if (copied < 0) {
+            *unsupported = errno == ENOSYS || errno == EOPNOTSUPP || errno == EXDEV
+                        || errno == EINVAL;
+            return *unsupported ? (int64_t)done : -1;
+        }
+        if (copied == 0) break; // Source got shorter
+        done += copied;
+    }
+    return done;
+}
+    #endif
+
+static bool copy_file(const char *src, const char *dst, bool overwrite) {
     if (!overwrite && sn_path_exists(dst)) return false;
 
     SnFile srcf, dstf;
 
     if (!sn_file_open(src, SN_FILE_OPEN_FLAG_READ, &srcf)) return false;
 
-    int flags = SN_FILE_OPEN_FLAG_CREATE | SN_FILE_OPEN_FLAG_WRITE;
-    if (!sn_file_open(dst, flags, &dstf)) return false;
+    int flags = SN_FILE_OPEN_FLAG_CREATE | SN_FILE_OPEN_FLAG_WRITE | SN_FILE_OPEN_FLAG_TRUNCATE;
+    if (!sn_file_open(dst, flags, &dstf)) {
+        sn_file_close(&srcf);
+        return false;
+    }
+
+    uint64_t size = sn_file_size(&srcf);
+    bool ok = true;
+
+    #if defined(SN_OS_LINUX)
+    // Clones and kernel copies only work within one file system
+    SnFsInfo fs;
+    struct stat st;
+    bool same_fs = fstat(FD(&srcf), &st) == 0 && sn_fs_probe(dst, &fs) && fs.device == st.st_dev;
+
+    if (same_fs && (fs.features & SN_FS_FEATURE_REFLINK)) {
+        if (ioctl(FD(&dstf), FICLONE, FD(&srcf)) == 0) goto done;
+        if (errno == EOPNOTSUPP || errno == ENOTTY || errno == EINVAL)
+            sn_fs_demote(fs.device, SN_FS_FEATURE_REFLINK);
+    }
+
+    bool kernel = same_fs && (fs.features & SN_FS_FEATURE_COPY_RANGE);
+    #endif
+
+    // Only data extents are copied, skipped ranges stay holes in the destination
+    char buffer[1 << 16];
+    SnFileExtent extent;
+    for (uint64_t offset = 0; ok && offset < size && sn_file_next_extent(&srcf, offset, &extent);
+         offset = extent.offset + extent.length) {
+        if (extent.offset + extent.length > size) extent.length = size - extent.offset;
+
+        uint64_t done = 0;
+    #if defined(SN_OS_LINUX)
+        if (kernel) {
+            bool unsupported = false;
+            int64_t copied = kernel_copy(FD(&srcf), FD(&dstf), extent.offset, extent.length,
+                                         &unsupported);
+            if (copied < 0) {
+                ok = false;
+                break;
+            }
+            if (unsupported) {
+                kernel = false;
+                sn_fs_demote(fs.device, SN_FS_FEATURE_COPY_RANGE);
+            }
+            done = copied;
+        }
+    #endif
+
+        ok = copy_range(FD(&srcf), FD(&dstf), extent.offset + done, extent.length - done, buffer,
+                        sizeof(buffer));
+    }
 
-    char buffer[4096];
-    int64_t ret;
-    while ((ret = sn_file_read(&srcf, buffer, SN_ARRAY_LENGTH(buffer))) > 0)
-        sn_file_write(&dstf, buffer, ret);
+    // Recreate the trailing hole
+    if (ok) ok = ftruncate(FD(&dstf), size) == 0;
 
+    #if defined(SN_OS_LINUX)
+done:
+    #endif
     sn_file_close(&srcf);
     sn_file_close(&dstf);
+    return ok;
+}
+
+bool sn_file_copy(const char *src, const char *dst, bool overwrite) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_COPY);
+    bool ok = copy_file(src, dst, overwrite);
+    SN_TRACE_END(SN_TRACE_OP_COPY, -1, src, 0, ok);
+    // Clones and kernel copies bypass the writes that notify
+    if (ok) sn_block_cache_notify_path(dst);
+    return ok;
+}
+
+static bool open_temp(const char *dir, SnFile *file) {
+    #if defined(O_TMPFILE)
+    // If the directory can not be probed let open tell what is wrong
+    SnFsInfo fs;
+    bool probed = sn_fs_probe(dir, &fs);
+    if (!probed || (fs.features & SN_FS_FEATURE_TMPFILE)) {
+        FD(file) = open(dir, O_TMPFILE | O_RDWR, 0644);
+        if (FD(file) >= 0) return true;
+
+        // Not supported by the filesystem, fall back to a named file
+        if (probed && (errno == EOPNOTSUPP || errno == EISDIR))
+            sn_fs_demote(fs.device, SN_FS_FEATURE_TMPFILE);
+    }
+    #endif
+
+    char path[4096];
+    int length = snprintf(path, sizeof(path), "%s/.snfile-XXXXXX", dir);
+    if (length < 0 || (size_t)length >= sizeof(path)) return false;
+
+    FD(file) = mkstemp(path);
+    if (FD(file) < 0) return false;
+
+    unlink(path);
     return true;
 }
 
+bool sn_file_open_temp(const char *dir, SnFile *file) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_OPEN_TEMP);
+    bool ok = open_temp(dir, file);
+    SN_TRACE_END(SN_TRACE_OP_OPEN_TEMP, ok ? FD(file) : -1, dir, 0, ok);
+    return ok;
+}
+
+static bool publish_temp(SnFile *file, const char *path) {
+    #if defined(SN_OS_LINUX)
+    // Only O_TMPFILE files can be linked back, unlinked files fail with ENOENT
+    char proc[64];
+    snprintf(proc, sizeof(proc), "/proc/self/fd/%d", FD(file));
+    if (linkat(AT_FDCWD, proc, AT_FDCWD, path, AT_SYMLINK_FOLLOW) == 0) return true;
+    if (errno == EEXIST) return false;
+    #endif
+
+    struct stat st;
+    if (fstat(FD(file), &st) != 0) return false;
+
+    int dst = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (dst < 0) return false;
+
+    char buffer[1 << 16];
+    bool ok = copy_range(FD(file), dst, 0, st.st_size, buffer, sizeof(buffer));
+    close(dst);
+
+    if (!ok) unlink(path);
+    return ok;
+}
+
+bool sn_file_publish_temp(SnFile *file, const char *path) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_PUBLISH_TEMP);
+    bool ok = publish_temp(file, path);
+    SN_TRACE_END(SN_TRACE_OP_PUBLISH_TEMP, FD(file), path, 0, ok);
+    return ok;
+}
+
 bool sn_file_move(const char *src, const char *dst, bool overwrite) {
-    if (!overwrite && sn_path_exists(dst)) return false;
-    return rename(src, dst) == 0;
+    SN_TRACE_BEGIN(SN_TRACE_OP_MOVE);
+    bool ok = false;
+    if (overwrite || !sn_path_exists(dst)) {
+        sn_file_cache_notify(src);
+        sn_file_cache_notify(dst);
+        sn_block_cache_notify_path(dst);
+        ok = rename(src, dst) == 0;
+        // Again for handles opened by misses that raced with the rename
+        if (ok) {
+            sn_file_cache_notify(src);
+            sn_file_cache_notify(dst);
+        }
+    }
+    SN_TRACE_END(SN_TRACE_OP_MOVE, -1, src, 0, ok);
+    return ok;
+}
+
+static void fill_info(const struct stat *st, SnFileInfo *info) {
+    *info = (SnFileInfo){
+        .size = st->st_size,
+
+        .modified_time = st->st_mtime,
+        .accessed_time = st->st_atime,
+        .change_time = st->st_ctime,
+
+        .modified_time_ns = MTIME_NS(*st),
+        .device = st->st_dev,
+        .inode = st->st_ino,
+        // st_blocks is in 512 byte units regardless of the filesystem block size
+        .allocated_size = (uint64_t)st->st_blocks * 512,
+        .link_count = (uint32_t)st->st_nlink,
+
+        .is_file = S_ISREG(st->st_mode),
+        .is_directory = S_ISDIR(st->st_mode),
+        .is_symlink = S_ISLNK(st->st_mode)};
 }
 
 bool sn_file_stat(const char *path, SnFileInfo *info) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_STAT);
     struct stat st;
-    if (stat(path, &st) != 0) return false;
+    bool ok = stat(path, &st) == 0;
+    SN_TRACE_END(SN_TRACE_OP_STAT, -1, path, 0, ok);
+    if (ok) fill_info(&st, info);
+    return ok;
+}
 
-    *info = (SnFileInfo){
-        .size = st.st_size,
+bool sn_file_lstat(const char *path, SnFileInfo *info) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_LSTAT);
+    struct stat st;
+    bool ok = lstat(path, &st) == 0;
+    SN_TRACE_END(SN_TRACE_OP_LSTAT, -1, path, 0, ok);
+    if (ok) fill_info(&st, info);
+    return ok;
+}
 
-        .modified_time = st.st_mtime,
-        .accessed_time = st.st_atime,
-        .change_time = st.st_ctime,
+bool sn_dir_entry_info(SnDir *dir, SnFileInfo *info) {
+    SN_UNUSED(dir);
+    SN_UNUSED(info);
+    return false;
+}
 
-        .is_file = S_ISREG(st.st_mode),
-        .is_directory = S_ISDIR(st.st_mode),
-        .is_symlink = S_ISLNK(st.st_mode)};
+bool sn_dir_stat_at(SnDir *dir, const char *name, SnFileInfo *info) {
+    struct stat st;
+    if (fstatat(dirfd(DIRECTORY(dir)), name, &st, AT_SYMLINK_NOFOLLOW) != 0) return false;
+    fill_info(&st, info);
+    return true;
+}
 
+    // Same limit as Linux
+    #define MAX_SYMLINKS 40
+    #define REALPATH_BUFFER_SIZE 4096
+
+typedef struct RealpathState {
+    SnPathCache *cache;
+    uint64_t generation;
+    uint32_t links;
+    bool directory; // Whether the last resolved component is a directory
+} RealpathState;
+
+static bool push_component(char *out, size_t *length, const char *name, size_t name_length) {
+    size_t separator = *length > 1 ? 1 : 0;
+    if (*length + separator + name_length >= REALPATH_BUFFER_SIZE) return false;
+
+    if (separator) out[(*length)++] = '/';
+    memcpy(out + *length, name, name_length);
+    *length += name_length;
+    out[*length] = 0;
     return true;
 }
 
+static void pop_component(char *out, size_t *length) {
+    while (*length > 1 && out[*length - 1] != '/') --*length;
+    if (*length > 1) --*length;
+    out[*length] = 0;
+}
+
+/**
+ * @brief Apply the components of path to the resolved prefix out.
+ *
+ * out always holds a path without links, so `..` can be applied lexically.
+ * Only directories and links to directories are cached, so the cache grows
+ * with the number of directories and not with the number of files.
+ */
+static bool resolve(RealpathState *state, char *out, size_t *length, const char *path) {
+    const char *p = path;
+    while (*p) {
+        while (*p == '/') ++p;
+        const char *name = p;
+        while (*p && *p != '/') ++p;
+        size_t name_length = p - name;
+
+        if (!name_length || (name_length == 1 && name[0] == '.')) {
+            state->directory = true;
+            continue;
+        }
+        if (name_length == 2 && name[0] == '.' && name[1] == '.') {
+            pop_component(out, length);
+            state->directory = true;
+            continue;
+        }
+
+        size_t parent_length = *length;
+        if (!push_component(out, length, name, name_length)) return false;
+
+        if (sn_path_cache_lookup(state->cache, out, *length, out, REALPATH_BUFFER_SIZE, length)) {
+            state->directory = true;
+            continue;
+        }
+
+        struct stat st;
+        if (lstat(out, &st) != 0) return false;
+
+        if (!S_ISLNK(st.st_mode)) {
+            state->directory = S_ISDIR(st.st_mode);
+            if (state->directory)
+                sn_path_cache_insert(state->cache, state->generation, out, *length, out, *length);
+            continue;
+        }
+
+        if (++state->links > MAX_SYMLINKS) return false;
+
+        // Link path and target, off the stack as this recurses per link
+        char *link = sn_file_alloc(2 * REALPATH_BUFFER_SIZE);
+        if (!link) return false;
+        char *target = link + REALPATH_BUFFER_SIZE;
+
+        size_t link_length = *length;
+        memcpy(link, out, link_length + 1);
+
+        ssize_t target_length = readlink(out, target, REALPATH_BUFFER_SIZE - 1);
+        bool ok = target_length >= 0;
+        if (ok) {
+            target[target_length] = 0;
+
+            *length = target[0] == '/' ? 1 : parent_length;
+            out[*length] = 0;
+
+            ok = resolve(state, out, length, target);
+            if (ok && state->directory)
+                sn_path_cache_insert(state->cache, state->generation, link, link_length, out,
+                                     *length);
+        }
+
+        sn_file_free(link, 2 * REALPATH_BUFFER_SIZE);
+        if (!ok) return false;
+    }
+
+    return true;
+}
+
+static bool real_path(SnPathCache *cache, const char *path, char *dst, size_t dst_size) {
+    if (!path[0]) return false;
+
+    RealpathState state = {.cache = cache,
+                           .generation = cache ? sn_path_cache_generation(cache) : 0};
+
+    char full[REALPATH_BUFFER_SIZE];
+    size_t full_length = 0;
+    if (path[0] != '/') {
+        if (!getcwd(full, sizeof(full) - 1)) return false;
+        full_length = strlen(full);
+        full[full_length++] = '/';
+    }
+
+    size_t path_length = strlen(path);
+    if (full_length + path_length >= sizeof(full)) return false;
+    memcpy(full + full_length, path, path_length + 1);
+    full_length += path_length;
+
+    char out[REALPATH_BUFFER_SIZE] = "/";
+    size_t length = 1;
+    const char *rest = full;
+
+    // Entries of a known directory cost one lookup, walk back to the longest cached parent
+    for (size_t end = full_length; cache && end > 1;) {
+        if (full[--end] != '/') continue;
+        if (sn_path_cache_lookup(cache, full, end, out, sizeof(out), &length)) {
+            rest = full + end;
+            break;
+        }
+    }
+
+    if (!resolve(&state, out, &length, rest) || length >= dst_size) return false;
+
+    memcpy(dst, out, length + 1);
+    return true;
+}
+
+bool sn_path_realpath(SnPathCache *cache, const char *path, char *dst, size_t dst_size) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_REALPATH);
+    bool ok = real_path(cache, path, dst, dst_size);
+    SN_TRACE_END(SN_TRACE_OP_REALPATH, -1, path, 0, ok);
+    return ok;
+}
+
+    #if defined(SN_OS_LINUX)
+        #define FS_ALL                                                                   \
+            (SN_FS_FEATURE_REFLINK | SN_FS_FEATURE_COPY_RANGE | SN_FS_FEATURE_DIRECT_IO \
+             | SN_FS_FEATURE_TMPFILE | SN_FS_FEATURE_SPARSE)
+
+typedef struct FsType {
+    uint64_t magic;
+    const char *name;
+    uint32_t features;
+} FsType;
+
+// Reflinks on xfs depend on how it was made, cleared on the first failed clone
+static const FsType fs_types[] = {
+    {0xEF53, "ext4", FS_ALL & ~SN_FS_FEATURE_REFLINK},
+    {0x58465342, "xfs", FS_ALL},
+    {0x9123683E, "btrfs", FS_ALL},
+    {0xCA451A4E, "bcachefs", FS_ALL},
+    {0xF2F52010, "f2fs", FS_ALL & ~SN_FS_FEATURE_REFLINK},
+    {0x01021994, "tmpfs", SN_FS_FEATURE_COPY_RANGE | SN_FS_FEATURE_TMPFILE | SN_FS_FEATURE_SPARSE},
+    {0x794C7630, "overlay", SN_FS_FEATURE_COPY_RANGE | SN_FS_FEATURE_SPARSE},
+    {0x6969, "nfs", SN_FS_FEATURE_COPY_RANGE | SN_FS_FEATURE_SPARSE},
+    {0x65735546, "fuse", SN_FS_FEATURE_COPY_RANGE},
+    {0x4D44, "vfat", SN_FS_FEATURE_COPY_RANGE},
+    {0x2011BAB0, "exfat", SN_FS_FEATURE_COPY_RANGE},
+};
+
+bool sn_fs_query(const char *path, SnFsInfo *info) {
+    struct statfs sfs;
+    if (statfs(path, &sfs) != 0) return false;
+
+    // Unknown file systems get everything, operations clear what fails
+    *info = (SnFsInfo){.type = (uint64_t)sfs.f_type,
+                       .block_size = (uint32_t)sfs.f_bsize,
+                       .features = FS_ALL & ~SN_FS_FEATURE_DIRECT_IO};
+    for (size_t i = 0; i < SN_ARRAY_LENGTH(fs_types); ++i) {
+        if (fs_types[i].magic == info->type) {
+            snprintf(info->type_name, sizeof(info->type_name), "%s", fs_types[i].name);
+            info->features = fs_types[i].features;
+            break;
+        }
+    }
+
+        #if defined(STATX_DIOALIGN)
+    struct statx stx;
+    if (statx(AT_FDCWD, path, 0, STATX_DIOALIGN, &stx) == 0 && (stx.stx_mask & STATX_DIOALIGN)) {
+        info->dio_mem_align = stx.stx_dio_mem_align;
+        info->dio_offset_align = stx.stx_dio_offset_align;
+        // Zero alignments mean no direct I/O at all
+        if (info->dio_offset_align) info->features |= SN_FS_FEATURE_DIRECT_IO;
+        else info->features &= ~SN_FS_FEATURE_DIRECT_IO;
+    }
+        #endif
+
+    return true;
+}
+    #else
+bool sn_fs_query(const char *path, SnFsInfo *info) {
+    struct statfs sfs;
+    if (statfs(path, &sfs) != 0) return false;
+
+    *info = (SnFsInfo){.block_size = (uint32_t)sfs.f_iosize};
+    snprintf(info->type_name, sizeof(info->type_name), "%s", sfs.f_fstypename);
+
+    // F_NOCACHE works everywhere, clonefile and holes need APFS
+    info->features = SN_FS_FEATURE_DIRECT_IO;
+    if (strcmp(sfs.f_fstypename, "apfs") == 0)
+        info->features |= SN_FS_FEATURE_REFLINK | SN_FS_FEATURE_SPARSE;
+
+    return true;
+}
+    #endif
+
+void *sn_file_map(SnFile *file, uint64_t size) {
+    if (!size) return NULL;
+    void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, FD(file), 0);
+    return data == MAP_FAILED ? NULL : data;
+}
+
+void sn_file_unmap(void *data, uint64_t size) {
+    int res = munmap(data, size);
+    SN_ASSERT(res == 0);
+    SN_UNUSED(res);
+}
+
 #endif
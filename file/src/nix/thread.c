@@ -0,0 +1,146 @@
+#define _GNU_SOURCE
+#include "src/thread.h"
+
+#if defined(SN_OS_LINUX) || defined(SN_OS_MAC)
+
+    #include <errno.h>
+    #include <pthread.h>
+    #include <sched.h>
+    #include <sys/syscall.h>
+    #include <time.h>
+    #include <unistd.h>
+
+typedef struct SnThreadPosix {
+    pthread_t thread;
+    SnThreadFunc func;
+    void *arg;
+} SnThreadPosix;
+
+    #define THREAD(thread) ((SnThreadPosix *)(thread))
+    #define MUTEX(mutex) ((pthread_mutex_t *)(mutex))
+    #define COND(cond) ((pthread_cond_t *)(cond))
+
+SN_STATIC_ASSERT(sizeof(SnThreadPosix) <= sizeof(SnThread), "SnThread size is not large enough!");
+SN_STATIC_ASSERT(sizeof(pthread_mutex_t) <= sizeof(SnMutex), "SnMutex size is not large enough!");
+SN_STATIC_ASSERT(sizeof(pthread_cond_t) <= sizeof(SnCond), "SnCond size is not large enough!");
+
+static void *thread_start(void *arg) {
+    SnThreadPosix *thread = arg;
+    thread->func(thread->arg);
+    return NULL;
+}
+
+bool sn_thread_create(SnThread *thread, SnThreadFunc func, void *arg) {
+    THREAD(thread)->func = func;
+    THREAD(thread)->arg = arg;
+    return pthread_create(&THREAD(thread)->thread, NULL, thread_start, thread) == 0;
+}
+
+void sn_thread_join(SnThread *thread) {
+    int res = pthread_join(THREAD(thread)->thread, NULL);
+    SN_ASSERT(res == 0);
+    SN_UNUSED(res);
+}
+
+uint32_t sn_thread_cpu_count(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (uint32_t)count : 1;
+}
+
+uint64_t sn_thread_id(void) {
+    #if defined(SN_OS_MAC)
+    uint64_t id = 0;
+    pthread_threadid_np(NULL, &id);
+    return id;
+    #else
+    return (uint64_t)syscall(SYS_gettid);
+    #endif
+}
+
+uint64_t sn_process_id(void) {
+    return (uint64_t)getpid();
+}
+
+void sn_thread_yield(void) {
+    sched_yield();
+}
+
+void sn_thread_sleep(uint32_t ms) {
+    struct timespec ts = {.tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000};
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+}
+
+uint64_t sn_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+bool sn_mutex_init(SnMutex *mutex) {
+    return pthread_mutex_init(MUTEX(mutex), NULL) == 0;
+}
+
+void sn_mutex_destroy(SnMutex *mutex) {
+    pthread_mutex_destroy(MUTEX(mutex));
+}
+
+void sn_mutex_lock(SnMutex *mutex) {
+    int res = pthread_mutex_lock(MUTEX(mutex));
+    SN_ASSERT(res == 0);
+    SN_UNUSED(res);
+}
+
+void sn_mutex_unlock(SnMutex *mutex) {
+    int res = pthread_mutex_unlock(MUTEX(mutex));
+    SN_ASSERT(res == 0);
+    SN_UNUSED(res);
+}
+
+bool sn_cond_init(SnCond *cond) {
+    #if defined(SN_OS_MAC)
+    return pthread_cond_init(COND(cond), NULL) == 0;
+    #else
+    // Timed waits use the monotonic clock
+    pthread_condattr_t attr;
+    if (pthread_condattr_init(&attr) != 0) return false;
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    bool ok = pthread_cond_init(COND(cond), &attr) == 0;
+    pthread_condattr_destroy(&attr);
+    return ok;
+    #endif
+}
+
+void sn_cond_destroy(SnCond *cond) {
+    pthread_cond_destroy(COND(cond));
+}
+
+void sn_cond_wait(SnCond *cond, SnMutex *mutex) {
+    pthread_cond_wait(COND(cond), MUTEX(mutex));
+}
+
+bool sn_cond_timed_wait(SnCond *cond, SnMutex *mutex, uint32_t ms) {
+    struct timespec ts;
+    #if defined(SN_OS_MAC)
+    ts = (struct timespec){.tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000};
+    return pthread_cond_timedwait_relative_np(COND(cond), MUTEX(mutex), &ts) != ETIMEDOUT;
+    #else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (long)(ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec += 1;
+        ts.tv_nsec -= 1000000000;
+    }
+    return pthread_cond_timedwait(COND(cond), MUTEX(mutex), &ts) != ETIMEDOUT;
+    #endif
+}
+
+void sn_cond_signal(SnCond *cond) {
+    pthread_cond_signal(COND(cond));
+}
+
+void sn_cond_broadcast(SnCond *cond) {
+    pthread_cond_broadcast(COND(cond));
+}
+
+#endif
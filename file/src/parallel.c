@@ -0,0 +1,207 @@
+#include "snfile/parallel.h"
+
+#include "src/internal.h"
+#include "src/pool.h"
+#include "src/thread.h"
+
+#include <string.h>
+
+#define PARALLEL_DEFAULT_RANGE_SIZE (4ull << 20)
+#define PARALLEL_RANGES_PER_THREAD 2
+// Read size when looking for the delimiter past a range
+#define PARALLEL_SCAN_CHUNK (64u << 10)
+
+typedef struct ParallelSlot {
+    char *buffer;
+    uint64_t capacity;
+
+    SnFileRange range;
+    void *partial;
+    bool empty;
+} ParallelSlot;
+
+/*
+ * Ranges are processed in waves of one slot per range. Range k nominally
+ * covers [k * range_size, (k + 1) * range_size), with a delimiter it covers the
+ * records starting in there: it begins after the first delimiter at or after
+ * its nominal begin - 1 and ends where range k + 1 begins.
+ */
+typedef struct ParallelRun {
+    SnFile *file;
+    const SnFileParallelConfig *config;
+    uint64_t size;
+    uint64_t range_size;
+    bool delimited;
+
+    const char *mapped;
+
+    ParallelSlot *slots;
+    uint64_t first; // Range of the first slot in the wave
+
+    volatile uint32_t stop;
+} ParallelRun;
+
+static bool reserve(ParallelSlot *slot, uint64_t capacity) {
+    if (capacity <= slot->capacity) return true;
+
+    char *buffer = sn_file_realloc(slot->buffer, slot->capacity, capacity);
+    if (!buffer) return false;
+
+    slot->buffer = buffer;
+    slot->capacity = capacity;
+    return true;
+}
+
+static void find_mapped(ParallelRun *run, uint64_t k, ParallelSlot *slot) {
+    const char *m = run->mapped;
+    uint64_t begin = k * run->range_size;
+    uint64_t end = begin + run->range_size < run->size ? begin + run->range_size : run->size;
+
+    if (run->delimited) {
+        char delimiter = run->config->delimiter;
+
+        if (k) {
+            const char *p = memchr(m + begin - 1, delimiter, end - begin);
+            if (!p) {
+                slot->empty = true;
+                return;
+            }
+            begin = p - m + 1;
+        }
+
+        if (end < run->size) {
+            const char *p = memchr(m + end - 1, delimiter, run->size - end + 1);
+            end = p ? (uint64_t)(p - m) + 1 : run->size;
+        }
+    }
+
+    slot->range = (SnFileRange){.index = k, .offset = begin, .length = end - begin, .data = m + begin};
+}
+
+static bool find_read(ParallelRun *run, uint64_t k, ParallelSlot *slot) {
+    uint64_t begin = k * run->range_size;
+    uint64_t end = begin + run->range_size < run->size ? begin + run->range_size : run->size;
+
+    // One byte before tells if a record starts right at begin
+    uint64_t from = run->delimited && k ? begin - 1 : begin;
+    uint64_t length = end - from;
+
+    if (!reserve(slot, length + (run->delimited ? PARALLEL_SCAN_CHUNK : 0))) return false;
+    if (sn_file_read_at(run->file, from, slot->buffer, length) != (int64_t)length) return false;
+
+    uint64_t skip = 0;
+    if (run->delimited) {
+        char delimiter = run->config->delimiter;
+
+        if (k) {
+            const char *p = memchr(slot->buffer, delimiter, length - 1);
+            if (!p) {
+                slot->empty = true;
+                return true;
+            }
+            skip = p - slot->buffer + 1;
+        }
+
+        // Extend to the end of the record crossing end
+        if (end < run->size && slot->buffer[length - 1] != delimiter) {
+            for (;;) {
+                uint64_t chunk = run->size - (from + length);
+                if (chunk > PARALLEL_SCAN_CHUNK) chunk = PARALLEL_SCAN_CHUNK;
+                if (!chunk) break;
+
+                if (!reserve(slot, length + chunk)) return false;
+                if (sn_file_read_at(run->file, from + length, slot->buffer + length, chunk)
+                    != (int64_t)chunk)
+                    return false;
+
+                const char *p = memchr(slot->buffer + length, delimiter, chunk);
+                if (p) {
+                    length = p - slot->buffer + 1;
+                    break;
+                }
+                length += chunk;
+            }
+        }
+    }
+
+    slot->range = (SnFileRange){
+        .index = k, .offset = from + skip, .length = length - skip, .data = slot->buffer + skip};
+    return true;
+}
+
+static void map_range(void *user_data, uint32_t index) {
+    ParallelRun *run = user_data;
+    ParallelSlot *slot = &run->slots[index];
+    uint64_t k = run->first + index;
+
+    slot->empty = false;
+    slot->partial = NULL;
+    if (sn_atomic_load_u32(&run->stop)) return;
+
+    if (run->mapped) {
+        find_mapped(run, k, slot);
+    } else if (!find_read(run, k, slot)) {
+        sn_atomic_store_u32(&run->stop, 1);
+        return;
+    }
+
+    if (slot->empty) return;
+
+    const SnFileParallelConfig *config = run->config;
+    if (!config->map(&slot->range, &slot->partial, config->user_data))
+        sn_atomic_store_u32(&run->stop, 1);
+}
+
+bool sn_file_parallel_for(SnFile *file, const SnFileParallelConfig *config) {
+    uint64_t size = sn_file_size(file);
+    if (!size) return true;
+
+    ParallelRun run = {
+        .file = file,
+        .config = config,
+        .size = size,
+        .range_size = config->range_size ? config->range_size : PARALLEL_DEFAULT_RANGE_SIZE,
+        .delimited = config->flags & SN_FILE_PARALLEL_FLAG_DELIMITED,
+    };
+    uint64_t count = (size + run.range_size - 1) / run.range_size;
+
+    SnPool *pool;
+    if (!sn_pool_create(config->thread_count, &pool)) return false;
+
+    uint32_t batch = sn_pool_thread_count(pool) * PARALLEL_RANGES_PER_THREAD;
+    run.slots = sn_file_alloc(batch * sizeof(ParallelSlot));
+    if (!run.slots) {
+        sn_pool_destroy(pool);
+        return false;
+    }
+    memset(run.slots, 0, batch * sizeof(ParallelSlot));
+
+    bool ok = true;
+    if (config->flags & SN_FILE_PARALLEL_FLAG_MAP) {
+        run.mapped = sn_file_map(file, size);
+        ok = run.mapped != NULL;
+    }
+
+    for (; ok && run.first < count; run.first += batch) {
+        uint32_t n = count - run.first < batch ? (uint32_t)(count - run.first) : batch;
+        sn_pool_run(pool, n, map_range, &run);
+
+        if (sn_atomic_load_u32(&run.stop)) {
+            ok = false;
+            break;
+        }
+
+        for (uint32_t i = 0; ok && i < n; ++i) {
+            ParallelSlot *slot = &run.slots[i];
+            if (!slot->empty && config->reduce)
+                ok = config->reduce(&slot->range, slot->partial, config->user_data);
+        }
+    }
+
+    if (run.mapped) sn_file_unmap((void *)run.mapped, size);
+    for (uint32_t i = 0; i < batch; ++i) sn_file_free(run.slots[i].buffer, run.slots[i].capacity);
+    sn_file_free(run.slots, batch * sizeof(ParallelSlot));
+    sn_pool_destroy(pool);
+
+    return ok;
+}
@@ -0,0 +1,192 @@
+#include "snfile/realpath.h"
+
+#include "src/internal.h"
+#include "src/thread.h"
+
+#include <string.h>
+
+#define PATH_CACHE_MIN_BUCKETS 256
+
+/*
+ * Maps a path to its resolved form. Entries for paths which resolve to
+ * themselves (no link in them) store the key only.
+ */
+typedef struct PathEntry {
+    struct PathEntry *next;
+    uint64_t hash;
+    uint32_t key_len;
+    uint32_t value_len;
+    bool same;
+    char data[]; // Key, then value when not same, both terminated
+} PathEntry;
+
+struct SnPathCache {
+    SnMutex mutex;
+    PathEntry **buckets;
+    uint64_t bucket_count;
+    uint64_t count;
+    volatile uint64_t generation;
+};
+
+static uint64_t hash_key(const char *key, size_t length) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (unsigned char)key[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static size_t entry_size(const PathEntry *entry) {
+    return sizeof(PathEntry) + entry->key_len + 1 + (entry->same ? 0 : entry->value_len + 1);
+}
+
+static void clear(SnPathCache *cache) {
+    for (uint64_t i = 0; i < cache->bucket_count; ++i) {
+        PathEntry *entry = cache->buckets[i];
+        while (entry) {
+            PathEntry *next = entry->next;
+            sn_file_free(entry, entry_size(entry));
+            entry = next;
+        }
+        cache->buckets[i] = NULL;
+    }
+    cache->count = 0;
+}
+
+static bool grow(SnPathCache *cache) {
+    uint64_t bucket_count = cache->bucket_count * 2;
+    PathEntry **buckets = sn_file_alloc(bucket_count * sizeof(PathEntry *));
+    if (!buckets) return false;
+    memset(buckets, 0, bucket_count * sizeof(PathEntry *));
+
+    for (uint64_t i = 0; i < cache->bucket_count; ++i) {
+        PathEntry *entry = cache->buckets[i];
+        while (entry) {
+            PathEntry *next = entry->next;
+            PathEntry **bucket = &buckets[entry->hash & (bucket_count - 1)];
+            entry->next = *bucket;
+            *bucket = entry;
+            entry = next;
+        }
+    }
+
+    sn_file_free(cache->buckets, cache->bucket_count * sizeof(PathEntry *));
+    cache->buckets = buckets;
+    cache->bucket_count = bucket_count;
+    return true;
+}
+
+static PathEntry *find(SnPathCache *cache, uint64_t hash, const char *key, size_t key_len) {
+    for (PathEntry *e = cache->buckets[hash & (cache->bucket_count - 1)]; e; e = e->next)
+        if (e->hash == hash && e->key_len == key_len && memcmp(e->data, key, key_len) == 0)
+            return e;
+    return NULL;
+}
+
+bool sn_path_cache_create(SnPathCache **cache) {
+    SnPathCache *c = sn_file_alloc(sizeof(SnPathCache));
+    if (!c) return false;
+    *c = (SnPathCache){.bucket_count = PATH_CACHE_MIN_BUCKETS};
+
+    c->buckets = sn_file_alloc(c->bucket_count * sizeof(PathEntry *));
+    if (!c->buckets || !sn_mutex_init(&c->mutex)) {
+        sn_file_free(c->buckets, c->bucket_count * sizeof(PathEntry *));
+        sn_file_free(c, sizeof(SnPathCache));
+        return false;
+    }
+    memset(c->buckets, 0, c->bucket_count * sizeof(PathEntry *));
+
+    *cache = c;
+    return true;
+}
+
+void sn_path_cache_destroy(SnPathCache *cache) {
+    clear(cache);
+    sn_mutex_destroy(&cache->mutex);
+    sn_file_free(cache->buckets, cache->bucket_count * sizeof(PathEntry *));
+    sn_file_free(cache, sizeof(SnPathCache));
+}
+
+void sn_path_cache_invalidate(SnPathCache *cache) {
+    sn_mutex_lock(&cache->mutex);
+    clear(cache);
+    sn_atomic_fetch_add_u64(&cache->generation, 1);
+    sn_mutex_unlock(&cache->mutex);
+}
+
+void sn_path_cache_set_generation(SnPathCache *cache, uint64_t generation) {
+    // Cheap check first, this is expected to be called before every resolve
+    if (sn_atomic_load_u64(&cache->generation) == generation) return;
+
+    sn_mutex_lock(&cache->mutex);
+    if (cache->generation != generation) {
+        clear(cache);
+        sn_atomic_store_u64(&cache->generation, generation);
+    }
+    sn_mutex_unlock(&cache->mutex);
+}
+
+uint64_t sn_path_cache_generation(const SnPathCache *cache) {
+    return sn_atomic_load_u64((volatile uint64_t *)&cache->generation);
+}
+
+bool sn_path_cache_lookup(SnPathCache *cache, const char *key, size_t key_len, char *dst,
+                          size_t dst_size, size_t *length) {
+    if (!cache) return false;
+
+    uint64_t hash = hash_key(key, key_len);
+
+    sn_mutex_lock(&cache->mutex);
+    PathEntry *entry = find(cache, hash, key, key_len);
+    bool found = entry && entry->value_len < dst_size;
+    if (found) {
+        // dst may be the key itself
+        const char *value = entry->same ? entry->data : entry->data + entry->key_len + 1;
+        memmove(dst, value, entry->value_len + 1);
+        *length = entry->value_len;
+    }
+    sn_mutex_unlock(&cache->mutex);
+
+    return found;
+}
+
+void sn_path_cache_insert(SnPathCache *cache, uint64_t generation, const char *key,
+                          size_t key_len, const char *value, size_t value_len) {
+    if (!cache) return;
+
+    uint64_t hash = hash_key(key, key_len);
+    bool same = key_len == value_len && memcmp(key, value, key_len) == 0;
+
+    PathEntry header = {.hash = hash,
+                        .key_len = (uint32_t)key_len,
+                        .value_len = (uint32_t)value_len,
+                        .same = same};
+    PathEntry *entry = sn_file_alloc(entry_size(&header));
+    if (!entry) return;
+    *entry = header;
+    memcpy(entry->data, key, key_len);
+    entry->data[key_len] = 0;
+    if (!same) {
+        memcpy(entry->data + key_len + 1, value, value_len);
+        entry->data[key_len + 1 + value_len] = 0;
+    }
+
+    sn_mutex_lock(&cache->mutex);
+
+    // Resolved against a file system state the cache no longer trusts
+    if (cache->generation != generation || find(cache, hash, key, key_len)
+        || (cache->count >= cache->bucket_count && !grow(cache))) {
+        sn_mutex_unlock(&cache->mutex);
+        sn_file_free(entry, entry_size(entry));
+        return;
+    }
+
+    PathEntry **bucket = &cache->buckets[hash & (cache->bucket_count - 1)];
+    entry->next = *bucket;
+    *bucket = entry;
+    cache->count++;
+
+    sn_mutex_unlock(&cache->mutex);
+}
@@ -0,0 +1,140 @@
+#include "src/pool.h"
+
+#include "src/internal.h"
+#include "src/thread.h"
+
+#define POOL_MAX_THREADS 64
+
+struct SnPool {
+    SnThread threads[POOL_MAX_THREADS];
+    uint32_t worker_count;
+
+    SnMutex run_mutex; // Serializes runs
+
+    SnMutex mutex;
+    SnCond start;
+    SnCond done;
+
+    // Current run, published by bumping generation
+    SnPoolFunc func;
+    void *user_data;
+    uint32_t count;
+    volatile uint32_t next;
+    uint64_t generation;
+    uint32_t active; // Workers which have not finished the current run
+    bool stop;
+};
+
+static void run_items(SnPool *pool, SnPoolFunc func, void *user_data, uint32_t count) {
+    for (;;) {
+        uint32_t index = sn_atomic_fetch_add_u32(&pool->next, 1);
+        if (index >= count) break;
+        func(user_data, index);
+    }
+}
+
+static void worker(void *arg) {
+    SnPool *pool = arg;
+    uint64_t seen = 0;
+
+    sn_mutex_lock(&pool->mutex);
+    for (;;) {
+        while (pool->generation == seen && !pool->stop) sn_cond_wait(&pool->start, &pool->mutex);
+        if (pool->stop) break;
+
+        seen = pool->generation;
+        SnPoolFunc func = pool->func;
+        void *user_data = pool->user_data;
+        uint32_t count = pool->count;
+        sn_mutex_unlock(&pool->mutex);
+
+        run_items(pool, func, user_data, count);
+
+        sn_mutex_lock(&pool->mutex);
+        if (--pool->active == 0) sn_cond_signal(&pool->done);
+    }
+    sn_mutex_unlock(&pool->mutex);
+}
+
+bool sn_pool_create(uint32_t thread_count, SnPool **pool) {
+    if (!thread_count) thread_count = sn_thread_cpu_count();
+    if (thread_count > POOL_MAX_THREADS + 1) thread_count = POOL_MAX_THREADS + 1;
+
+    SnPool *p = sn_file_alloc(sizeof(SnPool));
+    if (!p) return false;
+    *p = (SnPool){0};
+
+    if (!sn_mutex_init(&p->run_mutex)) goto fail_run_mutex;
+    if (!sn_mutex_init(&p->mutex)) goto fail_mutex;
+    if (!sn_cond_init(&p->start)) goto fail_start;
+    if (!sn_cond_init(&p->done)) goto fail_done;
+
+    for (; p->worker_count < thread_count - 1; ++p->worker_count) {
+        if (!sn_thread_create(&p->threads[p->worker_count], worker, p)) {
+            // Work with the threads we got
+            break;
+        }
+    }
+
+    *pool = p;
+    return true;
+
+fail_done:
+    sn_cond_destroy(&p->start);
+fail_start:
+    sn_mutex_destroy(&p->mutex);
+fail_mutex:
+    sn_mutex_destroy(&p->run_mutex);
+fail_run_mutex:
+    sn_file_free(p, sizeof(SnPool));
+    return false;
+}
+
+void sn_pool_destroy(SnPool *pool) {
+    if (!pool) return;
+
+    sn_mutex_lock(&pool->mutex);
+    pool->stop = true;
+    sn_cond_broadcast(&pool->start);
+    sn_mutex_unlock(&pool->mutex);
+
+    for (uint32_t i = 0; i < pool->worker_count; ++i) sn_thread_join(&pool->threads[i]);
+
+    sn_cond_destroy(&pool->done);
+    sn_cond_destroy(&pool->start);
+    sn_mutex_destroy(&pool->mutex);
+    sn_mutex_destroy(&pool->run_mutex);
+    sn_file_free(pool, sizeof(SnPool));
+}
+
+uint32_t sn_pool_thread_count(const SnPool *pool) {
+    return pool ? pool->worker_count + 1 : 1;
+}
+
+void sn_pool_run(SnPool *pool, uint32_t count, SnPoolFunc func, void *user_data) {
+    if (!pool || !pool->worker_count || count <= 1) {
+        for (uint32_t i = 0; i < count; ++i) func(user_data, i);
+        return;
+    }
+
+    sn_mutex_lock(&pool->run_mutex);
+
+    sn_mutex_lock(&pool->mutex);
+    pool->func = func;
+    pool->user_data = user_data;
+    pool->count = count;
+    sn_atomic_store_u32(&pool->next, 0);
+    pool->active = pool->worker_count;
+    pool->generation++;
+    sn_cond_broadcast(&pool->start);
+    sn_mutex_unlock(&pool->mutex);
+
+    run_items(pool, func, user_data, count);
+
+    // Every worker has to leave the run before the next one can be published
+    sn_mutex_lock(&pool->mutex);
+    while (pool->active) sn_cond_wait(&pool->done, &pool->mutex);
+    sn_mutex_unlock(&pool->mutex);
+
+    sn_mutex_unlock(&pool->run_mutex);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "snfile/snfile.h"
+
+/**
+ * @struct SnPool
+ * @brief Opaque pool of worker threads.
+ */
+typedef struct SnPool SnPool;
+
+/**
+ * @brief Work item, called once for every index of a run.
+ */
+typedef void (*SnPoolFunc)(void *user_data, uint32_t index);
+
+/**
+ * @brief Create a pool.
+ *
+ * @param thread_count Number of threads working on a run including the caller, 0 for CPU count.
+ * @param pool Pointer to write the pool to.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+bool sn_pool_create(uint32_t thread_count, SnPool **pool);
+
+/**
+ * @brief Stop the threads and destroy the pool.
+ *
+ * @param pool The pool, can be NULL.
+ */
+void sn_pool_destroy(SnPool *pool);
+
+/**
+ * @brief Get the number of threads working on a run including the caller.
+ *
+ * @param pool The pool, NULL counts as a single thread.
+ *
+ * @return The number of threads.
+ */
+uint32_t sn_pool_thread_count(const SnPool *pool);
+
+/**
+ * @brief Call func for every index in [0, count) and wait for all of them.
+ *
+ * The calling thread takes part. Runs on the same pool are serialized.
+ *
+ * @param pool The pool, NULL runs everything on the calling thread.
+ * @param count Number of indices.
+ * @param func The work item.
+ * @param user_data Passed to func.
+ */
+void sn_pool_run(SnPool *pool, uint32_t count, SnPoolFunc func, void *user_data);
@@ -0,0 +1,98 @@
+#include "snfile/snfile.h"
+
+#include "src/internal.h"
+
+// Initial capacity for files which report size 0, like the ones in procfs
+#define READ_ALL_UNKNOWN_SIZE_CAPACITY 4096
+
+static bool read_unknown_size(SnFile *file, bool terminate, SnFileBuffer *buffer) {
+    uint64_t capacity = READ_ALL_UNKNOWN_SIZE_CAPACITY;
+    uint64_t size = 0;
+    char *data = sn_file_alloc(capacity);
+    if (!data) return false;
+
+    for (;;) {
+        // Keep one byte free for the terminator
+        if (size + 1 >= capacity) {
+            char *grown = sn_file_realloc(data, capacity, capacity * 2);
+            if (!grown) break;
+            data = grown;
+            capacity *= 2;
+        }
+
+        int64_t got = sn_file_read(file, data + size, capacity - size - 1);
+        if (got < 0) break;
+
+        if (got == 0) {
+            if (terminate) data[size] = 0;
+            *buffer = (SnFileBuffer){.data = data, .size = size, .capacity = capacity};
+            return true;
+        }
+
+        size += got;
+    }
+
+    sn_file_free(data, capacity);
+    return false;
+}
+
+bool sn_file_read_all(const char *path, int flags, SnFileBuffer *buffer) {
+    SnFile file;
+    if (!sn_file_open(path, SN_FILE_OPEN_FLAG_READ | SN_FILE_OPEN_FLAG_BINARY, &file)) return false;
+
+    bool terminate = flags & SN_FILE_READ_ALL_FLAG_NULL_TERMINATE;
+    uint64_t size = sn_file_size(&file);
+
+    if (!size) {
+        bool ok = read_unknown_size(&file, terminate, buffer);
+        sn_file_close(&file);
+        return ok;
+    }
+
+    if (size >= SN_FILE_READ_ALL_MAP_THRESHOLD && !terminate
+        && !(flags & SN_FILE_READ_ALL_FLAG_NO_MAP)) {
+        void *data = sn_file_map(&file, size);
+        if (data) {
+            sn_file_close(&file);
+            *buffer = (SnFileBuffer){.data = data, .size = size, .capacity = size, .mapped = true};
+            return true;
+        }
+    }
+
+    uint64_t capacity = size + (terminate ? 1 : 0);
+    char *data = sn_file_alloc(capacity);
+    if (!data) {
+        sn_file_close(&file);
+        return false;
+    }
+
+    // File may shrink while reading, stop at EOF
+    uint64_t filled = 0;
+    bool ok = true;
+    while (filled < size) {
+        int64_t got = sn_file_read(&file, data + filled, size - filled);
+        if (got < 0) ok = false;
+        if (got <= 0) break;
+        filled += got;
+    }
+
+    sn_file_close(&file);
+
+    if (!ok) {
+        sn_file_free(data, capacity);
+        return false;
+    }
+
+    if (terminate) data[filled] = 0;
+    *buffer = (SnFileBuffer){.data = data, .size = filled, .capacity = capacity};
+    return true;
+}
+
+void sn_file_buffer_free(SnFileBuffer *buffer) {
+    if (!buffer->data) return;
+
+    if (buffer->mapped) sn_file_unmap(buffer->data, buffer->capacity);
+    else sn_file_free(buffer->data, buffer->capacity);
+
+    *buffer = (SnFileBuffer){0};
+}
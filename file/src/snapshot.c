@@ -0,0 +1,490 @@
+#include "snfile/snapshot.h"
+
+#include "src/internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SNAPSHOT_MAGIC "SNSNAP01"
+#define SNAPSHOT_VERSION 1
+
+typedef struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t record_count;
+    uint64_t strings_size;
+    uint64_t root_inode;
+    uint64_t root_mtime_ns;
+} SnapshotHeader;
+
+typedef struct SnapshotRecord {
+    uint64_t inode;
+    uint64_t size;
+    uint64_t mtime_ns;
+    uint64_t path_offset;
+    uint32_t path_len;
+    uint32_t subtree_end; /**< Index past the last descendant */
+    uint8_t type;
+    uint8_t reserved[7];
+} SnapshotRecord;
+
+struct SnSnapshot {
+    const SnapshotHeader *header;
+    const SnapshotRecord *records;
+    const char *strings;
+
+    void *memory;
+    uint64_t memory_size;
+    bool mapped;
+};
+
+typedef struct SnapshotBuilder {
+    SnapshotRecord *records;
+    uint64_t record_count;
+    uint64_t record_capacity;
+
+    char *strings;
+    uint64_t strings_size;
+    uint64_t strings_capacity;
+
+    const SnSnapshot *base;
+    int flags;
+
+    char path[4096];
+    size_t rel_start;
+} SnapshotBuilder;
+
+typedef struct SnapshotChild {
+    char *name;
+    int64_t base_index;
+} SnapshotChild;
+
+static bool is_separator(char c) {
+    return c == '/' || c == '\\';
+}
+
+/**
+ * @brief Compare paths with separator ordered before any other character.
+ *
+ * This makes sorted order equal to depth first order with siblings sorted by name.
+ */
+static int compare_paths(const char *a, const char *b) {
+    for (;; ++a, ++b) {
+        int ca = is_separator(*a) ? 1 : *a ? (unsigned char)*a + 1 : 0;
+        int cb = is_separator(*b) ? 1 : *b ? (unsigned char)*b + 1 : 0;
+        if (ca != cb) return ca - cb;
+        if (!ca) return 0;
+    }
+}
+
+static int compare_children(const void *a, const void *b) {
+    return strcmp(((const SnapshotChild *)a)->name, ((const SnapshotChild *)b)->name);
+}
+
+static uint8_t entry_type(const SnFileInfo *info) {
+    if (info->is_symlink) return SN_SNAPSHOT_ENTRY_TYPE_SYMLINK;
+    if (info->is_directory) return SN_SNAPSHOT_ENTRY_TYPE_DIRECTORY;
+    if (info->is_file) return SN_SNAPSHOT_ENTRY_TYPE_FILE;
+    return SN_SNAPSHOT_ENTRY_TYPE_OTHER;
+}
+
+static const char *record_path(const SnSnapshot *snapshot, uint64_t index) {
+    return snapshot->strings + snapshot->records[index].path_offset;
+}
+
+static const char *record_name(const SnSnapshot *snapshot, uint64_t index) {
+    return sn_path_filename(record_path(snapshot, index));
+}
+
+static int64_t builder_push(SnapshotBuilder *b, const SnapshotRecord *record, const char *path,
+                            size_t path_len) {
+    if (b->record_count == b->record_capacity) {
+        uint64_t capacity = b->record_capacity ? b->record_capacity * 2 : 256;
+        SnapshotRecord *records = sn_file_realloc(
+            b->records, b->record_capacity * sizeof(SnapshotRecord), capacity * sizeof(SnapshotRecord));
+        if (!records) return -1;
+        b->records = records;
+        b->record_capacity = capacity;
+    }
+
+    if (b->strings_size + path_len + 1 > b->strings_capacity) {
+        uint64_t capacity = b->strings_capacity ? b->strings_capacity * 2 : 4096;
+        while (capacity < b->strings_size + path_len + 1) capacity *= 2;
+        char *strings = sn_file_realloc(b->strings, b->strings_capacity, capacity);
+        if (!strings) return -1;
+        b->strings = strings;
+        b->strings_capacity = capacity;
+    }
+
+    SnapshotRecord *r = &b->records[b->record_count];
+    *r = *record;
+    r->path_offset = b->strings_size;
+    r->path_len = (uint32_t)path_len;
+    r->subtree_end = (uint32_t)b->record_count + 1;
+
+    memcpy(b->strings + b->strings_size, path, path_len);
+    b->strings[b->strings_size + path_len] = 0;
+    b->strings_size += path_len + 1;
+
+    return (int64_t)b->record_count++;
+}
+
+static bool children_push(SnapshotChild **children, size_t *count, size_t *capacity,
+                          const char *name) {
+    if (*count == *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 16;
+        SnapshotChild *items = sn_file_realloc(*children, *capacity * sizeof(SnapshotChild),
+                                               new_capacity * sizeof(SnapshotChild));
+        if (!items) return false;
+        *children = items;
+        *capacity = new_capacity;
+    }
+
+    size_t len = strlen(name);
+    char *dup = sn_file_alloc(len + 1);
+    if (!dup) return false;
+    memcpy(dup, name, len + 1);
+
+    (*children)[(*count)++] = (SnapshotChild){.name = dup, .base_index = -1};
+    return true;
+}
+
+static void children_free(SnapshotChild *children, size_t count, size_t capacity) {
+    for (size_t i = 0; i < count; ++i) sn_file_free(children[i].name, strlen(children[i].name) + 1);
+    sn_file_free(children, capacity * sizeof(SnapshotChild));
+}
+
+/**
+ * @brief Append name to the builder path.
+ *
+ * @return Returns the new path length, 0 if it does not fit.
+ */
+static size_t path_append(SnapshotBuilder *b, size_t path_len, const char *name) {
+    size_t name_len = strlen(name);
+    size_t len = path_len;
+    if (len > 0 && !is_separator(b->path[len - 1])) {
+        if (len + 1 >= sizeof(b->path)) return 0;
+        b->path[len++] = SN_PATH_SEPARATOR;
+    }
+    if (len + name_len >= sizeof(b->path)) return 0;
+
+    memcpy(b->path + len, name, name_len + 1);
+    return len + name_len;
+}
+
+static bool scan_dir(SnapshotBuilder *b, size_t path_len, int64_t base_dir, bool base_unchanged) {
+    const SnSnapshot *base = b->base;
+    uint64_t base_begin = 0, base_end = 0;
+    if (base) {
+        base_begin = base_dir < 0 ? 0 : (uint64_t)base_dir + 1;
+        base_end = base_dir < 0 ? base->header->record_count : base->records[base_dir].subtree_end;
+    }
+
+    SnapshotChild *children = NULL;
+    size_t count = 0, capacity = 0;
+
+    if (base && base_unchanged) {
+        // Directory listing did not change, reuse the names from base
+        for (uint64_t i = base_begin; i < base_end; i = base->records[i].subtree_end) {
+            if (!children_push(&children, &count, &capacity, record_name(base, i))) {
+                children_free(children, count, capacity);
+                return false;
+            }
+            children[count - 1].base_index = (int64_t)i;
+        }
+    } else {
+        SnDir dir;
+        if (sn_dir_open(b->path, &dir)) {
+            SnDirEntry entry;
+            while (sn_dir_read(&dir, &entry)) {
+                if (strcmp(entry.name, ".") == 0 || strcmp(entry.name, "..") == 0) continue;
+                if (!children_push(&children, &count, &capacity, entry.name)) {
+                    sn_dir_close(&dir);
+                    children_free(children, count, capacity);
+                    return false;
+                }
+            }
+            sn_dir_close(&dir);
+        }
+
+        if (count) qsort(children, count, sizeof(SnapshotChild), compare_children);
+
+        // Both lists are sorted by name, pair them up
+        uint64_t i = base_begin;
+        for (size_t c = 0; c < count && i < base_end;) {
+            int cmp = strcmp(children[c].name, record_name(base, i));
+            if (cmp == 0) children[c++].base_index = (int64_t)i;
+            if (cmp >= 0) i = base->records[i].subtree_end;
+            else ++c;
+        }
+    }
+
+    bool ok = true;
+    for (size_t c = 0; ok && c < count; ++c) {
+        SnapshotChild *child = &children[c];
+        size_t child_len = path_append(b, path_len, child->name);
+        if (!child_len) continue;
+
+        const SnapshotRecord *base_record = child->base_index >= 0 ? &base->records[child->base_index]
+                                                                   : NULL;
+
+        SnapshotRecord record = {0};
+        if (base_record && base_unchanged && (b->flags & SN_SNAPSHOT_CAPTURE_FLAG_TRUST_DIR_MTIME)
+            && base_record->type != SN_SNAPSHOT_ENTRY_TYPE_DIRECTORY) {
+            record = *base_record;
+        } else {
+            SnFileInfo info;
+            if (!sn_file_lstat(b->path, &info)) {
+                b->path[path_len] = 0;
+                continue;
+            }
+
+            record = (SnapshotRecord){.inode = info.inode,
+                                      .size = info.is_directory ? 0 : info.size,
+                                      .mtime_ns = info.modified_time_ns,
+                                      .type = entry_type(&info)};
+        }
+
+        int64_t index = builder_push(b, &record, b->path + b->rel_start, child_len - b->rel_start);
+        if (index < 0) ok = false;
+
+        if (ok && record.type == SN_SNAPSHOT_ENTRY_TYPE_DIRECTORY) {
+            bool was_dir = base_record && base_record->type == SN_SNAPSHOT_ENTRY_TYPE_DIRECTORY;
+            bool unchanged = was_dir && base_record->inode == record.inode
+                          && base_record->mtime_ns == record.mtime_ns;
+
+            ok = scan_dir(b, child_len, was_dir ? child->base_index : -1, unchanged);
+            b->records[index].subtree_end = (uint32_t)b->record_count;
+        }
+
+        b->path[path_len] = 0;
+    }
+
+    children_free(children, count, capacity);
+    return ok;
+}
+
+static bool snapshot_from_builder(SnapshotBuilder *b, const SnFileInfo *root, SnSnapshot **snapshot) {
+    uint64_t records_size = b->record_count * sizeof(SnapshotRecord);
+    uint64_t memory_size = sizeof(SnapshotHeader) + records_size + b->strings_size;
+
+    SnSnapshot *s = sn_file_alloc(sizeof(SnSnapshot));
+    char *memory = sn_file_alloc(memory_size);
+    if (!s || !memory) {
+        sn_file_free(s, sizeof(SnSnapshot));
+        sn_file_free(memory, memory_size);
+        return false;
+    }
+
+    SnapshotHeader header = {.version = SNAPSHOT_VERSION,
+                             .record_size = sizeof(SnapshotRecord),
+                             .record_count = b->record_count,
+                             .strings_size = b->strings_size,
+                             .root_inode = root->inode,
+                             .root_mtime_ns = root->modified_time_ns};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+
+    memcpy(memory, &header, sizeof(header));
+    if (records_size) memcpy(memory + sizeof(header), b->records, records_size);
+    if (b->strings_size) memcpy(memory + sizeof(header) + records_size, b->strings, b->strings_size);
+
+    *s = (SnSnapshot){.header = (const SnapshotHeader *)memory,
+                      .records = (const SnapshotRecord *)(memory + sizeof(header)),
+                      .strings = memory + sizeof(header) + records_size,
+                      .memory = memory,
+                      .memory_size = memory_size,
+                      .mapped = false};
+
+    *snapshot = s;
+    return true;
+}
+
+bool sn_snapshot_capture(const char *root, const SnSnapshot *base, int flags, SnSnapshot **snapshot) {
+    SnFileInfo root_info;
+    if (!sn_file_stat(root, &root_info) || !root_info.is_directory) return false;
+
+    SnapshotBuilder *b = sn_file_alloc(sizeof(SnapshotBuilder));
+    if (!b) return false;
+
+    *b = (SnapshotBuilder){0};
+
+    b->base = base;
+    b->flags = flags;
+
+    size_t root_len = strlen(root);
+    if (root_len + 1 >= sizeof(b->path)) {
+        sn_file_free(b, sizeof(SnapshotBuilder));
+        return false;
+    }
+    memcpy(b->path, root, root_len + 1);
+    b->rel_start = root_len;
+    if (root_len > 0 && !is_separator(root[root_len - 1])) ++b->rel_start;
+
+    bool unchanged = base && base->header->root_inode == root_info.inode
+                  && base->header->root_mtime_ns == root_info.modified_time_ns;
+
+    bool ok = scan_dir(b, root_len, -1, unchanged)
+           && snapshot_from_builder(b, &root_info, snapshot);
+
+    sn_file_free(b->records, b->record_capacity * sizeof(SnapshotRecord));
+    sn_file_free(b->strings, b->strings_capacity);
+    sn_file_free(b, sizeof(SnapshotBuilder));
+    return ok;
+}
+
+void sn_snapshot_free(SnSnapshot *snapshot) {
+    if (!snapshot) return;
+
+    if (snapshot->mapped) sn_file_unmap(snapshot->memory, snapshot->memory_size);
+    else sn_file_free(snapshot->memory, snapshot->memory_size);
+
+    sn_file_free(snapshot, sizeof(SnSnapshot));
+}
+
+bool sn_snapshot_save(const SnSnapshot *snapshot, const char *path) {
+    char tmp[4096];
+    size_t len = strlen(path);
+    if (len + 5 >= sizeof(tmp)) return false;
+    memcpy(tmp, path, len);
+    memcpy(tmp + len, ".tmp", 5);
+
+    SnFile file;
+    int flags = SN_FILE_OPEN_FLAG_CREATE | SN_FILE_OPEN_FLAG_WRITE | SN_FILE_OPEN_FLAG_TRUNCATE
+              | SN_FILE_OPEN_FLAG_BINARY;
+    if (!sn_file_open(tmp, flags, &file)) return false;
+
+    const char *data = snapshot->memory;
+    uint64_t remaining = snapshot->memory_size;
+    while (remaining) {
+        int64_t written = sn_file_write(&file, data, remaining);
+        if (written <= 0) break;
+        data += written;
+        remaining -= written;
+    }
+
+    bool ok = !remaining && sn_file_flush(&file);
+    sn_file_close(&file);
+
+    if (!ok || !sn_file_move(tmp, path, true)) {
+        sn_file_delete(tmp);
+        return false;
+    }
+
+    return true;
+}
+
+static bool validate(const char *memory, uint64_t size) {
+    if (size < sizeof(SnapshotHeader)) return false;
+
+    const SnapshotHeader *header = (const SnapshotHeader *)memory;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0) return false;
+    if (header->version != SNAPSHOT_VERSION) return false;
+    if (header->record_size != sizeof(SnapshotRecord)) return false;
+
+    uint64_t available = size - sizeof(SnapshotHeader);
+    if (header->record_count > available / sizeof(SnapshotRecord)) return false;
+    if (header->strings_size != available - header->record_count * sizeof(SnapshotRecord))
+        return false;
+
+    const SnapshotRecord *records = (const SnapshotRecord *)(memory + sizeof(SnapshotHeader));
+    const char *strings = (const char *)(records + header->record_count);
+    for (uint64_t i = 0; i < header->record_count; ++i) {
+        const SnapshotRecord *r = &records[i];
+        if (r->path_offset >= header->strings_size
+            || r->path_len >= header->strings_size - r->path_offset)
+            return false;
+        if (strings[r->path_offset + r->path_len] != 0) return false;
+        if (r->subtree_end <= i || r->subtree_end > header->record_count) return false;
+    }
+
+    return true;
+}
+
+bool sn_snapshot_load(const char *path, SnSnapshot **snapshot) {
+    SnFile file;
+    if (!sn_file_open(path, SN_FILE_OPEN_FLAG_READ | SN_FILE_OPEN_FLAG_BINARY, &file)) return false;
+
+    uint64_t size = sn_file_size(&file);
+    char *memory = sn_file_map(&file, size);
+    sn_file_close(&file);
+
+    if (!memory) return false;
+
+    SnSnapshot *s = sn_file_alloc(sizeof(SnSnapshot));
+    if (!s || !validate(memory, size)) {
+        sn_file_free(s, sizeof(SnSnapshot));
+        sn_file_unmap(memory, size);
+        return false;
+    }
+
+    const SnapshotHeader *header = (const SnapshotHeader *)memory;
+    uint64_t records_size = header->record_count * sizeof(SnapshotRecord);
+
+    *s = (SnSnapshot){.header = header,
+                      .records = (const SnapshotRecord *)(memory + sizeof(SnapshotHeader)),
+                      .strings = memory + sizeof(SnapshotHeader) + records_size,
+                      .memory = memory,
+                      .memory_size = size,
+                      .mapped = true};
+
+    *snapshot = s;
+    return true;
+}
+
+uint64_t sn_snapshot_count(const SnSnapshot *snapshot) {
+    return snapshot->header->record_count;
+}
+
+static void fill_entry(const SnSnapshot *snapshot, uint64_t index, SnSnapshotEntry *entry) {
+    const SnapshotRecord *r = &snapshot->records[index];
+    *entry = (SnSnapshotEntry){.path = snapshot->strings + r->path_offset,
+                               .inode = r->inode,
+                               .size = r->size,
+                               .mtime_ns = r->mtime_ns,
+                               .type = (SnSnapshotEntryType)r->type};
+}
+
+bool sn_snapshot_get(const SnSnapshot *snapshot, uint64_t index, SnSnapshotEntry *entry) {
+    if (index >= snapshot->header->record_count) return false;
+    fill_entry(snapshot, index, entry);
+    return true;
+}
+
+static bool record_modified(const SnapshotRecord *a, const SnapshotRecord *b) {
+    if (a->type != b->type || a->inode != b->inode) return true;
+    if (a->type == SN_SNAPSHOT_ENTRY_TYPE_DIRECTORY) return false;
+    return a->size != b->size || a->mtime_ns != b->mtime_ns;
+}
+
+bool sn_snapshot_diff(const SnSnapshot *from, const SnSnapshot *to, SnSnapshotDiffCallback callback,
+                      void *user_data) {
+    uint64_t i = 0, j = 0;
+    uint64_t from_count = from->header->record_count;
+    uint64_t to_count = to->header->record_count;
+    SnSnapshotEntry entry;
+
+    while (i < from_count || j < to_count) {
+        int cmp;
+        if (i == from_count) cmp = 1;
+        else if (j == to_count) cmp = -1;
+        else cmp = compare_paths(record_path(from, i), record_path(to, j));
+
+        if (cmp < 0) {
+            fill_entry(from, i++, &entry);
+            if (!callback(SN_SNAPSHOT_CHANGE_REMOVED, &entry, user_data)) return false;
+        } else if (cmp > 0) {
+            fill_entry(to, j++, &entry);
+            if (!callback(SN_SNAPSHOT_CHANGE_ADDED, &entry, user_data)) return false;
+        } else {
+            if (record_modified(&from->records[i], &to->records[j])) {
+                fill_entry(to, j, &entry);
+                if (!callback(SN_SNAPSHOT_CHANGE_MODIFIED, &entry, user_data)) return false;
+            }
+            ++i;
+            ++j;
+        }
+    }
+
+    return true;
+}
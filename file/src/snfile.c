@@ -1,5 +1,8 @@
 #include "snfile/snfile.h"
 
+#include "src/internal.h"
+#include "src/thread.h"
+
 bool sn_path_join(char *dst, size_t dst_size, const char *a, const char *b) {
     size_t i = 0;
 
@@ -86,3 +89,52 @@ const char *sn_path_extension(const char *path) {
     return dot ? dot + 1 : NULL;
 }
 
+
+bool sn_file_lock_timeout(SnFile *file, uint64_t offset, uint64_t length, SnFileLockType type,
+                          uint32_t timeout_ms) {
+    // There is no portable timed lock, poll with backoff
+    uint64_t deadline = sn_time_ns() + (uint64_t)timeout_ms * 1000000;
+    uint32_t backoff = 1;
+
+    for (;;) {
+        if (sn_file_try_lock(file, offset, length, type)) return true;
+
+        uint64_t now = sn_time_ns();
+        if (now >= deadline) return false;
+
+        uint32_t left = (uint32_t)((deadline - now + 999999) / 1000000);
+        sn_thread_sleep(backoff < left ? backoff : left);
+        if (backoff < 32) backoff *= 2;
+    }
+}
+
+bool sn_file_write_all(SnFile *file, SnFileIoVec *iov, uint32_t count) {
+    while (count) {
+        int64_t written = sn_file_writev(file, iov, count);
+        if (written <= 0) return false;
+
+        // Skip fully written buffers and continue from the partial one
+        while (count && (uint64_t)written >= iov->size) {
+            written -= iov->size;
+            ++iov;
+            --count;
+        }
+        if (count) {
+            iov->data = (const char *)iov->data + written;
+            iov->size -= written;
+        }
+    }
+
+    return true;
+}
+
+bool sn_file_read_exact(SnFile *file, void *buffer, uint64_t size) {
+    char *p = buffer;
+    while (size) {
+        int64_t read = sn_file_read(file, p, size);
+        if (read <= 0) return false;
+        p += read;
+        size -= read;
+    }
+    return true;
+}
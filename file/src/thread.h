@@ -0,0 +1,227 @@
+#pragma once
+
+#include "snfile/snfile.h"
+
+#if defined(_MSC_VER)
+    #include <intrin.h>
+
+    #define SN_THREAD_LOCAL __declspec(thread)
+#else
+    #define SN_THREAD_LOCAL _Thread_local
+#endif
+
+/**
+ * @brief Thread entry point.
+ */
+typedef void (*SnThreadFunc)(void *arg);
+
+/**
+ * @struct SnThread
+ * @brief Opaque thread handle.
+ */
+typedef struct SnThread {
+    alignas(16) char buffer[32];
+} SnThread;
+
+/**
+ * @struct SnMutex
+ * @brief Opaque mutex.
+ */
+typedef struct SnMutex {
+    alignas(16) char buffer[64];
+} SnMutex;
+
+/**
+ * @struct SnCond
+ * @brief Opaque condition variable.
+ */
+typedef struct SnCond {
+    alignas(16) char buffer[64];
+} SnCond;
+
+/**
+ * @brief Start a thread.
+ *
+ * @note The thread handle must stay alive until sn_thread_join.
+ *
+ * @param thread The thread handle to initialize.
+ * @param func The entry point.
+ * @param arg The argument passed to func.
+ *
+ * @return Returns true on success, false otherwise.
+ */
+bool sn_thread_create(SnThread *thread, SnThreadFunc func, void *arg);
+
+/**
+ * @brief Wait for the thread to finish.
+ *
+ * @param thread The thread.
+ */
+void sn_thread_join(SnThread *thread);
+
+/**
+ * @brief Get the number of online CPUs.
+ *
+ * @return Number of CPUs, at least 1.
+ */
+uint32_t sn_thread_cpu_count(void);
+
+/**
+ * @brief Get the id of the calling thread.
+ *
+ * @return The thread id.
+ */
+uint64_t sn_thread_id(void);
+
+/**
+ * @brief Get the id of the process.
+ *
+ * @return The process id.
+ */
+uint64_t sn_process_id(void);
+
+/**
+ * @brief Yield the rest of the time slice.
+ */
+void sn_thread_yield(void);
+
+/**
+ * @brief Sleep for the given milliseconds.
+ *
+ * @param ms Milliseconds to sleep.
+ */
+void sn_thread_sleep(uint32_t ms);
+
+/**
+ * @brief Get the monotonic clock.
+ *
+ * @return Nanoseconds from an arbitrary point.
+ */
+uint64_t sn_time_ns(void);
+
+bool sn_mutex_init(SnMutex *mutex);
+
+void sn_mutex_destroy(SnMutex *mutex);
+
+void sn_mutex_lock(SnMutex *mutex);
+
+void sn_mutex_unlock(SnMutex *mutex);
+
+bool sn_cond_init(SnCond *cond);
+
+void sn_cond_destroy(SnCond *cond);
+
+void sn_cond_wait(SnCond *cond, SnMutex *mutex);
+
+/**
+ * @brief Wait on the condition for at most ms milliseconds.
+ *
+ * @return Returns false on timeout, true otherwise.
+ */
+bool sn_cond_timed_wait(SnCond *cond, SnMutex *mutex, uint32_t ms);
+
+void sn_cond_signal(SnCond *cond);
+
+void sn_cond_broadcast(SnCond *cond);
+
+// Sequentially consistent atomics on plain integers
+#if defined(_MSC_VER)
+
+static inline uint64_t sn_atomic_load_u64(volatile uint64_t *p) {
+    return (uint64_t)_InterlockedOr64((volatile long long *)p, 0);
+}
+
+static inline void sn_atomic_store_u64(volatile uint64_t *p, uint64_t value) {
+    _InterlockedExchange64((volatile long long *)p, (long long)value);
+}
+
+static inline uint64_t sn_atomic_fetch_add_u64(volatile uint64_t *p, uint64_t value) {
+    return (uint64_t)_InterlockedExchangeAdd64((volatile long long *)p, (long long)value);
+}
+
+static inline bool sn_atomic_cas_u64(volatile uint64_t *p, uint64_t *expected, uint64_t desired) {
+    long long prev = _InterlockedCompareExchange64((volatile long long *)p, (long long)desired,
+                                                   (long long)*expected);
+    if ((uint64_t)prev == *expected) return true;
+    *expected = (uint64_t)prev;
+    return false;
+}
+
+static inline uint32_t sn_atomic_load_u32(volatile uint32_t *p) {
+    return (uint32_t)_InterlockedOr((volatile long *)p, 0);
+}
+
+static inline void sn_atomic_store_u32(volatile uint32_t *p, uint32_t value) {
+    _InterlockedExchange((volatile long *)p, (long)value);
+}
+
+static inline uint32_t sn_atomic_fetch_add_u32(volatile uint32_t *p, uint32_t value) {
+    return (uint32_t)_InterlockedExchangeAdd((volatile long *)p, (long)value);
+}
+
+static inline bool sn_atomic_cas_u32(volatile uint32_t *p, uint32_t *expected, uint32_t desired) {
+    long prev = _InterlockedCompareExchange((volatile long *)p, (long)desired, (long)*expected);
+    if ((uint32_t)prev == *expected) return true;
+    *expected = (uint32_t)prev;
+    return false;
+}
+
+#else
+
+static inline uint64_t sn_atomic_load_u64(volatile uint64_t *p) {
+    return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+
+static inline void sn_atomic_store_u64(volatile uint64_t *p, uint64_t value) {
+    __atomic_store_n(p, value, __ATOMIC_SEQ_CST);
+}
+
+static inline uint64_t sn_atomic_fetch_add_u64(volatile uint64_t *p, uint64_t value) {
+    return __atomic_fetch_add(p, value, __ATOMIC_SEQ_CST);
+}
+
+static inline bool sn_atomic_cas_u64(volatile uint64_t *p, uint64_t *expected, uint64_t desired) {
+    return __atomic_compare_exchange_n(p, expected, desired, false, __ATOMIC_SEQ_CST,
+                                       __ATOMIC_SEQ_CST);
+}
+
+static inline uint32_t sn_atomic_load_u32(volatile uint32_t *p) {
+    return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+
+static inline void sn_atomic_store_u32(volatile uint32_t *p, uint32_t value) {
+    __atomic_store_n(p, value, __ATOMIC_SEQ_CST);
+}
+
+static inline uint32_t sn_atomic_fetch_add_u32(volatile uint32_t *p, uint32_t value) {
+    return __atomic_fetch_add(p, value, __ATOMIC_SEQ_CST);
+}
+
+static inline bool sn_atomic_cas_u32(volatile uint32_t *p, uint32_t *expected, uint32_t desired) {
+    return __atomic_compare_exchange_n(p, expected, desired, false, __ATOMIC_SEQ_CST,
+                                       __ATOMIC_SEQ_CST);
+}
+
+#endif
+
+/**
+ * @brief Acquire a spin lock, for short rarely contended sections.
+ *
+ * @param lock The lock word, 0 when unlocked.
+ */
+static inline void sn_spin_lock(volatile uint32_t *lock) {
+    for (;;) {
+        uint32_t expected = 0;
+        if (sn_atomic_cas_u32(lock, &expected, 1)) return;
+        sn_thread_yield();
+    }
+}
+
+/**
+ * @brief Release a spin lock.
+ *
+ * @param lock The lock word.
+ */
+static inline void sn_spin_unlock(volatile uint32_t *lock) {
+    sn_atomic_store_u32(lock, 0);
+}
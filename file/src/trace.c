@@ -0,0 +1,333 @@
+#include "snfile/trace.h"
+
+#include "src/internal.h"
+#include "src/thread.h"
+#include "src/trace.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define TRACE_RINGS 64
+#define TRACE_DEFAULT_EVENTS 4096
+#define TRACE_MAX_EVENTS (1u << 24)
+
+#define EXPORT_BUFFER_SIZE (1 << 16)
+// Largest event line, the path escaped to \u00XX at worst
+#define EXPORT_EVENT_MAX (256 + SN_TRACE_PATH_SIZE * 6)
+
+/*
+ * Writers bump the sequence of a slot to odd, fill the event and bump it to
+ * even again. Readers keep an event only if the sequence before and after
+ * copying is the even value of the position they expect.
+ */
+typedef struct TraceSlot {
+    volatile uint64_t sequence;
+    SnTraceEvent event;
+} TraceSlot;
+
+typedef struct TraceRing {
+    volatile uint64_t head; // Events ever written
+    uint64_t capacity;      // Power of 2
+    TraceSlot slots[];
+} TraceRing;
+
+volatile uint32_t sn_trace_active;
+
+static volatile uint32_t trace_lock;
+static uint64_t trace_capacity = TRACE_DEFAULT_EVENTS;
+static volatile uint32_t trace_generation = 1;
+static volatile uint32_t trace_claims;
+static volatile uint64_t trace_rings[TRACE_RINGS]; // TraceRing pointers
+
+// Ring of the thread, valid while local_generation matches
+static SN_THREAD_LOCAL TraceRing *local_ring;
+static SN_THREAD_LOCAL uint32_t local_generation;
+static SN_THREAD_LOCAL uint64_t local_thread;
+
+static const char *op_names[] = {
+    [SN_TRACE_OP_OPEN] = "sn_file_open",
+    [SN_TRACE_OP_CLOSE] = "sn_file_close",
+    [SN_TRACE_OP_READ] = "sn_file_read",
+    [SN_TRACE_OP_WRITE] = "sn_file_write",
+    [SN_TRACE_OP_READ_AT] = "sn_file_read_at",
+    [SN_TRACE_OP_WRITE_AT] = "sn_file_write_at",
+    [SN_TRACE_OP_WRITEV] = "sn_file_writev",
+    [SN_TRACE_OP_SEEK] = "sn_file_seek",
+    [SN_TRACE_OP_FLUSH] = "sn_file_flush",
+    [SN_TRACE_OP_STAT] = "sn_file_stat",
+    [SN_TRACE_OP_LSTAT] = "sn_file_lstat",
+    [SN_TRACE_OP_DELETE] = "sn_file_delete",
+    [SN_TRACE_OP_MOVE] = "sn_file_move",
+    [SN_TRACE_OP_COPY] = "sn_file_copy",
+    [SN_TRACE_OP_DIR_OPEN] = "sn_dir_open",
+    [SN_TRACE_OP_DIR_READ] = "sn_dir_read",
+    [SN_TRACE_OP_DIR_CLOSE] = "sn_dir_close",
+    [SN_TRACE_OP_DIR_CREATE] = "sn_dir_create",
+    [SN_TRACE_OP_DIR_DELETE] = "sn_dir_delete",
+    [SN_TRACE_OP_TELL] = "sn_file_tell",
+    [SN_TRACE_OP_SIZE] = "sn_file_size",
+    [SN_TRACE_OP_SYNC_DATA] = "sn_file_sync_data",
+    [SN_TRACE_OP_DIR_SYNC] = "sn_dir_sync",
+    [SN_TRACE_OP_ALLOCATE] = "sn_file_allocate",
+    [SN_TRACE_OP_PUNCH_HOLE] = "sn_file_punch_hole",
+    [SN_TRACE_OP_NEXT_EXTENT] = "sn_file_next_extent",
+    [SN_TRACE_OP_LOCK] = "sn_file_lock",
+    [SN_TRACE_OP_TRY_LOCK] = "sn_file_try_lock",
+    [SN_TRACE_OP_UNLOCK] = "sn_file_unlock",
+    [SN_TRACE_OP_OPEN_TEMP] = "sn_file_open_temp",
+    [SN_TRACE_OP_PUBLISH_TEMP] = "sn_file_publish_temp",
+    [SN_TRACE_OP_REALPATH] = "sn_path_realpath",
+};
+
+SN_STATIC_ASSERT(SN_ARRAY_LENGTH(op_names) == SN_TRACE_OP_COUNT, "Missing trace op names!");
+
+static size_t ring_size(uint64_t capacity) {
+    return sizeof(TraceRing) + capacity * sizeof(TraceSlot);
+}
+
+static TraceRing *load_ring(uint32_t index) {
+    return (TraceRing *)(uintptr_t)sn_atomic_load_u64(&trace_rings[index]);
+}
+
+/**
+ * @brief Get the ring of the calling thread, claiming one on first use.
+ */
+static TraceRing *thread_ring(void) {
+    uint32_t generation = sn_atomic_load_u32(&trace_generation);
+    if (local_ring && local_generation == generation) return local_ring;
+
+    if (!local_thread) local_thread = sn_thread_id();
+
+    // Threads get rings of their own until they run out, then share them
+    uint32_t index = sn_atomic_fetch_add_u32(&trace_claims, 1) % TRACE_RINGS;
+
+    sn_spin_lock(&trace_lock);
+    TraceRing *ring = load_ring(index);
+    if (!ring) {
+        ring = sn_file_alloc(ring_size(trace_capacity));
+        if (ring) {
+            // Zero sequences never match a written position
+            memset(ring, 0, ring_size(trace_capacity));
+            ring->capacity = trace_capacity;
+            sn_atomic_store_u64(&trace_rings[index], (uintptr_t)ring);
+        }
+    }
+    sn_spin_unlock(&trace_lock);
+
+    local_ring = ring;
+    local_generation = generation;
+    return ring;
+}
+
+/**
+ * @brief Copy the end of path, without starting in the middle of a UTF-8 sequence.
+ */
+static void copy_path_tail(char *dst, const char *path) {
+    size_t length = path ? strlen(path) : 0;
+    if (length >= SN_TRACE_PATH_SIZE) {
+        path += length - (SN_TRACE_PATH_SIZE - 1);
+        length = SN_TRACE_PATH_SIZE - 1;
+        while (length && (*path & 0xc0) == 0x80) {
+            ++path;
+            --length;
+        }
+    }
+
+    if (length) memcpy(dst, path, length);
+    dst[length] = 0;
+}
+
+void sn_trace_record(uint64_t start, SnTraceOp op, int64_t handle, const char *path,
+                     uint64_t bytes, int64_t result) {
+    uint64_t end = sn_time_ns();
+
+    TraceRing *ring = thread_ring();
+    if (!ring) return;
+
+    uint64_t position = sn_atomic_fetch_add_u64(&ring->head, 1);
+    TraceSlot *slot = &ring->slots[position & (ring->capacity - 1)];
+
+    sn_atomic_store_u64(&slot->sequence, 2 * position + 1);
+
+    SnTraceEvent *event = &slot->event;
+    event->start_ns = start;
+    event->duration_ns = end - start;
+    event->thread_id = local_thread;
+    event->handle = handle;
+    event->bytes = bytes;
+    event->result = result;
+    event->op = op;
+    copy_path_tail(event->path, path);
+
+    sn_atomic_store_u64(&slot->sequence, 2 * position + 2);
+}
+
+bool sn_trace_start(uint32_t events_per_thread) {
+    uint64_t events = events_per_thread ? events_per_thread : TRACE_DEFAULT_EVENTS;
+    if (events > TRACE_MAX_EVENTS) return false;
+
+    uint64_t capacity = 1;
+    while (capacity < events) capacity <<= 1;
+
+    sn_spin_lock(&trace_lock);
+    trace_capacity = capacity;
+    sn_spin_unlock(&trace_lock);
+
+    sn_atomic_store_u32(&sn_trace_active, 1);
+    return true;
+}
+
+void sn_trace_stop(void) {
+    sn_atomic_store_u32(&sn_trace_active, 0);
+}
+
+void sn_trace_reset(void) {
+    // Callers guarantee nothing records or collects, see trace.h
+    sn_spin_lock(&trace_lock);
+    for (uint32_t i = 0; i < TRACE_RINGS; ++i) {
+        TraceRing *ring = load_ring(i);
+        if (!ring) continue;
+        sn_file_free(ring, ring_size(ring->capacity));
+        sn_atomic_store_u64(&trace_rings[i], 0);
+    }
+
+    sn_atomic_store_u32(&trace_claims, 0);
+    // Threads holding a freed ring claim a new one
+    sn_atomic_fetch_add_u32(&trace_generation, 1);
+    sn_spin_unlock(&trace_lock);
+}
+
+/**
+ * @brief Copy the intact events of ring, oldest first.
+ *
+ * @return Number of events copied.
+ */
+static uint64_t snapshot(TraceRing *ring, SnTraceEvent *events) {
+    uint64_t head = sn_atomic_load_u64(&ring->head);
+    uint64_t first = head > ring->capacity ? head - ring->capacity : 0;
+
+    uint64_t count = 0;
+    for (uint64_t position = first; position < head; ++position) {
+        TraceSlot *slot = &ring->slots[position & (ring->capacity - 1)];
+        uint64_t sequence = sn_atomic_load_u64(&slot->sequence);
+        if (sequence != 2 * position + 2) continue;
+
+        events[count] = slot->event;
+        if (sn_atomic_load_u64(&slot->sequence) == sequence) ++count;
+    }
+
+    return count;
+}
+
+uint64_t sn_trace_collect(SnTraceCallback callback, void *user_data) {
+    uint64_t total = 0;
+
+    for (uint32_t i = 0; i < TRACE_RINGS; ++i) {
+        TraceRing *ring = load_ring(i);
+        if (!ring) continue;
+
+        // Copied first, the callback may well trace operations into this ring
+        SnTraceEvent *events = sn_file_alloc(ring->capacity * sizeof(SnTraceEvent));
+        if (!events) continue;
+
+        uint64_t count = snapshot(ring, events);
+        for (uint64_t j = 0; j < count; ++j) callback(&events[j], user_data);
+        total += count;
+
+        sn_file_free(events, ring->capacity * sizeof(SnTraceEvent));
+    }
+
+    return total;
+}
+
+typedef struct ChromeExport {
+    SnFile file;
+    char *buffer;
+    size_t used;
+    uint64_t process_id;
+    uint64_t events;
+    bool ok;
+} ChromeExport;
+
+static void export_flush(ChromeExport *export) {
+    SnFileIoVec iov = {.data = export->buffer, .size = export->used};
+    if (export->ok && export->used) export->ok = sn_file_write_all(&export->file, &iov, 1);
+    export->used = 0;
+}
+
+static void export_append(ChromeExport *export, const char *text) {
+    size_t length = strlen(text);
+    if (export->used + length > EXPORT_BUFFER_SIZE) export_flush(export);
+    memcpy(export->buffer + export->used, text, length);
+    export->used += length;
+}
+
+static size_t escape_json(char *dst, const char *src) {
+    size_t length = 0;
+    for (; *src; ++src) {
+        unsigned char c = (unsigned char)*src;
+        if (c == '"' || c == '\\') {
+            dst[length++] = '\\';
+            dst[length++] = (char)c;
+        } else if (c < 0x20) {
+            length += sprintf(dst + length, "\\u%04x", c);
+        } else {
+            dst[length++] = (char)c;
+        }
+    }
+    dst[length] = 0;
+    return length;
+}
+
+static void export_event(const SnTraceEvent *event, void *user_data) {
+    ChromeExport *export = user_data;
+    if (export->used + EXPORT_EVENT_MAX > EXPORT_BUFFER_SIZE) export_flush(export);
+
+    char path[SN_TRACE_PATH_SIZE * 6];
+    escape_json(path, event->path);
+
+    // Chrome wants microseconds
+    char *line = export->buffer + export->used;
+    int written = snprintf(
+        line, EXPORT_BUFFER_SIZE - export->used,
+        "%s{\"name\":\"%s\",\"cat\":\"snfile\",\"ph\":\"X\",\"ts\":%llu.%03llu,"
+        "\"dur\":%llu.%03llu,\"pid\":%llu,\"tid\":%llu,\"args\":{\"handle\":%lld,"
+        "\"path\":\"%s\",\"bytes\":%llu,\"result\":%lld}}",
+        export->events ? ",\n" : "", sn_trace_op_name(event->op),
+        (unsigned long long)(event->start_ns / 1000), (unsigned long long)(event->start_ns % 1000),
+        (unsigned long long)(event->duration_ns / 1000),
+        (unsigned long long)(event->duration_ns % 1000), (unsigned long long)export->process_id,
+        (unsigned long long)event->thread_id, (long long)event->handle, path,
+        (unsigned long long)event->bytes, (long long)event->result);
+
+    if (written > 0) export->used += (size_t)written;
+    ++export->events;
+}
+
+bool sn_trace_export_chrome(const char *path) {
+    ChromeExport export = {.process_id = sn_process_id(), .ok = true};
+
+    export.buffer = sn_file_alloc(EXPORT_BUFFER_SIZE);
+    if (!export.buffer) return false;
+
+    int flags = SN_FILE_OPEN_FLAG_CREATE | SN_FILE_OPEN_FLAG_WRITE | SN_FILE_OPEN_FLAG_TRUNCATE;
+    if (!sn_file_open(path, flags, &export.file)) {
+        sn_file_free(export.buffer, EXPORT_BUFFER_SIZE);
+        return false;
+    }
+
+    export_append(&export, "{\"traceEvents\":[\n");
+    sn_trace_collect(export_event, &export);
+    export_append(&export, "\n],\"displayTimeUnit\":\"ns\"}\n");
+    export_flush(&export);
+
+    sn_file_close(&export.file);
+    sn_file_free(export.buffer, EXPORT_BUFFER_SIZE);
+
+    if (!export.ok) sn_file_delete(path);
+    return export.ok;
+}
+
+const char *sn_trace_op_name(SnTraceOp op) {
+    return (unsigned)op < SN_TRACE_OP_COUNT ? op_names[op] : "unknown";
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "snfile/trace.h"
+
+#include "src/thread.h"
+
+#if defined(SN_FILE_USDT)
+    #include <sys/sdt.h>
+
+    #define SN_TRACE_PROBE_BEGIN(op) DTRACE_PROBE1(snfile, op_begin, op)
+    #define SN_TRACE_PROBE_END(op, handle, path, bytes, result)                                    \
+        DTRACE_PROBE5(snfile, op_end, op, handle, path, bytes, result)
+#else
+    #define SN_TRACE_PROBE_BEGIN(op) ((void)0)
+    #define SN_TRACE_PROBE_END(op, handle, path, bytes, result) ((void)0)
+#endif
+
+// Non zero while sn_trace_start is in effect
+extern volatile uint32_t sn_trace_active;
+
+/**
+ * @brief Record an operation that started at start into the ring of the thread.
+ */
+void sn_trace_record(uint64_t start, SnTraceOp op, int64_t handle, const char *path,
+                     uint64_t bytes, int64_t result);
+
+/**
+ * @brief Mark the start of an operation, at most once per scope.
+ */
+#define SN_TRACE_BEGIN(op)                                                                         \
+    uint64_t sn_trace_start_ = sn_atomic_load_u32(&sn_trace_active) ? sn_time_ns() : 0;            \
+    SN_TRACE_PROBE_BEGIN(op)
+
+/**
+ * @brief Mark the end of the operation started with SN_TRACE_BEGIN.
+ */
+#define SN_TRACE_END(op, handle, path, bytes, result)                                              \
+    do {                                                                                           \
+        SN_TRACE_PROBE_END(op, handle, path, bytes, result);                                       \
+        if (sn_trace_start_)                                                                       \
+            sn_trace_record(sn_trace_start_, op, handle, path, bytes, (int64_t)(result));          \
+    } while (0)
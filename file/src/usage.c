@@ -0,0 +1,326 @@
+#include "snfile/usage.h"
+
+#include "src/internal.h"
+#include "src/pool.h"
+#include "src/thread.h"
+
+#include <string.h>
+
+#define INODE_SET_SHARDS 64
+#define INODE_SET_MIN_CAPACITY 64
+
+/*
+ * Directories are queued as nodes and listed by any thread. A node stays alive
+ * until its own listing and all child directories are done, pending counts
+ * those. The last one to finish reports the node, adds its totals to the
+ * parent and finishes the parent in turn.
+ */
+typedef struct UsageDir {
+    struct UsageDir *parent;
+    struct UsageDir *next; // Queue link
+
+    char *path;
+    size_t path_size;
+    uint32_t depth;
+
+    volatile uint32_t pending;
+    SnDirUsage usage; // Updated atomically
+} UsageDir;
+
+// Open addressed set of (device, inode), (0, 0) marks an empty slot
+typedef struct InodeShard {
+    SnMutex mutex;
+    uint64_t *keys; // Pairs
+    uint64_t capacity;
+    uint64_t count;
+} InodeShard;
+
+typedef struct UsageWalk {
+    const SnDirUsageConfig *config;
+    uint64_t root_device;
+
+    SnMutex mutex;
+    SnCond cond;
+    UsageDir *queue;
+    uint32_t active;
+
+    SnMutex report_mutex;
+    InodeShard shards[INODE_SET_SHARDS];
+
+    volatile uint32_t failed;
+    SnDirUsage result;
+} UsageWalk;
+
+static uint64_t hash_inode(uint64_t device, uint64_t inode) {
+    uint64_t h = inode * 0x9e3779b97f4a7c15ull ^ device;
+    h ^= h >> 31;
+    h *= 0xbf58476d1ce4e5b9ull;
+    return h ^ (h >> 29);
+}
+
+static void inode_set_put(uint64_t *keys, uint64_t capacity, uint64_t hash, uint64_t device,
+                          uint64_t inode) {
+    for (uint64_t i = hash & (capacity - 1);; i = (i + 1) & (capacity - 1)) {
+        if (!keys[2 * i] && !keys[2 * i + 1]) {
+            keys[2 * i] = device;
+            keys[2 * i + 1] = inode;
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Insert into the set.
+ *
+ * @return Returns true if it was not in the set (or could not be tracked), false otherwise.
+ */
+static bool inode_set_insert(UsageWalk *walk, uint64_t device, uint64_t inode) {
+    if (!device && !inode) return true;
+
+    uint64_t hash = hash_inode(device, inode);
+    InodeShard *shard = &walk->shards[hash % INODE_SET_SHARDS];
+    // Lower bits pick the shard, use the upper ones inside it
+    hash >>= 6;
+
+    sn_mutex_lock(&shard->mutex);
+
+    uint64_t mask = shard->capacity - 1;
+    for (uint64_t i = hash & mask; shard->capacity; i = (i + 1) & mask) {
+        uint64_t *key = &shard->keys[2 * i];
+        if (!key[0] && !key[1]) break;
+        if (key[0] == device && key[1] == inode) {
+            sn_mutex_unlock(&shard->mutex);
+            return false;
+        }
+    }
+
+    // Keep the load under a half
+    if ((shard->count + 1) * 2 > shard->capacity) {
+        uint64_t capacity = shard->capacity ? shard->capacity * 2 : INODE_SET_MIN_CAPACITY;
+        uint64_t *keys = sn_file_alloc(capacity * 2 * sizeof(uint64_t));
+        if (!keys) {
+            sn_mutex_unlock(&shard->mutex);
+            sn_atomic_store_u32(&walk->failed, 1);
+            return true;
+        }
+        memset(keys, 0, capacity * 2 * sizeof(uint64_t));
+
+        for (uint64_t i = 0; i < shard->capacity; ++i) {
+            uint64_t *key = &shard->keys[2 * i];
+            if (key[0] || key[1])
+                inode_set_put(keys, capacity, hash_inode(key[0], key[1]) >> 6, key[0], key[1]);
+        }
+
+        sn_file_free(shard->keys, shard->capacity * 2 * sizeof(uint64_t));
+        shard->keys = keys;
+        shard->capacity = capacity;
+    }
+
+    inode_set_put(shard->keys, shard->capacity, hash, device, inode);
+    shard->count++;
+
+    sn_mutex_unlock(&shard->mutex);
+    return true;
+}
+
+static void add_usage(SnDirUsage *dst, const SnDirUsage *src) {
+    sn_atomic_fetch_add_u64((volatile uint64_t *)&dst->apparent_size, src->apparent_size);
+    sn_atomic_fetch_add_u64((volatile uint64_t *)&dst->allocated_size, src->allocated_size);
+    sn_atomic_fetch_add_u64((volatile uint64_t *)&dst->file_count, src->file_count);
+    sn_atomic_fetch_add_u64((volatile uint64_t *)&dst->dir_count, src->dir_count);
+    sn_atomic_fetch_add_u64((volatile uint64_t *)&dst->error_count, src->error_count);
+}
+
+static UsageDir *dir_create(UsageDir *parent, const char *path, const SnFileInfo *info) {
+    UsageDir *dir = sn_file_alloc(sizeof(UsageDir));
+    if (!dir) return NULL;
+
+    size_t path_size = strlen(path) + 1;
+    *dir = (UsageDir){.parent = parent,
+                      .path_size = path_size,
+                      .depth = parent ? parent->depth + 1 : 0,
+                      .pending = 1,
+                      .usage = {.apparent_size = info->size,
+                                .allocated_size = info->allocated_size,
+                                .dir_count = 1}};
+
+    dir->path = sn_file_alloc(path_size);
+    if (!dir->path) {
+        sn_file_free(dir, sizeof(UsageDir));
+        return NULL;
+    }
+    memcpy(dir->path, path, path_size);
+
+    return dir;
+}
+
+static void dir_free(UsageDir *dir) {
+    sn_file_free(dir->path, dir->path_size);
+    sn_file_free(dir, sizeof(UsageDir));
+}
+
+static void push(UsageWalk *walk, UsageDir *dir) {
+    sn_mutex_lock(&walk->mutex);
+    dir->next = walk->queue;
+    walk->queue = dir;
+    sn_cond_signal(&walk->cond);
+    sn_mutex_unlock(&walk->mutex);
+}
+
+/**
+ * @brief Take a directory from the queue.
+ *
+ * @return Returns NULL once the queue is empty and no thread can add to it.
+ */
+static UsageDir *pop(UsageWalk *walk) {
+    sn_mutex_lock(&walk->mutex);
+
+    while (!walk->queue && walk->active) sn_cond_wait(&walk->cond, &walk->mutex);
+
+    UsageDir *dir = walk->queue;
+    if (dir) {
+        walk->queue = dir->next;
+        walk->active++;
+    }
+
+    sn_mutex_unlock(&walk->mutex);
+    return dir;
+}
+
+static void finish_listing(UsageWalk *walk) {
+    sn_mutex_lock(&walk->mutex);
+    if (--walk->active == 0 && !walk->queue) sn_cond_broadcast(&walk->cond);
+    sn_mutex_unlock(&walk->mutex);
+}
+
+/**
+ * @brief Drop one pending count, reporting and folding finished directories upwards.
+ */
+static void complete(UsageWalk *walk, UsageDir *dir) {
+    while (dir && sn_atomic_fetch_add_u32(&dir->pending, (uint32_t)-1) == 1) {
+        const SnDirUsageConfig *config = walk->config;
+        if (config->callback && dir->depth <= config->report_depth) {
+            sn_mutex_lock(&walk->report_mutex);
+            config->callback(dir->path, dir->depth, &dir->usage, config->user_data);
+            sn_mutex_unlock(&walk->report_mutex);
+        }
+
+        UsageDir *parent = dir->parent;
+        if (parent) add_usage(&parent->usage, &dir->usage);
+        else walk->result = dir->usage;
+
+        dir_free(dir);
+        dir = parent;
+    }
+}
+
+static void list_dir(UsageWalk *walk, UsageDir *dir) {
+    SnDirUsage local = {0};
+    bool one_filesystem = walk->config->flags & SN_DIR_USAGE_FLAG_ONE_FILESYSTEM;
+
+    SnDir d;
+    if (!sn_dir_open(dir->path, &d)) {
+        local.error_count++;
+        // Unreadable subdirectories are counted, an unreadable root fails the walk
+        if (!dir->parent) sn_atomic_store_u32(&walk->failed, 1);
+    } else {
+        char path[4096];
+        SnDirEntry entry;
+        while (sn_dir_read(&d, &entry)) {
+            if (strcmp(entry.name, ".") == 0 || strcmp(entry.name, "..") == 0) continue;
+
+            SnFileInfo info;
+            if (!sn_path_join(path, sizeof(path), dir->path, entry.name)
+                || !sn_file_lstat(path, &info)) {
+                local.error_count++;
+                continue;
+            }
+
+            if (info.is_directory && !info.is_symlink) {
+                if (one_filesystem && info.device != walk->root_device) continue;
+
+                UsageDir *child = dir_create(dir, path, &info);
+                if (!child) {
+                    sn_atomic_store_u32(&walk->failed, 1);
+                    local.error_count++;
+                    continue;
+                }
+
+                sn_atomic_fetch_add_u32(&dir->pending, 1);
+                push(walk, child);
+                continue;
+            }
+
+            if (info.link_count > 1 && !inode_set_insert(walk, info.device, info.inode)) continue;
+
+            local.apparent_size += info.size;
+            local.allocated_size += info.allocated_size;
+            local.file_count++;
+        }
+        sn_dir_close(&d);
+    }
+
+    add_usage(&dir->usage, &local);
+    complete(walk, dir);
+}
+
+static void walker(void *user_data, uint32_t index) {
+    SN_UNUSED(index);
+    UsageWalk *walk = user_data;
+
+    UsageDir *dir;
+    while ((dir = pop(walk))) {
+        list_dir(walk, dir);
+        finish_listing(walk);
+    }
+}
+
+bool sn_dir_usage(const char *root, const SnDirUsageConfig *config, SnDirUsage *usage) {
+    SnDirUsageConfig defaults = {0};
+    if (!config) config = &defaults;
+
+    SnFileInfo info;
+    if (!sn_file_stat(root, &info) || !info.is_directory) return false;
+
+    UsageWalk *walk = sn_file_alloc(sizeof(UsageWalk));
+    if (!walk) return false;
+    *walk = (UsageWalk){.config = config, .root_device = info.device};
+
+    bool ok = false;
+    uint32_t shards = 0;
+    SnPool *pool = NULL;
+
+    if (!sn_mutex_init(&walk->mutex)) goto fail_mutex;
+    if (!sn_cond_init(&walk->cond)) goto fail_cond;
+    if (!sn_mutex_init(&walk->report_mutex)) goto fail_report;
+    for (; shards < INODE_SET_SHARDS; ++shards)
+        if (!sn_mutex_init(&walk->shards[shards].mutex)) goto fail_shards;
+
+    if (!sn_pool_create(config->thread_count, &pool)) goto fail_shards;
+
+    UsageDir *dir = dir_create(NULL, root, &info);
+    if (!dir) goto fail_root;
+    walk->queue = dir;
+
+    sn_pool_run(pool, sn_pool_thread_count(pool), walker, walk);
+
+    *usage = walk->result;
+    ok = !sn_atomic_load_u32(&walk->failed);
+
+fail_root:
+    sn_pool_destroy(pool);
+fail_shards:
+    for (uint32_t i = 0; i < shards; ++i) {
+        InodeShard *shard = &walk->shards[i];
+        sn_file_free(shard->keys, shard->capacity * 2 * sizeof(uint64_t));
+        sn_mutex_destroy(&shard->mutex);
+    }
+    sn_mutex_destroy(&walk->report_mutex);
+fail_report:
+    sn_cond_destroy(&walk->cond);
+fail_cond:
+    sn_mutex_destroy(&walk->mutex);
+fail_mutex:
+    sn_file_free(walk, sizeof(UsageWalk));
+    return ok;
+}
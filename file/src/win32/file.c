@@ -1,10 +1,17 @@
 #include "snfile/snfile.h"
 
+#include "src/internal.h"
+#include "src/thread.h"
+#include "src/trace.h"
+
 #if defined(SN_OS_WINDOWS)
 
     #include <sncore/utf.h>
+    #include <stdio.h>
     #include <string.h>
+    #include <wchar.h>
     #include <windows.h>
+    #include <winioctl.h>
 
 typedef struct SnFileWin32 {
     HANDLE handle;
@@ -24,6 +31,8 @@ typedef struct SnDirWin32 {
     #define DFIRST(dir) (((SnDirWin32 *)(dir))->first)
     #define DCURR_NAME(dir) (((SnDirWin32 *)(dir))->current_name)
 
+    #define TRACE_HANDLE(handle) ((int64_t)(intptr_t)(handle))
+
 SN_STATIC_ASSERT(sizeof(SnFileWin32) <= sizeof(SnFile), "SnFile size is not large enough!");
 SN_STATIC_ASSERT(sizeof(SnDirWin32) <= sizeof(SnDir), "SnDir size is not large enough!");
 
@@ -45,7 +54,7 @@ static DWORD file_creation(int flags) {
     return OPEN_EXISTING;
 }
 
-bool sn_file_open(const char *path, SnFileOpenFlag flags, SnFile *file) {
+static bool open_file(const char *path, SnFileOpenFlag flags, SnFile *file) {
     wchar_t wpath[4096];
     if (sn_utf8_to_utf16(path, wpath, SN_ARRAY_LENGTH(wpath)) == (size_t)-1) return false;
 
@@ -62,42 +71,150 @@ bool sn_file_open(const char *path, SnFileOpenFlag flags, SnFile *file) {
     return true;
 }
 
+bool sn_file_open(const char *path, SnFileOpenFlag flags, SnFile *file) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_OPEN);
+    bool ok = open_file(path, flags, file);
+    SN_TRACE_END(SN_TRACE_OP_OPEN, ok ? TRACE_HANDLE(HDL(file)) : -1, path, 0, ok);
+    if (ok && (flags & SN_FILE_OPEN_FLAG_TRUNCATE)) sn_block_cache_notify(file, 0, UINT64_MAX);
+    return ok;
+}
+
 void sn_file_close(SnFile *file) {
     if (HDL(file) && HDL(file) != INVALID_HANDLE_VALUE) {
-        CloseHandle(HDL(file));
+        SN_TRACE_BEGIN(SN_TRACE_OP_CLOSE);
+        bool ok = CloseHandle(HDL(file));
+        SN_TRACE_END(SN_TRACE_OP_CLOSE, TRACE_HANDLE(HDL(file)), NULL, 0, ok);
         HDL(file) = INVALID_HANDLE_VALUE;
     }
 }
 
-int64_t sn_file_read(SnFile *file, void *buffer, uint64_t size) {
+static int64_t read_handle(HANDLE handle, void *buffer, uint64_t size) {
     DWORD read1 = 0;
     DWORD read2 = 0;
     DWORD size2 = 0;
     if (size > 0xffffffff) size2 = size - 0xffffffff;
     DWORD size1 = size - size2;
 
-    if (!ReadFile(HDL(file), buffer, size1, &read1, NULL)) return -1;
-    if (size2 && !ReadFile(HDL(file), (void *)(((char *)buffer) + size1), size2, &read2, NULL))
+    if (!ReadFile(handle, buffer, size1, &read1, NULL)) return -1;
+    if (size2 && !ReadFile(handle, (void *)(((char *)buffer) + size1), size2, &read2, NULL))
         return -1;
 
     return (int64_t)read1 + read2;
 }
 
-int64_t sn_file_write(SnFile *file, const void *buffer, uint64_t size) {
+int64_t sn_file_read(SnFile *file, void *buffer, uint64_t size) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_READ);
+    int64_t got = read_handle(HDL(file), buffer, size);
+    SN_TRACE_END(SN_TRACE_OP_READ, TRACE_HANDLE(HDL(file)), NULL, size, got);
+    return got;
+}
+
+static int64_t write_handle(HANDLE handle, const void *buffer, uint64_t size) {
     DWORD written1 = 0;
     DWORD written2 = 0;
     DWORD size2 = 0;
     if (size > 0xffffffff) size2 = size - 0xffffffff;
     DWORD size1 = size - size2;
 
-    if (!WriteFile(HDL(file), buffer, size1, &written1, NULL)) return -1;
-    if (size2 && !WriteFile(HDL(file), (const void *)(((char *)buffer) + size1), size2, &written2, NULL))
+    if (!WriteFile(handle, buffer, size1, &written1, NULL)) return -1;
+    if (size2
+        && !WriteFile(handle, (const void *)(((char *)buffer) + size1), size2, &written2, NULL))
         return -1;
 
     return (int64_t)written1 + written2;
 }
 
+int64_t sn_file_write(SnFile *file, const void *buffer, uint64_t size) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_WRITE);
+    int64_t put = write_handle(HDL(file), buffer, size);
+    SN_TRACE_END(SN_TRACE_OP_WRITE, TRACE_HANDLE(HDL(file)), NULL, size, put);
+    if (put > 0) sn_block_cache_notify(file, -1, (uint64_t)put);
+    return put;
+}
+
+// Largest single positional transfer
+    #define MAX_POSITIONAL_CHUNK (1u << 30)
+
+static int64_t read_at(HANDLE handle, uint64_t offset, void *buffer, uint64_t size) {
+    uint64_t total = 0;
+    while (total < size) {
+        uint64_t chunk = size - total < MAX_POSITIONAL_CHUNK ? size - total : MAX_POSITIONAL_CHUNK;
+
+        OVERLAPPED overlapped = {0};
+        overlapped.Offset = (DWORD)(offset + total);
+        overlapped.OffsetHigh = (DWORD)((offset + total) >> 32);
+
+        DWORD got = 0;
+        if (!ReadFile(handle, (char *)buffer + total, (DWORD)chunk, &got, &overlapped)) {
+            if (GetLastError() == ERROR_HANDLE_EOF) break;
+            return total ? (int64_t)total : -1;
+        }
+        if (!got) break;
+        total += got;
+    }
+    return (int64_t)total;
+}
+
+int64_t sn_file_read_at(SnFile *file, uint64_t offset, void *buffer, uint64_t size) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_READ_AT);
+    int64_t got = read_at(HDL(file), offset, buffer, size);
+    SN_TRACE_END(SN_TRACE_OP_READ_AT, TRACE_HANDLE(HDL(file)), NULL, size, got);
+    return got;
+}
+
+static int64_t write_at(HANDLE handle, uint64_t offset, const void *buffer, uint64_t size) {
+    uint64_t total = 0;
+    while (total < size) {
+        uint64_t chunk = size - total < MAX_POSITIONAL_CHUNK ? size - total : MAX_POSITIONAL_CHUNK;
+
+        OVERLAPPED overlapped = {0};
+        overlapped.Offset = (DWORD)(offset + total);
+        overlapped.OffsetHigh = (DWORD)((offset + total) >> 32);
+
+        DWORD put = 0;
+        if (!WriteFile(handle, (const char *)buffer + total, (DWORD)chunk, &put, &overlapped)
+            || !put)
+            return total ? (int64_t)total : -1;
+        total += put;
+    }
+    return (int64_t)total;
+}
+
+int64_t sn_file_write_at(SnFile *file, uint64_t offset, const void *buffer, uint64_t size) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_WRITE_AT);
+    int64_t put = write_at(HDL(file), offset, buffer, size);
+    SN_TRACE_END(SN_TRACE_OP_WRITE_AT, TRACE_HANDLE(HDL(file)), NULL, size, put);
+    if (put > 0) sn_block_cache_notify(file, (int64_t)offset, (uint64_t)put);
+    return put;
+}
+
+static int64_t write_vectors(HANDLE handle, const SnFileIoVec *iov, uint32_t count) {
+    // WriteFileGather needs unbuffered page aligned I/O, write one by one
+    int64_t total = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        int64_t written = write_handle(handle, iov[i].data, iov[i].size);
+        if (written < 0) return total ? total : -1;
+        total += written;
+        if ((uint64_t)written != iov[i].size) break;
+    }
+
+    return total;
+}
+
+int64_t sn_file_writev(SnFile *file, const SnFileIoVec *iov, uint32_t count) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_WRITEV);
+    int64_t put = write_vectors(HDL(file), iov, count);
+
+    uint64_t size = 0;
+    for (uint32_t i = 0; i < count; ++i) size += iov[i].size;
+    SN_TRACE_END(SN_TRACE_OP_WRITEV, TRACE_HANDLE(HDL(file)), NULL, size, put);
+    if (put > 0) sn_block_cache_notify(file, -1, (uint64_t)put);
+
+    return put;
+}
+
 bool sn_file_seek(SnFile *file, int64_t offset, SnFileSeekOrigin origin) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_SEEK);
     DWORD move = 0;
     switch (origin) {
         case SN_FILE_SEEK_ORIGIN_BEGIN:
@@ -115,27 +232,190 @@ bool sn_file_seek(SnFile *file, int64_t offset, SnFileSeekOrigin origin) {
     LARGE_INTEGER off;
     off.QuadPart = offset;
 
-    return SetFilePointerEx(HDL(file), off, NULL, move);
+    bool ok = SetFilePointerEx(HDL(file), off, NULL, move);
+    SN_TRACE_END(SN_TRACE_OP_SEEK, TRACE_HANDLE(HDL(file)), NULL, 0, ok);
+    return ok;
 }
 
 uint64_t sn_file_tell(SnFile *file) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_TELL);
     LARGE_INTEGER zero = {0};
     LARGE_INTEGER pos;
     SetFilePointerEx(HDL(file), zero, &pos, FILE_CURRENT);
+    SN_TRACE_END(SN_TRACE_OP_TELL, TRACE_HANDLE(HDL(file)), NULL, 0, pos.QuadPart);
     return (uint64_t)pos.QuadPart;
 }
 
 bool sn_file_flush(SnFile *file) {
-    return FlushFileBuffers(HDL(file));
+    SN_TRACE_BEGIN(SN_TRACE_OP_FLUSH);
+    bool ok = FlushFileBuffers(HDL(file));
+    SN_TRACE_END(SN_TRACE_OP_FLUSH, TRACE_HANDLE(HDL(file)), NULL, 0, ok);
+    return ok;
 }
 
 uint64_t sn_file_size(SnFile *file) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_SIZE);
     LARGE_INTEGER size;
-    if (!GetFileSizeEx(HDL(file), &size)) return 0;
+    if (!GetFileSizeEx(HDL(file), &size)) size.QuadPart = 0;
+    SN_TRACE_END(SN_TRACE_OP_SIZE, TRACE_HANDLE(HDL(file)), NULL, 0, size.QuadPart);
     return (uint64_t)size.QuadPart;
 }
 
-bool sn_dir_open(const char *path, SnDir *dir) {
+static bool next_extent(SnFile *file, uint64_t offset, SnFileExtent *extent) {
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(HDL(file), &size) || offset >= (uint64_t)size.QuadPart) return false;
+
+    FILE_ALLOCATED_RANGE_BUFFER query;
+    query.FileOffset.QuadPart = offset;
+    query.Length.QuadPart = size.QuadPart - offset;
+
+    // One range is enough, ERROR_MORE_DATA only means there are more after it
+    FILE_ALLOCATED_RANGE_BUFFER range;
+    DWORD returned = 0;
+    if (!DeviceIoControl(HDL(file), FSCTL_QUERY_ALLOCATED_RANGES, &query, sizeof(query), &range,
+                         sizeof(range), &returned, NULL)
+        && GetLastError() != ERROR_MORE_DATA) {
+        // Not supported, treat the rest as data
+        *extent = (SnFileExtent){.offset = offset, .length = size.QuadPart - offset};
+        return true;
+    }
+
+    if (returned < sizeof(range)) return false;
+
+    uint64_t start = range.FileOffset.QuadPart;
+    uint64_t end = start + range.Length.QuadPart;
+    if (start < offset) start = offset;
+    if (end > (uint64_t)size.QuadPart) end = size.QuadPart;
+    if (start >= end) return false;
+
+    *extent = (SnFileExtent){.offset = start, .length = end - start};
+    return true;
+}
+
+bool sn_file_next_extent(SnFile *file, uint64_t offset, SnFileExtent *extent) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_NEXT_EXTENT);
+    bool ok = next_extent(file, offset, extent);
+    SN_TRACE_END(SN_TRACE_OP_NEXT_EXTENT, TRACE_HANDLE(HDL(file)), NULL, 0, ok);
+    return ok;
+}
+
+static bool punch_hole(SnFile *file, uint64_t offset, uint64_t length) {
+    DWORD returned;
+    if (!DeviceIoControl(HDL(file), FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &returned, NULL))
+        return false;
+
+    FILE_ZERO_DATA_INFORMATION zero;
+    zero.FileOffset.QuadPart = offset;
+    zero.BeyondFinalZero.QuadPart = offset + length;
+
+    return DeviceIoControl(HDL(file), FSCTL_SET_ZERO_DATA, &zero, sizeof(zero), NULL, 0, &returned,
+                           NULL);
+}
+
+bool sn_file_punch_hole(SnFile *file, uint64_t offset, uint64_t length) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_PUNCH_HOLE);
+    bool ok = punch_hole(file, offset, length);
+    SN_TRACE_END(SN_TRACE_OP_PUNCH_HOLE, TRACE_HANDLE(HDL(file)), NULL, length, ok);
+    if (ok) sn_block_cache_notify(file, (int64_t)offset, length);
+    return ok;
+}
+
+static bool grow(SnFile *file, uint64_t size) {
+    LARGE_INTEGER current;
+    if (!GetFileSizeEx(HDL(file), &current)) return false;
+    if ((uint64_t)current.QuadPart >= size) return true;
+
+    // Allocation smaller than the file would truncate it, so only ever grow
+    FILE_ALLOCATION_INFO allocation = {.AllocationSize.QuadPart = (LONGLONG)size};
+    if (!SetFileInformationByHandle(HDL(file), FileAllocationInfo, &allocation,
+                                    sizeof(allocation)))
+        return false;
+
+    FILE_END_OF_FILE_INFO end = {.EndOfFile.QuadPart = (LONGLONG)size};
+    return SetFileInformationByHandle(HDL(file), FileEndOfFileInfo, &end, sizeof(end));
+}
+
+bool sn_file_allocate(SnFile *file, uint64_t size) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_ALLOCATE);
+    bool ok = grow(file, size);
+    SN_TRACE_END(SN_TRACE_OP_ALLOCATE, TRACE_HANDLE(HDL(file)), NULL, size, ok);
+    // A last block cached short is not the last one anymore
+    if (ok) sn_block_cache_notify(file, 0, UINT64_MAX);
+    return ok;
+}
+
+bool sn_file_identity(SnFile *file, uint64_t *device, uint64_t *inode) {
+    BY_HANDLE_FILE_INFORMATION data;
+    if (!GetFileInformationByHandle(HDL(file), &data)) return false;
+    *device = data.dwVolumeSerialNumber;
+    *inode = (((uint64_t)data.nFileIndexHigh) << 32) | data.nFileIndexLow;
+    return true;
+}
+
+bool sn_file_sync_data(SnFile *file) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_SYNC_DATA);
+    bool ok = FlushFileBuffers(HDL(file));
+    SN_TRACE_END(SN_TRACE_OP_SYNC_DATA, TRACE_HANDLE(HDL(file)), NULL, 0, ok);
+    return ok;
+}
+
+bool sn_dir_sync(const char *path) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_DIR_SYNC);
+    // NTFS journals directory changes itself
+    SN_TRACE_END(SN_TRACE_OP_DIR_SYNC, -1, path, 0, true);
+    return true;
+}
+
+static void lock_overlapped(uint64_t offset, uint64_t length, OVERLAPPED *overlapped, DWORD *low,
+                            DWORD *high) {
+    *overlapped = (OVERLAPPED){0};
+    overlapped->Offset = (DWORD)offset;
+    overlapped->OffsetHigh = (DWORD)(offset >> 32);
+
+    // Length 0 means everything from offset onwards
+    if (!length) length = UINT64_MAX;
+    *low = (DWORD)length;
+    *high = (DWORD)(length >> 32);
+}
+
+static bool lock_range(SnFile *file, uint64_t offset, uint64_t length, SnFileLockType type,
+                       bool wait) {
+    OVERLAPPED overlapped;
+    DWORD low, high;
+    lock_overlapped(offset, length, &overlapped, &low, &high);
+
+    DWORD flags = 0;
+    if (type == SN_FILE_LOCK_EXCLUSIVE) flags |= LOCKFILE_EXCLUSIVE_LOCK;
+    if (!wait) flags |= LOCKFILE_FAIL_IMMEDIATELY;
+
+    return LockFileEx(HDL(file), flags, 0, low, high, &overlapped);
+}
+
+bool sn_file_lock(SnFile *file, uint64_t offset, uint64_t length, SnFileLockType type) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_LOCK);
+    bool ok = lock_range(file, offset, length, type, true);
+    SN_TRACE_END(SN_TRACE_OP_LOCK, TRACE_HANDLE(HDL(file)), NULL, length, ok);
+    return ok;
+}
+
+bool sn_file_try_lock(SnFile *file, uint64_t offset, uint64_t length, SnFileLockType type) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_TRY_LOCK);
+    bool ok = lock_range(file, offset, length, type, false);
+    SN_TRACE_END(SN_TRACE_OP_TRY_LOCK, TRACE_HANDLE(HDL(file)), NULL, length, ok);
+    return ok;
+}
+
+bool sn_file_unlock(SnFile *file, uint64_t offset, uint64_t length) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_UNLOCK);
+    OVERLAPPED overlapped;
+    DWORD low, high;
+    lock_overlapped(offset, length, &overlapped, &low, &high);
+    bool ok = UnlockFileEx(HDL(file), 0, low, high, &overlapped);
+    SN_TRACE_END(SN_TRACE_OP_UNLOCK, TRACE_HANDLE(HDL(file)), NULL, length, ok);
+    return ok;
+}
+
+static bool open_dir(const char *path, SnDir *dir) {
     wchar_t wpath[4096];
     size_t written = sn_utf8_to_utf16(path, wpath, SN_ARRAY_LENGTH(wpath) - 2);
     if (written == (size_t)-1) return false;
@@ -152,7 +432,14 @@ bool sn_dir_open(const char *path, SnDir *dir) {
     return true;
 }
 
-bool sn_dir_read(SnDir *dir, SnDirEntry *entry) {
+bool sn_dir_open(const char *path, SnDir *dir) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_DIR_OPEN);
+    bool ok = open_dir(path, dir);
+    SN_TRACE_END(SN_TRACE_OP_DIR_OPEN, ok ? TRACE_HANDLE(DHDL(dir)) : -1, path, 0, ok);
+    return ok;
+}
+
+static bool read_dir(SnDir *dir, SnDirEntry *entry) {
     WIN32_FIND_DATAW *data = &DDATA(dir);
 
     if (DFIRST(dir)) DFIRST(dir) = false;
@@ -170,9 +457,18 @@ bool sn_dir_read(SnDir *dir, SnDirEntry *entry) {
     return true;
 }
 
+bool sn_dir_read(SnDir *dir, SnDirEntry *entry) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_DIR_READ);
+    bool ok = read_dir(dir, entry);
+    SN_TRACE_END(SN_TRACE_OP_DIR_READ, TRACE_HANDLE(DHDL(dir)), ok ? entry->name : NULL, 0, ok);
+    return ok;
+}
+
 void sn_dir_close(SnDir *dir) {
     if (DHDL(dir) && DHDL(dir) != INVALID_HANDLE_VALUE) {
-        FindClose(DHDL(dir));
+        SN_TRACE_BEGIN(SN_TRACE_OP_DIR_CLOSE);
+        bool ok = FindClose(DHDL(dir));
+        SN_TRACE_END(SN_TRACE_OP_DIR_CLOSE, TRACE_HANDLE(DHDL(dir)), NULL, 0, ok);
         DHDL(dir) = INVALID_HANDLE_VALUE;
     }
 }
@@ -197,13 +493,28 @@ bool sn_path_is_directory(const char *path) {
     return attr != INVALID_FILE_ATTRIBUTES && (attr & FILE_ATTRIBUTE_DIRECTORY);
 }
 
-bool sn_file_delete(const char *path) {
+static bool delete_file(const char *path) {
+    // Cached handles would keep the file alive
+    sn_file_cache_notify(path);
+    sn_block_cache_notify_path(path);
+
     wchar_t wpath[4096];
     if (sn_utf8_to_utf16(path, wpath, SN_ARRAY_LENGTH(wpath)) == (size_t)-1) return false;
-    return DeleteFileW(wpath);
+    if (!DeleteFileW(wpath)) return false;
+
+    // Again for handles opened by misses that raced with the delete
+    sn_file_cache_notify(path);
+    return true;
 }
 
-bool sn_dir_create(const char *path, bool recursive) {
+bool sn_file_delete(const char *path) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_DELETE);
+    bool ok = delete_file(path);
+    SN_TRACE_END(SN_TRACE_OP_DELETE, -1, path, 0, ok);
+    return ok;
+}
+
+static bool create_directories(const char *path, bool recursive) {
     wchar_t wpath[4096];
     if (sn_utf8_to_utf16(path, wpath, SN_ARRAY_LENGTH(wpath)) == (size_t)-1) return false;
 
@@ -222,59 +533,431 @@ bool sn_dir_create(const char *path, bool recursive) {
     return CreateDirectoryW(wpath, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
 }
 
-bool sn_dir_delete(const char *path) {
+bool sn_dir_create(const char *path, bool recursive) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_DIR_CREATE);
+    bool ok = create_directories(path, recursive);
+    SN_TRACE_END(SN_TRACE_OP_DIR_CREATE, -1, path, 0, ok);
+    return ok;
+}
+
+static bool delete_directory(const char *path) {
     wchar_t wpath[4096];
     if (sn_utf8_to_utf16(path, wpath, SN_ARRAY_LENGTH(wpath)) == (size_t)-1) return false;
     return RemoveDirectoryW(wpath);
 }
 
-bool sn_file_copy(const char *src, const char *dst, bool overwrite) {
+bool sn_dir_delete(const char *path) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_DIR_DELETE);
+    bool ok = delete_directory(path);
+    SN_TRACE_END(SN_TRACE_OP_DIR_DELETE, -1, path, 0, ok);
+    return ok;
+}
+
+static bool copy_range(SnFile *src, SnFile *dst, uint64_t offset, uint64_t length, char *buffer,
+                       size_t buffer_size) {
+    if (!sn_file_seek(src, offset, SN_FILE_SEEK_ORIGIN_BEGIN)
+        || !sn_file_seek(dst, offset, SN_FILE_SEEK_ORIGIN_BEGIN))
+        return false;
+
+    while (length) {
+        uint64_t chunk = length < buffer_size ? length : buffer_size;
+        int64_t got = sn_file_read(src, buffer, chunk);
+        if (got <= 0) return got == 0;
+        if (sn_file_write(dst, buffer, got) != got) return false;
+        length -= got;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Copy a sparse file extent by extent, CopyFileW writes the holes out as zeros.
+ */
+static bool copy_sparse(const char *src, const char *dst, bool overwrite) {
+    if (!overwrite && sn_path_exists(dst)) return false;
+
+    SnFile srcf, dstf;
+    if (!sn_file_open(src, SN_FILE_OPEN_FLAG_READ, &srcf)) return false;
+
+    int flags = SN_FILE_OPEN_FLAG_CREATE | SN_FILE_OPEN_FLAG_WRITE | SN_FILE_OPEN_FLAG_TRUNCATE;
+    if (!sn_file_open(dst, flags, &dstf)) {
+        sn_file_close(&srcf);
+        return false;
+    }
+
+    DWORD returned;
+    bool ok = DeviceIoControl(HDL(&dstf), FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &returned, NULL);
+
+    uint64_t size = sn_file_size(&srcf);
+
+    char buffer[1 << 16];
+    SnFileExtent extent;
+    for (uint64_t offset = 0; ok && offset < size && sn_file_next_extent(&srcf, offset, &extent);
+         offset = extent.offset + extent.length)
+        ok = copy_range(&srcf, &dstf, extent.offset, extent.length, buffer, sizeof(buffer));
+
+    if (ok) {
+        FILE_END_OF_FILE_INFO eof;
+        eof.EndOfFile.QuadPart = size;
+        ok = SetFileInformationByHandle(HDL(&dstf), FileEndOfFileInfo, &eof, sizeof(eof));
+    }
+
+    sn_file_close(&srcf);
+    sn_file_close(&dstf);
+    return ok;
+}
+
+static bool copy_file(const char *src, const char *dst, bool overwrite) {
     wchar_t wsrc[4096];
     if (sn_utf8_to_utf16(src, wsrc, SN_ARRAY_LENGTH(wsrc)) == (size_t)-1) return false;
 
+    DWORD attributes = GetFileAttributesW(wsrc);
+    if (attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_SPARSE_FILE))
+        return copy_sparse(src, dst, overwrite);
+
     wchar_t wdst[4096];
     if (sn_utf8_to_utf16(dst, wdst, SN_ARRAY_LENGTH(wdst)) == (size_t)-1) return false;
 
     return CopyFileW(wsrc, wdst, !overwrite);
 }
 
-bool sn_file_move(const char *src, const char *dst, bool overwrite) {
+bool sn_file_copy(const char *src, const char *dst, bool overwrite) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_COPY);
+    bool ok = copy_file(src, dst, overwrite);
+    SN_TRACE_END(SN_TRACE_OP_COPY, -1, src, 0, ok);
+    // CopyFileW bypasses the writes that notify
+    if (ok) sn_block_cache_notify_path(dst);
+    return ok;
+}
+
+static bool open_temp(const char *dir, SnFile *file) {
+    static volatile uint32_t counter;
+
+    wchar_t wdir[4096];
+    if (sn_utf8_to_utf16(dir, wdir, SN_ARRAY_LENGTH(wdir)) == (size_t)-1) return false;
+
+    wchar_t wpath[4096 + 64];
+    for (int attempt = 0; attempt < 16; ++attempt) {
+        LARGE_INTEGER ticks;
+        QueryPerformanceCounter(&ticks);
+        _snwprintf_s(wpath, SN_ARRAY_LENGTH(wpath), _TRUNCATE,
+                     L"%ls\\.snfile-%lu-%llx-%u.tmp", wdir, GetCurrentProcessId(),
+                     (unsigned long long)ticks.QuadPart, sn_atomic_fetch_add_u32(&counter, 1));
+
+        // Temporary attribute keeps the data in cache if possible
+        HDL(file) = CreateFileW(wpath, GENERIC_READ | GENERIC_WRITE | DELETE,
+                                FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                                CREATE_NEW, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE,
+                                NULL);
+        if (HDL(file) != INVALID_HANDLE_VALUE) return true;
+        if (GetLastError() != ERROR_FILE_EXISTS) return false;
+    }
+
+    return false;
+}
+
+bool sn_file_open_temp(const char *dir, SnFile *file) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_OPEN_TEMP);
+    bool ok = open_temp(dir, file);
+    SN_TRACE_END(SN_TRACE_OP_OPEN_TEMP, ok ? TRACE_HANDLE(HDL(file)) : -1, dir, 0, ok);
+    return ok;
+}
+
+static bool publish_temp(SnFile *file, const char *path) {
+    // A delete on close file can not be given another name, copy the contents
+    wchar_t wpath[4096];
+    if (sn_utf8_to_utf16(path, wpath, SN_ARRAY_LENGTH(wpath)) == (size_t)-1) return false;
+
+    SnFile dst;
+    HDL(&dst) = CreateFileW(wpath, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_NEW,
+                            FILE_ATTRIBUTE_NORMAL, NULL);
+    if (HDL(&dst) == INVALID_HANDLE_VALUE) return false;
+
+    uint64_t position = sn_file_tell(file);
+
+    char buffer[1 << 16];
+    bool ok = copy_range(file, &dst, 0, sn_file_size(file), buffer, sizeof(buffer));
+
+    sn_file_seek(file, (int64_t)position, SN_FILE_SEEK_ORIGIN_BEGIN);
+    sn_file_close(&dst);
+
+    if (!ok) DeleteFileW(wpath);
+    return ok;
+}
+
+bool sn_file_publish_temp(SnFile *file, const char *path) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_PUBLISH_TEMP);
+    bool ok = publish_temp(file, path);
+    SN_TRACE_END(SN_TRACE_OP_PUBLISH_TEMP, TRACE_HANDLE(HDL(file)), path, 0, ok);
+    return ok;
+}
+
+static bool move_file(const char *src, const char *dst, bool overwrite) {
     wchar_t wsrc[4096];
     if (sn_utf8_to_utf16(src, wsrc, SN_ARRAY_LENGTH(wsrc)) == (size_t)-1) return false;
 
     wchar_t wdst[4096];
     if (sn_utf8_to_utf16(dst, wdst, SN_ARRAY_LENGTH(wdst)) == (size_t)-1) return false;
 
-    return MoveFileExW(wsrc, wdst, (overwrite ? MOVEFILE_REPLACE_EXISTING : 0));
+    sn_file_cache_notify(src);
+    sn_file_cache_notify(dst);
+    sn_block_cache_notify_path(dst);
+    if (!MoveFileExW(wsrc, wdst, (overwrite ? MOVEFILE_REPLACE_EXISTING : 0))) return false;
+
+    // Again for handles opened by misses that raced with the move
+    sn_file_cache_notify(src);
+    sn_file_cache_notify(dst);
+    return true;
 }
 
-bool sn_file_stat(const char *path, SnFileInfo *info) {
+bool sn_file_move(const char *src, const char *dst, bool overwrite) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_MOVE);
+    bool ok = move_file(src, dst, overwrite);
+    SN_TRACE_END(SN_TRACE_OP_MOVE, -1, src, 0, ok);
+    return ok;
+}
+
+// Difference between FILETIME epoch (1601) and Unix epoch in 100ns units
+    #define FILETIME_UNIX_EPOCH 116444736000000000ull
+
+static uint64_t filetime_u64(FILETIME time) {
+    return (((uint64_t)time.dwHighDateTime) << 32) | time.dwLowDateTime;
+}
+
+static bool file_info(const char *path, bool follow, SnFileInfo *info) {
     wchar_t wpath[4096];
     if (sn_utf8_to_utf16(path, wpath, SN_ARRAY_LENGTH(wpath)) == (size_t)-1) return false;
 
-    WIN32_FILE_ATTRIBUTE_DATA data;
-    if (!GetFileAttributesExW(wpath, GetFileExInfoStandard, &data)) return false;
+    DWORD flags = FILE_FLAG_BACKUP_SEMANTICS;
+    if (!follow) flags |= FILE_FLAG_OPEN_REPARSE_POINT;
+
+    HANDLE handle = CreateFileW(wpath, FILE_READ_ATTRIBUTES,
+                                FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                                OPEN_EXISTING, flags, NULL);
+    if (handle == INVALID_HANDLE_VALUE) return false;
+
+    BY_HANDLE_FILE_INFORMATION data;
+    FILE_STANDARD_INFO standard;
+    BOOL ok = GetFileInformationByHandle(handle, &data)
+           && GetFileInformationByHandleEx(handle, FileStandardInfo, &standard, sizeof(standard));
+    CloseHandle(handle);
+    if (!ok) return false;
 
     ULARGE_INTEGER size;
     size.HighPart = data.nFileSizeHigh;
     size.LowPart = data.nFileSizeLow;
 
+    uint64_t modified = filetime_u64(data.ftLastWriteTime);
+
     *info = (SnFileInfo){
         .size = size.QuadPart,
 
         .is_directory = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0,
         .is_symlink = (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0,
 
-        .accessed_time
-        = (((uint64_t)data.ftLastAccessTime.dwHighDateTime) << 32) | data.ftLastAccessTime.dwLowDateTime,
+        .accessed_time = filetime_u64(data.ftLastAccessTime),
+        .modified_time = modified,
+        .change_time = filetime_u64(data.ftCreationTime),
+
+        .modified_time_ns = modified > FILETIME_UNIX_EPOCH ? (modified - FILETIME_UNIX_EPOCH) * 100 : 0,
+        .device = data.dwVolumeSerialNumber,
+        .inode = (((uint64_t)data.nFileIndexHigh) << 32) | data.nFileIndexLow,
+        .allocated_size = standard.AllocationSize.QuadPart,
+        .link_count = data.nNumberOfLinks};
+    info->is_file = !info->is_directory;
+
+    return true;
+}
+
+bool sn_file_stat(const char *path, SnFileInfo *info) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_STAT);
+    bool ok = file_info(path, true, info);
+    SN_TRACE_END(SN_TRACE_OP_STAT, -1, path, 0, ok);
+    return ok;
+}
+
+bool sn_file_lstat(const char *path, SnFileInfo *info) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_LSTAT);
+    bool ok = file_info(path, false, info);
+    SN_TRACE_END(SN_TRACE_OP_LSTAT, -1, path, 0, ok);
+    return ok;
+}
+
+bool sn_dir_entry_info(SnDir *dir, SnFileInfo *info) {
+    const WIN32_FIND_DATAW *data = &DDATA(dir);
 
-        .modified_time
-        = (((uint64_t)data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime,
+    ULARGE_INTEGER size;
+    size.HighPart = data->nFileSizeHigh;
+    size.LowPart = data->nFileSizeLow;
+
+    uint64_t modified = filetime_u64(data->ftLastWriteTime);
 
-        .change_time = (((uint64_t)data.ftCreationTime.dwHighDateTime) << 32) | data.ftCreationTime.dwLowDateTime};
+    *info = (SnFileInfo){
+        .size = size.QuadPart,
+
+        .is_directory = (data->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0,
+        .is_symlink = (data->dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0,
+
+        .accessed_time = filetime_u64(data->ftLastAccessTime),
+        .modified_time = modified,
+        .change_time = filetime_u64(data->ftCreationTime),
+
+        .modified_time_ns = modified > FILETIME_UNIX_EPOCH ? (modified - FILETIME_UNIX_EPOCH) * 100 : 0};
     info->is_file = !info->is_directory;
 
     return true;
 }
 
+bool sn_dir_stat_at(SnDir *dir, const char *name, SnFileInfo *info) {
+    // Every entry already got its info from the listing
+    SN_UNUSED(dir);
+    SN_UNUSED(name);
+    SN_UNUSED(info);
+    return false;
+}
+
+/**
+ * @brief Resolve an existing path through all links with the file system.
+ */
+static bool final_path(const wchar_t *wpath, char *dst, size_t dst_size) {
+    HANDLE handle = CreateFileW(wpath, FILE_READ_ATTRIBUTES,
+                                FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                                OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (handle == INVALID_HANDLE_VALUE) return false;
+
+    wchar_t wfinal[4096];
+    DWORD length = GetFinalPathNameByHandleW(handle, wfinal, SN_ARRAY_LENGTH(wfinal),
+                                             FILE_NAME_NORMALIZED | VOLUME_NAME_DOS);
+    CloseHandle(handle);
+    if (!length || length >= SN_ARRAY_LENGTH(wfinal)) return false;
+
+    // Drop the \\?\ prefix, \\?\UNC\server becomes \\server
+    wchar_t *p = wfinal;
+    if (wcsncmp(p, L"\\\\?\\UNC\\", 8) == 0) {
+        p += 6;
+        *p = L'\\';
+    } else if (wcsncmp(p, L"\\\\?\\", 4) == 0) {
+        p += 4;
+    }
+
+    return sn_utf16_to_utf8(p, dst, dst_size) != (size_t)-1;
+}
+
+static bool real_path(SnPathCache *cache, const char *path, char *dst, size_t dst_size) {
+    uint64_t generation = cache ? sn_path_cache_generation(cache) : 0;
+
+    wchar_t wpath[4096];
+    if (!path[0] || sn_utf8_to_utf16(path, wpath, SN_ARRAY_LENGTH(wpath)) == (size_t)-1)
+        return false;
+
+    // Absolute with . and .. applied lexically, which is what Windows does as well
+    wchar_t wfull[4096];
+    DWORD length = GetFullPathNameW(wpath, SN_ARRAY_LENGTH(wfull), wfull, NULL);
+    if (!length || length >= SN_ARRAY_LENGTH(wfull)) return false;
+    while (length > 3 && wfull[length - 1] == L'\\') wfull[--length] = 0;
+
+    wchar_t *leaf = wcsrchr(wfull, L'\\');
+    if (!leaf || !leaf[1]) return final_path(wfull, dst, dst_size);
+
+    // The parent is resolved once for all of its entries
+    wchar_t wparent[4096];
+    size_t parent_length = leaf - wfull;
+    if (parent_length == 2 && wfull[1] == L':') parent_length = 3; // Keep the root separator
+    memcpy(wparent, wfull, parent_length * sizeof(wchar_t));
+    wparent[parent_length] = 0;
+
+    char key[4096 * 3];
+    char resolved[4096 * 3];
+    size_t resolved_length;
+    if (sn_utf16_to_utf8(wparent, key, sizeof(key)) == (size_t)-1) return false;
+
+    size_t key_length = strlen(key);
+    if (!sn_path_cache_lookup(cache, key, key_length, resolved, sizeof(resolved), &resolved_length)) {
+        if (!final_path(wparent, resolved, sizeof(resolved)))
+            return final_path(wfull, dst, dst_size);
+        resolved_length = strlen(resolved);
+        sn_path_cache_insert(cache, generation, key, key_length, resolved, resolved_length);
+    }
+
+    char name[260 * 4];
+    char candidate[4096 * 3];
+    if (sn_utf16_to_utf8(leaf + 1, name, sizeof(name)) == (size_t)-1
+        || !sn_path_join(candidate, sizeof(candidate), resolved, name))
+        return false;
+
+    wchar_t wcandidate[4096];
+    if (sn_utf8_to_utf16(candidate, wcandidate, SN_ARRAY_LENGTH(wcandidate)) == (size_t)-1)
+        return false;
+
+    DWORD attributes = GetFileAttributesW(wcandidate);
+    if (attributes == INVALID_FILE_ATTRIBUTES) return false;
+    if (attributes & FILE_ATTRIBUTE_REPARSE_POINT) return final_path(wcandidate, dst, dst_size);
+
+    size_t candidate_length = strlen(candidate);
+    if (candidate_length >= dst_size) return false;
+    memcpy(dst, candidate, candidate_length + 1);
+    return true;
+}
+
+bool sn_path_realpath(SnPathCache *cache, const char *path, char *dst, size_t dst_size) {
+    SN_TRACE_BEGIN(SN_TRACE_OP_REALPATH);
+    bool ok = real_path(cache, path, dst, dst_size);
+    SN_TRACE_END(SN_TRACE_OP_REALPATH, -1, path, 0, ok);
+    return ok;
+}
+
+    #if !defined(FILE_SUPPORTS_BLOCK_REFCOUNTING)
+        #define FILE_SUPPORTS_BLOCK_REFCOUNTING 0x08000000
+    #endif
+
+bool sn_fs_query(const char *path, SnFsInfo *info) {
+    wchar_t wpath[4096];
+    if (sn_utf8_to_utf16(path, wpath, SN_ARRAY_LENGTH(wpath)) == (size_t)-1) return false;
+
+    wchar_t wroot[MAX_PATH + 1];
+    if (!GetVolumePathNameW(wpath, wroot, SN_ARRAY_LENGTH(wroot))) return false;
+
+    wchar_t wname[MAX_PATH + 1];
+    DWORD flags;
+    if (!GetVolumeInformationW(wroot, NULL, 0, NULL, NULL, &flags, wname, SN_ARRAY_LENGTH(wname)))
+        return false;
+
+    DWORD sectors_per_cluster, bytes_per_sector, free_clusters, total_clusters;
+    if (!GetDiskFreeSpaceW(wroot, &sectors_per_cluster, &bytes_per_sector, &free_clusters,
+                           &total_clusters))
+        return false;
+
+    // Unbuffered I/O works in whole sectors
+    *info = (SnFsInfo){.block_size = sectors_per_cluster * bytes_per_sector,
+                       .dio_mem_align = bytes_per_sector,
+                       .dio_offset_align = bytes_per_sector,
+                       .features = SN_FS_FEATURE_COPY_RANGE | SN_FS_FEATURE_DIRECT_IO
+                                 | SN_FS_FEATURE_TMPFILE};
+    if (flags & FILE_SUPPORTS_SPARSE_FILES) info->features |= SN_FS_FEATURE_SPARSE;
+    if (flags & FILE_SUPPORTS_BLOCK_REFCOUNTING) info->features |= SN_FS_FEATURE_REFLINK;
+
+    if (sn_utf16_to_utf8(wname, info->type_name, sizeof(info->type_name)) == (size_t)-1)
+        info->type_name[0] = 0;
+
+    return true;
+}
+
+void *sn_file_map(SnFile *file, uint64_t size) {
+    if (!size) return NULL;
+
+    HANDLE mapping = CreateFileMappingW(HDL(file), NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping) return NULL;
+
+    void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, (SIZE_T)size);
+
+    // The view keeps the mapping alive
+    CloseHandle(mapping);
+    return data;
+}
+
+void sn_file_unmap(void *data, uint64_t size) {
+    SN_UNUSED(size);
+    UnmapViewOfFile(data);
+}
+
 #endif
@@ -0,0 +1,116 @@
+#include "src/thread.h"
+
+#if defined(SN_OS_WINDOWS)
+
+    #include <windows.h>
+
+typedef struct SnThreadWin32 {
+    HANDLE handle;
+    SnThreadFunc func;
+    void *arg;
+} SnThreadWin32;
+
+    #define THREAD(thread) ((SnThreadWin32 *)(thread))
+    #define MUTEX(mutex) ((SRWLOCK *)(mutex))
+    #define COND(cond) ((CONDITION_VARIABLE *)(cond))
+
+SN_STATIC_ASSERT(sizeof(SnThreadWin32) <= sizeof(SnThread), "SnThread size is not large enough!");
+SN_STATIC_ASSERT(sizeof(SRWLOCK) <= sizeof(SnMutex), "SnMutex size is not large enough!");
+SN_STATIC_ASSERT(sizeof(CONDITION_VARIABLE) <= sizeof(SnCond), "SnCond size is not large enough!");
+
+static DWORD WINAPI thread_start(LPVOID arg) {
+    SnThreadWin32 *thread = arg;
+    thread->func(thread->arg);
+    return 0;
+}
+
+bool sn_thread_create(SnThread *thread, SnThreadFunc func, void *arg) {
+    THREAD(thread)->func = func;
+    THREAD(thread)->arg = arg;
+    THREAD(thread)->handle = CreateThread(NULL, 0, thread_start, thread, 0, NULL);
+    return THREAD(thread)->handle != NULL;
+}
+
+void sn_thread_join(SnThread *thread) {
+    WaitForSingleObject(THREAD(thread)->handle, INFINITE);
+    CloseHandle(THREAD(thread)->handle);
+    THREAD(thread)->handle = NULL;
+}
+
+uint32_t sn_thread_cpu_count(void) {
+    DWORD count = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+    return count ? (uint32_t)count : 1;
+}
+
+uint64_t sn_thread_id(void) {
+    return GetCurrentThreadId();
+}
+
+uint64_t sn_process_id(void) {
+    return GetCurrentProcessId();
+}
+
+void sn_thread_yield(void) {
+    SwitchToThread();
+}
+
+void sn_thread_sleep(uint32_t ms) {
+    Sleep(ms);
+}
+
+uint64_t sn_time_ns(void) {
+    static LARGE_INTEGER frequency;
+    if (!frequency.QuadPart) QueryPerformanceFrequency(&frequency);
+
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+
+    uint64_t seconds = counter.QuadPart / frequency.QuadPart;
+    uint64_t rest = counter.QuadPart % frequency.QuadPart;
+    return seconds * 1000000000ull + rest * 1000000000ull / frequency.QuadPart;
+}
+
+bool sn_mutex_init(SnMutex *mutex) {
+    InitializeSRWLock(MUTEX(mutex));
+    return true;
+}
+
+void sn_mutex_destroy(SnMutex *mutex) {
+    SN_UNUSED(mutex);
+}
+
+void sn_mutex_lock(SnMutex *mutex) {
+    AcquireSRWLockExclusive(MUTEX(mutex));
+}
+
+void sn_mutex_unlock(SnMutex *mutex) {
+    ReleaseSRWLockExclusive(MUTEX(mutex));
+}
+
+bool sn_cond_init(SnCond *cond) {
+    InitializeConditionVariable(COND(cond));
+    return true;
+}
+
+void sn_cond_destroy(SnCond *cond) {
+    SN_UNUSED(cond);
+}
+
+void sn_cond_wait(SnCond *cond, SnMutex *mutex) {
+    SleepConditionVariableSRW(COND(cond), MUTEX(mutex), INFINITE, 0);
+}
+
+bool sn_cond_timed_wait(SnCond *cond, SnMutex *mutex, uint32_t ms) {
+    if (SleepConditionVariableSRW(COND(cond), MUTEX(mutex), ms, 0)) return true;
+    return GetLastError() != ERROR_TIMEOUT;
+}
+
+void sn_cond_signal(SnCond *cond) {
+    WakeConditionVariable(COND(cond));
+}
+
+void sn_cond_broadcast(SnCond *cond) {
+    WakeAllConditionVariable(COND(cond));
+}
+
+#endif
@@ -0,0 +1,289 @@
+#include "snfile/writer.h"
+
+#include "src/internal.h"
+#include "src/thread.h"
+
+#include <string.h>
+
+#define WRITER_DEFAULT_BUFFER_SIZE (1ull << 20)
+#define WRITER_DEFAULT_FLUSH_INTERVAL_MS 10
+#define WRITER_MIN_BUFFER_SIZE 4096
+#define WRITER_MAX_IOV 256
+
+// Record header states
+#define RECORD_EMPTY 0
+#define RECORD_DATA 1
+#define RECORD_PAD 2
+
+#define RECORD_HEADER_SIZE 8
+#define ALIGN8(x) (((x) + 7) & ~(uint64_t)7)
+
+/*
+ * The buffer is a ring of records shared by all producers. A producer reserves
+ * space by moving tail with a CAS, copies its data and publishes the record by
+ * setting its header state. The background thread consumes published records
+ * from head in order, a record which does not fit before the end of the ring is
+ * preceded by a pad record.
+ */
+struct SnFileWriter {
+    SnFile *file;
+
+    char *ring;
+    uint64_t capacity;
+    uint64_t mask;
+
+    volatile uint64_t tail;
+    volatile uint64_t head;
+    volatile uint64_t dropped;
+    volatile uint32_t sleeping;
+    volatile uint32_t waiters;
+    volatile uint32_t stop;
+    volatile uint32_t failed;
+
+    SnFileWriterPolicy policy;
+    uint32_t flush_interval_ms;
+    uint64_t wake_threshold;
+
+    SnMutex mutex;
+    SnCond wake;  // Background thread waits for data
+    SnCond space; // Producers and flushers wait for head to move
+
+    SnThread thread;
+};
+
+static volatile uint32_t *record_state(SnFileWriter *w, uint64_t position) {
+    return (volatile uint32_t *)(w->ring + (position & w->mask));
+}
+
+static uint32_t *record_length(SnFileWriter *w, uint64_t position) {
+    return (uint32_t *)(w->ring + (position & w->mask) + 4);
+}
+
+static void wake_writer(SnFileWriter *w) {
+    sn_mutex_lock(&w->mutex);
+    sn_cond_signal(&w->wake);
+    sn_mutex_unlock(&w->mutex);
+}
+
+/**
+ * @brief Wait until head reaches target.
+ */
+static void wait_head(SnFileWriter *w, uint64_t target) {
+    sn_mutex_lock(&w->mutex);
+    sn_atomic_fetch_add_u32(&w->waiters, 1);
+
+    while (sn_atomic_load_u64(&w->head) < target && !sn_atomic_load_u32(&w->stop)) {
+        sn_cond_signal(&w->wake);
+        sn_cond_wait(&w->space, &w->mutex);
+    }
+
+    sn_atomic_fetch_add_u32(&w->waiters, (uint32_t)-1);
+    sn_mutex_unlock(&w->mutex);
+}
+
+/**
+ * @brief Write out published records starting at head.
+ *
+ * @return Returns false if there was nothing published.
+ */
+static bool drain(SnFileWriter *w) {
+    SnFileIoVec iov[WRITER_MAX_IOV];
+    uint32_t count = 0;
+
+    uint64_t head = w->head;
+    uint64_t tail = sn_atomic_load_u64(&w->tail);
+    uint64_t position = head;
+
+    while (position < tail && count < WRITER_MAX_IOV) {
+        uint32_t state = sn_atomic_load_u32(record_state(w, position));
+        if (state == RECORD_EMPTY) break; // Reserved, not yet published
+
+        if (state == RECORD_PAD) {
+            position += w->capacity - (position & w->mask);
+            continue;
+        }
+
+        uint32_t length = *record_length(w, position);
+        const char *data = w->ring + (position & w->mask) + RECORD_HEADER_SIZE;
+
+        iov[count++] = (SnFileIoVec){.data = data, .size = length};
+
+        position += RECORD_HEADER_SIZE + ALIGN8(length);
+    }
+
+    if (position == head) return false;
+
+    if (!sn_atomic_load_u32(&w->failed) && !sn_file_write_all(w->file, iov, count))
+        sn_atomic_store_u32(&w->failed, 1);
+
+    // Zero the consumed space, any word of it may be a record header when reused
+    uint64_t begin = head & w->mask;
+    uint64_t length = position - head;
+    if (begin + length > w->capacity) {
+        memset(w->ring + begin, 0, w->capacity - begin);
+        memset(w->ring, 0, begin + length - w->capacity);
+    } else {
+        memset(w->ring + begin, 0, length);
+    }
+
+    sn_atomic_store_u64(&w->head, position);
+
+    if (sn_atomic_load_u32(&w->waiters)) {
+        sn_mutex_lock(&w->mutex);
+        sn_cond_broadcast(&w->space);
+        sn_mutex_unlock(&w->mutex);
+    }
+
+    return true;
+}
+
+static void writer_thread(void *arg) {
+    SnFileWriter *w = arg;
+
+    for (;;) {
+        if (drain(w)) continue;
+
+        uint64_t tail = sn_atomic_load_u64(&w->tail);
+        if (tail != w->head) {
+            // A producer is still copying its record
+            sn_thread_yield();
+            continue;
+        }
+
+        sn_mutex_lock(&w->mutex);
+        sn_atomic_store_u32(&w->sleeping, 1);
+        if (sn_atomic_load_u64(&w->tail) == w->head) {
+            if (sn_atomic_load_u32(&w->stop)) {
+                sn_mutex_unlock(&w->mutex);
+                break;
+            }
+            sn_cond_timed_wait(&w->wake, &w->mutex, w->flush_interval_ms);
+        }
+        sn_atomic_store_u32(&w->sleeping, 0);
+        sn_mutex_unlock(&w->mutex);
+    }
+}
+
+bool sn_file_writer_create(SnFile *file, const SnFileWriterConfig *config, SnFileWriter **writer) {
+    SnFileWriterConfig defaults = {0};
+    if (!config) config = &defaults;
+
+    uint64_t capacity = WRITER_MIN_BUFFER_SIZE;
+    uint64_t requested = config->buffer_size ? config->buffer_size : WRITER_DEFAULT_BUFFER_SIZE;
+    while (capacity < requested) capacity <<= 1;
+
+    SnFileWriter *w = sn_file_alloc(sizeof(SnFileWriter));
+    if (!w) return false;
+
+    *w = (SnFileWriter){
+        .file = file,
+        .capacity = capacity,
+        .mask = capacity - 1,
+        .policy = config->policy,
+        .flush_interval_ms = config->flush_interval_ms ? config->flush_interval_ms
+                                                       : WRITER_DEFAULT_FLUSH_INTERVAL_MS,
+        .wake_threshold = capacity / 2,
+    };
+
+    w->ring = sn_file_alloc(capacity);
+    if (!w->ring) {
+        sn_file_free(w, sizeof(SnFileWriter));
+        return false;
+    }
+    memset(w->ring, 0, capacity);
+
+    if (!sn_mutex_init(&w->mutex)) goto fail_mutex;
+    if (!sn_cond_init(&w->wake)) goto fail_wake;
+    if (!sn_cond_init(&w->space)) goto fail_space;
+    if (!sn_thread_create(&w->thread, writer_thread, w)) goto fail_thread;
+
+    *writer = w;
+    return true;
+
+fail_thread:
+    sn_cond_destroy(&w->space);
+fail_space:
+    sn_cond_destroy(&w->wake);
+fail_wake:
+    sn_mutex_destroy(&w->mutex);
+fail_mutex:
+    sn_file_free(w->ring, capacity);
+    sn_file_free(w, sizeof(SnFileWriter));
+    return false;
+}
+
+void sn_file_writer_destroy(SnFileWriter *writer) {
+    sn_mutex_lock(&writer->mutex);
+    sn_atomic_store_u32(&writer->stop, 1);
+    sn_cond_signal(&writer->wake);
+    sn_mutex_unlock(&writer->mutex);
+
+    sn_thread_join(&writer->thread);
+
+    sn_cond_destroy(&writer->space);
+    sn_cond_destroy(&writer->wake);
+    sn_mutex_destroy(&writer->mutex);
+    sn_file_free(writer->ring, writer->capacity);
+    sn_file_free(writer, sizeof(SnFileWriter));
+}
+
+bool sn_file_writer_append(SnFileWriter *writer, const void *data, uint64_t size) {
+    SnFileWriter *w = writer;
+    if (sn_atomic_load_u32(&w->failed)) return false;
+    if (!size) return true;
+
+    uint64_t need = RECORD_HEADER_SIZE + ALIGN8(size);
+    if (need > w->capacity / 2) {
+        if (!sn_file_writer_flush(w)) return false;
+        return sn_file_write(w->file, data, size) == (int64_t)size;
+    }
+
+    uint64_t tail = sn_atomic_load_u64(&w->tail);
+    uint64_t position, end;
+    for (;;) {
+        uint64_t offset = tail & w->mask;
+        uint64_t pad = offset + need > w->capacity ? w->capacity - offset : 0;
+        position = tail + pad;
+        end = position + need;
+
+        if (end - sn_atomic_load_u64(&w->head) > w->capacity) {
+            if (w->policy == SN_FILE_WRITER_POLICY_DROP) {
+                sn_atomic_fetch_add_u64(&w->dropped, size);
+                return false;
+            }
+
+            wait_head(w, end - w->capacity);
+            if (sn_atomic_load_u32(&w->stop)) return false;
+
+            tail = sn_atomic_load_u64(&w->tail);
+            continue;
+        }
+
+        if (sn_atomic_cas_u64(&w->tail, &tail, end)) {
+            if (pad) sn_atomic_store_u32(record_state(w, tail), RECORD_PAD);
+            break;
+        }
+    }
+
+    memcpy(w->ring + (position & w->mask) + RECORD_HEADER_SIZE, data, size);
+    *record_length(w, position) = (uint32_t)size;
+    sn_atomic_store_u32(record_state(w, position), RECORD_DATA);
+
+    if (end - sn_atomic_load_u64(&w->head) >= w->wake_threshold && sn_atomic_load_u32(&w->sleeping))
+        wake_writer(w);
+
+    return true;
+}
+
+bool sn_file_writer_flush(SnFileWriter *writer) {
+    wait_head(writer, sn_atomic_load_u64(&writer->tail));
+    return !sn_atomic_load_u32(&writer->failed);
+}
+
+bool sn_file_writer_sync(SnFileWriter *writer) {
+    return sn_file_writer_flush(writer) && sn_file_flush(writer->file);
+}
+
+uint64_t sn_file_writer_dropped(SnFileWriter *writer) {
+    return sn_atomic_load_u64(&writer->dropped);
+}
@@ -1,9 +1,27 @@
+#define _GNU_SOURCE
+
+#include "snfile/blockcache.h"
+#include "snfile/cache.h"
+#include "snfile/compressed.h"
+#include "snfile/fsinfo.h"
+#include "snfile/glob.h"
+#include "snfile/log.h"
+#include "snfile/parallel.h"
+#include "snfile/realpath.h"
+#include "snfile/snapshot.h"
 #include "snfile/snfile.h"
+#include "snfile/trace.h"
+#include "snfile/usage.h"
+#include "snfile/writer.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if !defined(SN_OS_WINDOWS)
+    #include <unistd.h>
+#endif
+
 #define TEST_ASSERT(x)                                                     \
     do {                                                                   \
         if (!(x)) {                                                        \
@@ -17,6 +35,37 @@
 #define TEST_FILE "snfile_test_dir/test.txt"
 #define TEST_FILE_COPY "snfile_test_dir/test_copy.txt"
 #define TEST_FILE_MOVE "snfile_test_dir/test_moved.txt"
+#define TEST_GLOB_DIR "snfile_test_dir/glob"
+#define TEST_SNAPSHOT_DIR "snfile_test_dir/snapshot"
+#define TEST_SNAPSHOT_INDEX "snfile_test_dir/snapshot.idx"
+#define TEST_SPARSE_FILE "snfile_test_dir/sparse.bin"
+#define TEST_SPARSE_COPY "snfile_test_dir/sparse_copy.bin"
+#define TEST_WRITER_FILE "snfile_test_dir/writer.log"
+#define TEST_CACHE_FILE_A "snfile_test_dir/cache_a.txt"
+#define TEST_CACHE_FILE_B "snfile_test_dir/cache_b.txt"
+#define TEST_CACHE_FILE_C "snfile_test_dir/cache_c.txt"
+#define TEST_COMPRESSED_FILE "snfile_test_dir/compressed.snz"
+#define TEST_TEMP_DIR "snfile_test_dir/temp"
+#define TEST_TEMP_PUBLISHED "snfile_test_dir/temp/published.txt"
+#define TEST_USAGE_DIR "snfile_test_dir/usage"
+#define TEST_USAGE_SUBDIR "snfile_test_dir/usage/sub"
+#define TEST_USAGE_FILE_A "snfile_test_dir/usage/a.txt"
+#define TEST_USAGE_FILE_B "snfile_test_dir/usage/sub/b.txt"
+#define TEST_USAGE_LINK "snfile_test_dir/usage/sub/a_link.txt"
+#define TEST_PARALLEL_FILE "snfile_test_dir/parallel.txt"
+#define TEST_PROBE_FILE "snfile_test_dir/probe.bin"
+#define TEST_PROBE_COPY "snfile_test_dir/probe_copy.bin"
+#define TEST_LOG_DIR "snfile_test_dir/log"
+#define TEST_LIST_DIR "snfile_test_dir/list"
+#define TEST_REALPATH_DIR "snfile_test_dir/real"
+#define TEST_REALPATH_SUBDIR "snfile_test_dir/real/sub"
+#define TEST_REALPATH_FILE "snfile_test_dir/real/sub/file.txt"
+#define TEST_REALPATH_DIR_LINK "snfile_test_dir/real/dir_link"
+#define TEST_REALPATH_FILE_LINK "snfile_test_dir/real/file_link"
+#define TEST_TRACE_FILE "snfile_test_dir/trace.bin"
+#define TEST_TRACE_JSON "snfile_test_dir/trace.json"
+#define TEST_BLOCK_FILE "snfile_test_dir/blocks.bin"
+#define TEST_BLOCK_COPY "snfile_test_dir/blocks_copy.bin"
 
 static void test_path_utils(void) {
     char buffer[256];
@@ -117,6 +166,1387 @@ static void test_copy_move_stat(void) {
     printf("[OK] copy / move / stat\n");
 }
 
+static void write_small_file(const char *path, const char *content) {
+    SnFile file;
+    TEST_ASSERT(sn_file_open(
+        path, SN_FILE_OPEN_FLAG_CREATE | SN_FILE_OPEN_FLAG_WRITE | SN_FILE_OPEN_FLAG_TRUNCATE, &file));
+    TEST_ASSERT(sn_file_write(&file, content, strlen(content)) == (int64_t)strlen(content));
+    sn_file_close(&file);
+}
+
+static bool count_glob_match(const char *path, const SnDirEntry *entry, void *user_data) {
+    SN_UNUSED(path);
+    SN_UNUSED(entry);
+    ++*(int *)user_data;
+    return true;
+}
+
+static int count_glob(const char *pattern) {
+    SnGlob *glob;
+    TEST_ASSERT(sn_glob_compile(pattern, &glob));
+    int count = 0;
+    TEST_ASSERT(sn_dir_glob(TEST_GLOB_DIR, glob, count_glob_match, &count));
+    sn_glob_free(glob);
+    return count;
+}
+
+static void test_glob(void) {
+    SnGlob *glob;
+    TEST_ASSERT(sn_glob_compile("src/**/[a-c]?.{c,h}", &glob));
+    TEST_ASSERT(sn_glob_match(glob, "src/a1.c"));
+    TEST_ASSERT(sn_glob_match(glob, "src/x/y/b2.h"));
+    TEST_ASSERT(!sn_glob_match(glob, "src/x/d2.h"));
+    TEST_ASSERT(!sn_glob_match(glob, "src/x/a22.c"));
+    TEST_ASSERT(!sn_glob_match(glob, "include/a1.c"));
+    sn_glob_free(glob);
+
+    // Every match after the first one too
+    TEST_ASSERT(sn_glob_compile("src/**", &glob));
+    TEST_ASSERT(sn_glob_match(glob, "src/a"));
+    TEST_ASSERT(sn_glob_match(glob, "src/a/y.c"));
+    TEST_ASSERT(sn_glob_match(glob, "src/a/b/z.c"));
+    TEST_ASSERT(!sn_glob_match(glob, "include/a"));
+    sn_glob_free(glob);
+
+    TEST_ASSERT(sn_dir_create(TEST_GLOB_DIR "/sub/deep", true));
+    TEST_ASSERT(sn_dir_create(TEST_GLOB_DIR "/skip", true));
+    write_small_file(TEST_GLOB_DIR "/a.json", "{}");
+    write_small_file(TEST_GLOB_DIR "/b.txt", "b");
+    write_small_file(TEST_GLOB_DIR "/sub/c.json", "{}");
+    write_small_file(TEST_GLOB_DIR "/sub/f.json", "{}");
+    write_small_file(TEST_GLOB_DIR "/sub/g.json", "{}");
+    write_small_file(TEST_GLOB_DIR "/sub/deep/d.json", "{}");
+    write_small_file(TEST_GLOB_DIR "/skip/e.txt", "e");
+
+    TEST_ASSERT(count_glob("**/*.json") == 5);
+    TEST_ASSERT(count_glob("sub/*.json") == 3);
+    // sub itself, its three files, deep and deep/d.json
+    TEST_ASSERT(count_glob("sub/**") == 6);
+    TEST_ASSERT(count_glob("sub/deep/d.json") == 1);
+    TEST_ASSERT(count_glob("{a,b}.*") == 2);
+    TEST_ASSERT(count_glob("missing/**") == 0);
+
+    TEST_ASSERT(sn_file_delete(TEST_GLOB_DIR "/a.json"));
+    TEST_ASSERT(sn_file_delete(TEST_GLOB_DIR "/b.txt"));
+    TEST_ASSERT(sn_file_delete(TEST_GLOB_DIR "/sub/c.json"));
+    TEST_ASSERT(sn_file_delete(TEST_GLOB_DIR "/sub/f.json"));
+    TEST_ASSERT(sn_file_delete(TEST_GLOB_DIR "/sub/g.json"));
+    TEST_ASSERT(sn_file_delete(TEST_GLOB_DIR "/sub/deep/d.json"));
+    TEST_ASSERT(sn_file_delete(TEST_GLOB_DIR "/skip/e.txt"));
+    TEST_ASSERT(sn_dir_delete(TEST_GLOB_DIR "/sub/deep"));
+    TEST_ASSERT(sn_dir_delete(TEST_GLOB_DIR "/sub"));
+    TEST_ASSERT(sn_dir_delete(TEST_GLOB_DIR "/skip"));
+    TEST_ASSERT(sn_dir_delete(TEST_GLOB_DIR));
+
+    printf("[OK] glob\n");
+}
+
+static bool count_snapshot_change(SnSnapshotChange change, const SnSnapshotEntry *entry,
+                                  void *user_data) {
+    SN_UNUSED(entry);
+    ++((int *)user_data)[change];
+    return true;
+}
+
+static void test_snapshot(void) {
+    TEST_ASSERT(sn_dir_create(TEST_SNAPSHOT_DIR "/sub", true));
+    write_small_file(TEST_SNAPSHOT_DIR "/keep.txt", "keep");
+    write_small_file(TEST_SNAPSHOT_DIR "/sub/change.txt", "old");
+    write_small_file(TEST_SNAPSHOT_DIR "/sub/remove.txt", "remove");
+
+    SnSnapshot *first;
+    TEST_ASSERT(sn_snapshot_capture(TEST_SNAPSHOT_DIR, NULL, 0, &first));
+    TEST_ASSERT(sn_snapshot_count(first) == 4);
+    TEST_ASSERT(sn_snapshot_save(first, TEST_SNAPSHOT_INDEX));
+    sn_snapshot_free(first);
+
+    SnSnapshot *loaded;
+    TEST_ASSERT(sn_snapshot_load(TEST_SNAPSHOT_INDEX, &loaded));
+    TEST_ASSERT(sn_snapshot_count(loaded) == 4);
+
+    SnSnapshotEntry entry;
+    TEST_ASSERT(sn_snapshot_get(loaded, 0, &entry));
+    TEST_ASSERT(strcmp(entry.path, "keep.txt") == 0 && entry.type == SN_SNAPSHOT_ENTRY_TYPE_FILE);
+    TEST_ASSERT(sn_snapshot_get(loaded, 1, &entry));
+    TEST_ASSERT(strcmp(entry.path, "sub") == 0 && entry.type == SN_SNAPSHOT_ENTRY_TYPE_DIRECTORY);
+
+    write_small_file(TEST_SNAPSHOT_DIR "/sub/change.txt", "changed");
+    write_small_file(TEST_SNAPSHOT_DIR "/sub/add.txt", "add");
+    TEST_ASSERT(sn_file_delete(TEST_SNAPSHOT_DIR "/sub/remove.txt"));
+
+    SnSnapshot *second;
+    TEST_ASSERT(sn_snapshot_capture(TEST_SNAPSHOT_DIR, loaded, 0, &second));
+
+    int changes[3] = {0};
+    TEST_ASSERT(sn_snapshot_diff(loaded, second, count_snapshot_change, changes));
+    TEST_ASSERT(changes[SN_SNAPSHOT_CHANGE_ADDED] == 1);
+    TEST_ASSERT(changes[SN_SNAPSHOT_CHANGE_REMOVED] == 1);
+    TEST_ASSERT(changes[SN_SNAPSHOT_CHANGE_MODIFIED] == 1);
+
+    sn_snapshot_free(second);
+    sn_snapshot_free(loaded);
+
+    TEST_ASSERT(sn_file_delete(TEST_SNAPSHOT_INDEX));
+    TEST_ASSERT(sn_file_delete(TEST_SNAPSHOT_DIR "/keep.txt"));
+    TEST_ASSERT(sn_file_delete(TEST_SNAPSHOT_DIR "/sub/change.txt"));
+    TEST_ASSERT(sn_file_delete(TEST_SNAPSHOT_DIR "/sub/add.txt"));
+    TEST_ASSERT(sn_dir_delete(TEST_SNAPSHOT_DIR "/sub"));
+    TEST_ASSERT(sn_dir_delete(TEST_SNAPSHOT_DIR));
+
+    printf("[OK] snapshot\n");
+}
+
+static void test_sparse(void) {
+    char block[4096];
+    memset(block, 'a', sizeof(block));
+
+    SnFile file;
+    TEST_ASSERT(sn_file_open(TEST_SPARSE_FILE,
+                             SN_FILE_OPEN_FLAG_CREATE | SN_FILE_OPEN_FLAG_READ | SN_FILE_OPEN_FLAG_WRITE
+                                 | SN_FILE_OPEN_FLAG_TRUNCATE | SN_FILE_OPEN_FLAG_BINARY,
+                             &file));
+
+    for (int i = 0; i < 16; ++i)
+        TEST_ASSERT(sn_file_write(&file, block, sizeof(block)) == (int64_t)sizeof(block));
+    TEST_ASSERT(sn_file_seek(&file, 4 << 20, SN_FILE_SEEK_ORIGIN_BEGIN));
+    TEST_ASSERT(sn_file_write(&file, block, sizeof(block)) == (int64_t)sizeof(block));
+    TEST_ASSERT(sn_file_seek(&file, 8 << 20, SN_FILE_SEEK_ORIGIN_BEGIN));
+    TEST_ASSERT(sn_file_write(&file, "end", 3) == 3);
+
+    // Punching is not supported everywhere, data must read as zeros when it is
+    bool punched = sn_file_punch_hole(&file, 0, sizeof(block) * 16);
+
+    uint64_t position = sn_file_tell(&file);
+    SnFileExtent extent;
+    uint64_t covered = 0;
+    bool found_middle = false;
+    for (uint64_t off = 0; sn_file_next_extent(&file, off, &extent); off = extent.offset + extent.length) {
+        TEST_ASSERT(extent.length > 0);
+        covered += extent.length;
+        if (extent.offset <= (4 << 20) && extent.offset + extent.length > (4 << 20)) found_middle = true;
+    }
+    TEST_ASSERT(found_middle);
+    TEST_ASSERT(covered <= sn_file_size(&file));
+    TEST_ASSERT(sn_file_tell(&file) == position);
+    sn_file_close(&file);
+
+    TEST_ASSERT(sn_file_copy(TEST_SPARSE_FILE, TEST_SPARSE_COPY, true));
+
+    // Holes are not supported everywhere, the copy must keep them when the source has them
+    SnFileInfo source, copy;
+    TEST_ASSERT(sn_file_stat(TEST_SPARSE_FILE, &source) && sn_file_stat(TEST_SPARSE_COPY, &copy));
+    if (source.allocated_size < source.size / 2) TEST_ASSERT(copy.allocated_size < copy.size / 2);
+
+    TEST_ASSERT(sn_file_open(TEST_SPARSE_COPY, SN_FILE_OPEN_FLAG_READ | SN_FILE_OPEN_FLAG_BINARY, &file));
+    TEST_ASSERT(sn_file_size(&file) == (8 << 20) + 3);
+
+    char buffer[4096];
+    TEST_ASSERT(sn_file_read(&file, buffer, sizeof(buffer)) == (int64_t)sizeof(buffer));
+    TEST_ASSERT(buffer[0] == (punched ? 0 : 'a'));
+    TEST_ASSERT(sn_file_seek(&file, 4 << 20, SN_FILE_SEEK_ORIGIN_BEGIN));
+    TEST_ASSERT(sn_file_read(&file, buffer, sizeof(buffer)) == (int64_t)sizeof(buffer));
+    TEST_ASSERT(memcmp(buffer, block, sizeof(block)) == 0);
+    TEST_ASSERT(sn_file_seek(&file, 8 << 20, SN_FILE_SEEK_ORIGIN_BEGIN));
+    TEST_ASSERT(sn_file_read(&file, buffer, sizeof(buffer)) == 3);
+    TEST_ASSERT(memcmp(buffer, "end", 3) == 0);
+    sn_file_close(&file);
+
+    SnFileBuffer mapped;
+    TEST_ASSERT(sn_file_read_all(TEST_SPARSE_COPY, 0, &mapped));
+    TEST_ASSERT(mapped.mapped && mapped.size == (8 << 20) + 3);
+    TEST_ASSERT(memcmp((char *)mapped.data + (4 << 20), block, sizeof(block)) == 0);
+    sn_file_buffer_free(&mapped);
+
+    TEST_ASSERT(sn_file_delete(TEST_SPARSE_FILE));
+    TEST_ASSERT(sn_file_delete(TEST_SPARSE_COPY));
+
+    printf("[OK] sparse\n");
+}
+
+typedef struct CountingAllocator {
+    int64_t live_bytes;
+    int allocations;
+} CountingAllocator;
+
+static void *counting_alloc(size_t size, void *user_data) {
+    CountingAllocator *counter = user_data;
+    counter->live_bytes += size;
+    ++counter->allocations;
+    return malloc(size);
+}
+
+static void *counting_realloc(void *ptr, size_t old_size, size_t new_size, void *user_data) {
+    CountingAllocator *counter = user_data;
+    counter->live_bytes += (int64_t)new_size - (int64_t)old_size;
+    return realloc(ptr, new_size);
+}
+
+static void counting_free(void *ptr, size_t size, void *user_data) {
+    CountingAllocator *counter = user_data;
+    counter->live_bytes -= size;
+    free(ptr);
+}
+
+static void test_read_all(void) {
+    CountingAllocator counter = {0};
+    SnFileAllocator allocator = {.alloc = counting_alloc,
+                                 .realloc = counting_realloc,
+                                 .free = counting_free,
+                                 .user_data = &counter};
+    sn_file_set_allocator(&allocator);
+
+    SnFileBuffer buffer;
+    TEST_ASSERT(sn_file_read_all(TEST_FILE, SN_FILE_READ_ALL_FLAG_NULL_TERMINATE, &buffer));
+    TEST_ASSERT(!buffer.mapped);
+    TEST_ASSERT(buffer.size == strlen("Hello from SnFile!\n"));
+    TEST_ASSERT(strcmp(buffer.data, "Hello from SnFile!\n") == 0);
+    TEST_ASSERT(counter.allocations == 1);
+    sn_file_buffer_free(&buffer);
+    TEST_ASSERT(counter.live_bytes == 0);
+
+    // Library internals go through the hooks too
+    SnGlob *glob;
+    TEST_ASSERT(sn_glob_compile("{a,b}/**/*.c", &glob));
+    TEST_ASSERT(counter.live_bytes > 0);
+    sn_glob_free(glob);
+    TEST_ASSERT(counter.live_bytes == 0);
+
+    sn_file_set_allocator(NULL);
+
+    TEST_ASSERT(sn_file_read_all(TEST_FILE_MOVE, 0, &buffer));
+    TEST_ASSERT(buffer.size == strlen("Hello from SnFile!\n"));
+    TEST_ASSERT(memcmp(buffer.data, "Hello from SnFile!\n", buffer.size) == 0);
+    sn_file_buffer_free(&buffer);
+    TEST_ASSERT(buffer.data == NULL);
+
+    TEST_ASSERT(!sn_file_read_all(TEST_DIR "/missing.txt", 0, &buffer));
+
+    printf("[OK] read all\n");
+}
+
+static void test_writer(void) {
+    SnFile file;
+    TEST_ASSERT(sn_file_open(TEST_WRITER_FILE,
+                             SN_FILE_OPEN_FLAG_CREATE | SN_FILE_OPEN_FLAG_WRITE | SN_FILE_OPEN_FLAG_TRUNCATE
+                                 | SN_FILE_OPEN_FLAG_APPEND | SN_FILE_OPEN_FLAG_BINARY,
+                             &file));
+
+    SnFileWriterConfig config = {.buffer_size = 4096, .policy = SN_FILE_WRITER_POLICY_BLOCK};
+    SnFileWriter *writer;
+    TEST_ASSERT(sn_file_writer_create(&file, &config, &writer));
+
+    char line[16];
+    for (int i = 0; i < 1000; ++i) {
+        snprintf(line, sizeof(line), "line %04d\n", i);
+        TEST_ASSERT(sn_file_writer_append(writer, line, 10));
+    }
+
+    // Larger than half of the buffer, written directly
+    char big[3000];
+    memset(big, 'x', sizeof(big));
+    TEST_ASSERT(sn_file_writer_append(writer, big, sizeof(big)));
+
+    TEST_ASSERT(sn_file_writer_sync(writer));
+    TEST_ASSERT(sn_file_size(&file) == 10000 + sizeof(big));
+    TEST_ASSERT(sn_file_writer_append(writer, "tail\n", 5));
+    sn_file_writer_destroy(writer);
+    sn_file_close(&file);
+
+    SnFileBuffer buffer;
+    TEST_ASSERT(sn_file_read_all(TEST_WRITER_FILE, SN_FILE_READ_ALL_FLAG_NO_MAP, &buffer));
+    TEST_ASSERT(buffer.size == 10000 + sizeof(big) + 5);
+    for (int i = 0; i < 1000; ++i) {
+        snprintf(line, sizeof(line), "line %04d\n", i);
+        TEST_ASSERT(memcmp((char *)buffer.data + i * 10, line, 10) == 0);
+    }
+    TEST_ASSERT(memcmp((char *)buffer.data + buffer.size - 5, "tail\n", 5) == 0);
+    sn_file_buffer_free(&buffer);
+
+    TEST_ASSERT(sn_file_delete(TEST_WRITER_FILE));
+
+    printf("[OK] writer\n");
+}
+
+static void test_lock(void) {
+    SnFile a, b;
+    TEST_ASSERT(sn_file_open(TEST_FILE, SN_FILE_OPEN_FLAG_READ | SN_FILE_OPEN_FLAG_WRITE, &a));
+    TEST_ASSERT(sn_file_open(TEST_FILE, SN_FILE_OPEN_FLAG_READ | SN_FILE_OPEN_FLAG_WRITE, &b));
+
+    TEST_ASSERT(sn_file_lock(&a, 0, 100, SN_FILE_LOCK_EXCLUSIVE));
+    TEST_ASSERT(sn_file_try_lock(&b, 100, 100, SN_FILE_LOCK_EXCLUSIVE));
+
+#if !defined(SN_OS_MAC)
+    // Handle owned locks conflict within the process
+    TEST_ASSERT(!sn_file_try_lock(&b, 50, 10, SN_FILE_LOCK_SHARED));
+    TEST_ASSERT(!sn_file_lock_timeout(&b, 50, 10, SN_FILE_LOCK_EXCLUSIVE, 20));
+#endif
+
+    TEST_ASSERT(sn_file_unlock(&a, 0, 100));
+    TEST_ASSERT(sn_file_lock_timeout(&b, 0, 100, SN_FILE_LOCK_SHARED, 20));
+    TEST_ASSERT(sn_file_try_lock(&a, 0, 100, SN_FILE_LOCK_SHARED));
+
+    TEST_ASSERT(sn_file_unlock(&a, 0, 100));
+    TEST_ASSERT(sn_file_unlock(&b, 0, 100));
+    TEST_ASSERT(sn_file_unlock(&b, 100, 100));
+
+    // Lengths past INT64_MAX mean the rest of the file on every platform
+    TEST_ASSERT(sn_file_lock(&a, 1000, UINT64_MAX, SN_FILE_LOCK_EXCLUSIVE));
+#if !defined(SN_OS_MAC)
+    TEST_ASSERT(!sn_file_try_lock(&b, 1u << 30, 1, SN_FILE_LOCK_SHARED));
+#endif
+    TEST_ASSERT(sn_file_unlock(&a, 1000, UINT64_MAX));
+
+    sn_file_close(&a);
+    sn_file_close(&b);
+
+    printf("[OK] lock\n");
+}
+
+typedef struct RacingAcquire {
+    SnFileCache *cache;
+    const char *path;
+    bool armed;
+} RacingAcquire;
+
+static void *racing_alloc(size_t size, void *user_data) {
+    SN_UNUSED(user_data);
+    return malloc(size);
+}
+
+static void *racing_realloc(void *ptr, size_t old_size, size_t new_size, void *user_data) {
+    SN_UNUSED(old_size);
+    SN_UNUSED(user_data);
+    return realloc(ptr, new_size);
+}
+
+static void racing_free(void *ptr, size_t size, void *user_data) {
+    SN_UNUSED(size);
+    free(ptr);
+
+    // Runs when sn_file_delete frees the dropped entry, before the file is unlinked
+    RacingAcquire *race = user_data;
+    if (!race->armed) return;
+    race->armed = false;
+    SnFile *file = sn_file_cache_acquire(race->cache, race->path, SN_FILE_OPEN_FLAG_READ);
+    if (file) sn_file_cache_release(race->cache, file);
+}
+
+static void test_file_cache(void) {
+    write_small_file(TEST_CACHE_FILE_A, "a");
+    write_small_file(TEST_CACHE_FILE_B, "b");
+    write_small_file(TEST_CACHE_FILE_C, "c");
+
+    SnFileCacheConfig config = {.max_open = 2, .shard_count = 1};
+    SnFileCache *cache;
+    TEST_ASSERT(sn_file_cache_create(&config, &cache));
+
+    int flags = SN_FILE_OPEN_FLAG_READ;
+    SnFile *a = sn_file_cache_acquire(cache, TEST_CACHE_FILE_A, flags);
+    TEST_ASSERT(a);
+    TEST_ASSERT(sn_file_cache_acquire(cache, TEST_CACHE_FILE_A, flags) == a);
+    sn_file_cache_release(cache, a);
+    sn_file_cache_release(cache, a);
+
+    // Different flags are a different handle
+    SnFile *rw = sn_file_cache_acquire(cache, TEST_CACHE_FILE_A, flags | SN_FILE_OPEN_FLAG_WRITE);
+    TEST_ASSERT(rw && rw != a);
+    sn_file_cache_release(cache, rw);
+
+    // Both handles idle, the least recently used one is closed
+    SnFile *b = sn_file_cache_acquire(cache, TEST_CACHE_FILE_B, flags);
+    TEST_ASSERT(b);
+    TEST_ASSERT(sn_file_cache_acquire(cache, TEST_CACHE_FILE_A, flags | SN_FILE_OPEN_FLAG_WRITE)
+                == rw);
+
+    // Limit reached with everything checked out
+    TEST_ASSERT(!sn_file_cache_acquire(cache, TEST_CACHE_FILE_C, flags));
+    TEST_ASSERT(!sn_file_cache_acquire(cache, "snfile_test_dir/missing.txt", flags));
+
+    char c;
+    TEST_ASSERT(sn_file_read(b, &c, 1) == 1 && c == 'b');
+
+    // Deleting invalidates, the checked out handle stays usable until released
+    TEST_ASSERT(sn_file_delete(TEST_CACHE_FILE_B));
+    TEST_ASSERT(sn_file_seek(b, 0, SN_FILE_SEEK_ORIGIN_BEGIN));
+    TEST_ASSERT(sn_file_read(b, &c, 1) == 1 && c == 'b');
+    sn_file_cache_release(cache, b);
+
+    SnFile *cf = sn_file_cache_acquire(cache, TEST_CACHE_FILE_C, flags);
+    TEST_ASSERT(cf);
+    sn_file_cache_release(cache, cf);
+    sn_file_cache_release(cache, rw);
+
+    TEST_ASSERT(sn_file_move(TEST_CACHE_FILE_C, TEST_CACHE_FILE_B, true));
+    TEST_ASSERT(sn_file_delete(TEST_CACHE_FILE_A));
+
+    SnFileCacheStats stats;
+    sn_file_cache_stats(cache, &stats);
+    TEST_ASSERT(stats.hits == 2 && stats.misses == 6 && stats.evictions == 1);
+
+    // A miss between invalidating and unlinking does not keep the deleted file
+    SnFile *old = sn_file_cache_acquire(cache, TEST_CACHE_FILE_B, flags);
+    TEST_ASSERT(old);
+    sn_file_cache_release(cache, old);
+
+    RacingAcquire race = {.cache = cache, .path = TEST_CACHE_FILE_B, .armed = true};
+    SnFileAllocator allocator = {.alloc = racing_alloc,
+                                 .realloc = racing_realloc,
+                                 .free = racing_free,
+                                 .user_data = &race};
+    sn_file_set_allocator(&allocator);
+    TEST_ASSERT(sn_file_delete(TEST_CACHE_FILE_B));
+    sn_file_set_allocator(NULL);
+    TEST_ASSERT(!race.armed);
+
+    write_small_file(TEST_CACHE_FILE_B, "n");
+    SnFile *fresh = sn_file_cache_acquire(cache, TEST_CACHE_FILE_B, flags);
+    TEST_ASSERT(fresh);
+    TEST_ASSERT(sn_file_read(fresh, &c, 1) == 1 && c == 'n');
+    sn_file_cache_release(cache, fresh);
+
+    sn_file_cache_destroy(cache);
+    TEST_ASSERT(sn_file_delete(TEST_CACHE_FILE_B));
+
+    printf("[OK] file cache\n");
+}
+
+static void test_compressed(void) {
+    // Compressible text followed by incompressible noise
+    uint64_t size = 300000;
+    char *data = malloc(size);
+    TEST_ASSERT(data);
+    for (uint64_t i = 0; i < 200000; i += 20)
+        snprintf(data + i, 21, "record %011llu\n", (unsigned long long)i);
+    uint32_t x = 12345;
+    for (uint64_t i = 200000; i < size; ++i) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        data[i] = (char)x;
+    }
+
+    SnFile file;
+    TEST_ASSERT(sn_file_open(TEST_COMPRESSED_FILE,
+                             SN_FILE_OPEN_FLAG_CREATE | SN_FILE_OPEN_FLAG_READ | SN_FILE_OPEN_FLAG_WRITE
+                                 | SN_FILE_OPEN_FLAG_TRUNCATE | SN_FILE_OPEN_FLAG_BINARY,
+                             &file));
+
+    SnCompressedConfig config = {.block_size = 4096, .thread_count = 4};
+    SnCompressedWriter *writer;
+    TEST_ASSERT(sn_compressed_writer_create(&file, &config, &writer));
+    // Uneven chunks across block boundaries
+    for (uint64_t i = 0; i < size; i += 7777) {
+        uint64_t n = size - i < 7777 ? size - i : 7777;
+        TEST_ASSERT(sn_compressed_writer_write(writer, data + i, n));
+    }
+    TEST_ASSERT(sn_compressed_writer_finish(writer));
+    sn_compressed_writer_destroy(writer);
+
+    TEST_ASSERT(sn_file_size(&file) < size);
+
+    SnCompressedReader *reader;
+    TEST_ASSERT(sn_compressed_reader_open(&file, 4, &reader));
+    TEST_ASSERT(sn_compressed_reader_size(reader) == size);
+
+    char *out = malloc(size);
+    TEST_ASSERT(out);
+    TEST_ASSERT(sn_compressed_reader_read_at(reader, 0, out, size) == (int64_t)size);
+    TEST_ASSERT(memcmp(out, data, size) == 0);
+
+    // Partial blocks at both ends, and reads served from the kept block
+    uint64_t offsets[] = {1, 4095, 4096, 5000, 199990, 250001, size - 10};
+    for (size_t i = 0; i < SN_ARRAY_LENGTH(offsets); ++i) {
+        memset(out, 0, 9000);
+        int64_t n = sn_compressed_reader_read_at(reader, offsets[i], out, 9000);
+        uint64_t expected = size - offsets[i] < 9000 ? size - offsets[i] : 9000;
+        TEST_ASSERT(n == (int64_t)expected);
+        TEST_ASSERT(memcmp(out, data + offsets[i], expected) == 0);
+
+        int64_t next = n > 10 ? 10 : n - 1;
+        TEST_ASSERT(sn_compressed_reader_read_at(reader, offsets[i] + 1, out, 10) == next);
+        TEST_ASSERT(memcmp(out, data + offsets[i] + 1, next) == 0);
+    }
+    TEST_ASSERT(sn_compressed_reader_read_at(reader, size, out, 10) == 0);
+
+    // Block 1 is kept, then decoding block 0 replaces it while the same read needs it
+    TEST_ASSERT(sn_compressed_reader_read_at(reader, 4096 + 100, out, 100) == 100);
+    TEST_ASSERT(memcmp(out, data + 4096 + 100, 100) == 0);
+    TEST_ASSERT(sn_compressed_reader_read_at(reader, 4096 - 100, out, 150) == 150);
+    TEST_ASSERT(memcmp(out, data + 4096 - 100, 150) == 0);
+
+    sn_compressed_reader_close(reader);
+    sn_file_close(&file);
+
+    // A truncated stream is rejected
+    TEST_ASSERT(
+        sn_file_open(TEST_COMPRESSED_FILE, SN_FILE_OPEN_FLAG_READ | SN_FILE_OPEN_FLAG_BINARY, &file));
+    SnFile copy;
+    TEST_ASSERT(sn_file_open(TEST_FILE_COPY,
+                             SN_FILE_OPEN_FLAG_CREATE | SN_FILE_OPEN_FLAG_READ | SN_FILE_OPEN_FLAG_WRITE
+                                 | SN_FILE_OPEN_FLAG_TRUNCATE | SN_FILE_OPEN_FLAG_BINARY,
+                             &copy));
+    uint64_t truncated = sn_file_size(&file) - 1;
+    TEST_ASSERT(sn_file_read(&file, out, truncated) == (int64_t)truncated);
+    TEST_ASSERT(sn_file_write(&copy, out, truncated) == (int64_t)truncated);
+    TEST_ASSERT(!sn_compressed_reader_open(&copy, 1, &reader));
+    sn_file_close(&copy);
+    sn_file_close(&file);
+
+    free(out);
+    free(data);
+    TEST_ASSERT(sn_file_delete(TEST_FILE_COPY));
+    TEST_ASSERT(sn_file_delete(TEST_COMPRESSED_FILE));
+
+    printf("[OK] compressed\n");
+}
+
+static uint32_t count_entries(const char *path) {
+    SnDir dir;
+    TEST_ASSERT(sn_dir_open(path, &dir));
+
+    uint32_t count = 0;
+    SnDirEntry entry;
+    while (sn_dir_read(&dir, &entry))
+        if (strcmp(entry.name, ".") != 0 && strcmp(entry.name, "..") != 0) ++count;
+
+    sn_dir_close(&dir);
+    return count;
+}
+
+static void test_temp(void) {
+    TEST_ASSERT(sn_dir_create(TEST_TEMP_DIR, false));
+
+    SnFile temp;
+    TEST_ASSERT(sn_file_open_temp(TEST_TEMP_DIR, &temp));
+    TEST_ASSERT(sn_file_write(&temp, "scratch", 7) == 7);
+
+#if !defined(SN_OS_WINDOWS)
+    // Nameless until published
+    TEST_ASSERT(count_entries(TEST_TEMP_DIR) == 0);
+#endif
+
+    TEST_ASSERT(sn_file_publish_temp(&temp, TEST_TEMP_PUBLISHED));
+    TEST_ASSERT(!sn_file_publish_temp(&temp, TEST_TEMP_PUBLISHED));
+
+    // The handle keeps its position
+    TEST_ASSERT(sn_file_tell(&temp) == 7);
+    sn_file_close(&temp);
+
+    SnFileBuffer buffer;
+    TEST_ASSERT(sn_file_read_all(TEST_TEMP_PUBLISHED, 0, &buffer));
+    TEST_ASSERT(buffer.size == 7 && memcmp(buffer.data, "scratch", 7) == 0);
+    sn_file_buffer_free(&buffer);
+
+    // Closing an unpublished scratch file leaves nothing behind
+    TEST_ASSERT(sn_file_open_temp(TEST_TEMP_DIR, &temp));
+    TEST_ASSERT(sn_file_write(&temp, "gone", 4) == 4);
+    sn_file_close(&temp);
+    TEST_ASSERT(count_entries(TEST_TEMP_DIR) == 1);
+
+    TEST_ASSERT(sn_file_delete(TEST_TEMP_PUBLISHED));
+    TEST_ASSERT(sn_dir_delete(TEST_TEMP_DIR));
+
+    printf("[OK] temp\n");
+}
+
+typedef struct UsageReport {
+    uint32_t calls;
+    uint32_t root_call;
+    SnDirUsage sub;
+} UsageReport;
+
+static void usage_callback(const char *path, uint32_t depth, const SnDirUsage *usage,
+                           void *user_data) {
+    UsageReport *report = user_data;
+    report->calls++;
+    if (depth == 0) report->root_call = report->calls;
+    if (strcmp(sn_path_filename(path), "sub") == 0) report->sub = *usage;
+}
+
+static void test_usage(void) {
+    TEST_ASSERT(sn_dir_create(TEST_USAGE_SUBDIR, true));
+
+    char block[5000];
+    memset(block, 'u', sizeof(block));
+    SnFile file;
+    TEST_ASSERT(sn_file_open(TEST_USAGE_FILE_B,
+                             SN_FILE_OPEN_FLAG_CREATE | SN_FILE_OPEN_FLAG_WRITE | SN_FILE_OPEN_FLAG_TRUNCATE,
+                             &file));
+    TEST_ASSERT(sn_file_write(&file, block, sizeof(block)) == sizeof(block));
+    sn_file_close(&file);
+    write_small_file(TEST_USAGE_FILE_A, "0123456789");
+
+    uint64_t expected_files = 2;
+#if !defined(SN_OS_WINDOWS)
+    // Second name of a, counted once
+    TEST_ASSERT(link(TEST_USAGE_FILE_A, TEST_USAGE_LINK) == 0);
+#endif
+
+    SnFileInfo root, sub, a, b;
+    TEST_ASSERT(sn_file_lstat(TEST_USAGE_DIR, &root));
+    TEST_ASSERT(sn_file_lstat(TEST_USAGE_SUBDIR, &sub));
+    TEST_ASSERT(sn_file_lstat(TEST_USAGE_FILE_A, &a));
+    TEST_ASSERT(sn_file_lstat(TEST_USAGE_FILE_B, &b));
+    TEST_ASSERT(a.size == 10 && b.size == sizeof(block));
+
+    UsageReport report = {0};
+    SnDirUsageConfig config = {.thread_count = 4,
+                               .report_depth = 1,
+                               .callback = usage_callback,
+                               .user_data = &report};
+    SnDirUsage usage;
+    TEST_ASSERT(sn_dir_usage(TEST_USAGE_DIR, &config, &usage));
+
+    TEST_ASSERT(usage.file_count == expected_files);
+    TEST_ASSERT(usage.dir_count == 2);
+    TEST_ASSERT(usage.error_count == 0);
+    TEST_ASSERT(usage.apparent_size == root.size + sub.size + a.size + b.size);
+    TEST_ASSERT(usage.allocated_size
+                == root.allocated_size + sub.allocated_size + a.allocated_size + b.allocated_size);
+
+    // Children are reported before their parents
+    TEST_ASSERT(report.calls == 2 && report.root_call == 2);
+    TEST_ASSERT(report.sub.dir_count == 1 && report.sub.apparent_size >= sub.size + b.size);
+
+    // Defaults, single file trees and invalid roots
+    TEST_ASSERT(sn_dir_usage(TEST_USAGE_SUBDIR, NULL, &usage));
+    TEST_ASSERT(usage.dir_count == 1 && usage.file_count >= 1);
+    TEST_ASSERT(!sn_dir_usage(TEST_USAGE_FILE_A, NULL, &usage));
+
+#if !defined(SN_OS_WINDOWS)
+    TEST_ASSERT(sn_file_delete(TEST_USAGE_LINK));
+#endif
+    TEST_ASSERT(sn_file_delete(TEST_USAGE_FILE_A));
+    TEST_ASSERT(sn_file_delete(TEST_USAGE_FILE_B));
+    TEST_ASSERT(sn_dir_delete(TEST_USAGE_SUBDIR));
+    TEST_ASSERT(sn_dir_delete(TEST_USAGE_DIR));
+
+    printf("[OK] usage\n");
+}
+
+typedef struct LinePartial {
+    uint64_t lines;
+    uint64_t sum;
+} LinePartial;
+
+typedef struct LineTotals {
+    uint64_t next_offset;
+    uint64_t last_index;
+    uint64_t ranges;
+    uint64_t lines;
+    uint64_t sum;
+    bool delimited;
+    bool ordered;
+} LineTotals;
+
+static bool line_map(const SnFileRange *range, void **partial, void *user_data) {
+    LineTotals *totals = user_data;
+    LinePartial *p = calloc(1, sizeof(LinePartial));
+    if (!p) return false;
+
+    // Whole records only
+    if (totals->delimited && range->data[range->length - 1] != '\n') return false;
+
+    uint64_t value = 0;
+    for (uint64_t i = 0; i < range->length; ++i) {
+        char c = range->data[i];
+        if (c == '\n') {
+            p->lines++;
+            p->sum += value;
+            value = 0;
+        } else if (c >= '0' && c <= '9') {
+            value = value * 10 + (c - '0');
+        }
+    }
+
+    *partial = p;
+    return true;
+}
+
+static bool line_reduce(const SnFileRange *range, void *partial, void *user_data) {
+    LineTotals *totals = user_data;
+    LinePartial *p = partial;
+
+    // Ranges tile the file in order
+    if (range->offset != totals->next_offset) totals->ordered = false;
+    if (totals->ranges && range->index <= totals->last_index) totals->ordered = false;
+
+    totals->next_offset = range->offset + range->length;
+    totals->last_index = range->index;
+    totals->ranges++;
+    totals->lines += p->lines;
+    totals->sum += p->sum;
+
+    free(p);
+    return true;
+}
+
+static bool stop_map(const SnFileRange *range, void **partial, void *user_data) {
+    SN_UNUSED(partial);
+    SN_UNUSED(user_data);
+    return range->index < 3;
+}
+
+static void test_parallel_for(void) {
+    SnFile file;
+    TEST_ASSERT(sn_file_open(TEST_PARALLEL_FILE,
+                             SN_FILE_OPEN_FLAG_CREATE | SN_FILE_OPEN_FLAG_READ | SN_FILE_OPEN_FLAG_WRITE
+                                 | SN_FILE_OPEN_FLAG_TRUNCATE | SN_FILE_OPEN_FLAG_BINARY,
+                             &file));
+
+    // Numbered lines, some padded far beyond the range size
+    char line[40000];
+    uint64_t lines = 5000, sum = 0, size = 0;
+    for (uint64_t i = 0; i < lines; ++i) {
+        int n = snprintf(line, sizeof(line), "%llu", (unsigned long long)i);
+        if (i % 1000 == 7) {
+            memset(line + n, ' ', 30000);
+            n += 30000;
+        }
+        line[n++] = '\n';
+        TEST_ASSERT(sn_file_write(&file, line, n) == n);
+        sum += i;
+        size += n;
+    }
+
+    int modes[] = {SN_FILE_PARALLEL_FLAG_DELIMITED,
+                   SN_FILE_PARALLEL_FLAG_DELIMITED | SN_FILE_PARALLEL_FLAG_MAP, 0};
+    for (size_t m = 0; m < SN_ARRAY_LENGTH(modes); ++m) {
+        LineTotals totals = {.delimited = modes[m] & SN_FILE_PARALLEL_FLAG_DELIMITED,
+                             .ordered = true};
+        SnFileParallelConfig config = {.range_size = 4096,
+                                       .thread_count = 4,
+                                       .flags = modes[m],
+                                       .delimiter = '\n',
+                                       .map = line_map,
+                                       .reduce = line_reduce,
+                                       .user_data = &totals};
+        TEST_ASSERT(sn_file_parallel_for(&file, &config));
+
+        TEST_ASSERT(totals.ordered);
+        TEST_ASSERT(totals.next_offset == size);
+        TEST_ASSERT(totals.lines == lines);
+        if (totals.delimited) TEST_ASSERT(totals.sum == sum);
+        else TEST_ASSERT(totals.ranges == (size + 4095) / 4096);
+    }
+
+    SnFileParallelConfig config = {.range_size = 4096, .map = stop_map};
+    TEST_ASSERT(!sn_file_parallel_for(&file, &config));
+
+    sn_file_close(&file);
+    TEST_ASSERT(sn_file_delete(TEST_PARALLEL_FILE));
+
+    printf("[OK] parallel for\n");
+}
+
+static void test_realpath(void) {
+    TEST_ASSERT(sn_dir_create(TEST_REALPATH_DIR, false));
+    TEST_ASSERT(sn_dir_create(TEST_REALPATH_SUBDIR, false));
+
+    SnFile file;
+    TEST_ASSERT(sn_file_open(TEST_REALPATH_FILE, SN_FILE_OPEN_FLAG_CREATE | SN_FILE_OPEN_FLAG_WRITE,
+                             &file));
+    sn_file_close(&file);
+
+    SnPathCache *cache;
+    TEST_ASSERT(sn_path_cache_create(&cache));
+
+    char expected[4096], resolved[4096];
+    TEST_ASSERT(sn_path_realpath(NULL, TEST_REALPATH_FILE, expected, sizeof(expected)));
+    TEST_ASSERT(strcmp(sn_path_filename(expected), "file.txt") == 0);
+
+    // The second lookup is served from the cache
+    for (int i = 0; i < 2; ++i) {
+        TEST_ASSERT(sn_path_realpath(cache, TEST_REALPATH_FILE, resolved, sizeof(resolved)));
+        TEST_ASSERT(strcmp(resolved, expected) == 0);
+    }
+    TEST_ASSERT(sn_path_realpath(cache, TEST_REALPATH_SUBDIR "/../sub/./file.txt", resolved,
+                                 sizeof(resolved)));
+    TEST_ASSERT(strcmp(resolved, expected) == 0);
+
+#if !defined(SN_OS_WINDOWS)
+    TEST_ASSERT(symlink("sub", TEST_REALPATH_DIR_LINK) == 0);
+    TEST_ASSERT(symlink("dir_link/file.txt", TEST_REALPATH_FILE_LINK) == 0);
+
+    for (int i = 0; i < 2; ++i) {
+        TEST_ASSERT(sn_path_realpath(cache, TEST_REALPATH_DIR_LINK "/file.txt", resolved,
+                                     sizeof(resolved)));
+        TEST_ASSERT(strcmp(resolved, expected) == 0);
+        TEST_ASSERT(sn_path_realpath(cache, TEST_REALPATH_FILE_LINK, resolved, sizeof(resolved)));
+        TEST_ASSERT(strcmp(resolved, expected) == 0);
+    }
+
+    // .. applies to the link target, not to the link
+    TEST_ASSERT(sn_path_realpath(cache, TEST_REALPATH_DIR_LINK "/../sub/file.txt", resolved,
+                                 sizeof(resolved)));
+    TEST_ASSERT(strcmp(resolved, expected) == 0);
+
+    // A stale entry stays until the cache is invalidated
+    TEST_ASSERT(sn_file_delete(TEST_REALPATH_DIR_LINK));
+    TEST_ASSERT(symlink(".", TEST_REALPATH_DIR_LINK) == 0);
+    TEST_ASSERT(sn_path_realpath(cache, TEST_REALPATH_DIR_LINK "/file.txt", resolved,
+                                 sizeof(resolved)));
+
+    uint64_t generation = sn_path_cache_generation(cache);
+    sn_path_cache_invalidate(cache);
+    TEST_ASSERT(sn_path_cache_generation(cache) == generation + 1);
+    TEST_ASSERT(!sn_path_realpath(cache, TEST_REALPATH_DIR_LINK "/file.txt", resolved,
+                                  sizeof(resolved)));
+    TEST_ASSERT(sn_path_realpath(cache, TEST_REALPATH_DIR_LINK "/sub/file.txt", resolved,
+                                 sizeof(resolved)));
+    TEST_ASSERT(strcmp(resolved, expected) == 0);
+
+    TEST_ASSERT(sn_file_delete(TEST_REALPATH_FILE_LINK));
+    TEST_ASSERT(sn_file_delete(TEST_REALPATH_DIR_LINK));
+#endif
+
+    sn_path_cache_set_generation(cache, 42);
+    TEST_ASSERT(sn_path_cache_generation(cache) == 42);
+    TEST_ASSERT(sn_path_realpath(cache, TEST_REALPATH_FILE, resolved, sizeof(resolved)));
+    TEST_ASSERT(strcmp(resolved, expected) == 0);
+
+    TEST_ASSERT(!sn_path_realpath(cache, TEST_REALPATH_DIR "/missing", resolved, sizeof(resolved)));
+    TEST_ASSERT(!sn_path_realpath(cache, TEST_REALPATH_FILE, resolved, 4));
+    TEST_ASSERT(!sn_path_realpath(cache, "", resolved, sizeof(resolved)));
+
+    // Only directories are remembered, a deleted file is noticed
+    TEST_ASSERT(sn_file_delete(TEST_REALPATH_FILE));
+    TEST_ASSERT(!sn_path_realpath(cache, TEST_REALPATH_FILE, resolved, sizeof(resolved)));
+
+    sn_path_cache_destroy(cache);
+
+    TEST_ASSERT(sn_dir_delete(TEST_REALPATH_SUBDIR));
+    TEST_ASSERT(sn_dir_delete(TEST_REALPATH_DIR));
+
+    printf("[OK] realpath\n");
+}
+
+static void test_dir_read_all(void) {
+    TEST_ASSERT(sn_dir_create(TEST_LIST_DIR, false));
+
+    char path[256];
+    uint64_t count = 200;
+    for (uint64_t i = 0; i < count; ++i) {
+        snprintf(path, sizeof(path), TEST_LIST_DIR "/file_%03llu", (unsigned long long)i);
+        SnFile file;
+        TEST_ASSERT(sn_file_open(path, SN_FILE_OPEN_FLAG_CREATE | SN_FILE_OPEN_FLAG_WRITE, &file));
+        TEST_ASSERT(sn_file_write(&file, path, i) == (int64_t)i);
+        sn_file_close(&file);
+    }
+
+    // Too small, tells the size needed
+    SnDirArena arena = {0};
+    SnDirListing listing;
+    SnDir dir;
+    TEST_ASSERT(sn_dir_open(TEST_LIST_DIR, &dir));
+    TEST_ASSERT(!sn_dir_read_all(&dir, SN_DIR_SORT_NONE, 0, &arena, &listing));
+    sn_dir_close(&dir);
+    TEST_ASSERT(arena.required >= count * sizeof(SnDirListEntry));
+
+    // Room for every sort, each listing placed after the previous one
+    arena.size = 3 * (arena.required + alignof(SnDirListEntry));
+    arena.data = malloc(arena.size);
+    TEST_ASSERT(arena.data);
+
+    SnDirSort sorts[] = {SN_DIR_SORT_NONE, SN_DIR_SORT_NAME, SN_DIR_SORT_INODE};
+    for (size_t s = 0; s < SN_ARRAY_LENGTH(sorts); ++s) {
+        size_t used = arena.used;
+
+        TEST_ASSERT(sn_dir_open(TEST_LIST_DIR, &dir));
+        TEST_ASSERT(sn_dir_read_all(&dir, sorts[s], SN_DIR_READ_ALL_FLAG_STAT, &arena, &listing));
+        sn_dir_close(&dir);
+
+        TEST_ASSERT(listing.count == count);
+        TEST_ASSERT(arena.used > used && arena.used <= arena.size);
+
+        uint64_t seen = 0;
+        for (uint64_t i = 0; i < listing.count; ++i) {
+            const SnDirListEntry *e = &listing.entries[i];
+            unsigned long long n;
+            TEST_ASSERT(sscanf(e->entry.name, "file_%llu", &n) == 1 && n < count);
+            TEST_ASSERT(e->has_info && e->info.is_file && e->info.size == n);
+            seen += n;
+
+            if (i == 0) continue;
+            const SnDirListEntry *prev = &listing.entries[i - 1];
+            if (sorts[s] == SN_DIR_SORT_NAME)
+                TEST_ASSERT(strcmp(prev->entry.name, e->entry.name) < 0);
+            if (sorts[s] == SN_DIR_SORT_INODE) TEST_ASSERT(prev->entry.inode <= e->entry.inode);
+        }
+        TEST_ASSERT(seen == count * (count - 1) / 2);
+    }
+
+    // Without stat
+    TEST_ASSERT(sn_dir_open(TEST_LIST_DIR, &dir));
+    arena.used = 0;
+    TEST_ASSERT(sn_dir_read_all(&dir, SN_DIR_SORT_NAME, 0, &arena, &listing));
+    sn_dir_close(&dir);
+    TEST_ASSERT(listing.count == count && !listing.entries[0].has_info);
+    TEST_ASSERT(strcmp(listing.entries[0].entry.name, "file_000") == 0);
+
+    for (uint64_t i = 0; i < listing.count; ++i) {
+        TEST_ASSERT(sn_path_join(path, sizeof(path), TEST_LIST_DIR, listing.entries[i].entry.name));
+        TEST_ASSERT(sn_file_delete(path));
+    }
+    free(arena.data);
+
+    // Empty directory
+    arena = (SnDirArena){0};
+    TEST_ASSERT(sn_dir_open(TEST_LIST_DIR, &dir));
+    TEST_ASSERT(
+        sn_dir_read_all(&dir, SN_DIR_SORT_NAME, SN_DIR_READ_ALL_FLAG_STAT, &arena, &listing));
+    sn_dir_close(&dir);
+    TEST_ASSERT(listing.count == 0);
+
+    TEST_ASSERT(sn_dir_delete(TEST_LIST_DIR));
+
+    printf("[OK] dir read all\n");
+}
+
+static void test_fs_probe(void) {
+    SnFsInfo info, again;
+    TEST_ASSERT(sn_fs_probe(TEST_DIR, &info));
+
+    SnFileInfo file_info;
+    TEST_ASSERT(sn_file_stat(TEST_DIR, &file_info));
+    TEST_ASSERT(info.device == file_info.device);
+    TEST_ASSERT(info.block_size > 0);
+    if (info.dio_offset_align) TEST_ASSERT(info.features & SN_FS_FEATURE_DIRECT_IO);
+
+    // Cached, and the same after probing again
+    TEST_ASSERT(sn_fs_probe(TEST_DIR, &again));
+    TEST_ASSERT(memcmp(&info, &again, sizeof(info)) == 0);
+    sn_fs_probe_reset();
+    TEST_ASSERT(sn_fs_probe(TEST_DIR, &again));
+    TEST_ASSERT(again.device == info.device && strcmp(again.type_name, info.type_name) == 0);
+
+    TEST_ASSERT(!sn_fs_probe(TEST_DIR "/missing", &info));
+
+    // Copies take whatever fast path the probe allows
+    SnFile file;
+    TEST_ASSERT(sn_file_open(
+        TEST_PROBE_FILE, SN_FILE_OPEN_FLAG_CREATE | SN_FILE_OPEN_FLAG_WRITE | SN_FILE_OPEN_FLAG_BINARY,
+        &file));
+    char block[4096];
+    for (int i = 0; i < 300; ++i) {
+        memset(block, 'a' + i % 26, sizeof(block));
+        TEST_ASSERT(sn_file_write(&file, block, sizeof(block) - i) == (int64_t)sizeof(block) - i);
+    }
+    sn_file_close(&file);
+
+    for (int i = 0; i < 2; ++i) {
+        TEST_ASSERT(sn_file_copy(TEST_PROBE_FILE, TEST_PROBE_COPY, true));
+
+        SnFileBuffer a, b;
+        TEST_ASSERT(sn_file_read_all(TEST_PROBE_FILE, 0, &a));
+        TEST_ASSERT(sn_file_read_all(TEST_PROBE_COPY, 0, &b));
+        TEST_ASSERT(a.size == b.size && memcmp(a.data, b.data, a.size) == 0);
+        sn_file_buffer_free(&a);
+        sn_file_buffer_free(&b);
+    }
+
+    TEST_ASSERT(sn_file_delete(TEST_PROBE_FILE));
+    TEST_ASSERT(sn_file_delete(TEST_PROBE_COPY));
+    sn_fs_probe_reset();
+
+    printf("[OK] fs probe\n");
+}
+
+static uint32_t make_log_record(uint32_t i, char *buffer) {
+    int n = snprintf(buffer, 32, "record %u", i);
+    memset(buffer + n, 'x', i % 200);
+    return (uint32_t)n + i % 200;
+}
+
+static bool check_log_record(const SnLogRecord *record, uint32_t i) {
+    char expected[256];
+    uint32_t size = make_log_record(i, expected);
+    return record->size == size && memcmp(record->data, expected, size) == 0;
+}
+
+static void test_log(void) {
+    uint64_t segment_size = 64 << 10;
+    SnLogConfig config = {.segment_size = segment_size};
+    SnLog *log;
+    TEST_ASSERT(sn_log_open(TEST_LOG_DIR, &config, &log));
+    TEST_ASSERT(sn_log_end(log) > 0);
+
+    // Batches spanning several segments
+    static char data[10][256];
+    uint32_t count = 2000;
+    uint64_t release_position = 0;
+    for (uint32_t i = 0; i < count; i += 10) {
+        SnFileIoVec records[10];
+        for (uint32_t j = 0; j < 10; ++j)
+            records[j] = (SnFileIoVec){.data = data[j], .size = make_log_record(i + j, data[j])};
+
+        uint64_t position;
+        TEST_ASSERT(sn_log_append(log, records, 10, &position));
+        if (i == 1500) release_position = position;
+    }
+    TEST_ASSERT(sn_log_sync(log));
+    TEST_ASSERT(sn_log_end(log) > 3 * segment_size);
+
+    SnFileIoVec huge = {.data = data, .size = segment_size};
+    TEST_ASSERT(!sn_log_append(log, &huge, 1, NULL));
+
+    SnLogReader *reader;
+    SnLogRecord record;
+    TEST_ASSERT(sn_log_reader_open(TEST_LOG_DIR, 0, &reader));
+    for (uint32_t i = 0; i < count; ++i) {
+        TEST_ASSERT(sn_log_reader_next(reader, &record));
+        TEST_ASSERT(check_log_record(&record, i));
+        if (i == 1500) TEST_ASSERT(record.position == release_position);
+    }
+    TEST_ASSERT(!sn_log_reader_next(reader, &record));
+
+    // The reader follows new records
+    SnFileIoVec one = {.data = data[0], .size = make_log_record(count, data[0])};
+    TEST_ASSERT(sn_log_append(log, &one, 1, NULL));
+    TEST_ASSERT(sn_log_reader_next(reader, &record));
+    TEST_ASSERT(check_log_record(&record, count));
+    TEST_ASSERT(!sn_log_reader_next(reader, &record));
+
+    // A torn record and stray bytes after the end are erased on open
+    uint64_t end = sn_log_end(log);
+    sn_log_close(log);
+
+    char path[256];
+    snprintf(path, sizeof(path), TEST_LOG_DIR "/%016llx.log",
+             (unsigned long long)(end / segment_size));
+    SnFile file;
+    TEST_ASSERT(sn_file_open(path, SN_FILE_OPEN_FLAG_WRITE | SN_FILE_OPEN_FLAG_BINARY, &file));
+    uint32_t torn[2] = {100, 12345};
+    TEST_ASSERT(sn_file_write_at(&file, end % segment_size, torn, sizeof(torn)) == sizeof(torn));
+    TEST_ASSERT(sn_file_write_at(&file, end % segment_size + 200, "junk", 4) == 4);
+    sn_file_close(&file);
+
+    TEST_ASSERT(sn_log_open(TEST_LOG_DIR, NULL, &log));
+    TEST_ASSERT(sn_log_end(log) == end);
+
+    one.size = make_log_record(count + 1, data[0]);
+    TEST_ASSERT(sn_log_append(log, &one, 1, NULL));
+    TEST_ASSERT(sn_log_sync(log));
+    TEST_ASSERT(sn_log_reader_next(reader, &record));
+    TEST_ASSERT(check_log_record(&record, count + 1));
+    TEST_ASSERT(!sn_log_reader_next(reader, &record));
+    sn_log_reader_close(reader);
+
+    // Readers of a released log start at the oldest segment left
+    TEST_ASSERT(sn_log_release(log, release_position));
+    TEST_ASSERT(!sn_path_exists(TEST_LOG_DIR "/0000000000000000.log"));
+    TEST_ASSERT(sn_log_reader_open(TEST_LOG_DIR, 0, &reader));
+    TEST_ASSERT(sn_log_reader_next(reader, &record));
+    TEST_ASSERT(record.position / segment_size == release_position / segment_size);
+    sn_log_reader_close(reader);
+
+    TEST_ASSERT(sn_log_reader_open(TEST_LOG_DIR, release_position, &reader));
+    for (uint32_t i = 1500; i <= count + 1; ++i) {
+        TEST_ASSERT(sn_log_reader_next(reader, &record));
+        TEST_ASSERT(check_log_record(&record, i));
+    }
+    TEST_ASSERT(!sn_log_reader_next(reader, &record));
+    sn_log_reader_close(reader);
+
+    sn_log_close(log);
+
+    SnDir dir;
+    SnDirEntry entry;
+    TEST_ASSERT(sn_dir_open(TEST_LOG_DIR, &dir));
+    while (sn_dir_read(&dir, &entry)) {
+        if (entry.name[0] == '.') continue;
+        TEST_ASSERT(sn_path_join(path, sizeof(path), TEST_LOG_DIR, entry.name));
+        TEST_ASSERT(sn_file_delete(path));
+    }
+    sn_dir_close(&dir);
+    TEST_ASSERT(sn_dir_delete(TEST_LOG_DIR));
+
+    printf("[OK] log\n");
+}
+
+typedef struct TraceCounts {
+    uint64_t ops[SN_TRACE_OP_COUNT];
+    bool open_ok;
+    bool write_ok;
+    bool tail_ok;
+} TraceCounts;
+
+static void count_trace_event(const SnTraceEvent *event, void *user_data) {
+    TraceCounts *counts = user_data;
+    TEST_ASSERT(event->op < SN_TRACE_OP_COUNT && event->start_ns);
+    ++counts->ops[event->op];
+
+    size_t length = strlen(event->path);
+    if (event->op == SN_TRACE_OP_OPEN)
+        counts->open_ok = event->result == 1 && event->handle >= 0
+                       && strcmp(event->path, TEST_TRACE_FILE) == 0;
+    if (event->op == SN_TRACE_OP_WRITE)
+        counts->write_ok = event->bytes == 5 && event->result == 5 && !length;
+    if (event->op == SN_TRACE_OP_STAT && !event->result)
+        counts->tail_ok = event->handle == -1 && length == SN_TRACE_PATH_SIZE - 1
+                       && strcmp(event->path + length - 8, "/missing") == 0;
+}
+
+static bool trace_map(const SnFileRange *range, void **partial, void *user_data) {
+    SN_UNUSED(range);
+    SN_UNUSED(partial);
+    SN_UNUSED(user_data);
+    return true;
+}
+
+static void test_trace(void) {
+    TEST_ASSERT(!sn_trace_start(UINT32_MAX));
+    TEST_ASSERT(sn_trace_start(1000));
+
+    SnFile file;
+    TEST_ASSERT(sn_file_open(TEST_TRACE_FILE,
+                             SN_FILE_OPEN_FLAG_CREATE | SN_FILE_OPEN_FLAG_READ | SN_FILE_OPEN_FLAG_WRITE
+                                 | SN_FILE_OPEN_FLAG_TRUNCATE | SN_FILE_OPEN_FLAG_BINARY,
+                             &file));
+    TEST_ASSERT(sn_file_write(&file, "hello", 5) == 5);
+    static char block[64 << 10];
+    TEST_ASSERT(sn_file_write_at(&file, 5, block, sizeof(block)) == sizeof(block));
+
+    // Reads from worker threads land in rings of their own
+    SnFileParallelConfig config = {.range_size = 4096, .thread_count = 4, .map = trace_map};
+    TEST_ASSERT(sn_file_parallel_for(&file, &config));
+
+    // Lock waits and allocations are traced as well
+    TEST_ASSERT(sn_file_lock(&file, 0, 5, SN_FILE_LOCK_EXCLUSIVE));
+    TEST_ASSERT(sn_file_allocate(&file, 1 << 20));
+    TEST_ASSERT(sn_file_unlock(&file, 0, 5));
+    sn_file_close(&file);
+
+    char missing[256];
+    memset(missing, 'a', 100);
+    snprintf(missing + 100, sizeof(missing) - 100, "/missing");
+    SnFileInfo info;
+    TEST_ASSERT(sn_file_stat(TEST_TRACE_FILE, &info));
+    TEST_ASSERT(!sn_file_stat(missing, &info));
+
+    sn_trace_stop();
+    TEST_ASSERT(sn_file_delete(TEST_TRACE_FILE));
+
+    TraceCounts counts = {0};
+    uint64_t total = sn_trace_collect(count_trace_event, &counts);
+    TEST_ASSERT(counts.ops[SN_TRACE_OP_OPEN] == 1 && counts.ops[SN_TRACE_OP_CLOSE] == 1);
+    TEST_ASSERT(counts.ops[SN_TRACE_OP_WRITE] == 1 && counts.ops[SN_TRACE_OP_WRITE_AT] == 1);
+    TEST_ASSERT(counts.ops[SN_TRACE_OP_READ_AT] >= (sizeof(block) + 5 + 4095) / 4096);
+    TEST_ASSERT(counts.ops[SN_TRACE_OP_STAT] == 2 && counts.ops[SN_TRACE_OP_DELETE] == 0);
+    TEST_ASSERT(counts.ops[SN_TRACE_OP_LOCK] == 1 && counts.ops[SN_TRACE_OP_UNLOCK] == 1);
+    TEST_ASSERT(counts.ops[SN_TRACE_OP_ALLOCATE] == 1);
+    TEST_ASSERT(counts.open_ok && counts.write_ok && counts.tail_ok);
+
+    TEST_ASSERT(sn_trace_export_chrome(TEST_TRACE_JSON));
+    SnFileBuffer buffer;
+    TEST_ASSERT(sn_file_read_all(TEST_TRACE_JSON, 0, &buffer));
+    char *json = malloc(buffer.size + 1);
+    TEST_ASSERT(json);
+    memcpy(json, buffer.data, buffer.size);
+    json[buffer.size] = 0;
+    sn_file_buffer_free(&buffer);
+
+    TEST_ASSERT(strncmp(json, "{\"traceEvents\":[", 16) == 0);
+    TEST_ASSERT(strstr(json, "\"name\":\"sn_file_write_at\""));
+    TEST_ASSERT(strstr(json, "\"path\":\"" TEST_TRACE_FILE "\""));
+    uint64_t events = 0;
+    for (const char *p = json; (p = strstr(p, "\"ph\":\"X\"")); ++p) ++events;
+    TEST_ASSERT(events == total);
+    free(json);
+    TEST_ASSERT(sn_file_delete(TEST_TRACE_JSON));
+
+    // Full rings keep the newest events
+    sn_trace_reset();
+    TEST_ASSERT(sn_trace_collect(count_trace_event, &counts) == 0);
+    TEST_ASSERT(sn_trace_start(16));
+    for (int i = 0; i < 40; ++i) TEST_ASSERT(sn_file_stat(TEST_DIR, &info));
+    sn_trace_stop();
+    TEST_ASSERT(sn_trace_collect(count_trace_event, &counts) == 16);
+    sn_trace_reset();
+
+    TEST_ASSERT(strcmp(sn_trace_op_name(SN_TRACE_OP_DIR_READ), "sn_dir_read") == 0);
+    TEST_ASSERT(strcmp(sn_trace_op_name(SN_TRACE_OP_REALPATH), "sn_path_realpath") == 0);
+
+    printf("[OK] trace\n");
+}
+
+static char block_byte(uint64_t offset) {
+    return (char)(offset * 7 + offset / 251);
+}
+
+static bool check_block_read(SnBlockCache *cache, SnBlockFile *file, uint64_t offset,
+                             uint64_t size, uint64_t file_size) {
+    char buffer[20000];
+    int64_t got = sn_block_cache_read(cache, file, offset, buffer, size);
+    uint64_t expected = offset >= file_size ? 0
+                      : file_size - offset < size ? file_size - offset
+                                                  : size;
+    if (got != (int64_t)expected) return false;
+    for (uint64_t i = 0; i < expected; ++i)
+        if (buffer[i] != block_byte(offset + i)) return false;
+    return true;
+}
+
+typedef struct BlockReaders {
+    SnBlockCache *cache;
+    SnBlockFile *file;
+    uint64_t file_size;
+    volatile bool ok;
+} BlockReaders;
+
+static bool block_map(const SnFileRange *range, void **partial, void *user_data) {
+    SN_UNUSED(partial);
+    BlockReaders *readers = user_data;
+    // Every worker reads the start of the file too, so they share blocks
+    for (uint64_t i = 0; i < 16; ++i) {
+        uint64_t offset = (range->offset + i * 1237) % readers->file_size;
+        if (!check_block_read(readers->cache, readers->file, offset, 3000, readers->file_size)
+            || !check_block_read(readers->cache, readers->file, i * 512, 100, readers->file_size))
+            readers->ok = false;
+    }
+    return true;
+}
+
+static void test_block_cache(void) {
+    SnFile file;
+    TEST_ASSERT(sn_file_open(TEST_BLOCK_FILE,
+                             SN_FILE_OPEN_FLAG_CREATE | SN_FILE_OPEN_FLAG_READ | SN_FILE_OPEN_FLAG_WRITE
+                                 | SN_FILE_OPEN_FLAG_TRUNCATE | SN_FILE_OPEN_FLAG_BINARY,
+                             &file));
+
+    uint64_t file_size = (1 << 20) + 123;
+    static char data[(1 << 20) + 123];
+    for (uint64_t i = 0; i < file_size; ++i) data[i] = block_byte(i);
+    TEST_ASSERT(sn_file_write(&file, data, file_size) == (int64_t)file_size);
+
+    SnBlockCacheConfig config = {
+        .memory_budget = 256 << 10, .block_size = 3000, .readahead = 8, .shard_count = 4};
+    SnBlockCache *cache;
+    TEST_ASSERT(sn_block_cache_create(&config, &cache));
+
+    SnBlockFile block_file;
+    TEST_ASSERT(sn_block_file_init(&file, &block_file));
+
+    // Repeated reads come from memory, block_size was rounded up to 4 KiB
+    SnBlockCacheStats stats;
+    TEST_ASSERT(check_block_read(cache, &block_file, 100000, 100, file_size));
+    sn_block_cache_stats(cache, &stats);
+    TEST_ASSERT(stats.hits == 0 && stats.misses == 1 && stats.readahead == 0);
+    TEST_ASSERT(check_block_read(cache, &block_file, 98304, 4096, file_size));
+    TEST_ASSERT(check_block_read(cache, &block_file, 100000, 100, file_size));
+    sn_block_cache_stats(cache, &stats);
+    TEST_ASSERT(stats.hits == 2 && stats.misses == 1);
+
+    // Across blocks and at the end
+    TEST_ASSERT(check_block_read(cache, &block_file, 4090, 20, file_size));
+    TEST_ASSERT(check_block_read(cache, &block_file, file_size - 10, 100, file_size));
+    TEST_ASSERT(check_block_read(cache, &block_file, file_size - 10, 100, file_size));
+    TEST_ASSERT(check_block_read(cache, &block_file, file_size + 5, 100, file_size));
+
+    // Sequential reads trigger readahead
+    for (uint64_t offset = 200000; offset < 300000; offset += 1000)
+        TEST_ASSERT(check_block_read(cache, &block_file, offset, 1000, file_size));
+    sn_block_cache_stats(cache, &stats);
+    TEST_ASSERT(stats.readahead > 0);
+
+    // A pass over more than the budget evicts
+    for (uint64_t offset = 0; offset < file_size; offset += 10000)
+        TEST_ASSERT(check_block_read(cache, &block_file, offset, 10000, file_size));
+    sn_block_cache_stats(cache, &stats);
+    TEST_ASSERT(stats.evictions > 0);
+
+    // Writes through any handle drop the blocks they change
+    TEST_ASSERT(check_block_read(cache, &block_file, 50000, 100, file_size));
+    TEST_ASSERT(sn_file_write_at(&file, 50010, "XYZ", 3) == 3);
+    char buffer[100];
+    TEST_ASSERT(sn_block_cache_read(cache, &block_file, 50000, buffer, 100) == 100);
+    TEST_ASSERT(memcmp(buffer + 10, "XYZ", 3) == 0 && buffer[13] == block_byte(50013));
+
+    SnFile other;
+    TEST_ASSERT(sn_file_open(TEST_BLOCK_FILE, SN_FILE_OPEN_FLAG_WRITE | SN_FILE_OPEN_FLAG_BINARY,
+                             &other));
+    TEST_ASSERT(sn_file_seek(&other, 50020, SN_FILE_SEEK_ORIGIN_BEGIN));
+    TEST_ASSERT(sn_file_write(&other, "abc", 3) == 3);
+    TEST_ASSERT(sn_block_cache_read(cache, &block_file, 50000, buffer, 100) == 100);
+    TEST_ASSERT(memcmp(buffer + 20, "abc", 3) == 0);
+
+    // Appending extends a last block cached short
+    TEST_ASSERT(sn_file_seek(&other, 0, SN_FILE_SEEK_ORIGIN_END));
+    TEST_ASSERT(sn_file_write(&other, "tail", 4) == 4);
+    TEST_ASSERT(sn_block_cache_read(cache, &block_file, file_size - 2, buffer, 100) == 6);
+    TEST_ASSERT(memcmp(buffer + 2, "tail", 4) == 0);
+    sn_file_close(&other);
+
+    // Truncating drops every block
+    TEST_ASSERT(sn_file_open(TEST_BLOCK_FILE,
+                             SN_FILE_OPEN_FLAG_WRITE | SN_FILE_OPEN_FLAG_TRUNCATE
+                                 | SN_FILE_OPEN_FLAG_BINARY,
+                             &other));
+    TEST_ASSERT(sn_block_cache_read(cache, &block_file, 0, buffer, 100) == 0);
+    TEST_ASSERT(sn_file_write(&other, data, file_size) == (int64_t)file_size);
+    sn_file_close(&other);
+
+    // Shared by concurrent readers
+    BlockReaders readers = {
+        .cache = cache, .file = &block_file, .file_size = file_size, .ok = true};
+    SnFileParallelConfig parallel = {
+        .range_size = 64 << 10, .thread_count = 4, .map = block_map, .user_data = &readers};
+    TEST_ASSERT(sn_file_parallel_for(&file, &parallel));
+    TEST_ASSERT(readers.ok);
+
+    sn_block_cache_stats(cache, &stats);
+    uint64_t misses = stats.misses;
+    TEST_ASSERT(check_block_read(cache, &block_file, 0, 100, file_size));
+    sn_block_cache_invalidate(cache, &block_file);
+    TEST_ASSERT(check_block_read(cache, &block_file, 0, 100, file_size));
+    sn_block_cache_stats(cache, &stats);
+    TEST_ASSERT(stats.misses == misses + 1);
+
+    // A miss next to a cached block reads ahead only when it continues the previous read
+    uint64_t readahead = stats.readahead;
+    TEST_ASSERT(check_block_read(cache, &block_file, 10 * 4096, 100, file_size));
+    TEST_ASSERT(check_block_read(cache, &block_file, 30 * 4096, 100, file_size));
+    TEST_ASSERT(check_block_read(cache, &block_file, 11 * 4096, 100, file_size));
+    sn_block_cache_stats(cache, &stats);
+    TEST_ASSERT(stats.readahead == readahead);
+    TEST_ASSERT(check_block_read(cache, &block_file, 12 * 4096, 100, file_size));
+    sn_block_cache_stats(cache, &stats);
+    TEST_ASSERT(stats.readahead > readahead);
+
+    // Growing the file drops the last block
+    TEST_ASSERT(check_block_read(cache, &block_file, file_size - 10, 100, file_size));
+    TEST_ASSERT(sn_file_allocate(&file, file_size + 90));
+    TEST_ASSERT(sn_block_cache_read(cache, &block_file, file_size - 10, buffer, 100) == 100);
+    TEST_ASSERT(buffer[9] == block_byte(file_size - 1) && buffer[10] == 0 && buffer[99] == 0);
+
+    // Copies over the file drop its blocks
+    TEST_ASSERT(check_block_read(cache, &block_file, 0, 100, file_size));
+    TEST_ASSERT(sn_file_open(TEST_BLOCK_COPY,
+                             SN_FILE_OPEN_FLAG_CREATE | SN_FILE_OPEN_FLAG_WRITE
+                                 | SN_FILE_OPEN_FLAG_TRUNCATE | SN_FILE_OPEN_FLAG_BINARY,
+                             &other));
+    TEST_ASSERT(sn_file_write(&other, "copied", 6) == 6);
+    sn_file_close(&other);
+    TEST_ASSERT(sn_file_copy(TEST_BLOCK_COPY, TEST_BLOCK_FILE, true));
+    TEST_ASSERT(sn_block_cache_read(cache, &block_file, 0, buffer, 100) == 6);
+    TEST_ASSERT(memcmp(buffer, "copied", 6) == 0);
+
+    // Writes past the end make a short last block stale without touching it
+    TEST_ASSERT(sn_file_write_at(&file, 20000, "0123456789", 10) == 10);
+    char *grown = malloc(30000);
+    TEST_ASSERT(grown);
+    TEST_ASSERT(sn_block_cache_read(cache, &block_file, 0, grown, 30000) == 20010);
+    TEST_ASSERT(memcmp(grown, "copied", 6) == 0 && memcmp(grown + 20000, "0123456789", 10) == 0);
+    free(grown);
+
+    sn_file_close(&file);
+    sn_block_cache_destroy(cache);
+    TEST_ASSERT(sn_file_delete(TEST_BLOCK_FILE));
+    TEST_ASSERT(sn_file_delete(TEST_BLOCK_COPY));
+
+    printf("[OK] block cache\n");
+}
+
 static void test_cleanup(void) {
     TEST_ASSERT(sn_file_delete(TEST_FILE));
     TEST_ASSERT(sn_file_delete(TEST_FILE_MOVE));
@@ -134,6 +1564,23 @@ int main(void) {
     test_file_io();
     test_seek_and_size();
     test_copy_move_stat();
+    test_glob();
+    test_snapshot();
+    test_sparse();
+    test_read_all();
+    test_writer();
+    test_lock();
+    test_file_cache();
+    test_compressed();
+    test_temp();
+    test_usage();
+    test_parallel_for();
+    test_realpath();
+    test_dir_read_all();
+    test_fs_probe();
+    test_log();
+    test_trace();
+    test_block_cache();
     test_cleanup();
 
     printf("==== ALL TESTS PASSED ====\n");